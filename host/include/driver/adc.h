@@ -0,0 +1,25 @@
+//
+// Created by derk on 19-10-26.
+//
+
+#ifndef DRIVER_ADC_H
+#define DRIVER_ADC_H
+
+//Types only, the drivers go through hal.h
+#include "esp_err.h"
+
+typedef enum
+{
+    ADC1_CHANNEL_0 = 0,
+    ADC1_CHANNEL_3 = 3,
+    ADC1_CHANNEL_6 = 6,
+    ADC1_CHANNEL_7 = 7,
+    ADC1_CHANNEL_MAX = 8
+} adc1_channel_t;
+
+#define ADC1_GPIO36_CHANNEL ADC1_CHANNEL_0
+#define ADC1_GPIO39_CHANNEL ADC1_CHANNEL_3
+#define ADC1_GPIO34_CHANNEL ADC1_CHANNEL_6
+#define ADC1_GPIO35_CHANNEL ADC1_CHANNEL_7
+
+#endif //DRIVER_ADC_H
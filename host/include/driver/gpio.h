@@ -0,0 +1,13 @@
+//
+// Created by derk on 19-10-26.
+//
+
+#ifndef DRIVER_GPIO_H
+#define DRIVER_GPIO_H
+
+//Types only, the drivers go through hal.h
+#include "esp_err.h"
+#include "esp_attr.h"
+#include "hal/gpio_types.h"
+
+#endif //DRIVER_GPIO_H
@@ -0,0 +1,13 @@
+//
+// Created by derk on 19-10-26.
+//
+
+#ifndef ETS_SYS_H
+#define ETS_SYS_H
+
+#include <stdint.h>
+
+//Busy waits like the rom function, on the same clock as esp_timer_get_time()
+void ets_delay_us(uint32_t us);
+
+#endif //ETS_SYS_H
@@ -0,0 +1,12 @@
+//
+// Created by derk on 19-10-26.
+//
+
+#ifndef ESP_ETH_H
+#define ESP_ETH_H
+
+//Not used on the host, http.c includes it
+
+#include "esp_err.h"
+
+#endif //ESP_ETH_H
@@ -0,0 +1,14 @@
+//
+// Created by derk on 19-10-26.
+//
+
+#ifndef ESP_HEAP_CAPS_H
+#define ESP_HEAP_CAPS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define MALLOC_CAP_8BIT (1 << 2)
+#define MALLOC_CAP_DEFAULT (1 << 12)
+
+#endif //ESP_HEAP_CAPS_H
@@ -0,0 +1,132 @@
+//
+// Created by derk on 19-10-26.
+//
+
+#ifndef ESP_HTTP_SERVER_H
+#define ESP_HTTP_SERVER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include "esp_err.h"
+
+/*
+ * In-process stand-in for the esp-idf http server, enough for http.c and ws.c.
+ * There are no sockets: requests and websocket clients come from the tests
+ * through host_http_request() and host_ws_connect() in src/host.h, and every
+ * handler and queued work item runs on one httpd task like on the device.
+ */
+
+#define HTTPD_MAX_URI_LEN 512
+#define HTTPD_RESP_USE_STRLEN -1
+#define HTTPD_TYPE_JSON "application/json"
+#define HTTPD_TYPE_TEXT "text/html"
+
+typedef void* httpd_handle_t;
+
+//Same values as http_parser, which the esp-idf server uses
+typedef enum
+{
+    HTTP_DELETE = 0,
+    HTTP_GET = 1,
+    HTTP_HEAD = 2,
+    HTTP_POST = 3,
+    HTTP_PUT = 4
+} httpd_method_t;
+
+typedef enum
+{
+    HTTPD_400_BAD_REQUEST,
+    HTTPD_404_NOT_FOUND,
+    HTTPD_405_METHOD_NOT_ALLOWED,
+    HTTPD_500_INTERNAL_SERVER_ERROR
+} httpd_err_code_t;
+
+typedef struct httpd_req
+{
+    httpd_handle_t handle;
+    int method;
+    const char uri[HTTPD_MAX_URI_LEN + 1];
+    size_t content_len;
+    void* aux;
+    void* user_ctx;
+    void* sess_ctx;
+} httpd_req_t;
+
+typedef struct httpd_uri
+{
+    const char* uri;
+    httpd_method_t method;
+    esp_err_t (*handler)(httpd_req_t* req);
+    void* user_ctx;
+    bool is_websocket;
+    bool handle_ws_control_frames;
+    const char* supported_subprotocol;
+} httpd_uri_t;
+
+typedef void (*httpd_close_func_t)(httpd_handle_t hd, int sockfd);
+typedef bool (*httpd_uri_match_func_t)(const char* reference_uri, const char* uri_to_match, size_t match_upto);
+typedef void (*httpd_work_fn_t)(void* arg);
+
+typedef struct
+{
+    uint16_t server_port;
+    uint16_t max_open_sockets;
+    uint16_t max_uri_handlers;
+    httpd_close_func_t close_fn;
+    httpd_uri_match_func_t uri_match_fn;
+} httpd_config_t;
+
+#define HTTPD_DEFAULT_CONFIG() { \
+        .server_port = 80, \
+        .max_open_sockets = 7, \
+        .max_uri_handlers = 8, \
+        .close_fn = NULL, \
+        .uri_match_fn = NULL \
+    }
+
+typedef enum
+{
+    HTTPD_WS_TYPE_CONTINUE = 0x0,
+    HTTPD_WS_TYPE_TEXT = 0x1,
+    HTTPD_WS_TYPE_BINARY = 0x2,
+    HTTPD_WS_TYPE_CLOSE = 0x8,
+    HTTPD_WS_TYPE_PING = 0x9,
+    HTTPD_WS_TYPE_PONG = 0xa
+} httpd_ws_type_t;
+
+typedef struct httpd_ws_frame
+{
+    bool final;
+    bool fragmented;
+    httpd_ws_type_t type;
+    uint8_t* payload;
+    size_t len;
+} httpd_ws_frame_t;
+
+esp_err_t httpd_start(httpd_handle_t* handle, const httpd_config_t* config);
+esp_err_t httpd_stop(httpd_handle_t handle);
+esp_err_t httpd_register_uri_handler(httpd_handle_t handle, const httpd_uri_t* uri_handler);
+bool httpd_uri_match_wildcard(const char* uri_template, const char* uri_to_match, size_t match_upto);
+esp_err_t httpd_queue_work(httpd_handle_t handle, httpd_work_fn_t work, void* arg);
+esp_err_t httpd_sess_trigger_close(httpd_handle_t handle, int sockfd);
+
+int httpd_req_recv(httpd_req_t* req, char* buf, size_t buf_len);
+int httpd_req_to_sockfd(httpd_req_t* req);
+esp_err_t httpd_req_get_url_query_str(httpd_req_t* req, char* buf, size_t buf_len);
+esp_err_t httpd_query_key_value(const char* qry, const char* key, char* val, size_t val_size);
+esp_err_t httpd_req_get_hdr_value_str(httpd_req_t* req, const char* field, char* val, size_t val_size);
+
+esp_err_t httpd_resp_set_status(httpd_req_t* req, const char* status);
+esp_err_t httpd_resp_set_type(httpd_req_t* req, const char* type);
+esp_err_t httpd_resp_set_hdr(httpd_req_t* req, const char* field, const char* value);
+esp_err_t httpd_resp_send(httpd_req_t* req, const char* buf, ssize_t buf_len);
+esp_err_t httpd_resp_send_chunk(httpd_req_t* req, const char* buf, ssize_t buf_len);
+esp_err_t httpd_resp_sendstr(httpd_req_t* req, const char* str);
+esp_err_t httpd_resp_send_err(httpd_req_t* req, httpd_err_code_t error, const char* message);
+
+esp_err_t httpd_ws_send_frame_async(httpd_handle_t handle, int fd, httpd_ws_frame_t* frame);
+esp_err_t httpd_ws_recv_frame(httpd_req_t* req, httpd_ws_frame_t* frame, size_t max_len);
+
+#endif //ESP_HTTP_SERVER_H
@@ -0,0 +1,12 @@
+//
+// Created by derk on 19-10-26.
+//
+
+#ifndef ESP_NETIF_H
+#define ESP_NETIF_H
+
+//The host has no network interfaces, the simulated broker is in-process
+
+#include "esp_err.h"
+
+#endif //ESP_NETIF_H
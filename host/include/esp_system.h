@@ -0,0 +1,18 @@
+//
+// Created by derk on 19-10-26.
+//
+
+#ifndef ESP_SYSTEM_H
+#define ESP_SYSTEM_H
+
+#include <stdint.h>
+#include "esp_err.h"
+
+//What glibc has handed out taken from a fixed budget, see host/src/esp.c
+uint32_t esp_get_free_heap_size(void);
+uint32_t esp_get_minimum_free_heap_size(void);
+
+//Ends the simulation, there is nothing to restart into
+void esp_restart(void) __attribute__((noreturn));
+
+#endif //ESP_SYSTEM_H
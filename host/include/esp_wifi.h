@@ -0,0 +1,12 @@
+//
+// Created by derk on 19-10-26.
+//
+
+#ifndef ESP_WIFI_H
+#define ESP_WIFI_H
+
+//Wifi is replaced by host/src/network.c, nothing of the driver is needed
+
+#include "esp_err.h"
+
+#endif //ESP_WIFI_H
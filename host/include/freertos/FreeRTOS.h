@@ -0,0 +1,76 @@
+//
+// Created by derk on 19-10-26.
+//
+
+#ifndef FREERTOS_H
+#define FREERTOS_H
+
+/*
+ * Just enough FreeRTOS for the firmware to run as a Linux process, every task
+ * is a pthread. Priorities and core affinity are recorded but not enforced,
+ * the kernel schedules the threads. Critical sections are one recursive mutex
+ * per portMUX_TYPE: they exclude each other like on the esp32, but a thread
+ * holding one can still be preempted.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <pthread.h>
+#include "sdkconfig.h"
+#include "esp_attr.h"
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint8_t StackType_t;
+
+#define pdFALSE ((BaseType_t)0)
+#define pdTRUE ((BaseType_t)1)
+#define pdFAIL pdFALSE
+#define pdPASS pdTRUE
+#define errQUEUE_EMPTY pdFALSE
+#define errQUEUE_FULL pdFALSE
+
+#define configTICK_RATE_HZ CONFIG_FREERTOS_HZ
+#define configMAX_PRIORITIES 25
+#define configMAX_TASK_NAME_LEN 16
+#define configMINIMAL_STACK_SIZE 768
+
+#define portNUM_PROCESSORS 2
+#define portMAX_DELAY ((TickType_t)0xffffffffUL)
+#define portTICK_PERIOD_MS ((TickType_t)1000 / configTICK_RATE_HZ)
+#define pdMS_TO_TICKS(ms) ((TickType_t)(((TickType_t)(ms) * (TickType_t)configTICK_RATE_HZ) / (TickType_t)1000))
+
+#define tskIDLE_PRIORITY 0
+#define tskNO_AFFINITY 0x7fffffff
+#define PRO_CPU_NUM 0
+#define APP_CPU_NUM 1
+
+typedef struct
+{
+    pthread_mutex_t mutex;
+} portMUX_TYPE;
+
+#define portMUX_INITIALIZER_UNLOCKED { .mutex = PTHREAD_RECURSIVE_MUTEX_INITIALIZER_NP }
+
+#define portENTER_CRITICAL(mux) pthread_mutex_lock(&(mux)->mutex)
+#define portEXIT_CRITICAL(mux) pthread_mutex_unlock(&(mux)->mutex)
+#define portENTER_CRITICAL_ISR(mux) portENTER_CRITICAL(mux)
+#define portEXIT_CRITICAL_ISR(mux) portEXIT_CRITICAL(mux)
+#define portENTER_CRITICAL_SAFE(mux) portENTER_CRITICAL(mux)
+#define portEXIT_CRITICAL_SAFE(mux) portEXIT_CRITICAL(mux)
+
+//The "interrupts" of the host build are simulator threads, woken tasks run without help
+#define portYIELD_FROM_ISR(...) do { } while(0)
+
+//Core the calling task was pinned to, 0 for tasks without affinity and foreign threads
+BaseType_t xPortGetCoreID(void);
+
+typedef struct { uint8_t dummy[64]; } StaticTask_t;
+typedef struct { uint8_t dummy[96]; } StaticQueue_t;
+typedef StaticQueue_t StaticSemaphore_t;
+typedef struct { uint8_t dummy[64]; } StaticEventGroup_t;
+typedef struct { uint8_t dummy[48]; } StaticTimer_t;
+
+#endif //FREERTOS_H
@@ -0,0 +1,22 @@
+//
+// Created by derk on 19-10-26.
+//
+
+#ifndef FREERTOS_QUEUE_H
+#define FREERTOS_QUEUE_H
+
+#include "FreeRTOS.h"
+
+typedef struct host_queue* QueueHandle_t;
+
+QueueHandle_t host_queue_create(UBaseType_t length, UBaseType_t item_size);
+#define xQueueCreate(length, item_size) host_queue_create(length, item_size)
+QueueHandle_t xQueueCreateStatic(UBaseType_t length, UBaseType_t item_size, uint8_t* storage, StaticQueue_t* buffer);
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void* item, TickType_t ticks);
+#define xQueueSendToBack(queue, item, ticks) xQueueSend(queue, item, ticks)
+BaseType_t xQueueSendFromISR(QueueHandle_t queue, const void* item, BaseType_t* higher_priority_task_woken);
+BaseType_t xQueueReceive(QueueHandle_t queue, void* item, TickType_t ticks);
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue);
+
+#endif //FREERTOS_QUEUE_H
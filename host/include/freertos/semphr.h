@@ -0,0 +1,23 @@
+//
+// Created by derk on 19-10-26.
+//
+
+#ifndef FREERTOS_SEMPHR_H
+#define FREERTOS_SEMPHR_H
+
+#include "FreeRTOS.h"
+
+//Mutexes and binary semaphores are counting semaphores with a maximum of one
+typedef struct host_semaphore* SemaphoreHandle_t;
+
+SemaphoreHandle_t host_semaphore_create(uint32_t initial);
+#define xSemaphoreCreateMutex() host_semaphore_create(1)
+#define xSemaphoreCreateBinary() host_semaphore_create(0)
+SemaphoreHandle_t xSemaphoreCreateMutexStatic(StaticSemaphore_t* buffer);
+SemaphoreHandle_t xSemaphoreCreateBinaryStatic(StaticSemaphore_t* buffer);
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore);
+BaseType_t xSemaphoreGiveFromISR(SemaphoreHandle_t semaphore, BaseType_t* higher_priority_task_woken);
+
+#endif //FREERTOS_SEMPHR_H
@@ -0,0 +1,69 @@
+//
+// Created by derk on 19-10-26.
+//
+
+#ifndef FREERTOS_TASK_H
+#define FREERTOS_TASK_H
+
+#include "FreeRTOS.h"
+
+typedef struct host_task* TaskHandle_t;
+typedef void (*TaskFunction_t)(void* param);
+
+typedef enum
+{
+    eRunning,
+    eReady,
+    eBlocked,
+    eSuspended,
+    eDeleted
+} eTaskState;
+
+typedef struct
+{
+    TaskHandle_t xHandle;
+    const char* pcTaskName;
+    UBaseType_t xTaskNumber;
+    eTaskState eCurrentState;
+    UBaseType_t uxCurrentPriority;
+    UBaseType_t uxBasePriority;
+    //Thread cpu time in microseconds, the same unit as the esp_timer based counters on the target
+    uint32_t ulRunTimeCounter;
+    StackType_t* pxStackBase;
+    uint32_t usStackHighWaterMark;
+    BaseType_t xCoreID;
+} TaskStatus_t;
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char* name, uint32_t stack_depth, void* param,
+                                   UBaseType_t priority, TaskHandle_t* handle, BaseType_t core);
+TaskHandle_t xTaskCreateStaticPinnedToCore(TaskFunction_t fn, const char* name, uint32_t stack_depth, void* param,
+                                           UBaseType_t priority, StackType_t* stack, StaticTask_t* buffer,
+                                           BaseType_t core);
+#define xTaskCreate(fn, name, stack_depth, param, priority, handle) \
+    xTaskCreatePinnedToCore(fn, name, stack_depth, param, priority, handle, tskNO_AFFINITY)
+#define xTaskCreateStatic(fn, name, stack_depth, param, priority, stack, buffer) \
+    xTaskCreateStaticPinnedToCore(fn, name, stack_depth, param, priority, stack, buffer, tskNO_AFFINITY)
+
+void vTaskDelay(TickType_t ticks);
+TickType_t xTaskGetTickCount(void);
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+char* pcTaskGetTaskName(TaskHandle_t task);
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t* higher_priority_task_woken);
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks);
+
+/*
+ * Host threads have megabytes of stack and nothing measures how much of it is
+ * used; the high water mark is the requested depth, as if nothing was touched.
+ */
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task);
+UBaseType_t uxTaskGetNumberOfTasks(void);
+UBaseType_t uxTaskGetSystemState(TaskStatus_t* status, UBaseType_t size, uint32_t* total_runtime);
+
+/**
+ * @brief Register the calling thread as a task, for threads the shim did not start
+ */
+TaskHandle_t host_task_adopt(const char* name);
+
+#endif //FREERTOS_TASK_H
@@ -0,0 +1,25 @@
+//
+// Created by derk on 19-10-26.
+//
+
+#ifndef FREERTOS_TIMERS_H
+#define FREERTOS_TIMERS_H
+
+#include "FreeRTOS.h"
+
+//Software timers run on the esp_timer thread, there is no separate timer service task
+typedef struct host_rtos_timer* TimerHandle_t;
+typedef void (*TimerCallbackFunction_t)(TimerHandle_t timer);
+
+TimerHandle_t xTimerCreate(const char* name, TickType_t period, UBaseType_t auto_reload, void* id,
+                           TimerCallbackFunction_t callback);
+TimerHandle_t xTimerCreateStatic(const char* name, TickType_t period, UBaseType_t auto_reload, void* id,
+                                 TimerCallbackFunction_t callback, StaticTimer_t* buffer);
+BaseType_t xTimerStart(TimerHandle_t timer, TickType_t ticks);
+BaseType_t xTimerStop(TimerHandle_t timer, TickType_t ticks);
+BaseType_t xTimerReset(TimerHandle_t timer, TickType_t ticks);
+BaseType_t xTimerResetFromISR(TimerHandle_t timer, BaseType_t* higher_priority_task_woken);
+BaseType_t xTimerChangePeriod(TimerHandle_t timer, TickType_t period, TickType_t ticks);
+void* pvTimerGetTimerID(TimerHandle_t timer);
+
+#endif //FREERTOS_TIMERS_H
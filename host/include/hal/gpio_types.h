@@ -0,0 +1,22 @@
+//
+// Created by derk on 19-10-26.
+//
+
+#ifndef HAL_GPIO_TYPES_H
+#define HAL_GPIO_TYPES_H
+
+typedef enum
+{
+    GPIO_NUM_NC = -1,
+    GPIO_NUM_0 = 0,
+    GPIO_NUM_4 = 4,
+    GPIO_NUM_16 = 16,
+    GPIO_NUM_21 = 21,
+    GPIO_NUM_22 = 22,
+    GPIO_NUM_23 = 23,
+    GPIO_NUM_34 = 34,
+    GPIO_NUM_36 = 36,
+    GPIO_NUM_MAX = 40
+} gpio_num_t;
+
+#endif //HAL_GPIO_TYPES_H
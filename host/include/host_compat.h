@@ -0,0 +1,13 @@
+//
+// Created by derk on 19-10-26.
+//
+
+#ifndef HOST_COMPAT_H
+#define HOST_COMPAT_H
+
+#include <stddef.h>
+
+//Forced into every file: newlib has these, older glibc does not
+size_t strlcpy(char* destination, const char* source, size_t size);
+
+#endif //HOST_COMPAT_H
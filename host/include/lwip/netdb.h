@@ -0,0 +1,5 @@
+//
+// Created by derk on 19-10-26.
+//
+
+//Not used on the host, mqtt.c includes it
@@ -0,0 +1,6 @@
+//
+// Created by derk on 19-10-26.
+//
+
+//mqtt.c includes it, http.c closes sessions with close()
+#include <unistd.h>
@@ -0,0 +1,100 @@
+//
+// Created by derk on 19-10-26.
+//
+
+#ifndef MQTT_CLIENT_H
+#define MQTT_CLIENT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "esp_err.h"
+#include "esp_event.h"
+
+/*
+ * The esp-mqtt client API against a broker simulated in-process, see
+ * host/src/mqtt_client.c. Events are dispatched on an "mqtt_task" thread like
+ * the real client does.
+ */
+
+typedef struct esp_mqtt_client* esp_mqtt_client_handle_t;
+
+typedef enum
+{
+    MQTT_EVENT_ANY = -1,
+    MQTT_EVENT_ERROR = 0,
+    MQTT_EVENT_CONNECTED,
+    MQTT_EVENT_DISCONNECTED,
+    MQTT_EVENT_SUBSCRIBED,
+    MQTT_EVENT_UNSUBSCRIBED,
+    MQTT_EVENT_PUBLISHED,
+    MQTT_EVENT_DATA,
+    MQTT_EVENT_BEFORE_CONNECT
+} esp_mqtt_event_id_t;
+
+typedef struct
+{
+    esp_mqtt_event_id_t event_id;
+    esp_mqtt_client_handle_t client;
+    void* user_context;
+    char* data;
+    int data_len;
+    int total_data_len;
+    int current_data_offset;
+    char* topic;
+    int topic_len;
+    int msg_id;
+    int session_present;
+    bool retain;
+    int qos;
+    bool dup;
+} esp_mqtt_event_t;
+
+typedef esp_mqtt_event_t* esp_mqtt_event_handle_t;
+
+typedef enum
+{
+    MQTT_TRANSPORT_UNKNOWN,
+    MQTT_TRANSPORT_OVER_TCP,
+    MQTT_TRANSPORT_OVER_SSL,
+    MQTT_TRANSPORT_OVER_WS,
+    MQTT_TRANSPORT_OVER_WSS
+} esp_mqtt_transport_t;
+
+typedef struct
+{
+    const char* uri;
+    const char* host;
+    uint32_t port;
+    esp_mqtt_transport_t transport;
+    const char* username;
+    const char* password;
+    const char* client_id;
+    const char* lwt_topic;
+    const char* lwt_msg;
+    int lwt_qos;
+    int lwt_retain;
+    int lwt_msg_len;
+    bool disable_auto_reconnect;
+    const char* cert_pem;
+    size_t cert_len;
+    bool skip_cert_common_name_check;
+    int keepalive;
+    int reconnect_timeout_ms;
+    int network_timeout_ms;
+    int task_prio;
+    int task_stack;
+    int buffer_size;
+    int out_buffer_size;
+} esp_mqtt_client_config_t;
+
+esp_mqtt_client_handle_t esp_mqtt_client_init(const esp_mqtt_client_config_t* config);
+esp_err_t esp_mqtt_client_register_event(esp_mqtt_client_handle_t client, esp_mqtt_event_id_t event,
+                                         esp_event_handler_t handler, void* handler_args);
+esp_err_t esp_mqtt_client_start(esp_mqtt_client_handle_t client);
+esp_err_t esp_mqtt_client_stop(esp_mqtt_client_handle_t client);
+esp_err_t esp_mqtt_client_disconnect(esp_mqtt_client_handle_t client);
+int esp_mqtt_client_publish(esp_mqtt_client_handle_t client, const char* topic, const char* data, int len, int qos,
+                            int retain);
+int esp_mqtt_client_subscribe(esp_mqtt_client_handle_t client, const char* topic, int qos);
+
+#endif //MQTT_CLIENT_H
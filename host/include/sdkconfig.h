@@ -0,0 +1,18 @@
+//
+// Created by derk on 19-10-26.
+//
+
+//Host build configuration, mirrors the parts of the target sdkconfig the sources look at
+
+#define CONFIG_FREERTOS_HZ 100
+#define CONFIG_FREERTOS_USE_TRACE_FACILITY 1
+#define CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS 1
+#define CONFIG_PLANT_TRACE_TASK_STATS 1
+#define CONFIG_LOG_DEFAULT_LEVEL 3
+#define CONFIG_PLANT_LOCAL_LIGHT 1
+#define CONFIG_PLANT_SAMPLE_LOG_INTERVAL_S 10
+//The simulated broker accepts anything, plain mqtt
+#define CONFIG_PLANT_MQTT_HOST "localhost"
+#define CONFIG_PLANT_MQTT_PORT 1883
+#define CONFIG_PLANT_MQTT_USERNAME ""
+#define CONFIG_PLANT_MQTT_PASSWORD ""
@@ -0,0 +1,29 @@
+//
+// Created by derk on 19-10-26.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <esp_log.h>
+#include "base.h"
+#include "executor.h"
+#include "settings.h"
+#include "bench.h"
+#include "host.h"
+
+//Same lines as the device prints with CONFIG_PLANT_BENCHMARK, compare with tools/bench_check.py
+int main(int argc, char** argv)
+{
+    host_log_level = ESP_LOG_WARN;
+    host_task_adopt("main");
+    initialize_nvs();
+    initialize_executor();
+    initialize_settings();
+
+    bench_run();
+    fflush(stdout);
+    //The executor task never ends, leave it running into exit
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,46 @@
+//
+// Created by derk on 19-10-26.
+//
+
+#ifndef BROKER_H
+#define BROKER_H
+
+#include <stdint.h>
+
+//The broker behind the esp-mqtt shim in mqtt_client.c
+
+#define BROKER_MAX_TOPICS 16
+#define BROKER_TOPIC_SIZE 48
+#define BROKER_PAYLOAD_SIZE 64
+
+typedef struct
+{
+    char topic[BROKER_TOPIC_SIZE];
+    char last[BROKER_PAYLOAD_SIZE];
+    uint32_t count;
+} broker_topic_t;
+
+typedef struct
+{
+    uint32_t connects;
+    uint32_t publishes;
+    uint32_t pubacks;
+    //Publishes refused because too many were waiting for their PUBACK
+    uint32_t refused;
+    uint32_t topic_count;
+    broker_topic_t topics[BROKER_MAX_TOPICS];
+} broker_stats_t;
+
+/**
+ * @brief PUBACKs come back after rtt_ms, give or take half of it, and one in fifty takes five times as long
+ */
+void broker_initialize(uint32_t seed, uint32_t rtt_ms);
+
+/**
+ * @brief Deliver a message to the client once it subscribed to a matching topic, like a retained message
+ */
+void broker_inject(const char* topic, const char* payload);
+
+void broker_get_stats(broker_stats_t* stats);
+
+#endif //BROKER_H
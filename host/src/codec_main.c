@@ -0,0 +1,222 @@
+//
+// Created by derk on 19-10-26.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "sample_codec.h"
+
+/*
+ * Compresses a recorded trace with the sample codec of the firmware and
+ * reports the compression ratio and the encode and decode throughput.
+ * Every block is decoded on its own and checked against the trace.
+ */
+
+#define MAX_LINE 1024
+//Repeat encoding and decoding for at least this long, one pass over a trace is too short to time
+#define MIN_RUN_NS 200000000LL
+//What the samples take uncompressed: a 64 bit timestamp and a 32 bit reading per measurement
+#define RAW_RECORD_SIZE (sizeof(int64_t) + MEASUREMENT_COUNT * sizeof(int32_t))
+
+//The names the firmware gives the measurements, see get_measurement_name
+static const char* column_names[MEASUREMENT_COUNT] = {
+    [MEASUREMENT_TEMPERATURE] = "temperature",
+    [MEASUREMENT_HUMIDITY] = "humidity",
+    [MEASUREMENT_SOIL_MOISTURE_LEVEL] = "soil_moisture_level",
+    [MEASUREMENT_LIGHT_LEVEL] = "light_level"
+};
+
+static sample_record_t* records = NULL;
+static size_t record_count = 0;
+static sample_block_t* blocks = NULL;
+static size_t block_count = 0;
+
+static int find_column(const char* line, const char* name)
+{
+    char header[MAX_LINE];
+    int column = 0;
+
+    strcpy(header, line);
+    for(char* field = strtok(header, ",\r\n"); field; field = strtok(NULL, ",\r\n"), ++column)
+    {
+        if(strcmp(field, name) == 0) return column;
+    }
+    return -1;
+}
+
+static bool load_trace(const char* path)
+{
+    char line[MAX_LINE];
+    int columns[MEASUREMENT_COUNT];
+    size_t capacity = 0;
+    FILE* file = fopen(path, "r");
+
+    if(!file)
+    {
+        perror(path);
+        return false;
+    }
+    if(!fgets(line, sizeof(line), file))
+    {
+        fprintf(stderr, "%s: empty\n", path);
+        fclose(file);
+        return false;
+    }
+
+    int time_column = find_column(line, "time");
+    if(time_column < 0)
+        time_column = find_column(line, "timestamp");
+    int found_columns = 0;
+    for(int type = 0; type < MEASUREMENT_COUNT; ++type)
+    {
+        columns[type] = find_column(line, column_names[type]);
+        if(columns[type] >= 0) ++found_columns;
+    }
+    if(time_column < 0 || found_columns == 0)
+    {
+        fprintf(stderr, "%s: needs a time column and at least one measurement column\n", path);
+        fclose(file);
+        return false;
+    }
+
+    while(fgets(line, sizeof(line), file))
+    {
+        sample_record_t record = { 0 };
+        bool has_time = false;
+        int column = 0;
+
+        if(line[0] == '#' || line[0] == '\n') continue;
+        for(char* field = strtok(line, ",\r\n"); field; field = strtok(NULL, ",\r\n"), ++column)
+        {
+            if(column == time_column)
+            {
+                record.timestamp = (uint32_t)strtod(field, NULL);
+                has_time = true;
+            }
+            for(int type = 0; type < MEASUREMENT_COUNT; ++type)
+            {
+                if(column == columns[type])
+                    record.values[type] = (int32_t)strtol(field, NULL, 10);
+            }
+        }
+        if(!has_time) continue;
+
+        if(record_count == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 4096;
+            records = realloc(records, capacity * sizeof(*records));
+            if(!records)
+            {
+                fclose(file);
+                return false;
+            }
+        }
+        records[record_count++] = record;
+    }
+    fclose(file);
+    if(record_count == 0)
+    {
+        fprintf(stderr, "%s: no samples\n", path);
+        return false;
+    }
+    return true;
+}
+
+static int64_t clock_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+static void encode(void)
+{
+    sample_encoder_t encoder;
+
+    block_count = 0;
+    for(size_t i = 0; i < record_count; ++i)
+    {
+        if(block_count == 0 || !sample_encoder_add(&encoder, &records[i]))
+        {
+            sample_encoder_init(&encoder, &blocks[block_count++], records[i].timestamp);
+            sample_encoder_add(&encoder, &records[i]);
+        }
+    }
+}
+
+//Returns the number of records that match the trace
+static size_t decode(void)
+{
+    sample_decoder_t decoder;
+    sample_record_t record;
+    size_t matched = 0;
+
+    for(size_t block = 0; block < block_count; ++block)
+    {
+        sample_decoder_init(&decoder, &blocks[block]);
+        while(sample_decoder_next(&decoder, &record))
+        {
+            if(matched < record_count && memcmp(&record, &records[matched], sizeof(record)) == 0)
+                ++matched;
+        }
+    }
+    return matched;
+}
+
+int main(int argc, char** argv)
+{
+    if(argc != 2 || strcmp(argv[1], "-h") == 0 || strcmp(argv[1], "--help") == 0)
+    {
+        fprintf(stderr, "usage: %s TRACE.csv\n"
+                        "TRACE.csv has a header with time or timestamp (seconds) and any of the columns "
+                        "temperature, humidity, soil_moisture_level and light_level\n", argv[0]);
+        return argc == 2 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    if(!load_trace(argv[1])) return EXIT_FAILURE;
+
+    //Worst case a record per block
+    blocks = calloc(record_count, sizeof(*blocks));
+    if(!blocks) return EXIT_FAILURE;
+
+    size_t passes = 0;
+    int64_t start = clock_ns();
+    int64_t encode_ns;
+    do
+    {
+        encode();
+        ++passes;
+        encode_ns = clock_ns() - start;
+    } while(encode_ns < MIN_RUN_NS);
+    double encode_s = encode_ns / 1e9 / passes;
+
+    if(decode() != record_count)
+    {
+        fprintf(stderr, "decoded samples do not match the trace\n");
+        return EXIT_FAILURE;
+    }
+
+    passes = 0;
+    int64_t decode_ns;
+    start = clock_ns();
+    do
+    {
+        decode();
+        ++passes;
+        decode_ns = clock_ns() - start;
+    } while(decode_ns < MIN_RUN_NS);
+    double decode_s = decode_ns / 1e9 / passes;
+
+    double raw_bytes = (double)record_count * RAW_RECORD_SIZE;
+    double block_bytes = (double)block_count * SAMPLE_BLOCK_SIZE;
+    printf("samples:        %zu in %zu blocks of %d bytes\n", record_count, block_count, SAMPLE_BLOCK_SIZE);
+    printf("size:           %.0f bytes raw, %.0f bytes compressed, %.2f bytes per sample\n", raw_bytes,
+           block_bytes, block_bytes / record_count);
+    printf("ratio:          %.2fx\n", raw_bytes / block_bytes);
+    printf("encode:         %.1f Msamples/s, %.1f MB/s raw\n", record_count / encode_s / 1e6,
+           raw_bytes / encode_s / 1e6);
+    printf("decode:         %.1f Msamples/s, %.1f MB/s raw\n", record_count / decode_s / 1e6,
+           raw_bytes / decode_s / 1e6);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,312 @@
+//
+// Created by derk on 19-10-26.
+//
+
+#include <errno.h>
+#include <malloc.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <esp_err.h>
+#include <esp_log.h>
+#include <esp_system.h>
+#include <esp_timer.h>
+#include <esp32/rom/ets_sys.h>
+#include "host.h"
+
+#define ESP_TIMER_TASK_STACK_SIZE 4096
+#define ESP_TIMER_TASK_PRIORITY 22
+//The free heap is this budget minus what glibc handed out, so a leak on the host shows like one on the device.
+//Task stacks are 256 KiB each here, the figure is not comparable to the esp32's
+#define HOST_HEAP_SIZE (64 * 1024 * 1024)
+
+struct host_timer
+{
+    esp_timer_cb_t callback;
+    void* arg;
+    const char* name;
+    int64_t expiry;
+    uint64_t period;
+    bool armed;
+    struct host_timer* next;
+};
+
+esp_log_level_t host_log_level = ESP_LOG_INFO;
+
+static struct timespec start_time;
+static pthread_mutex_t log_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t timer_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t timer_wake;
+static pthread_once_t timer_once = PTHREAD_ONCE_INIT;
+static struct host_timer* timers = NULL;
+
+__attribute__((constructor)) static void initialize_clock(void)
+{
+    clock_gettime(CLOCK_MONOTONIC, &start_time);
+}
+
+int64_t esp_timer_get_time(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)(now.tv_sec - start_time.tv_sec) * 1000000 + (now.tv_nsec - start_time.tv_nsec) / 1000;
+}
+
+uint32_t esp_log_timestamp(void)
+{
+    return (uint32_t)(esp_timer_get_time() / 1000);
+}
+
+void esp_log_write(esp_log_level_t level, const char* tag, const char* format, ...)
+{
+    va_list args;
+    if(level > host_log_level) return;
+
+    va_start(args, format);
+    pthread_mutex_lock(&log_lock);
+    vprintf(format, args);
+    fflush(stdout);
+    pthread_mutex_unlock(&log_lock);
+    va_end(args);
+}
+
+const char* esp_err_to_name(esp_err_t code)
+{
+    switch(code)
+    {
+    case ESP_OK: return "ESP_OK";
+    case ESP_FAIL: return "ESP_FAIL";
+    case ESP_ERR_NO_MEM: return "ESP_ERR_NO_MEM";
+    case ESP_ERR_INVALID_ARG: return "ESP_ERR_INVALID_ARG";
+    case ESP_ERR_INVALID_STATE: return "ESP_ERR_INVALID_STATE";
+    case ESP_ERR_INVALID_SIZE: return "ESP_ERR_INVALID_SIZE";
+    case ESP_ERR_NOT_FOUND: return "ESP_ERR_NOT_FOUND";
+    case ESP_ERR_TIMEOUT: return "ESP_ERR_TIMEOUT";
+    case ESP_ERR_NVS_NOT_FOUND: return "ESP_ERR_NVS_NOT_FOUND";
+    case ESP_ERR_NVS_INVALID_LENGTH: return "ESP_ERR_NVS_INVALID_LENGTH";
+    case ESP_ERR_NVS_NO_FREE_PAGES: return "ESP_ERR_NVS_NO_FREE_PAGES";
+    case ESP_ERR_NVS_NEW_VERSION_FOUND: return "ESP_ERR_NVS_NEW_VERSION_FOUND";
+    default: return "UNKNOWN ERROR";
+    }
+}
+
+static uint32_t minimum_free_heap = UINT32_MAX;
+
+uint32_t esp_get_free_heap_size(void)
+{
+    //In use in every arena plus the mmapped blocks, which is where the task stacks are
+    struct mallinfo2 info = mallinfo2();
+    size_t used = info.uordblks + info.hblkhd;
+    uint32_t free_heap = used < HOST_HEAP_SIZE ? (uint32_t)(HOST_HEAP_SIZE - used) : 0;
+
+    uint32_t minimum = __atomic_load_n(&minimum_free_heap, __ATOMIC_RELAXED);
+    while(free_heap < minimum &&
+          !__atomic_compare_exchange_n(&minimum_free_heap, &minimum, free_heap, false, __ATOMIC_RELAXED,
+                                       __ATOMIC_RELAXED))
+        ;
+    return free_heap;
+}
+
+//glibc has no low water mark, this is the lowest figure any caller saw
+uint32_t esp_get_minimum_free_heap_size(void)
+{
+    uint32_t free_heap = esp_get_free_heap_size();
+    uint32_t minimum = __atomic_load_n(&minimum_free_heap, __ATOMIC_RELAXED);
+    return minimum < free_heap ? minimum : free_heap;
+}
+
+void esp_restart(void)
+{
+    ESP_LOGW("host", "esp_restart called, stopping the simulation");
+    fflush(stdout);
+    exit(EXIT_SUCCESS);
+}
+
+void ets_delay_us(uint32_t us)
+{
+    //Spins like the rom function, a sleep would be late by the scheduler latency
+    int64_t end = esp_timer_get_time() + us;
+    while(esp_timer_get_time() < end);
+}
+
+void host_cond_init(pthread_cond_t* cond)
+{
+    pthread_condattr_t attributes;
+    pthread_condattr_init(&attributes);
+    pthread_condattr_setclock(&attributes, CLOCK_MONOTONIC);
+    pthread_cond_init(cond, &attributes);
+    pthread_condattr_destroy(&attributes);
+}
+
+bool host_wait(pthread_cond_t* cond, pthread_mutex_t* mutex, const struct timespec* deadline)
+{
+    if(!deadline)
+    {
+        pthread_cond_wait(cond, mutex);
+        return true;
+    }
+    return pthread_cond_timedwait(cond, mutex, deadline) != ETIMEDOUT;
+}
+
+const struct timespec* host_deadline_us(int64_t microseconds, struct timespec* deadline)
+{
+    clock_gettime(CLOCK_MONOTONIC, deadline);
+    deadline->tv_sec += microseconds / 1000000;
+    deadline->tv_nsec += (microseconds % 1000000) * 1000;
+    if(deadline->tv_nsec >= 1000000000)
+    {
+        deadline->tv_nsec -= 1000000000;
+        ++deadline->tv_sec;
+    }
+    return deadline;
+}
+
+const struct timespec* host_deadline(TickType_t ticks, struct timespec* deadline)
+{
+    if(ticks == portMAX_DELAY) return NULL;
+    return host_deadline_us((int64_t)ticks * 1000000 / configTICK_RATE_HZ, deadline);
+}
+
+void host_sleep_us(int64_t microseconds)
+{
+    struct timespec duration = {
+        .tv_sec = microseconds / 1000000,
+        .tv_nsec = (microseconds % 1000000) * 1000
+    };
+    while(nanosleep(&duration, &duration) != 0 && errno == EINTR);
+}
+
+uint32_t host_random(uint32_t* state)
+{
+    //xorshift32, zero is the one state it cannot leave
+    uint32_t x = *state ? *state : 0x9e3779b9;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    *state = x;
+    return x;
+}
+
+static struct host_timer* next_expiry(void)
+{
+    struct host_timer* next = NULL;
+    for(struct host_timer* timer = timers; timer; timer = timer->next)
+    {
+        if(timer->armed && (!next || timer->expiry < next->expiry))
+            next = timer;
+    }
+    return next;
+}
+
+static void timer_task(void* param)
+{
+    struct timespec deadline;
+
+    pthread_mutex_lock(&timer_lock);
+    for(;;)
+    {
+        struct host_timer* timer = next_expiry();
+        if(!timer)
+        {
+            host_wait(&timer_wake, &timer_lock, NULL);
+            continue;
+        }
+
+        int64_t now = esp_timer_get_time();
+        if(timer->expiry > now)
+        {
+            host_wait(&timer_wake, &timer_lock, host_deadline_us(timer->expiry - now, &deadline));
+            continue;
+        }
+
+        if(timer->period)
+            timer->expiry += timer->period;
+        else
+            timer->armed = false;
+        //Callbacks start and stop timers themselves
+        pthread_mutex_unlock(&timer_lock);
+        timer->callback(timer->arg);
+        pthread_mutex_lock(&timer_lock);
+    }
+}
+
+static void start_timer_task(void)
+{
+    host_cond_init(&timer_wake);
+    xTaskCreatePinnedToCore(timer_task, "esp_timer", ESP_TIMER_TASK_STACK_SIZE, NULL, ESP_TIMER_TASK_PRIORITY, NULL,
+                            PRO_CPU_NUM);
+}
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t* args, esp_timer_handle_t* handle)
+{
+    if(!args || !args->callback || !handle) return ESP_ERR_INVALID_ARG;
+    struct host_timer* timer = calloc(1, sizeof(*timer));
+    if(!timer) return ESP_ERR_NO_MEM;
+
+    pthread_once(&timer_once, start_timer_task);
+    timer->callback = args->callback;
+    timer->arg = args->arg;
+    timer->name = args->name;
+
+    pthread_mutex_lock(&timer_lock);
+    timer->next = timers;
+    timers = timer;
+    pthread_mutex_unlock(&timer_lock);
+    *handle = timer;
+    return ESP_OK;
+}
+
+static esp_err_t start_timer(esp_timer_handle_t timer, uint64_t timeout_us, uint64_t period_us)
+{
+    if(!timer) return ESP_ERR_INVALID_ARG;
+
+    pthread_mutex_lock(&timer_lock);
+    if(timer->armed)
+    {
+        pthread_mutex_unlock(&timer_lock);
+        return ESP_ERR_INVALID_STATE;
+    }
+    timer->expiry = esp_timer_get_time() + (int64_t)timeout_us;
+    timer->period = period_us;
+    timer->armed = true;
+    pthread_cond_signal(&timer_wake);
+    pthread_mutex_unlock(&timer_lock);
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_start_once(esp_timer_handle_t timer, uint64_t timeout_us)
+{
+    return start_timer(timer, timeout_us, 0);
+}
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period_us)
+{
+    return start_timer(timer, period_us, period_us);
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer)
+{
+    if(!timer) return ESP_ERR_INVALID_ARG;
+
+    pthread_mutex_lock(&timer_lock);
+    bool armed = timer->armed;
+    timer->armed = false;
+    pthread_cond_signal(&timer_wake);
+    pthread_mutex_unlock(&timer_lock);
+    return armed ? ESP_OK : ESP_ERR_INVALID_STATE;
+}
+
+size_t strlcpy(char* destination, const char* source, size_t size)
+{
+    size_t length = strlen(source);
+    if(size)
+    {
+        size_t copied = length < size - 1 ? length : size - 1;
+        memcpy(destination, source, copied);
+        destination[copied] = '\0';
+    }
+    return length;
+}
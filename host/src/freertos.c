@@ -0,0 +1,583 @@
+//
+// Created by derk on 19-10-26.
+//
+
+#include <assert.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+#include <freertos/event_groups.h>
+#include <freertos/timers.h>
+#include <esp_timer.h>
+#include "host.h"
+
+#define HOST_MAX_TASKS 32
+//Every task gets this much real stack, painted so the use can be measured against its stack_depth
+#define HOST_STACK_SIZE (256 * 1024)
+#define HOST_STACK_PAINT 0xa5
+
+struct host_task
+{
+    pthread_t thread;
+    char name[configMAX_TASK_NAME_LEN];
+    TaskFunction_t fn;
+    void* param;
+    uint32_t stack_depth;
+    uint8_t* stack;
+    //Where the task function starts, what glibc keeps above it does not count
+    uint8_t* stack_top;
+    UBaseType_t priority;
+    BaseType_t core;
+    UBaseType_t number;
+    pthread_mutex_t lock;
+    pthread_cond_t notified;
+    uint32_t notifications;
+};
+
+struct host_queue
+{
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    uint8_t* items;
+    UBaseType_t length;
+    UBaseType_t item_size;
+    UBaseType_t head;
+    UBaseType_t count;
+};
+
+struct host_semaphore
+{
+    pthread_mutex_t lock;
+    pthread_cond_t available;
+    uint32_t count;
+};
+
+struct host_event_group
+{
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    EventBits_t bits;
+};
+
+struct host_rtos_timer
+{
+    esp_timer_handle_t timer;
+    const char* name;
+    TickType_t period;
+    bool auto_reload;
+    void* id;
+    TimerCallbackFunction_t callback;
+};
+
+//Slots are never reused, tasks on the target are not deleted either
+static struct host_task tasks[HOST_MAX_TASKS];
+static UBaseType_t task_count = 0;
+static pthread_mutex_t tasks_lock = PTHREAD_MUTEX_INITIALIZER;
+static __thread struct host_task* current_task = NULL;
+
+static struct host_task* add_task(const char* name, uint32_t stack_depth, UBaseType_t priority, BaseType_t core)
+{
+    pthread_mutex_lock(&tasks_lock);
+    if(task_count == HOST_MAX_TASKS)
+    {
+        pthread_mutex_unlock(&tasks_lock);
+        fprintf(stderr, "more than %d tasks\n", HOST_MAX_TASKS);
+        abort();
+    }
+    struct host_task* task = &tasks[task_count];
+    strncpy(task->name, name, sizeof(task->name) - 1);
+    task->stack_depth = stack_depth;
+    task->priority = priority;
+    task->core = core;
+    task->number = ++task_count;
+    pthread_mutex_init(&task->lock, NULL);
+    host_cond_init(&task->notified);
+    pthread_mutex_unlock(&tasks_lock);
+    return task;
+}
+
+static UBaseType_t count_tasks(void)
+{
+    pthread_mutex_lock(&tasks_lock);
+    UBaseType_t count = task_count;
+    pthread_mutex_unlock(&tasks_lock);
+    return count;
+}
+
+static void* run_task(void* param)
+{
+    struct host_task* task = param;
+    uint8_t top;
+    __atomic_store_n(&task->stack_top, &top, __ATOMIC_RELEASE);
+    current_task = task;
+    task->fn(task->param);
+    //A FreeRTOS task must not return, the esp32 port aborts here as well
+    fprintf(stderr, "task %s returned\n", task->name);
+    abort();
+}
+
+BaseType_t xPortGetCoreID(void)
+{
+    if(!current_task || current_task->core == tskNO_AFFINITY) return PRO_CPU_NUM;
+    return current_task->core;
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char* name, uint32_t stack_depth, void* param,
+                                   UBaseType_t priority, TaskHandle_t* handle, BaseType_t core)
+{
+    assert(fn);
+    struct host_task* task = add_task(name, stack_depth, priority, core);
+    task->fn = fn;
+    task->param = param;
+    if(handle)
+        *handle = task;
+
+    pthread_attr_t attr;
+    task->stack = malloc(HOST_STACK_SIZE);
+    if(!task->stack) return pdFAIL;
+    memset(task->stack, HOST_STACK_PAINT, HOST_STACK_SIZE);
+    pthread_attr_init(&attr);
+    pthread_attr_setstack(&attr, task->stack, HOST_STACK_SIZE);
+    int err = pthread_create(&task->thread, &attr, run_task, task);
+    pthread_attr_destroy(&attr);
+    if(err != 0) return pdFAIL;
+    pthread_setname_np(task->thread, task->name);
+    return pdPASS;
+}
+
+TaskHandle_t xTaskCreateStaticPinnedToCore(TaskFunction_t fn, const char* name, uint32_t stack_depth, void* param,
+                                           UBaseType_t priority, StackType_t* stack, StaticTask_t* buffer,
+                                           BaseType_t core)
+{
+    TaskHandle_t handle = NULL;
+    xTaskCreatePinnedToCore(fn, name, stack_depth, param, priority, &handle, core);
+    return handle;
+}
+
+TaskHandle_t host_task_adopt(const char* name)
+{
+    struct host_task* task = add_task(name, 0, 1, tskNO_AFFINITY);
+    task->thread = pthread_self();
+    current_task = task;
+    return task;
+}
+
+void vTaskDelay(TickType_t ticks)
+{
+    if(ticks == 0)
+        sched_yield();
+    else
+        host_sleep_us((int64_t)ticks * 1000000 / configTICK_RATE_HZ);
+}
+
+TickType_t xTaskGetTickCount(void)
+{
+    return (TickType_t)(esp_timer_get_time() * configTICK_RATE_HZ / 1000000);
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    return current_task;
+}
+
+char* pcTaskGetTaskName(TaskHandle_t task)
+{
+    if(!task) task = current_task;
+    //Threads the shim does not know about, only the host's own
+    return task ? task->name : "host";
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task)
+{
+    assert(task);
+    pthread_mutex_lock(&task->lock);
+    ++task->notifications;
+    pthread_cond_signal(&task->notified);
+    pthread_mutex_unlock(&task->lock);
+    return pdPASS;
+}
+
+void vTaskNotifyGiveFromISR(TaskHandle_t task, BaseType_t* higher_priority_task_woken)
+{
+    xTaskNotifyGive(task);
+    if(higher_priority_task_woken)
+        *higher_priority_task_woken = pdFALSE;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks)
+{
+    struct host_task* task = current_task;
+    struct timespec deadline;
+    const struct timespec* until = host_deadline(ticks, &deadline);
+    assert(task);
+
+    pthread_mutex_lock(&task->lock);
+    while(task->notifications == 0 && ticks != 0)
+    {
+        if(!host_wait(&task->notified, &task->lock, until)) break;
+    }
+    uint32_t value = task->notifications;
+    if(value)
+        task->notifications = clear_on_exit ? 0 : value - 1;
+    pthread_mutex_unlock(&task->lock);
+    return value;
+}
+
+size_t host_task_stack_used(TaskHandle_t handle, uint32_t* stack_depth)
+{
+    struct host_task* task = handle;
+    const uint8_t* top = __atomic_load_n(&task->stack_top, __ATOMIC_ACQUIRE);
+
+    if(stack_depth)
+        *stack_depth = task->stack_depth;
+    if(!task->stack || !top) return 0;
+    //The stack grows down from top, the lowest byte that lost its paint is as deep as it went
+    const uint8_t* lowest = task->stack;
+    while(lowest < top && *lowest == HOST_STACK_PAINT)
+        ++lowest;
+    return top - lowest;
+}
+
+static UBaseType_t stack_high_water_mark(struct host_task* task)
+{
+    size_t used = host_task_stack_used(task, NULL);
+    return used < task->stack_depth ? task->stack_depth - used : 0;
+}
+
+UBaseType_t uxTaskGetStackHighWaterMark(TaskHandle_t task)
+{
+    if(!task) task = current_task;
+    return task ? stack_high_water_mark(task) : 0;
+}
+
+UBaseType_t uxTaskGetNumberOfTasks(void)
+{
+    return count_tasks();
+}
+
+static uint32_t cpu_time_us(pthread_t thread)
+{
+    clockid_t clock;
+    struct timespec time;
+
+    if(pthread_getcpuclockid(thread, &clock) != 0 || clock_gettime(clock, &time) != 0) return 0;
+    return (uint32_t)((uint64_t)time.tv_sec * 1000000 + time.tv_nsec / 1000);
+}
+
+UBaseType_t uxTaskGetSystemState(TaskStatus_t* status, UBaseType_t size, uint32_t* total_runtime)
+{
+    UBaseType_t count = count_tasks();
+    if(count > size) return 0;
+
+    for(UBaseType_t i = 0; i < count; ++i)
+    {
+        struct host_task* task = &tasks[i];
+        status[i] = (TaskStatus_t) {
+            .xHandle = task,
+            .pcTaskName = task->name,
+            .xTaskNumber = task->number,
+            .eCurrentState = task == current_task ? eRunning : eBlocked,
+            .uxCurrentPriority = task->priority,
+            .uxBasePriority = task->priority,
+            .ulRunTimeCounter = cpu_time_us(task->thread),
+            .usStackHighWaterMark = stack_high_water_mark(task),
+            .xCoreID = task->core
+        };
+    }
+    //Per core like the runtime counters on the esp32, a task that keeps one core busy is at 100%
+    if(total_runtime)
+        *total_runtime = (uint32_t)esp_timer_get_time();
+    return count;
+}
+
+QueueHandle_t host_queue_create(UBaseType_t length, UBaseType_t item_size)
+{
+    struct host_queue* queue = calloc(1, sizeof(*queue));
+    if(!queue) return NULL;
+    queue->items = calloc(length, item_size);
+    if(!queue->items)
+    {
+        free(queue);
+        return NULL;
+    }
+    queue->length = length;
+    queue->item_size = item_size;
+    pthread_mutex_init(&queue->lock, NULL);
+    host_cond_init(&queue->not_empty);
+    host_cond_init(&queue->not_full);
+    return queue;
+}
+
+QueueHandle_t xQueueCreateStatic(UBaseType_t length, UBaseType_t item_size, uint8_t* storage, StaticQueue_t* buffer)
+{
+    return host_queue_create(length, item_size);
+}
+
+BaseType_t xQueueSend(QueueHandle_t queue, const void* item, TickType_t ticks)
+{
+    struct timespec deadline;
+    const struct timespec* until = host_deadline(ticks, &deadline);
+
+    pthread_mutex_lock(&queue->lock);
+    while(queue->count == queue->length)
+    {
+        if(ticks == 0 || !host_wait(&queue->not_full, &queue->lock, until))
+        {
+            pthread_mutex_unlock(&queue->lock);
+            return errQUEUE_FULL;
+        }
+    }
+    UBaseType_t tail = (queue->head + queue->count) % queue->length;
+    memcpy(queue->items + tail * queue->item_size, item, queue->item_size);
+    ++queue->count;
+    pthread_cond_signal(&queue->not_empty);
+    pthread_mutex_unlock(&queue->lock);
+    return pdPASS;
+}
+
+BaseType_t xQueueSendFromISR(QueueHandle_t queue, const void* item, BaseType_t* higher_priority_task_woken)
+{
+    if(higher_priority_task_woken)
+        *higher_priority_task_woken = pdFALSE;
+    return xQueueSend(queue, item, 0);
+}
+
+BaseType_t xQueueReceive(QueueHandle_t queue, void* item, TickType_t ticks)
+{
+    struct timespec deadline;
+    const struct timespec* until = host_deadline(ticks, &deadline);
+
+    pthread_mutex_lock(&queue->lock);
+    while(queue->count == 0)
+    {
+        if(ticks == 0 || !host_wait(&queue->not_empty, &queue->lock, until))
+        {
+            pthread_mutex_unlock(&queue->lock);
+            return errQUEUE_EMPTY;
+        }
+    }
+    memcpy(item, queue->items + queue->head * queue->item_size, queue->item_size);
+    queue->head = (queue->head + 1) % queue->length;
+    --queue->count;
+    pthread_cond_signal(&queue->not_full);
+    pthread_mutex_unlock(&queue->lock);
+    return pdPASS;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue)
+{
+    pthread_mutex_lock(&queue->lock);
+    UBaseType_t count = queue->count;
+    pthread_mutex_unlock(&queue->lock);
+    return count;
+}
+
+SemaphoreHandle_t host_semaphore_create(uint32_t initial)
+{
+    struct host_semaphore* semaphore = calloc(1, sizeof(*semaphore));
+    if(!semaphore) return NULL;
+    pthread_mutex_init(&semaphore->lock, NULL);
+    host_cond_init(&semaphore->available);
+    semaphore->count = initial;
+    return semaphore;
+}
+
+SemaphoreHandle_t xSemaphoreCreateMutexStatic(StaticSemaphore_t* buffer)
+{
+    return host_semaphore_create(1);
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinaryStatic(StaticSemaphore_t* buffer)
+{
+    return host_semaphore_create(0);
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t semaphore, TickType_t ticks)
+{
+    struct timespec deadline;
+    const struct timespec* until = host_deadline(ticks, &deadline);
+
+    pthread_mutex_lock(&semaphore->lock);
+    while(semaphore->count == 0)
+    {
+        if(ticks == 0 || !host_wait(&semaphore->available, &semaphore->lock, until))
+        {
+            pthread_mutex_unlock(&semaphore->lock);
+            return pdFALSE;
+        }
+    }
+    --semaphore->count;
+    pthread_mutex_unlock(&semaphore->lock);
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t semaphore)
+{
+    BaseType_t given = pdFALSE;
+
+    pthread_mutex_lock(&semaphore->lock);
+    if(semaphore->count == 0)
+    {
+        semaphore->count = 1;
+        pthread_cond_signal(&semaphore->available);
+        given = pdTRUE;
+    }
+    pthread_mutex_unlock(&semaphore->lock);
+    return given;
+}
+
+BaseType_t xSemaphoreGiveFromISR(SemaphoreHandle_t semaphore, BaseType_t* higher_priority_task_woken)
+{
+    if(higher_priority_task_woken)
+        *higher_priority_task_woken = pdFALSE;
+    return xSemaphoreGive(semaphore);
+}
+
+EventGroupHandle_t xEventGroupCreate(void)
+{
+    struct host_event_group* group = calloc(1, sizeof(*group));
+    if(!group) return NULL;
+    pthread_mutex_init(&group->lock, NULL);
+    host_cond_init(&group->changed);
+    return group;
+}
+
+EventGroupHandle_t xEventGroupCreateStatic(StaticEventGroup_t* buffer)
+{
+    return xEventGroupCreate();
+}
+
+EventBits_t xEventGroupSetBits(EventGroupHandle_t group, EventBits_t bits)
+{
+    pthread_mutex_lock(&group->lock);
+    group->bits |= bits;
+    EventBits_t result = group->bits;
+    pthread_cond_broadcast(&group->changed);
+    pthread_mutex_unlock(&group->lock);
+    return result;
+}
+
+EventBits_t xEventGroupClearBits(EventGroupHandle_t group, EventBits_t bits)
+{
+    pthread_mutex_lock(&group->lock);
+    EventBits_t result = group->bits;
+    group->bits &= ~bits;
+    pthread_mutex_unlock(&group->lock);
+    return result;
+}
+
+EventBits_t xEventGroupGetBits(EventGroupHandle_t group)
+{
+    pthread_mutex_lock(&group->lock);
+    EventBits_t result = group->bits;
+    pthread_mutex_unlock(&group->lock);
+    return result;
+}
+
+EventBits_t xEventGroupWaitBits(EventGroupHandle_t group, EventBits_t bits, BaseType_t clear_on_exit,
+                                BaseType_t wait_for_all, TickType_t ticks)
+{
+    struct timespec deadline;
+    const struct timespec* until = host_deadline(ticks, &deadline);
+
+    pthread_mutex_lock(&group->lock);
+    for(;;)
+    {
+        EventBits_t set = group->bits & bits;
+        if(wait_for_all ? set == bits : set != 0)
+        {
+            EventBits_t result = group->bits;
+            if(clear_on_exit)
+                group->bits &= ~bits;
+            pthread_mutex_unlock(&group->lock);
+            return result;
+        }
+        if(ticks == 0 || !host_wait(&group->changed, &group->lock, until)) break;
+    }
+    EventBits_t result = group->bits;
+    pthread_mutex_unlock(&group->lock);
+    return result;
+}
+
+static void on_timer(void* arg)
+{
+    struct host_rtos_timer* timer = arg;
+    timer->callback(timer);
+}
+
+TimerHandle_t xTimerCreate(const char* name, TickType_t period, UBaseType_t auto_reload, void* id,
+                           TimerCallbackFunction_t callback)
+{
+    struct host_rtos_timer* timer = calloc(1, sizeof(*timer));
+    if(!timer) return NULL;
+    timer->name = name;
+    timer->period = period;
+    timer->auto_reload = auto_reload;
+    timer->id = id;
+    timer->callback = callback;
+
+    esp_timer_create_args_t args = {
+        .callback = on_timer,
+        .arg = timer,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = name
+    };
+    if(esp_timer_create(&args, &timer->timer) != ESP_OK)
+    {
+        free(timer);
+        return NULL;
+    }
+    return timer;
+}
+
+TimerHandle_t xTimerCreateStatic(const char* name, TickType_t period, UBaseType_t auto_reload, void* id,
+                                 TimerCallbackFunction_t callback, StaticTimer_t* buffer)
+{
+    return xTimerCreate(name, period, auto_reload, id, callback);
+}
+
+BaseType_t xTimerStart(TimerHandle_t timer, TickType_t ticks)
+{
+    uint64_t period_us = (uint64_t)timer->period * 1000000 / configTICK_RATE_HZ;
+
+    //Starting a running timer restarts it
+    esp_timer_stop(timer->timer);
+    if(timer->auto_reload)
+        return esp_timer_start_periodic(timer->timer, period_us) == ESP_OK ? pdPASS : pdFAIL;
+    return esp_timer_start_once(timer->timer, period_us) == ESP_OK ? pdPASS : pdFAIL;
+}
+
+BaseType_t xTimerStop(TimerHandle_t timer, TickType_t ticks)
+{
+    esp_timer_stop(timer->timer);
+    return pdPASS;
+}
+
+BaseType_t xTimerReset(TimerHandle_t timer, TickType_t ticks)
+{
+    return xTimerStart(timer, ticks);
+}
+
+BaseType_t xTimerResetFromISR(TimerHandle_t timer, BaseType_t* higher_priority_task_woken)
+{
+    if(higher_priority_task_woken)
+        *higher_priority_task_woken = pdFALSE;
+    return xTimerStart(timer, 0);
+}
+
+BaseType_t xTimerChangePeriod(TimerHandle_t timer, TickType_t period, TickType_t ticks)
+{
+    timer->period = period;
+    return xTimerStart(timer, ticks);
+}
+
+void* pvTimerGetTimerID(TimerHandle_t timer)
+{
+    return timer->id;
+}
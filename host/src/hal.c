@@ -0,0 +1,252 @@
+//
+// Created by derk on 19-10-26.
+//
+
+#include "hal.h"
+
+#include <pthread.h>
+#include <esp_timer.h>
+#include <esp32/rom/ets_sys.h>
+#include "measurements.h"
+#include "base.h"
+#include "button.h"
+#include "plant.h"
+#include "host.h"
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+//DHT11 response after the bus is released, in microseconds; the firmware times out at 80, 50 and 70
+#define DHT11_RESPONSE_LOW_US 76
+#define DHT11_RESPONSE_HIGH_US 76
+#define DHT11_BIT_LOW_US 46
+#define DHT11_ZERO_HIGH_US 24
+#define DHT11_ONE_HIGH_US 68
+
+//KAKU gaps are told apart in periods of the transmitter, see switch_kaku.c
+#define KAKU_PERIOD_US 230
+#define KAKU_SHORT_GAP_US (KAKU_PERIOD_US * 35 / 10)
+#define KAKU_SYNC_GAP_US (KAKU_PERIOD_US * 9)
+#define KAKU_CODE_BITS 32
+
+typedef struct
+{
+    bool output;
+    int level;
+} pin_t;
+
+static pin_t pins[GPIO_NUM_MAX];
+static pthread_mutex_t pin_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Latched when the firmware releases the bus. The frame advances with the
+ * delays of the reading thread rather than the wall clock, so a preempted or
+ * slow host does not garble it: the driver measures pulses by counting its
+ * polls, and those are what the model counts as well.
+ */
+static int64_t dht11_position = -1;
+static pthread_t dht11_reader;
+static uint8_t dht11_frame[5];
+
+//The reset button, only the tests press it through host_button_set()
+static bool button_pressed = false;
+static hal_isr_t button_isr = NULL;
+static void* button_isr_arg = NULL;
+
+static int64_t kaku_fall_time = 0;
+static int kaku_gaps = -1;
+static uint32_t kaku_first_gap = 0;
+static uint32_t kaku_code = 0;
+
+void hal_gpio_output(gpio_num_t pin)
+{
+    pthread_mutex_lock(&pin_lock);
+    pins[pin].output = true;
+    pthread_mutex_unlock(&pin_lock);
+}
+
+static void start_dht11_frame(void)
+{
+    uint8_t humidity = plant_humidity();
+    uint8_t temperature = plant_temperature();
+
+    dht11_frame[0] = humidity;
+    dht11_frame[1] = 0;
+    dht11_frame[2] = temperature;
+    dht11_frame[3] = 0;
+    dht11_frame[4] = humidity + temperature;
+    dht11_position = 0;
+    dht11_reader = pthread_self();
+    plant_dht11_read();
+}
+
+void hal_gpio_input(gpio_num_t pin, bool pull_up)
+{
+    pthread_mutex_lock(&pin_lock);
+    pins[pin].output = false;
+    if(pin == DHT11_GPIO)
+        start_dht11_frame();
+    pthread_mutex_unlock(&pin_lock);
+}
+
+void hal_gpio_on_edge(gpio_num_t pin, hal_isr_t isr, void* arg)
+{
+    pthread_mutex_lock(&pin_lock);
+    if(pin == RESET_CONNECTION_BUTTON_GPIO)
+    {
+        button_isr = isr;
+        button_isr_arg = arg;
+    }
+    pthread_mutex_unlock(&pin_lock);
+}
+
+void host_button_set(bool pressed)
+{
+    pthread_mutex_lock(&pin_lock);
+    bool edge = button_pressed != pressed;
+    button_pressed = pressed;
+    hal_isr_t isr = button_isr;
+    void* arg = button_isr_arg;
+    pthread_mutex_unlock(&pin_lock);
+
+    if(edge && isr)
+        isr(arg);
+}
+
+//Call with pin_lock held
+static int dht11_level(void)
+{
+    int64_t t = dht11_position;
+
+    if(t < 0) return 1;
+    if(t < DHT11_RESPONSE_LOW_US) return 0;
+    t -= DHT11_RESPONSE_LOW_US;
+    if(t < DHT11_RESPONSE_HIGH_US) return 1;
+    t -= DHT11_RESPONSE_HIGH_US;
+
+    for(int bit = 0; bit < 40; ++bit)
+    {
+        bool one = dht11_frame[bit / 8] & (1 << (7 - bit % 8));
+        if(t < DHT11_BIT_LOW_US) return 0;
+        t -= DHT11_BIT_LOW_US;
+        if(t < (one ? DHT11_ONE_HIGH_US : DHT11_ZERO_HIGH_US)) return 1;
+        t -= one ? DHT11_ONE_HIGH_US : DHT11_ZERO_HIGH_US;
+    }
+    //End of frame, the sensor lets go of the bus
+    if(t < DHT11_BIT_LOW_US) return 0;
+    dht11_position = -1;
+    return 1;
+}
+
+//Call with pin_lock held
+static void kaku_edge(int level)
+{
+    int64_t now = esp_timer_get_time();
+    if(!level)
+    {
+        kaku_fall_time = now;
+        return;
+    }
+
+    //Every rising edge ends a gap, two gaps make a bit: short-long is a 0, long-short a 1
+    uint32_t gap = (uint32_t)(now - kaku_fall_time);
+    if(gap > KAKU_SYNC_GAP_US)
+    {
+        kaku_gaps = 0;
+        kaku_code = 0;
+        return;
+    }
+    if(kaku_gaps < 0) return;
+
+    if(kaku_gaps++ % 2 == 0)
+    {
+        kaku_first_gap = gap;
+        return;
+    }
+    bool first_short = kaku_first_gap < KAKU_SHORT_GAP_US;
+    bool second_short = gap < KAKU_SHORT_GAP_US;
+    if(first_short == second_short)
+    {
+        //Dim codes and noise, only plain on/off frames are decoded
+        kaku_gaps = -1;
+        return;
+    }
+    kaku_code = kaku_code << 1 | !first_short;
+    if(kaku_gaps == KAKU_CODE_BITS * 2)
+    {
+        plant_kaku_received(kaku_code);
+        kaku_gaps = -1;
+    }
+}
+
+void hal_gpio_set_level(gpio_num_t pin, uint32_t level)
+{
+    pthread_mutex_lock(&pin_lock);
+    bool edge = pins[pin].level != (int)level;
+    pins[pin].level = level;
+    if(edge && pin == KAKU_GPIO)
+        kaku_edge(level);
+    pthread_mutex_unlock(&pin_lock);
+
+    if(edge && pin == RELAY_GPIO)
+        plant_set_pump(level);
+}
+
+int hal_gpio_get_level(gpio_num_t pin)
+{
+    pthread_mutex_lock(&pin_lock);
+    int level;
+    if(pins[pin].output)
+        level = pins[pin].level;
+    else if(pin == DHT11_GPIO)
+        level = dht11_level();
+    else if(pin == RESET_CONNECTION_BUTTON_GPIO)
+        level = button_pressed ? 0 : 1;
+    else
+        level = 1;
+    pthread_mutex_unlock(&pin_lock);
+    return level;
+}
+
+void hal_adc_init(adc1_channel_t channel)
+{
+}
+
+int32_t hal_adc_read(adc1_channel_t channel)
+{
+    if(channel == HUMIDITY_GPIO) return plant_soil_moisture();
+    if(channel == LDR_GPIO) return plant_light_level();
+    return 0;
+}
+
+void hal_pwm_init(gpio_num_t pin, uint32_t frequency_hz)
+{
+}
+
+void hal_pwm_set_duty(uint8_t duty)
+{
+}
+
+int64_t hal_time_us(void)
+{
+    return esp_timer_get_time();
+}
+
+void hal_delay_us(uint32_t microseconds)
+{
+    pthread_mutex_lock(&pin_lock);
+    if(dht11_position >= 0 && pthread_equal(dht11_reader, pthread_self()))
+        dht11_position += microseconds;
+    pthread_mutex_unlock(&pin_lock);
+    ets_delay_us(microseconds);
+}
+
+//TSC ticks, a constant rate on anything recent rather than core cycles
+uint32_t hal_cycle_count(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return (uint32_t)__rdtsc();
+#else
+    return 0;
+#endif
+}
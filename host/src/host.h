@@ -0,0 +1,96 @@
+//
+// Created by derk on 19-10-26.
+//
+
+#ifndef HOST_H
+#define HOST_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <esp_log.h>
+#include <esp_http_server.h>
+
+//Shared by the host shims, the firmware never sees this header
+
+//Condition variables time out on CLOCK_MONOTONIC, the clock esp_timer_get_time() is based on
+void host_cond_init(pthread_cond_t* cond);
+
+/**
+ * @brief Wait for cond until the deadline
+ * @param deadline From host_deadline(), NULL waits forever
+ * @return false once the deadline passed
+ */
+bool host_wait(pthread_cond_t* cond, pthread_mutex_t* mutex, const struct timespec* deadline);
+
+/**
+ * @brief Absolute deadline ticks from now
+ * @return deadline, or NULL for portMAX_DELAY
+ */
+const struct timespec* host_deadline(TickType_t ticks, struct timespec* deadline);
+const struct timespec* host_deadline_us(int64_t microseconds, struct timespec* deadline);
+
+void host_sleep_us(int64_t microseconds);
+
+/**
+ * @brief Deepest stack use of a task so far, measured on its painted stack
+ * @note x86-64 code and glibc take more stack than the same code on the esp32
+ * @param stack_depth Set to the stack size the firmware asked for, may be NULL
+ */
+size_t host_task_stack_used(TaskHandle_t task, uint32_t* stack_depth);
+
+//ESP_LOGx below this level are dropped, the deferred logger prints on its own
+extern esp_log_level_t host_log_level;
+
+//File behind the emulated samples partition, NULL keeps it in memory only
+extern const char* host_flash_path;
+//Writes and erases the flash still takes before the power is cut, the ones after fail; negative never cuts
+extern int host_flash_writes_left;
+
+#define HOST_HTTP_BODY_SIZE (16 * 1024)
+
+typedef struct
+{
+    int status;
+    char type[32];
+    //Set with httpd_resp_set_hdr, a "Name: value\n" line each
+    char headers[256];
+    char body[HOST_HTTP_BODY_SIZE + 1];
+    size_t length;
+    bool truncated;
+} host_http_response_t;
+
+/**
+ * @brief One request to the emulated http server, handled on its task; the query string goes in uri
+ * @param body NULL for none
+ * @return ESP_OK once there is a response, ESP_FAIL when the handler failed without sending one
+ */
+esp_err_t host_http_request(httpd_method_t method, const char* uri, const char* body, host_http_response_t* response);
+
+/**
+ * @brief A frame for a websocket client, called on the httpd task; blocking here blocks the send, like a full socket
+ * @return false to fail the send, like a connection that was reset or timed out
+ */
+typedef bool (*host_ws_receive_cb_t)(int fd, const uint8_t* payload, size_t len, void* context);
+
+/**
+ * @brief Open a websocket client and do the handshake
+ * @return The socket, -1 when there is no websocket handler for uri or no free session
+ */
+int host_ws_connect(const char* uri, host_ws_receive_cb_t receive, void* context);
+//The client goes away, the server's close_fn runs on the httpd task
+void host_ws_close(int fd);
+
+/**
+ * @brief Press or release the reset button, pulled up so pressed reads low
+ * @note Every change is an edge and runs the isr the firmware set on the calling thread, like an interrupt would
+ */
+void host_button_set(bool pressed);
+
+//Same sequence for the same seed, every caller takes its own state
+uint32_t host_random(uint32_t* state);
+
+#endif //HOST_H
@@ -0,0 +1,479 @@
+//
+// Created by derk on 19-10-26.
+//
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <esp_http_server.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+#include "host.h"
+
+/*
+ * Stands in for the esp-idf http server, see esp_http_server.h. One server at
+ * a time. Requests, handshakes, closes and httpd_queue_work items all go
+ * through one work queue that the httpd task drains in order, so handlers and
+ * ws.c's flush never run concurrently, like on the device.
+ */
+
+#define MAX_URI_HANDLERS 16
+#define MAX_SESSIONS 16
+#define WORK_QUEUE_LENGTH 32
+//Far above what the process has open, http.c's close() on it only fails
+#define FIRST_SOCKET 1000
+
+typedef struct
+{
+    httpd_work_fn_t fn;
+    void* arg;
+} work_t;
+
+typedef struct
+{
+    bool open;
+    host_ws_receive_cb_t receive;
+    void* context;
+} session_t;
+
+//The aux of a request
+typedef struct
+{
+    const char* body;
+    size_t body_length;
+    size_t body_read;
+    int sockfd;
+    const httpd_uri_t* handler;
+    host_http_response_t* response;
+    bool sent;
+    bool complete;
+    esp_err_t result;
+    SemaphoreHandle_t done;
+} request_t;
+
+typedef struct
+{
+    httpd_config_t config;
+    httpd_uri_t handlers[MAX_URI_HANDLERS];
+    size_t handler_count;
+    session_t sessions[MAX_SESSIONS];
+
+    pthread_mutex_t lock;
+    pthread_cond_t changed;
+    work_t work[WORK_QUEUE_LENGTH];
+    size_t work_head;
+    size_t work_count;
+    bool running;
+} server_t;
+
+static const char* TAG = "httpd";
+
+static server_t server = {
+    .lock = PTHREAD_MUTEX_INITIALIZER
+};
+static bool started = false;
+static bool task_created = false;
+
+static void run_httpd(void* param)
+{
+    for(;;)
+    {
+        pthread_mutex_lock(&server.lock);
+        while(!server.work_count)
+            pthread_cond_wait(&server.changed, &server.lock);
+        work_t work = server.work[server.work_head];
+        server.work_head = (server.work_head + 1) % WORK_QUEUE_LENGTH;
+        --server.work_count;
+        pthread_cond_broadcast(&server.changed);
+        pthread_mutex_unlock(&server.lock);
+
+        work.fn(work.arg);
+    }
+}
+
+esp_err_t httpd_start(httpd_handle_t* handle, const httpd_config_t* config)
+{
+    assert(handle && config);
+    if(started) return ESP_ERR_INVALID_STATE;
+
+    pthread_mutex_lock(&server.lock);
+    server.config = *config;
+    server.handler_count = 0;
+    memset(server.sessions, 0, sizeof(server.sessions));
+    server.running = true;
+    pthread_mutex_unlock(&server.lock);
+
+    //The task outlives a stop, host tasks can not be deleted
+    if(!task_created)
+    {
+        host_cond_init(&server.changed);
+        xTaskCreate(run_httpd, "httpd", 4096, NULL, 5, NULL);
+        task_created = true;
+    }
+    started = true;
+    *handle = &server;
+    return ESP_OK;
+}
+
+static esp_err_t queue_work(httpd_work_fn_t fn, void* arg);
+
+//One per calling thread and never deleted, the httpd task may still be in xSemaphoreGive when the caller wakes
+static SemaphoreHandle_t done_semaphore(void)
+{
+    static __thread SemaphoreHandle_t done = NULL;
+    if(!done)
+        done = xSemaphoreCreateBinary();
+    return done;
+}
+
+static void give(void* arg)
+{
+    xSemaphoreGive((SemaphoreHandle_t) arg);
+}
+
+//Waits until the work that is queued now has run, the queue is in order and has one task
+static void drain(void)
+{
+    SemaphoreHandle_t done = done_semaphore();
+    if(queue_work(give, done) == ESP_OK)
+        xSemaphoreTake(done, portMAX_DELAY);
+}
+
+esp_err_t httpd_stop(httpd_handle_t handle)
+{
+    if(!started || handle != &server) return ESP_ERR_INVALID_ARG;
+    drain();
+    pthread_mutex_lock(&server.lock);
+    server.running = false;
+    pthread_mutex_unlock(&server.lock);
+    started = false;
+    return ESP_OK;
+}
+
+esp_err_t httpd_register_uri_handler(httpd_handle_t handle, const httpd_uri_t* uri_handler)
+{
+    assert(uri_handler);
+    if(handle != &server) return ESP_ERR_INVALID_ARG;
+    if(server.handler_count >= server.config.max_uri_handlers || server.handler_count >= MAX_URI_HANDLERS)
+    {
+        ESP_LOGW(TAG, "No slot for %s", uri_handler->uri);
+        return ESP_ERR_NO_MEM;
+    }
+    server.handlers[server.handler_count++] = *uri_handler;
+    return ESP_OK;
+}
+
+//A trailing * matches anything, a ? before it makes the character in front optional
+bool httpd_uri_match_wildcard(const char* uri_template, const char* uri_to_match, size_t match_upto)
+{
+    size_t length = strlen(uri_template);
+    bool wildcard = length && uri_template[length - 1] == '*';
+    if(wildcard) --length;
+    bool optional = wildcard && length && uri_template[length - 1] == '?';
+    if(optional) --length;
+
+    if(!wildcard)
+        return length == match_upto && strncmp(uri_template, uri_to_match, match_upto) == 0;
+    if(match_upto >= length && strncmp(uri_template, uri_to_match, length) == 0)
+        return true;
+    //"/api/?*" also matches "/api"
+    return optional && match_upto == length - 1 && strncmp(uri_template, uri_to_match, match_upto) == 0;
+}
+
+static esp_err_t queue_work(httpd_work_fn_t fn, void* arg)
+{
+    pthread_mutex_lock(&server.lock);
+    if(!server.running || server.work_count == WORK_QUEUE_LENGTH)
+    {
+        pthread_mutex_unlock(&server.lock);
+        return ESP_FAIL;
+    }
+    server.work[(server.work_head + server.work_count) % WORK_QUEUE_LENGTH] = (work_t) { .fn = fn, .arg = arg };
+    ++server.work_count;
+    pthread_cond_broadcast(&server.changed);
+    pthread_mutex_unlock(&server.lock);
+    return ESP_OK;
+}
+
+esp_err_t httpd_queue_work(httpd_handle_t handle, httpd_work_fn_t work, void* arg)
+{
+    if(handle != &server || !work) return ESP_ERR_INVALID_ARG;
+    return queue_work(work, arg);
+}
+
+//A copy, the receive callback runs without the lock
+static bool find_session(int sockfd, session_t* session)
+{
+    int index = sockfd - FIRST_SOCKET;
+    if(index < 0 || index >= MAX_SESSIONS) return false;
+    pthread_mutex_lock(&server.lock);
+    *session = server.sessions[index];
+    pthread_mutex_unlock(&server.lock);
+    return session->open;
+}
+
+static void set_session_closed(int sockfd)
+{
+    pthread_mutex_lock(&server.lock);
+    server.sessions[sockfd - FIRST_SOCKET].open = false;
+    pthread_mutex_unlock(&server.lock);
+}
+
+//On the httpd task
+static void close_session(void* arg)
+{
+    int sockfd = (int)(intptr_t) arg;
+    session_t session;
+    if(!find_session(sockfd, &session)) return;
+    set_session_closed(sockfd);
+    if(server.config.close_fn)
+        server.config.close_fn(&server, sockfd);
+}
+
+esp_err_t httpd_sess_trigger_close(httpd_handle_t handle, int sockfd)
+{
+    if(handle != &server) return ESP_ERR_INVALID_ARG;
+    return queue_work(close_session, (void*)(intptr_t) sockfd);
+}
+
+int httpd_req_recv(httpd_req_t* req, char* buf, size_t buf_len)
+{
+    request_t* request = req->aux;
+    size_t length = request->body_length - request->body_read;
+    if(length > buf_len) length = buf_len;
+    memcpy(buf, request->body + request->body_read, length);
+    request->body_read += length;
+    return (int) length;
+}
+
+int httpd_req_to_sockfd(httpd_req_t* req)
+{
+    return ((request_t*) req->aux)->sockfd;
+}
+
+esp_err_t httpd_req_get_url_query_str(httpd_req_t* req, char* buf, size_t buf_len)
+{
+    const char* query = strchr(req->uri, '?');
+    if(!query) return ESP_ERR_NOT_FOUND;
+    if(strlen(query + 1) >= buf_len) return ESP_ERR_INVALID_SIZE;
+    strcpy(buf, query + 1);
+    return ESP_OK;
+}
+
+esp_err_t httpd_query_key_value(const char* qry, const char* key, char* val, size_t val_size)
+{
+    size_t key_length = strlen(key);
+    for(const char* pair = qry; pair && *pair; pair = strchr(pair, '&') ? strchr(pair, '&') + 1 : NULL)
+    {
+        if(strncmp(pair, key, key_length) != 0 || pair[key_length] != '=') continue;
+        const char* value = pair + key_length + 1;
+        size_t length = strcspn(value, "&");
+        if(length >= val_size) return ESP_ERR_INVALID_SIZE;
+        memcpy(val, value, length);
+        val[length] = '\0';
+        return ESP_OK;
+    }
+    return ESP_ERR_NOT_FOUND;
+}
+
+esp_err_t httpd_req_get_hdr_value_str(httpd_req_t* req, const char* field, char* val, size_t val_size)
+{
+    //Requests from the tests carry no headers
+    return ESP_ERR_NOT_FOUND;
+}
+
+esp_err_t httpd_resp_set_status(httpd_req_t* req, const char* status)
+{
+    ((request_t*) req->aux)->response->status = atoi(status);
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_set_type(httpd_req_t* req, const char* type)
+{
+    host_http_response_t* response = ((request_t*) req->aux)->response;
+    snprintf(response->type, sizeof(response->type), "%s", type);
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_set_hdr(httpd_req_t* req, const char* field, const char* value)
+{
+    host_http_response_t* response = ((request_t*) req->aux)->response;
+    size_t used = strlen(response->headers);
+    snprintf(response->headers + used, sizeof(response->headers) - used, "%s: %s\n", field, value);
+    return ESP_OK;
+}
+
+static void append(host_http_response_t* response, const char* buf, size_t length)
+{
+    if(length > HOST_HTTP_BODY_SIZE - response->length)
+    {
+        length = HOST_HTTP_BODY_SIZE - response->length;
+        response->truncated = true;
+    }
+    memcpy(response->body + response->length, buf, length);
+    response->length += length;
+    response->body[response->length] = '\0';
+}
+
+esp_err_t httpd_resp_send_chunk(httpd_req_t* req, const char* buf, ssize_t buf_len)
+{
+    request_t* request = req->aux;
+    if(request->complete) return ESP_ERR_INVALID_STATE;
+    if(buf_len == HTTPD_RESP_USE_STRLEN)
+        buf_len = buf ? strlen(buf) : 0;
+    request->sent = true;
+    if(!buf || buf_len == 0)
+        request->complete = true;
+    else
+        append(request->response, buf, buf_len);
+    return ESP_OK;
+}
+
+esp_err_t httpd_resp_send(httpd_req_t* req, const char* buf, ssize_t buf_len)
+{
+    request_t* request = req->aux;
+    if(request->sent) return ESP_ERR_INVALID_STATE;
+    if(buf && buf_len)
+        httpd_resp_send_chunk(req, buf, buf_len);
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+esp_err_t httpd_resp_sendstr(httpd_req_t* req, const char* str)
+{
+    return httpd_resp_send(req, str, str ? HTTPD_RESP_USE_STRLEN : 0);
+}
+
+esp_err_t httpd_resp_send_err(httpd_req_t* req, httpd_err_code_t error, const char* message)
+{
+    static const int codes[] = {
+        [HTTPD_400_BAD_REQUEST] = 400,
+        [HTTPD_404_NOT_FOUND] = 404,
+        [HTTPD_405_METHOD_NOT_ALLOWED] = 405,
+        [HTTPD_500_INTERNAL_SERVER_ERROR] = 500
+    };
+    host_http_response_t* response = ((request_t*) req->aux)->response;
+    response->status = codes[error];
+    httpd_resp_set_type(req, HTTPD_TYPE_TEXT);
+    return httpd_resp_sendstr(req, message);
+}
+
+esp_err_t httpd_ws_send_frame_async(httpd_handle_t handle, int fd, httpd_ws_frame_t* frame)
+{
+    assert(frame);
+    session_t session;
+    if(handle != &server || !find_session(fd, &session) || !session.receive) return ESP_FAIL;
+    return session.receive(fd, frame->payload, frame->len, session.context) ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t httpd_ws_recv_frame(httpd_req_t* req, httpd_ws_frame_t* frame, size_t max_len)
+{
+    //The emulated clients never send a frame
+    return ESP_FAIL;
+}
+
+static const httpd_uri_t* find_handler(httpd_method_t method, const char* uri, bool websocket)
+{
+    size_t length = strcspn(uri, "?");
+    for(size_t i = 0; i < server.handler_count; ++i)
+    {
+        const httpd_uri_t* handler = &server.handlers[i];
+        if(handler->method != method || handler->is_websocket != websocket) continue;
+        if(server.config.uri_match_fn ? server.config.uri_match_fn(handler->uri, uri, length)
+                                      : strlen(handler->uri) == length && strncmp(handler->uri, uri, length) == 0)
+            return handler;
+    }
+    return NULL;
+}
+
+//On the httpd task
+static void handle_request(void* arg)
+{
+    httpd_req_t* req = arg;
+    request_t* request = req->aux;
+
+    req->user_ctx = request->handler->user_ctx;
+    request->result = request->handler->handler(req);
+    xSemaphoreGive(request->done);
+}
+
+static esp_err_t run_request(httpd_req_t* req)
+{
+    request_t* request = req->aux;
+    request->done = done_semaphore();
+    esp_err_t err = queue_work(handle_request, req);
+    if(err == ESP_OK)
+        xSemaphoreTake(request->done, portMAX_DELAY);
+    return err == ESP_OK ? request->result : err;
+}
+
+esp_err_t host_http_request(httpd_method_t method, const char* uri, const char* body, host_http_response_t* response)
+{
+    assert(uri && response);
+    httpd_req_t req = { .handle = &server, .method = method };
+    request_t request = {
+        .body = body ? body : "",
+        .body_length = body ? strlen(body) : 0,
+        .sockfd = -1,
+        .response = response
+    };
+
+    memset(response, 0, sizeof(*response));
+    response->status = 200;
+    if(!started || strlen(uri) > HTTPD_MAX_URI_LEN) return ESP_FAIL;
+    strcpy((char*) req.uri, uri);
+    req.content_len = request.body_length;
+    req.aux = &request;
+
+    request.handler = find_handler(method, uri, false);
+    if(!request.handler)
+    {
+        response->status = 404;
+        return ESP_OK;
+    }
+    esp_err_t err = run_request(&req);
+    //The esp-idf server closes the connection when the handler failed, whatever it sent stays sent
+    return request.sent ? ESP_OK : err == ESP_OK ? ESP_FAIL : err;
+}
+
+int host_ws_connect(const char* uri, host_ws_receive_cb_t receive, void* context)
+{
+    assert(uri);
+    httpd_req_t req = { .handle = &server, .method = HTTP_GET };
+    host_http_response_t response;
+    request_t request = { .body = "", .response = &response };
+
+    if(!started || strlen(uri) > HTTPD_MAX_URI_LEN) return -1;
+    request.handler = find_handler(HTTP_GET, uri, true);
+    if(!request.handler) return -1;
+
+    pthread_mutex_lock(&server.lock);
+    int index = 0;
+    while(index < MAX_SESSIONS && server.sessions[index].open)
+        ++index;
+    if(index == MAX_SESSIONS)
+    {
+        pthread_mutex_unlock(&server.lock);
+        return -1;
+    }
+    server.sessions[index] = (session_t) { .open = true, .receive = receive, .context = context };
+    pthread_mutex_unlock(&server.lock);
+
+    strcpy((char*) req.uri, uri);
+    request.sockfd = FIRST_SOCKET + index;
+    req.aux = &request;
+    if(run_request(&req) != ESP_OK)
+    {
+        set_session_closed(request.sockfd);
+        return -1;
+    }
+    return request.sockfd;
+}
+
+void host_ws_close(int fd)
+{
+    if(httpd_sess_trigger_close(&server, fd) == ESP_OK)
+        drain();
+}
@@ -0,0 +1,163 @@
+//
+// Created by derk on 19-10-26.
+//
+
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include "metrics.h"
+#include "trace.h"
+#include "sample_log.h"
+#include "broker.h"
+#include "plant.h"
+#include "host.h"
+
+#define DEFAULT_DURATION_S 60
+#define DEFAULT_SPEED 360.0
+#define DEFAULT_SEED 1
+#define DEFAULT_RTT_MS 20
+//Thresholds are zero until someone sends them, these make the plant do something
+#define DEFAULT_LIGHT_THRESHOLD "1000"
+#define DEFAULT_MOISTURE_THRESHOLD "1500"
+
+void app_main(void);
+
+static void usage(const char* name)
+{
+    fprintf(stderr,
+            "usage: %s [options]\n"
+            "  -d, --duration SECONDS   wall clock time to run, default %d\n"
+            "  -s, --speed FACTOR       plant time per wall clock second, default %.0f\n"
+            "  -r, --seed N             seed for the plant and the broker, default %d\n"
+            "  -t, --rtt-ms MS          average PUBACK round trip, default %d\n"
+            "  -l, --light VALUE        light threshold sent over mqtt, default " DEFAULT_LIGHT_THRESHOLD "\n"
+            "  -m, --moisture VALUE     moisture threshold sent over mqtt, default " DEFAULT_MOISTURE_THRESHOLD "\n"
+            "  -f, --flash FILE         keep the samples partition in FILE, the log carries over to the next run\n"
+            "  -p, --metrics            print the /metrics page at the end\n"
+            "  -q, --quiet              only warnings and errors from ESP_LOGx\n",
+            name, DEFAULT_DURATION_S, DEFAULT_SPEED, DEFAULT_SEED, DEFAULT_RTT_MS);
+}
+
+static bool print_line(const char* line, size_t len, void* context)
+{
+    fwrite(line, 1, len, stdout);
+    return true;
+}
+
+static void print_lane(const char* name, const trace_span_stats_t* span)
+{
+    printf("%s: %u waits, avg %u us, max %u us\n", name, span->count,
+           span->count ? (uint32_t)(span->total_us / span->count) : 0, span->max_us);
+}
+
+static void print_stacks(void)
+{
+    TaskStatus_t tasks[16];
+    UBaseType_t count = uxTaskGetSystemState(tasks, sizeof(tasks) / sizeof(tasks[0]), NULL);
+
+    printf("stack used of asked, on x86-64:");
+    for(UBaseType_t i = 0; i < count; ++i)
+    {
+        uint32_t stack_depth;
+        size_t used = host_task_stack_used(tasks[i].xHandle, &stack_depth);
+        //The adopted main thread has no stack of its own
+        if(stack_depth)
+            printf(" %s %zu/%u", tasks[i].pcTaskName, used, stack_depth);
+    }
+    printf("\n");
+}
+
+static void print_summary(void)
+{
+    plant_stats_t plant;
+    broker_stats_t broker;
+    trace_stats_t trace;
+    sample_log_stats_t log;
+    double hours = plant_time() / 3600.0;
+
+    plant_get_stats(&plant);
+    broker_get_stats(&broker);
+    trace_get_stats(&trace);
+    sample_log_get_stats(&log);
+
+    printf("\n--- %.1f s wall clock, plant clock at day %d %02d:%02d ---\n", esp_timer_get_time() / 1e6,
+           (int)(hours / 24) + 1, (int)hours % 24, (int)(hours * 60) % 60);
+    printf("plant: moisture %d, light %d, lamp %s (%u switches, %u kaku frames), %u waterings for %u ms, "
+           "%u dht11 frames\n", plant.moisture, plant.light, plant.lamp ? "on" : "off", plant.lamp_switches,
+           plant.kaku_frames, plant.waterings, plant.watering_ms, plant.dht11_frames);
+    printf("broker: %u connects, %u publishes, %u pubacks, %u refused\n", broker.connects, broker.publishes,
+           broker.pubacks, broker.refused);
+    for(uint32_t i = 0; i < broker.topic_count; ++i)
+        printf("  %-32s %6u  %s\n", broker.topics[i].topic, broker.topics[i].count, broker.topics[i].last);
+    printf("sample to puback: %u samples, avg %u us, max %u us\n", trace.samples,
+           trace.samples ? (uint32_t)(trace.total_latency_us / trace.samples) : 0, trace.max_latency_us);
+    print_lane("light lane", &trace.spans[TRACE_SPAN_ACTUATION]);
+    print_lane("telemetry lane", &trace.spans[TRACE_SPAN_TELEMETRY_QUEUE]);
+    printf("sample log: %u blocks on %u sectors, %u erases, log clock %u to %u s\n", log.blocks, log.sectors,
+           log.erases, log.oldest, log.newest);
+    print_stacks();
+}
+
+int main(int argc, char** argv)
+{
+    static const struct option options[] = {
+        { "duration", required_argument, NULL, 'd' },
+        { "speed", required_argument, NULL, 's' },
+        { "seed", required_argument, NULL, 'r' },
+        { "rtt-ms", required_argument, NULL, 't' },
+        { "light", required_argument, NULL, 'l' },
+        { "moisture", required_argument, NULL, 'm' },
+        { "flash", required_argument, NULL, 'f' },
+        { "metrics", no_argument, NULL, 'p' },
+        { "quiet", no_argument, NULL, 'q' },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+    double duration = DEFAULT_DURATION_S;
+    double speed = DEFAULT_SPEED;
+    uint32_t seed = DEFAULT_SEED;
+    uint32_t rtt_ms = DEFAULT_RTT_MS;
+    const char* light_threshold = DEFAULT_LIGHT_THRESHOLD;
+    const char* moisture_threshold = DEFAULT_MOISTURE_THRESHOLD;
+    bool metrics = false;
+    int option;
+
+    while((option = getopt_long(argc, argv, "d:s:r:t:l:m:f:pqh", options, NULL)) != -1)
+    {
+        switch(option)
+        {
+        case 'd': duration = atof(optarg); break;
+        case 's': speed = atof(optarg); break;
+        case 'r': seed = (uint32_t)strtoul(optarg, NULL, 0); break;
+        case 't': rtt_ms = (uint32_t)strtoul(optarg, NULL, 0); break;
+        case 'l': light_threshold = optarg; break;
+        case 'm': moisture_threshold = optarg; break;
+        case 'f': host_flash_path = optarg; break;
+        case 'p': metrics = true; break;
+        case 'q': host_log_level = ESP_LOG_WARN; break;
+        case 'h': usage(argv[0]); return EXIT_SUCCESS;
+        default: usage(argv[0]); return EXIT_FAILURE;
+        }
+    }
+
+    plant_initialize(seed, speed);
+    broker_initialize(seed, rtt_ms);
+    broker_inject("plant/1/threshold/light", light_threshold);
+    broker_inject("plant/1/threshold/moisture", moisture_threshold);
+
+    //app_main returns once everything is started, like on the device
+    host_task_adopt("main");
+    app_main();
+    host_sleep_us((int64_t)(duration * 1e6));
+
+    print_summary();
+    if(metrics)
+        metrics_render(print_line, NULL);
+    fflush(stdout);
+    //The firmware tasks never end, leave them running into exit
+    exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,375 @@
+//
+// Created by derk on 19-10-26.
+//
+
+#include <mqtt_client.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <esp_timer.h>
+#include "broker.h"
+#include "plant.h"
+#include "host.h"
+
+#define MQTT_TASK_STACK_SIZE 6144
+#define MQTT_TASK_PRIORITY 5
+//Messages waiting for their PUBACK, the real outbox grows until the heap runs out
+#define MQTT_MAX_INFLIGHT 64
+#define MQTT_MAX_SUBSCRIPTIONS 8
+#define MQTT_MAX_INJECTED 8
+#define MQTT_IDLE_WAIT_US 1000000
+
+typedef struct
+{
+    int msg_id;
+    esp_mqtt_event_id_t event;
+    int64_t due;
+} pending_t;
+
+typedef struct
+{
+    char topic[BROKER_TOPIC_SIZE];
+    char payload[BROKER_PAYLOAD_SIZE];
+    bool delivered;
+} injected_t;
+
+struct esp_mqtt_client
+{
+    esp_event_handler_t handler;
+    void* handler_args;
+    TaskHandle_t task;
+    bool started;
+    bool connected;
+    bool disconnect_requested;
+    int next_msg_id;
+    pending_t pending[MQTT_MAX_INFLIGHT];
+    char subscriptions[MQTT_MAX_SUBSCRIPTIONS][BROKER_TOPIC_SIZE];
+    uint32_t subscription_count;
+};
+
+//One client, one broker; the lock covers both
+static pthread_mutex_t broker_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t broker_wake;
+static uint32_t random_state;
+static uint32_t rtt_us = 20000;
+static injected_t injected[MQTT_MAX_INJECTED];
+static uint32_t injected_count = 0;
+static broker_stats_t stats;
+
+void broker_initialize(uint32_t seed, uint32_t rtt_ms)
+{
+    host_cond_init(&broker_wake);
+    random_state = seed;
+    rtt_us = rtt_ms * 1000;
+}
+
+static uint32_t round_trip(void)
+{
+    uint32_t rtt = rtt_us / 2 + host_random(&random_state) % (rtt_us + 1);
+    if(host_random(&random_state) % 50 == 0)
+        rtt *= 5;
+    return rtt;
+}
+
+static void record_topic(const char* topic, const char* data, int len)
+{
+    broker_topic_t* entry = NULL;
+    for(uint32_t i = 0; i < stats.topic_count; ++i)
+    {
+        if(strcmp(stats.topics[i].topic, topic) == 0)
+            entry = &stats.topics[i];
+    }
+    if(!entry)
+    {
+        if(stats.topic_count == BROKER_MAX_TOPICS) return;
+        entry = &stats.topics[stats.topic_count++];
+        snprintf(entry->topic, sizeof(entry->topic), "%s", topic);
+    }
+    snprintf(entry->last, sizeof(entry->last), "%.*s", len, data);
+    ++entry->count;
+}
+
+//'+' matches one level, that is all the firmware subscribes with
+static bool topic_matches(const char* filter, const char* topic)
+{
+    while(*filter && *topic)
+    {
+        if(*filter == '+')
+        {
+            while(*topic && *topic != '/')
+                ++topic;
+            ++filter;
+            continue;
+        }
+        if(*filter++ != *topic++) return false;
+    }
+    return *filter == *topic;
+}
+
+//Call with broker_lock held
+static bool add_pending(esp_mqtt_client_handle_t client, int msg_id, esp_mqtt_event_id_t event, uint32_t delay_us)
+{
+    for(int i = 0; i < MQTT_MAX_INFLIGHT; ++i)
+    {
+        pending_t* slot = &client->pending[i];
+        if(slot->msg_id) continue;
+        slot->msg_id = msg_id;
+        slot->event = event;
+        slot->due = esp_timer_get_time() + delay_us;
+        pthread_cond_signal(&broker_wake);
+        return true;
+    }
+    return false;
+}
+
+//Call with broker_lock held
+static int next_msg_id(esp_mqtt_client_handle_t client)
+{
+    client->next_msg_id = client->next_msg_id % 65535 + 1;
+    return client->next_msg_id;
+}
+
+//Called without the lock, handlers publish and subscribe themselves
+static void dispatch(esp_mqtt_client_handle_t client, esp_mqtt_event_t* event)
+{
+    event->client = client;
+    event->user_context = client->handler_args;
+    client->handler(client->handler_args, "MQTT_EVENTS", event->event_id, event);
+}
+
+static void dispatch_id(esp_mqtt_client_handle_t client, esp_mqtt_event_id_t id, int msg_id)
+{
+    esp_mqtt_event_t event = {
+        .event_id = id,
+        .msg_id = msg_id
+    };
+    dispatch(client, &event);
+}
+
+//Call with broker_lock held, returns with it held
+static bool deliver_injected(esp_mqtt_client_handle_t client)
+{
+    for(uint32_t i = 0; i < injected_count; ++i)
+    {
+        injected_t* message = &injected[i];
+        if(message->delivered) continue;
+        for(uint32_t j = 0; j < client->subscription_count; ++j)
+        {
+            if(!topic_matches(client->subscriptions[j], message->topic)) continue;
+
+            esp_mqtt_event_t event = {
+                .event_id = MQTT_EVENT_DATA,
+                .topic = message->topic,
+                .topic_len = (int)strlen(message->topic),
+                .data = message->payload,
+                .data_len = (int)strlen(message->payload),
+                .total_data_len = (int)strlen(message->payload),
+                .qos = 1
+            };
+            message->delivered = true;
+            pthread_mutex_unlock(&broker_lock);
+            dispatch(client, &event);
+            pthread_mutex_lock(&broker_lock);
+            return true;
+        }
+    }
+    return false;
+}
+
+static void mqtt_task(void* param)
+{
+    esp_mqtt_client_handle_t client = param;
+    struct timespec deadline;
+
+    pthread_mutex_lock(&broker_lock);
+    for(;;)
+    {
+        if(client->connected && (client->disconnect_requested || !client->started))
+        {
+            client->connected = false;
+            client->disconnect_requested = false;
+            memset(client->pending, 0, sizeof(client->pending));
+            pthread_mutex_unlock(&broker_lock);
+            dispatch_id(client, MQTT_EVENT_DISCONNECTED, 0);
+            pthread_mutex_lock(&broker_lock);
+            continue;
+        }
+
+        if(client->started && !client->connected)
+        {
+            //One round trip for CONNECT/CONNACK, there is no TLS to simulate
+            uint32_t delay = round_trip();
+            pthread_mutex_unlock(&broker_lock);
+            dispatch_id(client, MQTT_EVENT_BEFORE_CONNECT, 0);
+            host_sleep_us(delay);
+            pthread_mutex_lock(&broker_lock);
+            if(!client->started) continue;
+            client->connected = true;
+            client->subscription_count = 0;
+            ++stats.connects;
+            pthread_mutex_unlock(&broker_lock);
+            dispatch_id(client, MQTT_EVENT_CONNECTED, 0);
+            pthread_mutex_lock(&broker_lock);
+            continue;
+        }
+
+        if(client->connected && deliver_injected(client)) continue;
+
+        pending_t* next = NULL;
+        for(int i = 0; i < MQTT_MAX_INFLIGHT; ++i)
+        {
+            pending_t* slot = &client->pending[i];
+            if(slot->msg_id && (!next || slot->due < next->due))
+                next = slot;
+        }
+
+        int64_t now = esp_timer_get_time();
+        if(next && next->due <= now)
+        {
+            pending_t done = *next;
+            next->msg_id = 0;
+            if(done.event == MQTT_EVENT_PUBLISHED)
+                ++stats.pubacks;
+            pthread_mutex_unlock(&broker_lock);
+            dispatch_id(client, done.event, done.msg_id);
+            pthread_mutex_lock(&broker_lock);
+            continue;
+        }
+        host_wait(&broker_wake, &broker_lock, host_deadline_us(next ? next->due - now : MQTT_IDLE_WAIT_US, &deadline));
+    }
+}
+
+esp_mqtt_client_handle_t esp_mqtt_client_init(const esp_mqtt_client_config_t* config)
+{
+    esp_mqtt_client_handle_t client = calloc(1, sizeof(*client));
+    if(!client) return NULL;
+
+    //The lwt is never sent, the simulated connection does not drop
+    if(xTaskCreatePinnedToCore(mqtt_task, "mqtt_task", MQTT_TASK_STACK_SIZE, client, MQTT_TASK_PRIORITY,
+                               &client->task, tskNO_AFFINITY) != pdPASS)
+    {
+        free(client);
+        return NULL;
+    }
+    return client;
+}
+
+esp_err_t esp_mqtt_client_register_event(esp_mqtt_client_handle_t client, esp_mqtt_event_id_t event,
+                                         esp_event_handler_t handler, void* handler_args)
+{
+    if(!client) return ESP_ERR_INVALID_ARG;
+    pthread_mutex_lock(&broker_lock);
+    client->handler = handler;
+    client->handler_args = handler_args;
+    pthread_mutex_unlock(&broker_lock);
+    return ESP_OK;
+}
+
+esp_err_t esp_mqtt_client_start(esp_mqtt_client_handle_t client)
+{
+    if(!client) return ESP_ERR_INVALID_ARG;
+    esp_err_t err = ESP_OK;
+
+    pthread_mutex_lock(&broker_lock);
+    if(client->started)
+        err = ESP_FAIL;
+    client->started = true;
+    pthread_cond_signal(&broker_wake);
+    pthread_mutex_unlock(&broker_lock);
+    return err;
+}
+
+esp_err_t esp_mqtt_client_stop(esp_mqtt_client_handle_t client)
+{
+    if(!client) return ESP_ERR_INVALID_ARG;
+    pthread_mutex_lock(&broker_lock);
+    client->started = false;
+    pthread_cond_signal(&broker_wake);
+    pthread_mutex_unlock(&broker_lock);
+    return ESP_OK;
+}
+
+esp_err_t esp_mqtt_client_disconnect(esp_mqtt_client_handle_t client)
+{
+    if(!client) return ESP_ERR_INVALID_ARG;
+    pthread_mutex_lock(&broker_lock);
+    client->disconnect_requested = true;
+    pthread_cond_signal(&broker_wake);
+    pthread_mutex_unlock(&broker_lock);
+    return ESP_OK;
+}
+
+int esp_mqtt_client_publish(esp_mqtt_client_handle_t client, const char* topic, const char* data, int len, int qos,
+                            int retain)
+{
+    if(!client || !topic) return -1;
+    if(len <= 0)
+        len = data ? (int)strlen(data) : 0;
+    int msg_id = 0;
+
+    pthread_mutex_lock(&broker_lock);
+    if(!client->connected)
+    {
+        pthread_mutex_unlock(&broker_lock);
+        return -1;
+    }
+    if(qos > 0)
+    {
+        msg_id = next_msg_id(client);
+        if(!add_pending(client, msg_id, MQTT_EVENT_PUBLISHED, round_trip()))
+        {
+            ++stats.refused;
+            pthread_mutex_unlock(&broker_lock);
+            return -1;
+        }
+    }
+    ++stats.publishes;
+    record_topic(topic, data, len);
+    pthread_mutex_unlock(&broker_lock);
+
+    //The smart socket for the lamp listens on the broker
+    if(strcmp(topic, "socket/1/state") == 0)
+        plant_set_lamp(len >= 4 && strncmp(data, "\"on\"", 4) == 0);
+    return msg_id;
+}
+
+int esp_mqtt_client_subscribe(esp_mqtt_client_handle_t client, const char* topic, int qos)
+{
+    if(!client || !topic) return -1;
+
+    pthread_mutex_lock(&broker_lock);
+    if(!client->connected || client->subscription_count == MQTT_MAX_SUBSCRIPTIONS)
+    {
+        pthread_mutex_unlock(&broker_lock);
+        return -1;
+    }
+    snprintf(client->subscriptions[client->subscription_count++], BROKER_TOPIC_SIZE, "%s", topic);
+    int msg_id = next_msg_id(client);
+    add_pending(client, msg_id, MQTT_EVENT_SUBSCRIBED, round_trip());
+    pthread_mutex_unlock(&broker_lock);
+    return msg_id;
+}
+
+void broker_inject(const char* topic, const char* payload)
+{
+    pthread_mutex_lock(&broker_lock);
+    if(injected_count < MQTT_MAX_INJECTED)
+    {
+        injected_t* message = &injected[injected_count++];
+        snprintf(message->topic, sizeof(message->topic), "%s", topic);
+        snprintf(message->payload, sizeof(message->payload), "%s", payload);
+        message->delivered = false;
+    }
+    pthread_cond_signal(&broker_wake);
+    pthread_mutex_unlock(&broker_lock);
+}
+
+void broker_get_stats(broker_stats_t* out)
+{
+    pthread_mutex_lock(&broker_lock);
+    *out = stats;
+    pthread_mutex_unlock(&broker_lock);
+}
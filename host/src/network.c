@@ -0,0 +1,32 @@
+//
+// Created by derk on 19-10-26.
+//
+
+#include <stdbool.h>
+#include "wifi.h"
+#include "www.h"
+#include "button.h"
+#include "boot.h"
+#include "event_bus.h"
+
+/*
+ * Stands in for wifi.c and www.c. The host is always connected: the connect
+ * event goes out as soon as wifi is initialized and mqtt starts from there
+ * like on the device. There is no www partition, so no static pages.
+ */
+
+void initialize_wifi(void)
+{
+    setup_reset_button();
+    event_bus_post_id(EVENT_WIFI_STA_START);
+    boot_mark(BOOT_PHASE_WIFI_CONNECTED);
+    event_bus_post_id(EVENT_WIFI_CONNECTED);
+}
+
+void wifi_received_credentials(void)
+{
+}
+
+void www_register_handlers(httpd_handle_t server)
+{
+}
@@ -0,0 +1,198 @@
+//
+// Created by derk on 19-10-26.
+//
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <string.h>
+#include <nvs.h>
+#include <nvs_flash.h>
+
+#define NVS_MAX_NAMESPACES 4
+#define NVS_MAX_ENTRIES 32
+//Same limits as the real partition
+#define NVS_KEY_NAME_MAX_SIZE 16
+#define NVS_VALUE_MAX_SIZE 128
+
+typedef enum
+{
+    NVS_TYPE_U16,
+    NVS_TYPE_U32,
+    NVS_TYPE_STR,
+    NVS_TYPE_BLOB
+} nvs_type_t;
+
+typedef struct
+{
+    bool used;
+    uint8_t space;
+    nvs_type_t type;
+    char key[NVS_KEY_NAME_MAX_SIZE];
+    uint8_t value[NVS_VALUE_MAX_SIZE];
+    size_t length;
+} nvs_entry_t;
+
+//Handles are namespace index + 1, the store starts empty like an erased flash
+static char namespaces[NVS_MAX_NAMESPACES][NVS_KEY_NAME_MAX_SIZE];
+static nvs_entry_t entries[NVS_MAX_ENTRIES];
+static pthread_mutex_t nvs_lock = PTHREAD_MUTEX_INITIALIZER;
+
+esp_err_t nvs_flash_init(void)
+{
+    return ESP_OK;
+}
+
+esp_err_t nvs_flash_erase(void)
+{
+    pthread_mutex_lock(&nvs_lock);
+    memset(namespaces, 0, sizeof(namespaces));
+    memset(entries, 0, sizeof(entries));
+    pthread_mutex_unlock(&nvs_lock);
+    return ESP_OK;
+}
+
+esp_err_t nvs_open(const char* name, nvs_open_mode_t open_mode, nvs_handle_t* out_handle)
+{
+    if(!name || !out_handle || strlen(name) >= NVS_KEY_NAME_MAX_SIZE) return ESP_ERR_INVALID_ARG;
+    esp_err_t err = ESP_ERR_NVS_NOT_FOUND;
+
+    pthread_mutex_lock(&nvs_lock);
+    for(int i = 0; i < NVS_MAX_NAMESPACES; ++i)
+    {
+        if(strcmp(namespaces[i], name) == 0 ||
+           (open_mode == NVS_READWRITE && namespaces[i][0] == '\0'))
+        {
+            strcpy(namespaces[i], name);
+            *out_handle = i + 1;
+            err = ESP_OK;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&nvs_lock);
+    return err;
+}
+
+void nvs_close(nvs_handle_t handle)
+{
+}
+
+esp_err_t nvs_commit(nvs_handle_t handle)
+{
+    //Writes land in the store straight away
+    return handle >= 1 && handle <= NVS_MAX_NAMESPACES ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+static nvs_entry_t* find(nvs_handle_t handle, const char* key)
+{
+    for(int i = 0; i < NVS_MAX_ENTRIES; ++i)
+    {
+        if(entries[i].used && entries[i].space == handle && strcmp(entries[i].key, key) == 0)
+            return &entries[i];
+    }
+    return NULL;
+}
+
+static esp_err_t set(nvs_handle_t handle, const char* key, nvs_type_t type, const void* value, size_t length)
+{
+    if(handle < 1 || handle > NVS_MAX_NAMESPACES || !key) return ESP_ERR_INVALID_ARG;
+    if(strlen(key) >= NVS_KEY_NAME_MAX_SIZE || length > NVS_VALUE_MAX_SIZE) return ESP_ERR_INVALID_ARG;
+
+    pthread_mutex_lock(&nvs_lock);
+    nvs_entry_t* entry = find(handle, key);
+    for(int i = 0; !entry && i < NVS_MAX_ENTRIES; ++i)
+    {
+        if(!entries[i].used)
+            entry = &entries[i];
+    }
+    if(!entry)
+    {
+        pthread_mutex_unlock(&nvs_lock);
+        return ESP_ERR_NVS_NO_FREE_PAGES;
+    }
+    entry->used = true;
+    entry->space = handle;
+    entry->type = type;
+    strcpy(entry->key, key);
+    memcpy(entry->value, value, length);
+    entry->length = length;
+    pthread_mutex_unlock(&nvs_lock);
+    return ESP_OK;
+}
+
+static esp_err_t get(nvs_handle_t handle, const char* key, nvs_type_t type, void* value, size_t* length)
+{
+    if(handle < 1 || handle > NVS_MAX_NAMESPACES || !key || !length) return ESP_ERR_INVALID_ARG;
+    esp_err_t err = ESP_OK;
+
+    pthread_mutex_lock(&nvs_lock);
+    nvs_entry_t* entry = find(handle, key);
+    if(!entry || entry->type != type)
+        err = ESP_ERR_NVS_NOT_FOUND;
+    else if(!value)
+        *length = entry->length;
+    else if(*length < entry->length)
+        err = ESP_ERR_NVS_INVALID_LENGTH;
+    else
+    {
+        memcpy(value, entry->value, entry->length);
+        *length = entry->length;
+    }
+    pthread_mutex_unlock(&nvs_lock);
+    return err;
+}
+
+esp_err_t nvs_erase_key(nvs_handle_t handle, const char* key)
+{
+    if(!key) return ESP_ERR_INVALID_ARG;
+
+    pthread_mutex_lock(&nvs_lock);
+    nvs_entry_t* entry = find(handle, key);
+    if(entry)
+        entry->used = false;
+    pthread_mutex_unlock(&nvs_lock);
+    return entry ? ESP_OK : ESP_ERR_NVS_NOT_FOUND;
+}
+
+esp_err_t nvs_get_u16(nvs_handle_t handle, const char* key, uint16_t* out_value)
+{
+    size_t length = sizeof(*out_value);
+    return get(handle, key, NVS_TYPE_U16, out_value, &length);
+}
+
+esp_err_t nvs_set_u16(nvs_handle_t handle, const char* key, uint16_t value)
+{
+    return set(handle, key, NVS_TYPE_U16, &value, sizeof(value));
+}
+
+esp_err_t nvs_get_u32(nvs_handle_t handle, const char* key, uint32_t* out_value)
+{
+    size_t length = sizeof(*out_value);
+    return get(handle, key, NVS_TYPE_U32, out_value, &length);
+}
+
+esp_err_t nvs_set_u32(nvs_handle_t handle, const char* key, uint32_t value)
+{
+    return set(handle, key, NVS_TYPE_U32, &value, sizeof(value));
+}
+
+esp_err_t nvs_get_str(nvs_handle_t handle, const char* key, char* out_value, size_t* length)
+{
+    return get(handle, key, NVS_TYPE_STR, out_value, length);
+}
+
+esp_err_t nvs_set_str(nvs_handle_t handle, const char* key, const char* value)
+{
+    if(!value) return ESP_ERR_INVALID_ARG;
+    return set(handle, key, NVS_TYPE_STR, value, strlen(value) + 1);
+}
+
+esp_err_t nvs_get_blob(nvs_handle_t handle, const char* key, void* out_value, size_t* length)
+{
+    return get(handle, key, NVS_TYPE_BLOB, out_value, length);
+}
+
+esp_err_t nvs_set_blob(nvs_handle_t handle, const char* key, const void* value, size_t length)
+{
+    if(!value) return ESP_ERR_INVALID_ARG;
+    return set(handle, key, NVS_TYPE_BLOB, value, length);
+}
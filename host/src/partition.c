@@ -0,0 +1,133 @@
+//
+// Created by derk on 19-10-26.
+//
+
+#include <fcntl.h>
+#include <pthread.h>
+#include <string.h>
+#include <unistd.h>
+#include <esp_partition.h>
+#include <esp_log.h>
+#include "host.h"
+
+//Same place and size as in partitions.csv
+#define FLASH_SECTOR_SIZE 4096
+#define SAMPLES_PARTITION_ADDRESS 0x140000
+#define SAMPLES_PARTITION_SIZE 0xc0000
+
+static const char* TAG = "flash";
+
+const char* host_flash_path = NULL;
+int host_flash_writes_left = -1;
+
+static const esp_partition_t samples_partition = {
+    .type = ESP_PARTITION_TYPE_DATA,
+    .subtype = 0x41,
+    .address = SAMPLES_PARTITION_ADDRESS,
+    .size = SAMPLES_PARTITION_SIZE,
+    .label = "samples"
+};
+
+static uint8_t flash[SAMPLES_PARTITION_SIZE];
+static int flash_file = -1;
+static pthread_once_t flash_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t flash_lock = PTHREAD_MUTEX_INITIALIZER;
+
+//Starts erased, or with what the file holds so the log survives a restart
+static void load_flash(void)
+{
+    memset(flash, 0xff, sizeof(flash));
+    if(!host_flash_path) return;
+
+    flash_file = open(host_flash_path, O_RDWR | O_CREAT, 0644);
+    if(flash_file < 0)
+    {
+        ESP_LOGE(TAG, "Can not open %s, flash is not kept", host_flash_path);
+        return;
+    }
+    ssize_t length = pread(flash_file, flash, sizeof(flash), 0);
+    if(length < (ssize_t)sizeof(flash))
+    {
+        //New or short file, the rest is erased flash
+        memset(flash + (length > 0 ? length : 0), 0xff, sizeof(flash) - (length > 0 ? length : 0));
+        if(pwrite(flash_file, flash, sizeof(flash), 0) != sizeof(flash))
+            ESP_LOGE(TAG, "Can not write %s", host_flash_path);
+    }
+}
+
+static void store(size_t offset, size_t size)
+{
+    if(flash_file >= 0 && pwrite(flash_file, flash + offset, size, offset) != (ssize_t)size)
+        ESP_LOGE(TAG, "Can not write %s", host_flash_path);
+}
+
+//Caller holds flash_lock; false once the power is cut, nothing reaches the flash any more
+static bool powered(void)
+{
+    if(host_flash_writes_left == 0) return false;
+    if(host_flash_writes_left > 0) --host_flash_writes_left;
+    return true;
+}
+
+static bool in_range(const esp_partition_t* partition, size_t offset, size_t size)
+{
+    return partition == &samples_partition && offset <= partition->size && size <= partition->size - offset;
+}
+
+const esp_partition_t* esp_partition_find_first(esp_partition_type_t type, esp_partition_subtype_t subtype,
+                                                const char* label)
+{
+    pthread_once(&flash_once, load_flash);
+    if(type != samples_partition.type || subtype != samples_partition.subtype) return NULL;
+    if(label && strcmp(label, samples_partition.label) != 0) return NULL;
+    return &samples_partition;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t* partition, size_t src_offset, void* dst, size_t size)
+{
+    if(!dst || !in_range(partition, src_offset, size)) return ESP_ERR_INVALID_ARG;
+    pthread_mutex_lock(&flash_lock);
+    memcpy(dst, flash + src_offset, size);
+    pthread_mutex_unlock(&flash_lock);
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_write(const esp_partition_t* partition, size_t dst_offset, const void* src, size_t size)
+{
+    if(!src || !in_range(partition, dst_offset, size)) return ESP_ERR_INVALID_ARG;
+    const uint8_t* bytes = src;
+
+    pthread_mutex_lock(&flash_lock);
+    if(!powered())
+    {
+        pthread_mutex_unlock(&flash_lock);
+        return ESP_FAIL;
+    }
+    for(size_t i = 0; i < size; ++i)
+    {
+        //A bit that is already 0 stays 0, like on the chip; the firmware should never try
+        if(bytes[i] & ~flash[dst_offset + i])
+            ESP_LOGW(TAG, "Write to unerased flash at 0x%zx", dst_offset + i);
+        flash[dst_offset + i] &= bytes[i];
+    }
+    store(dst_offset, size);
+    pthread_mutex_unlock(&flash_lock);
+    return ESP_OK;
+}
+
+esp_err_t esp_partition_erase_range(const esp_partition_t* partition, size_t offset, size_t size)
+{
+    if(!in_range(partition, offset, size) || offset % FLASH_SECTOR_SIZE || size % FLASH_SECTOR_SIZE)
+        return ESP_ERR_INVALID_ARG;
+
+    pthread_mutex_lock(&flash_lock);
+    if(!powered())
+    {
+        pthread_mutex_unlock(&flash_lock);
+        return ESP_FAIL;
+    }
+    memset(flash + offset, 0xff, size);
+    store(offset, size);
+    pthread_mutex_unlock(&flash_lock);
+    return ESP_OK;
+}
@@ -0,0 +1,172 @@
+//
+// Created by derk on 19-10-26.
+//
+
+#include "plant.h"
+
+#include <math.h>
+#include <pthread.h>
+#include <esp_timer.h>
+#include <esp_log.h>
+#include "host.h"
+
+#define ADC_MAX 4095
+//Raw moisture, higher is wetter
+#define SOIL_START 2200
+#define SOIL_DRY 600
+#define SOIL_SATURATED 3200
+#define SOIL_DRYING_PER_HOUR 30.0
+#define SOIL_WATERING_PER_S 180.0
+#define DAYLIGHT_MAX 2800.0
+#define NIGHT_LIGHT 80.0
+#define LAMP_LIGHT 800.0
+#define ADC_NOISE 8
+
+static const char *TAG = "plant";
+
+static pthread_mutex_t plant_lock = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t random_state;
+static double time_scale = 1.0;
+static double soil;
+//Plant time the soil was last brought up to date
+static double soil_updated_at;
+static int64_t pump_started_at = -1;
+static bool lamp_on = false;
+static plant_stats_t stats;
+
+void plant_initialize(uint32_t seed, double speed)
+{
+    random_state = seed;
+    time_scale = speed;
+    soil = SOIL_START + (int32_t)(host_random(&random_state) % 200) - 100;
+    soil_updated_at = plant_time();
+}
+
+double plant_time(void)
+{
+    return PLANT_START_HOUR * 3600.0 + esp_timer_get_time() / 1e6 * time_scale;
+}
+
+static int32_t noise(void)
+{
+    return (int32_t)(host_random(&random_state) % (2 * ADC_NOISE + 1)) - ADC_NOISE;
+}
+
+static int32_t clamp_adc(double value)
+{
+    if(value < 0) return 0;
+    if(value > ADC_MAX) return ADC_MAX;
+    return (int32_t)value;
+}
+
+//Sun at its highest at 14:00, below the horizon from 20:00 to 08:00
+static double sunlight(double time)
+{
+    double elevation = sin(2 * M_PI * (time - 8 * 3600.0) / PLANT_DAY_S);
+    return elevation > 0 ? elevation * DAYLIGHT_MAX : 0;
+}
+
+//Call with plant_lock held
+static void update_soil(void)
+{
+    double now = plant_time();
+    soil -= (now - soil_updated_at) / 3600.0 * SOIL_DRYING_PER_HOUR;
+    if(soil < SOIL_DRY)
+        soil = SOIL_DRY;
+    soil_updated_at = now;
+}
+
+int32_t plant_soil_moisture(void)
+{
+    pthread_mutex_lock(&plant_lock);
+    update_soil();
+    int32_t value = clamp_adc(soil + noise());
+    stats.moisture = value;
+    pthread_mutex_unlock(&plant_lock);
+    return value;
+}
+
+int32_t plant_light_level(void)
+{
+    pthread_mutex_lock(&plant_lock);
+    double light = NIGHT_LIGHT + sunlight(plant_time()) + (lamp_on ? LAMP_LIGHT : 0);
+    int32_t value = clamp_adc(light + noise());
+    stats.light = value;
+    pthread_mutex_unlock(&plant_lock);
+    return value;
+}
+
+uint8_t plant_temperature(void)
+{
+    //Follows the sun, a few hours late
+    double time = plant_time() - 3 * 3600.0;
+    return (uint8_t)lround(19 + 4 * sin(2 * M_PI * (time - 8 * 3600.0) / PLANT_DAY_S));
+}
+
+uint8_t plant_humidity(void)
+{
+    double time = plant_time() - 3 * 3600.0;
+    return (uint8_t)lround(55 - 10 * sin(2 * M_PI * (time - 8 * 3600.0) / PLANT_DAY_S));
+}
+
+void plant_set_pump(bool on)
+{
+    int64_t now = esp_timer_get_time();
+
+    pthread_mutex_lock(&plant_lock);
+    if(on && pump_started_at < 0)
+    {
+        pump_started_at = now;
+        ++stats.waterings;
+    }
+    else if(!on && pump_started_at >= 0)
+    {
+        double seconds = (now - pump_started_at) / 1e6;
+        update_soil();
+        soil += seconds * SOIL_WATERING_PER_S;
+        if(soil > SOIL_SATURATED)
+            soil = SOIL_SATURATED;
+        stats.watering_ms += (uint32_t)(seconds * 1000);
+        pump_started_at = -1;
+    }
+    pthread_mutex_unlock(&plant_lock);
+}
+
+void plant_set_lamp(bool on)
+{
+    pthread_mutex_lock(&plant_lock);
+    bool changed = lamp_on != on;
+    lamp_on = on;
+    stats.lamp = on;
+    if(changed)
+        ++stats.lamp_switches;
+    pthread_mutex_unlock(&plant_lock);
+
+    if(changed)
+        ESP_LOGI(TAG, "lamp %s", on ? "on" : "off");
+}
+
+void plant_kaku_received(uint32_t code)
+{
+    pthread_mutex_lock(&plant_lock);
+    ++stats.kaku_frames;
+    pthread_mutex_unlock(&plant_lock);
+    //Id in the upper 26 bits, the state in bit 4
+    plant_set_lamp((code >> 4) & 1);
+}
+
+void plant_dht11_read(void)
+{
+    pthread_mutex_lock(&plant_lock);
+    ++stats.dht11_frames;
+    pthread_mutex_unlock(&plant_lock);
+}
+
+void plant_get_stats(plant_stats_t* out)
+{
+    pthread_mutex_lock(&plant_lock);
+    update_soil();
+    *out = stats;
+    out->moisture = (int32_t)soil;
+    pthread_mutex_unlock(&plant_lock);
+}
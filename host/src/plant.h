@@ -0,0 +1,56 @@
+//
+// Created by derk on 19-10-26.
+//
+
+#ifndef PLANT_H
+#define PLANT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * The plant and the room it stands in. Soil dries out and the daylight
+ * follows a day/night cycle in plant time, which runs speed times faster than
+ * the wall clock; the pump and the lamp act in wall clock time, like the
+ * firmware that drives them. The same seed gives the same plant.
+ */
+
+//Plant time starts at 06:00, two hours before sunrise
+#define PLANT_START_HOUR 6
+#define PLANT_DAY_S 86400.0
+
+typedef struct
+{
+    uint32_t waterings;
+    uint32_t watering_ms;
+    uint32_t lamp_switches;
+    uint32_t kaku_frames;
+    uint32_t dht11_frames;
+    bool lamp;
+    int32_t moisture;
+    int32_t light;
+} plant_stats_t;
+
+void plant_initialize(uint32_t seed, double speed);
+
+//Seconds since midnight of the first day
+double plant_time(void);
+
+//Raw 12 bit readings with a little noise
+int32_t plant_soil_moisture(void);
+int32_t plant_light_level(void);
+
+//Whole degrees and percent, as the DHT11 reports them
+uint8_t plant_temperature(void);
+uint8_t plant_humidity(void);
+
+void plant_set_pump(bool on);
+void plant_set_lamp(bool on);
+
+//A complete KAKU frame seen on the transmitter pin
+void plant_kaku_received(uint32_t code);
+void plant_dht11_read(void);
+
+void plant_get_stats(plant_stats_t* stats);
+
+#endif //PLANT_H
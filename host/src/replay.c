@@ -0,0 +1,410 @@
+//
+// Created by derk on 19-10-26.
+//
+
+#include <getopt.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "control.h"
+#include "measurements.h"
+#include "base.h"
+
+/*
+ * Runs recorded samples through the threshold rules of the firmware
+ * (control.c) on a virtual clock, for every combination of the given
+ * parameters, one combination per thread at a time.
+ *
+ * The trace is open loop: waterings do not show up in the recorded soil
+ * moisture. The lamp can be fed back into the light level with --lamp-light,
+ * for traces recorded while it was off.
+ */
+
+#define MAX_LINE 1024
+#define MAX_VALUES 64
+#define DEFAULT_FLOW_ML_S 20.0
+#define DEFAULT_CHURN_S 600
+
+typedef struct
+{
+    int64_t time_ms;
+    int32_t moisture;
+    int32_t light;
+} sample_t;
+
+typedef struct
+{
+    uint16_t light_threshold;
+    uint16_t moisture_threshold;
+    uint16_t light_margin;
+    uint32_t watering_ms;
+    uint32_t soak_ms;
+} params_t;
+
+typedef struct
+{
+    uint32_t waterings;
+    int64_t pump_ms;
+    uint32_t light_on;
+    uint32_t light_off;
+    int64_t lamp_on_ms;
+    //Lamp periods, on or off, shorter than --churn-s
+    uint32_t short_cycles;
+} result_t;
+
+typedef struct
+{
+    uint32_t values[MAX_VALUES];
+    size_t count;
+} value_list_t;
+
+static sample_t* samples = NULL;
+static size_t sample_count = 0;
+static params_t* runs = NULL;
+static result_t* results = NULL;
+static size_t run_count = 0;
+static size_t next_run = 0;
+static uint32_t interval_ms = MEASURE_INTERVAL_MS;
+static int32_t lamp_light = 0;
+static int64_t churn_ms = DEFAULT_CHURN_S * 1000;
+
+static void usage(const char* name)
+{
+    fprintf(stderr,
+            "usage: %s [options] TRACE.csv\n"
+            "TRACE.csv has a header with time or timestamp (seconds), soil_moisture_level and light_level columns\n"
+            "parameters take a value or FROM:TO:STEP, every combination is replayed\n"
+            "  -l, --light LIST         light threshold, default 1000\n"
+            "  -m, --moisture LIST      moisture threshold, default 1500\n"
+            "  -M, --margin LIST        light margin, default %d\n"
+            "  -w, --watering-ms LIST   pump time per watering, default %d\n"
+            "  -k, --soak-ms LIST       wait after watering, default %d\n"
+            "  -i, --interval-ms MS     time between samples, default %d\n"
+            "  -L, --lamp-light RAW     added to the light level while the lamp is on, default 0\n"
+            "  -f, --flow ML_S          pump flow for the watering volume, default %.0f\n"
+            "  -c, --churn-s SECONDS    lamp periods shorter than this are churn, default %d\n"
+            "  -j, --jobs N             threads, default one per core\n",
+            name, LIGHT_THRESHOLD_MARGIN, WATERING_DURATION_MS, WATERING_SOAK_MS, MEASURE_INTERVAL_MS,
+            DEFAULT_FLOW_ML_S, DEFAULT_CHURN_S);
+}
+
+static bool parse_list(const char* text, value_list_t* list)
+{
+    char* end;
+    unsigned long from = strtoul(text, &end, 0);
+    unsigned long to = from;
+    unsigned long step = 1;
+
+    if(*end == ':')
+    {
+        to = strtoul(end + 1, &end, 0);
+        if(*end != ':') return false;
+        step = strtoul(end + 1, &end, 0);
+    }
+    if(*end != '\0' || step == 0 || to < from) return false;
+
+    list->count = 0;
+    for(unsigned long value = from; value <= to; value += step)
+    {
+        if(list->count == MAX_VALUES) return false;
+        list->values[list->count++] = (uint32_t)value;
+    }
+    return true;
+}
+
+static int find_column(char* header, const char* name)
+{
+    int column = 0;
+    for(char* field = strtok(header, ",\r\n"); field; field = strtok(NULL, ",\r\n"), ++column)
+    {
+        if(strcmp(field, name) == 0) return column;
+    }
+    return -1;
+}
+
+static bool load_trace(const char* path)
+{
+    char line[MAX_LINE];
+    char header[MAX_LINE];
+    size_t capacity = 0;
+    FILE* file = fopen(path, "r");
+
+    if(!file)
+    {
+        perror(path);
+        return false;
+    }
+    if(!fgets(line, sizeof(line), file))
+    {
+        fprintf(stderr, "%s: empty\n", path);
+        fclose(file);
+        return false;
+    }
+
+    int time_column, moisture_column, light_column;
+    strcpy(header, line);
+    time_column = find_column(header, "time");
+    if(time_column < 0)
+    {
+        strcpy(header, line);
+        time_column = find_column(header, "timestamp");
+    }
+    strcpy(header, line);
+    moisture_column = find_column(header, "soil_moisture_level");
+    strcpy(header, line);
+    light_column = find_column(header, "light_level");
+    if(time_column < 0 || moisture_column < 0 || light_column < 0)
+    {
+        fprintf(stderr, "%s: needs time, soil_moisture_level and light_level columns\n", path);
+        fclose(file);
+        return false;
+    }
+
+    while(fgets(line, sizeof(line), file))
+    {
+        sample_t sample = { 0 };
+        int column = 0;
+        int found = 0;
+
+        if(line[0] == '#' || line[0] == '\n') continue;
+        for(char* field = strtok(line, ",\r\n"); field; field = strtok(NULL, ",\r\n"), ++column)
+        {
+            if(column == time_column)
+                sample.time_ms = (int64_t)(strtod(field, NULL) * 1000);
+            else if(column == moisture_column)
+                sample.moisture = (int32_t)strtol(field, NULL, 10);
+            else if(column == light_column)
+                sample.light = (int32_t)strtol(field, NULL, 10);
+            else
+                continue;
+            ++found;
+        }
+        if(found != 3) continue;
+        if(sample_count && sample.time_ms < samples[sample_count - 1].time_ms)
+        {
+            fprintf(stderr, "%s: not sorted by time\n", path);
+            fclose(file);
+            return false;
+        }
+
+        if(sample_count == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 4096;
+            samples = realloc(samples, capacity * sizeof(*samples));
+            if(!samples)
+            {
+                fclose(file);
+                return false;
+            }
+        }
+        samples[sample_count++] = sample;
+    }
+    fclose(file);
+    if(sample_count < 2)
+    {
+        fprintf(stderr, "%s: fewer than two samples\n", path);
+        return false;
+    }
+    return true;
+}
+
+static void lamp_switched(result_t* result, int64_t now, int64_t* last_switch)
+{
+    if(now - *last_switch < churn_ms)
+        ++result->short_cycles;
+    *last_switch = now;
+}
+
+static void replay(const params_t* params, result_t* result)
+{
+    control_t control = CONTROL_INITIALIZER;
+    //send_data reports the lamp off as soon as mqtt connects
+    light_states_t light_state = LIGHT_STATES_OFF;
+    int64_t now = samples[0].time_ms;
+    int64_t end = samples[sample_count - 1].time_ms;
+    //The esp_timer in main.c, -1 while it is not running
+    int64_t watering_due = -1;
+    int64_t pump_started = 0;
+    int64_t last_switch = now;
+    size_t index = 0;
+
+    memset(result, 0, sizeof(*result));
+    for(; now <= end; now += interval_ms)
+    {
+        while(index + 1 < sample_count && samples[index + 1].time_ms <= now)
+            ++index;
+
+        while(watering_due >= 0 && watering_due <= now)
+        {
+            bool pump_was_on = control.pump_on;
+            uint32_t next_ms = control_watering_step(&control, params->soak_ms);
+            if(pump_was_on)
+                result->pump_ms += watering_due - pump_started;
+            watering_due = next_ms ? watering_due + next_ms : -1;
+        }
+
+        int32_t light = samples[index].light + (light_state == LIGHT_STATES_ON ? lamp_light : 0);
+        uint32_t reached = control_check_thresholds(params->light_threshold, params->moisture_threshold, light,
+                                                    samples[index].moisture);
+
+        //Events carry the light level as an uint16_t, so does the replay
+        if(reached & CONTROL_LIGHT_REACHED)
+        {
+            if(control_light_reached(&control, light_state, (uint16_t)light) == CONTROL_LIGHT_ON)
+            {
+                light_state = LIGHT_STATES_ON;
+                ++result->light_on;
+                lamp_switched(result, now, &last_switch);
+            }
+        }
+        else if(control_light_above(&control, light_state, (uint16_t)light, params->light_threshold,
+                                    params->light_margin) == CONTROL_LIGHT_OFF)
+        {
+            light_state = LIGHT_STATES_OFF;
+            ++result->light_off;
+            result->lamp_on_ms += now - last_switch;
+            lamp_switched(result, now, &last_switch);
+        }
+
+        if((reached & CONTROL_MOISTURE_REACHED) && control_watering_start(&control))
+        {
+            ++result->waterings;
+            pump_started = now;
+            watering_due = now + params->watering_ms;
+        }
+    }
+
+    if(light_state == LIGHT_STATES_ON)
+        result->lamp_on_ms += end - last_switch;
+    if(control.pump_on)
+        result->pump_ms += end - pump_started;
+}
+
+static void* replay_worker(void* param)
+{
+    for(;;)
+    {
+        size_t run = __atomic_fetch_add(&next_run, 1, __ATOMIC_RELAXED);
+        if(run >= run_count) return NULL;
+        replay(&runs[run], &results[run]);
+    }
+}
+
+static int64_t wall_clock_ms(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+int main(int argc, char** argv)
+{
+    static const struct option options[] = {
+        { "light", required_argument, NULL, 'l' },
+        { "moisture", required_argument, NULL, 'm' },
+        { "margin", required_argument, NULL, 'M' },
+        { "watering-ms", required_argument, NULL, 'w' },
+        { "soak-ms", required_argument, NULL, 'k' },
+        { "interval-ms", required_argument, NULL, 'i' },
+        { "lamp-light", required_argument, NULL, 'L' },
+        { "flow", required_argument, NULL, 'f' },
+        { "churn-s", required_argument, NULL, 'c' },
+        { "jobs", required_argument, NULL, 'j' },
+        { "help", no_argument, NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+    value_list_t light = { { 1000 }, 1 };
+    value_list_t moisture = { { 1500 }, 1 };
+    value_list_t margin = { { LIGHT_THRESHOLD_MARGIN }, 1 };
+    value_list_t watering = { { WATERING_DURATION_MS }, 1 };
+    value_list_t soak = { { WATERING_SOAK_MS }, 1 };
+    double flow_ml_s = DEFAULT_FLOW_ML_S;
+    long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    value_list_t* list = NULL;
+    int option;
+
+    while((option = getopt_long(argc, argv, "l:m:M:w:k:i:L:f:c:j:h", options, NULL)) != -1)
+    {
+        switch(option)
+        {
+        case 'l': list = &light; break;
+        case 'm': list = &moisture; break;
+        case 'M': list = &margin; break;
+        case 'w': list = &watering; break;
+        case 'k': list = &soak; break;
+        case 'i': interval_ms = (uint32_t)strtoul(optarg, NULL, 0); continue;
+        case 'L': lamp_light = (int32_t)strtol(optarg, NULL, 0); continue;
+        case 'f': flow_ml_s = atof(optarg); continue;
+        case 'c': churn_ms = strtoll(optarg, NULL, 0) * 1000; continue;
+        case 'j': jobs = strtol(optarg, NULL, 0); continue;
+        case 'h': usage(argv[0]); return EXIT_SUCCESS;
+        default: usage(argv[0]); return EXIT_FAILURE;
+        }
+        if(!parse_list(optarg, list))
+        {
+            fprintf(stderr, "bad value list: %s\n", optarg);
+            return EXIT_FAILURE;
+        }
+    }
+    if(optind != argc - 1 || interval_ms == 0 || jobs < 1)
+    {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+    if(!load_trace(argv[optind])) return EXIT_FAILURE;
+
+    run_count = light.count * moisture.count * margin.count * watering.count * soak.count;
+    runs = calloc(run_count, sizeof(*runs));
+    results = calloc(run_count, sizeof(*results));
+    if(!runs || !results) return EXIT_FAILURE;
+
+    size_t run = 0;
+    for(size_t a = 0; a < light.count; ++a)
+        for(size_t b = 0; b < moisture.count; ++b)
+            for(size_t c = 0; c < margin.count; ++c)
+                for(size_t d = 0; d < watering.count; ++d)
+                    for(size_t e = 0; e < soak.count; ++e)
+                    {
+                        runs[run++] = (params_t) {
+                            .light_threshold = (uint16_t)light.values[a],
+                            .moisture_threshold = (uint16_t)moisture.values[b],
+                            .light_margin = (uint16_t)margin.values[c],
+                            .watering_ms = watering.values[d],
+                            .soak_ms = soak.values[e]
+                        };
+                    }
+
+    if((size_t)jobs > run_count)
+        jobs = (long)run_count;
+    pthread_t* threads = calloc(jobs, sizeof(*threads));
+    if(!threads) return EXIT_FAILURE;
+
+    int64_t start = wall_clock_ms();
+    for(long i = 0; i < jobs; ++i)
+        pthread_create(&threads[i], NULL, replay_worker, NULL);
+    for(long i = 0; i < jobs; ++i)
+        pthread_join(threads[i], NULL);
+    int64_t elapsed = wall_clock_ms() - start;
+
+    double days = (samples[sample_count - 1].time_ms - samples[0].time_ms) / 86400000.0;
+    printf("light_threshold,moisture_threshold,light_margin,watering_ms,soak_ms,"
+           "waterings,pump_s,water_ml,light_on,light_off,lamp_on_h,toggles_per_day,short_cycles\n");
+    for(size_t i = 0; i < run_count; ++i)
+    {
+        const params_t* params = &runs[i];
+        const result_t* result = &results[i];
+        printf("%u,%u,%u,%u,%u,%u,%.1f,%.0f,%u,%u,%.2f,%.2f,%u\n", params->light_threshold,
+               params->moisture_threshold, params->light_margin, params->watering_ms, params->soak_ms,
+               result->waterings, result->pump_ms / 1000.0, result->pump_ms / 1000.0 * flow_ml_s, result->light_on,
+               result->light_off, result->lamp_on_ms / 3600000.0,
+               days > 0 ? (result->light_on + result->light_off) / days : 0.0, result->short_cycles);
+    }
+
+    fprintf(stderr, "%zu samples over %.2f days, %zu parameter sets on %ld threads in %lld ms, %.0fx real time\n",
+            sample_count, days, run_count, jobs, (long long)elapsed,
+            elapsed ? days * 86400000.0 * run_count / elapsed : 0.0);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,140 @@
+//
+// Created by derk on 19-10-26.
+//
+
+#include <string.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include "button.h"
+#include "event_bus.h"
+#include "executor.h"
+#include "host.h"
+#include "test.h"
+
+/*
+ * Bounce traces replayed on the reset button against the real clock. The
+ * contacts chatter for a few ms on every press and release, like a tact
+ * switch does; the gestures that come out of button.c are checked against
+ * the 30 ms debounce, the 1500 ms long press and the 300 ms double-press
+ * window.
+ */
+
+#define MS 1000
+#define MAX_GESTURES 4
+//Timers run on the 10 ms tick and the executor has to pick the event up
+#define SLACK_MS 60
+
+typedef struct
+{
+    uint32_t at_ms;
+    bool pressed;
+} step_t;
+
+typedef struct
+{
+    button_event_t gesture;
+    uint32_t earliest_ms;
+} expected_t;
+
+typedef struct
+{
+    button_event_t gesture;
+    int64_t posted;
+} seen_t;
+
+static seen_t seen[MAX_GESTURES];
+static uint32_t seen_count = 0;
+
+#define BOUNCE_PRESS(ms) {ms, true}, {ms + 1, false}, {ms + 2, true}, {ms + 4, false}, {ms + 5, true}
+#define BOUNCE_RELEASE(ms) {ms, false}, {ms + 1, true}, {ms + 3, false}, {ms + 6, true}, {ms + 7, false}
+
+//Held 120 ms, the short press goes out when the double-press window closes
+static const step_t short_press[] = { BOUNCE_PRESS(0), BOUNCE_RELEASE(120) };
+static const expected_t short_press_gestures[] = { {BUTTON_EVENT_SHORT_PRESS, 127 + BUTTON_DEBOUNCE_MS + BUTTON_DOUBLE_PRESS_MS} };
+
+//Spikes closer together than the debounce period, it settles released
+static const step_t noise[] = {
+    {0, true}, {3, false}, {20, true}, {22, false}, {45, true}, {47, false}, {100, true}, {102, false}
+};
+
+//Reported once it is held long enough, the release after it is no gesture
+static const step_t long_press[] = { BOUNCE_PRESS(0), BOUNCE_RELEASE(1800) };
+static const expected_t long_press_gestures[] = { {BUTTON_EVENT_LONG_PRESS, 5 + BUTTON_DEBOUNCE_MS + BUTTON_LONG_PRESS_MS} };
+
+//The second press settles 200 ms after the first release did
+static const step_t double_press[] = { BOUNCE_PRESS(0), BOUNCE_RELEASE(100), BOUNCE_PRESS(300), BOUNCE_RELEASE(400) };
+static const expected_t double_press_gestures[] = { {BUTTON_EVENT_DOUBLE_PRESS, 407 + BUTTON_DEBOUNCE_MS} };
+
+//The second press settles 400 ms after the first release, two short presses
+static const step_t two_presses[] = { BOUNCE_PRESS(0), BOUNCE_RELEASE(100), BOUNCE_PRESS(500), BOUNCE_RELEASE(600) };
+static const expected_t two_presses_gestures[] = {
+    {BUTTON_EVENT_SHORT_PRESS, 107 + BUTTON_DEBOUNCE_MS + BUTTON_DOUBLE_PRESS_MS},
+    {BUTTON_EVENT_SHORT_PRESS, 607 + BUTTON_DEBOUNCE_MS + BUTTON_DOUBLE_PRESS_MS}
+};
+
+//Bounces up to 25 ms apart on the release still count as one release
+static const step_t slow_bounce[] = {
+    BOUNCE_PRESS(0), {150, false}, {170, true}, {195, false}, {215, true}, {240, false}
+};
+static const expected_t slow_bounce_gestures[] = { {BUTTON_EVENT_SHORT_PRESS, 240 + BUTTON_DEBOUNCE_MS + BUTTON_DOUBLE_PRESS_MS} };
+
+static void on_button(const event_t* event, void* context)
+{
+    uint32_t index = __atomic_load_n(&seen_count, __ATOMIC_RELAXED);
+    if(index < MAX_GESTURES)
+        seen[index] = (seen_t) { .gesture = event->data.button, .posted = event->posted };
+    __atomic_store_n(&seen_count, index + 1, __ATOMIC_RELEASE);
+}
+
+#define REPLAY(trace, gestures) replay(#trace, trace, sizeof(trace) / sizeof(trace[0]), gestures, \
+                                       sizeof(gestures) / sizeof(gestures[0]))
+
+static void replay(const char* name, const step_t* steps, size_t step_count, const expected_t* gestures,
+                   size_t gesture_count)
+{
+    __atomic_store_n(&seen_count, 0, __ATOMIC_RELEASE);
+    int64_t start = esp_timer_get_time();
+    for(size_t i = 0; i < step_count; ++i)
+    {
+        int64_t wait = start + (int64_t) steps[i].at_ms * MS - esp_timer_get_time();
+        if(wait > 0)
+            host_sleep_us(wait);
+        host_button_set(steps[i].pressed);
+    }
+    //Long enough for anything the trace could still cause
+    host_sleep_us((BUTTON_LONG_PRESS_MS + SLACK_MS) * MS);
+
+    uint32_t count = __atomic_load_n(&seen_count, __ATOMIC_ACQUIRE);
+    if(count != gesture_count)
+        fprintf(stderr, "%s:\n", name);
+    CHECK_EQUAL(gesture_count, count);
+    for(size_t i = 0; i < gesture_count && i < count; ++i)
+    {
+        int64_t at_ms = (seen[i].posted - start) / MS;
+        if(seen[i].gesture != gestures[i].gesture || at_ms < gestures[i].earliest_ms ||
+           at_ms > gestures[i].earliest_ms + SLACK_MS)
+            fprintf(stderr, "%s: gesture %zu at %lld ms\n", name, i, (long long) at_ms);
+        CHECK_EQUAL(gestures[i].gesture, seen[i].gesture);
+        CHECK(at_ms >= gestures[i].earliest_ms);
+        CHECK(at_ms <= gestures[i].earliest_ms + SLACK_MS);
+    }
+}
+
+int main(void)
+{
+    host_log_level = ESP_LOG_WARN;
+    host_task_adopt("main");
+    initialize_executor();
+    initialize_event_bus();
+    event_bus_subscribe(EVENT_BUTTON_PRESSED, &on_button, NULL);
+    setup_reset_button();
+
+    REPLAY(short_press, short_press_gestures);
+    replay("noise", noise, sizeof(noise) / sizeof(noise[0]), NULL, 0);
+    REPLAY(long_press, long_press_gestures);
+    REPLAY(double_press, double_press_gestures);
+    REPLAY(two_presses, two_presses_gestures);
+    REPLAY(slow_bounce, slow_bounce_gestures);
+    return TEST_RESULT();
+}
@@ -0,0 +1,128 @@
+//
+// Created by derk on 19-10-26.
+//
+
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+#include "executor.h"
+#include "host.h"
+#include "test.h"
+
+/*
+ * The executor task against the real clock: timers within and beyond one lap
+ * of the wheel, cancelling an armed timer and cancelling a job whose timer
+ * already expired but that did not run yet.
+ */
+
+#define MS 1000
+
+typedef struct
+{
+    job_t job;
+    int runs;
+    int64_t ran_at;
+} probe_t;
+
+static SemaphoreHandle_t release;
+static SemaphoreHandle_t started;
+
+static void record_run(void* arg)
+{
+    probe_t* probe = arg;
+    probe->ran_at = esp_timer_get_time();
+    __atomic_add_fetch(&probe->runs, 1, __ATOMIC_RELAXED);
+}
+
+//Keeps the executor busy until the test gives release
+static void block(void* arg)
+{
+    xSemaphoreGive(started);
+    xSemaphoreTake(release, portMAX_DELAY);
+}
+
+static probe_t probe(const char* name)
+{
+    probe_t probe = { .job = JOB_INITIALIZER(record_run, NULL, name) };
+    return probe;
+}
+
+static void test_delays(void)
+{
+    probe_t near = probe("near");
+    probe_t far = probe("far");
+    probe_t cancelled = probe("cancelled");
+    near.job.arg = &near;
+    far.job.arg = &far;
+    cancelled.job.arg = &cancelled;
+
+    int64_t start = esp_timer_get_time();
+    //Beyond one lap of the wheel, and the earliest one cancelled
+    executor_schedule(&far.job, EXECUTOR_WHEEL_SLOTS * portTICK_PERIOD_MS + 200, 0);
+    executor_schedule(&cancelled.job, 20, 0);
+    executor_schedule(&near.job, 100, 0);
+    executor_cancel(&cancelled.job);
+    host_sleep_us((EXECUTOR_WHEEL_SLOTS * portTICK_PERIOD_MS + 400) * MS);
+
+    CHECK_EQUAL(1, near.runs);
+    CHECK_EQUAL(1, far.runs);
+    CHECK_EQUAL(0, cancelled.runs);
+    CHECK(near.ran_at - start >= 100 * MS);
+    CHECK(near.ran_at - start < 150 * MS);
+    CHECK(far.ran_at - start >= (EXECUTOR_WHEEL_SLOTS * portTICK_PERIOD_MS + 200) * MS);
+    CHECK(far.ran_at - start < (EXECUTOR_WHEEL_SLOTS * portTICK_PERIOD_MS + 250) * MS);
+}
+
+static void test_periodic(void)
+{
+    probe_t periodic = probe("periodic");
+    periodic.job.arg = &periodic;
+
+    executor_schedule(&periodic.job, 0, 50);
+    host_sleep_us(275 * MS);
+    executor_cancel(&periodic.job);
+    int runs = __atomic_load_n(&periodic.runs, __ATOMIC_RELAXED);
+    host_sleep_us(150 * MS);
+
+    CHECK(runs >= 5 && runs <= 7);
+    CHECK_EQUAL(runs, periodic.runs);
+}
+
+static void test_cancel_expired(void)
+{
+    job_t blocker = JOB_INITIALIZER(block, NULL, "blocker");
+    job_t second_blocker = JOB_INITIALIZER(block, NULL, "second_blocker");
+    probe_t victim = probe("victim");
+    victim.job.arg = &victim;
+
+    //Both timers expire while the executor is busy, the next expire() queues them in order
+    executor_submit(&blocker);
+    xSemaphoreTake(started, portMAX_DELAY);
+    executor_schedule(&second_blocker, 10, 0);
+    executor_schedule(&victim.job, 40, 0);
+    host_sleep_us(100 * MS);
+    xSemaphoreGive(release);
+
+    //The victim is queued behind the second blocker now
+    xSemaphoreTake(started, portMAX_DELAY);
+    executor_cancel(&victim.job);
+    xSemaphoreGive(release);
+    host_sleep_us(50 * MS);
+
+    CHECK_EQUAL(0, victim.runs);
+}
+
+int main(void)
+{
+    host_log_level = ESP_LOG_WARN;
+    host_task_adopt("main");
+    release = xSemaphoreCreateBinary();
+    started = xSemaphoreCreateBinary();
+    initialize_executor();
+
+    test_delays();
+    test_periodic();
+    test_cancel_expired();
+    return TEST_RESULT();
+}
@@ -0,0 +1,278 @@
+//
+// Created by derk on 19-10-26.
+//
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <esp_timer.h>
+#include "sample_log.h"
+#include "host.h"
+#include "test.h"
+
+/*
+ * The sample log on the emulated flash of src/partition.c. Every boot is a
+ * forked process on the same flash file, what it had in ram is gone when it
+ * exits, like after a power cut.
+ */
+
+#define INTERVAL_S CONFIG_PLANT_SAMPLE_LOG_INTERVAL_S
+#define WRITER_TIMEOUT_US (1000 * 1000)
+
+typedef struct
+{
+    uint32_t from;
+    uint32_t to;
+    uint32_t count;
+    uint32_t first;
+    uint32_t last;
+    bool ascending;
+} collected_t;
+
+static uint32_t random_state = 1;
+static uint32_t seconds = 0;
+
+//The next sample of this boot, one per log interval with values that do not compress well
+static void add_sample(void)
+{
+    measurement_snapshot_t sample = { .sample_id = seconds, .timestamp = (int64_t)seconds * 1000000 };
+
+    for(int i = 0; i < MEASUREMENT_COUNT; ++i)
+        sample.values[i] = (int32_t)(host_random(&random_state) % 4096);
+    sample_log_add(&sample);
+    seconds += INTERVAL_S;
+}
+
+//Full blocks on flash right away, not some time later from the writer task
+static void log_sample(void)
+{
+    add_sample();
+    sample_log_flush();
+}
+
+static void log_until_blocks(uint32_t blocks)
+{
+    sample_log_stats_t stats;
+    do
+    {
+        log_sample();
+        sample_log_get_stats(&stats);
+    } while(stats.blocks < blocks);
+}
+
+static bool collect_block(const sample_block_t* block, void* context)
+{
+    collected_t* collected = context;
+    sample_decoder_t decoder;
+    sample_record_t record;
+
+    sample_decoder_init(&decoder, block);
+    while(sample_decoder_next(&decoder, &record))
+    {
+        if(record.timestamp < collected->from || record.timestamp > collected->to) continue;
+        if(collected->count == 0)
+            collected->first = record.timestamp;
+        else if(record.timestamp <= collected->last)
+            collected->ascending = false;
+        collected->last = record.timestamp;
+        collected->count++;
+    }
+    return true;
+}
+
+static size_t collect(uint32_t from, uint32_t to, collected_t* collected)
+{
+    *collected = (collected_t) { .from = from, .to = to, .ascending = true };
+    return sample_log_for_each_block(from, to, collect_block, collected);
+}
+
+//Runs one boot, true when its checks passed
+static bool boot(void (*run)(void))
+{
+    fflush(NULL);
+    pid_t pid = fork();
+    if(pid == 0)
+    {
+        initialize_sample_log();
+        run();
+        _exit(TEST_RESULT());
+    }
+    int status;
+    return pid > 0 && waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static void fill_five_blocks(void)
+{
+    log_until_blocks(5);
+}
+
+static void check_persisted(void)
+{
+    sample_log_stats_t stats;
+    collected_t all;
+
+    sample_log_get_stats(&stats);
+    CHECK_EQUAL(5, stats.blocks);
+    collect(0, UINT32_MAX, &all);
+    CHECK(all.ascending);
+    CHECK_EQUAL(0, all.first);
+    CHECK_EQUAL((all.count - 1) * INTERVAL_S, all.last);
+
+    //The clock carries on from the newest sample on flash
+    CHECK(sample_log_now() > all.last);
+    log_sample();
+    log_sample();
+    collected_t after;
+    collect(0, UINT32_MAX, &after);
+    CHECK(after.ascending);
+    CHECK_EQUAL(all.count + 2, after.count);
+    CHECK_EQUAL(all.last + 1 + INTERVAL_S, after.last);
+}
+
+static void check_wrapped(void);
+
+static void fill_past_wrap(void)
+{
+    sample_log_stats_t stats;
+    do
+    {
+        log_sample();
+        sample_log_get_stats(&stats);
+    } while(stats.erases < stats.sectors + 10);
+    check_wrapped();
+}
+
+static void check_wrapped(void)
+{
+    sample_log_stats_t stats;
+    collected_t all;
+    collected_t range;
+
+    sample_log_get_stats(&stats);
+    CHECK(stats.oldest > 0);
+    //One sector is always being filled or was just erased
+    CHECK(stats.blocks > (stats.sectors - 2) * SAMPLE_LOG_BLOCKS_PER_SECTOR);
+    collect(0, UINT32_MAX, &all);
+    CHECK(all.ascending);
+    CHECK_EQUAL(stats.oldest, all.first);
+    CHECK_EQUAL((all.last - all.first) / INTERVAL_S + 1, all.count);
+
+    //Unaligned ends, the sectors before the range are skipped on the index alone
+    uint32_t from = stats.oldest + 1000 * INTERVAL_S + 3;
+    size_t visited = collect(from, from + 500 * INTERVAL_S, &range);
+    CHECK(range.ascending);
+    CHECK_EQUAL(500, range.count);
+    CHECK_EQUAL(from + INTERVAL_S - 3, range.first);
+    CHECK(visited < 2 * 500 / (SAMPLE_BLOCK_DATA_SIZE / (1 + 2 * MEASUREMENT_COUNT)) + 2);
+
+    CHECK_EQUAL(0, collect(0, stats.oldest - 1, &range));
+    CHECK_EQUAL(0, collect(10, 5, &range));
+}
+
+static void check_wrapped_after_boot(void)
+{
+    collected_t all;
+    check_wrapped();
+    collect(0, UINT32_MAX, &all);
+    CHECK(sample_log_now() > all.last);
+}
+
+//The writer task writes the first full block on its own, it is in the walk all the time
+static void check_writer(void)
+{
+    sample_log_stats_t stats;
+    collected_t all;
+    uint32_t count = 0;
+
+    while(collect(0, UINT32_MAX, &all) < 2)
+    {
+        add_sample();
+        ++count;
+    }
+    CHECK(all.ascending);
+    CHECK_EQUAL(count, all.count);
+
+    int64_t deadline = esp_timer_get_time() + WRITER_TIMEOUT_US;
+    do
+    {
+        host_sleep_us(1000);
+        sample_log_get_stats(&stats);
+    } while(stats.blocks == 0 && esp_timer_get_time() < deadline);
+    CHECK_EQUAL(1, stats.blocks);
+    CHECK_EQUAL(2, collect(0, UINT32_MAX, &all));
+    CHECK(all.ascending);
+    CHECK_EQUAL(count, all.count);
+}
+
+static void check_written(void)
+{
+    sample_log_stats_t stats;
+    sample_log_get_stats(&stats);
+    CHECK_EQUAL(1, stats.blocks);
+}
+
+static int writes_before_cut;
+
+//The power is cut while the next sector is started
+static void cut_in_next_sector(void)
+{
+    log_until_blocks(SAMPLE_LOG_BLOCKS_PER_SECTOR);
+    host_flash_writes_left = writes_before_cut;
+    //A few blocks worth, none of them reaches the flash
+    for(int i = 0; i < 50; ++i)
+        log_sample();
+}
+
+static void check_after_cut(void)
+{
+    sample_log_stats_t stats;
+    collected_t all;
+
+    sample_log_get_stats(&stats);
+    CHECK_EQUAL(SAMPLE_LOG_BLOCKS_PER_SECTOR, stats.blocks);
+    collect(0, UINT32_MAX, &all);
+    CHECK(all.count > 0);
+    CHECK(sample_log_now() > all.last);
+
+    //New samples come after the old ones, also once they reach flash
+    log_until_blocks(SAMPLE_LOG_BLOCKS_PER_SECTOR + 2);
+    collected_t after;
+    collect(0, UINT32_MAX, &after);
+    CHECK(after.ascending);
+    CHECK(after.count > all.count);
+}
+
+static bool with_flash(const char* name, void (*first)(void), void (*second)(void))
+{
+    char path[] = "/tmp/sample_log_test_XXXXXX";
+    int fd = mkstemp(path);
+    if(fd < 0)
+    {
+        perror("mkstemp");
+        return false;
+    }
+    close(fd);
+    host_flash_path = path;
+
+    bool passed = boot(first) && boot(second);
+    fprintf(stderr, "%s: %s\n", name, passed ? "ok" : "FAILED");
+    unlink(path);
+    return passed;
+}
+
+int main(void)
+{
+    //The failed writes of the power cut tests are expected
+    host_log_level = ESP_LOG_NONE;
+
+    CHECK(with_flash("persistence", fill_five_blocks, check_persisted));
+    CHECK(with_flash("writer task", check_writer, check_written));
+    CHECK(with_flash("wrap-around", fill_past_wrap, check_wrapped_after_boot));
+    //After the erase, before the sector header
+    writes_before_cut = 1;
+    CHECK(with_flash("power cut before the header", cut_in_next_sector, check_after_cut));
+    //After the header, before the first block
+    writes_before_cut = 2;
+    CHECK(with_flash("power cut before the first block", cut_in_next_sector, check_after_cut));
+    return TEST_RESULT();
+}
@@ -0,0 +1,120 @@
+//
+// Created by derk on 19-10-26.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <esp_system.h>
+#include <esp_timer.h>
+#include "broker.h"
+#include "plant.h"
+#include "host.h"
+#include "test.h"
+
+/*
+ * The whole firmware against the simulated plant and broker at 3600 times
+ * the plant clock, while the test keeps calling every api endpoint and opens
+ * and closes websocket clients. Once all of that ran a first time the free
+ * heap has to stay flat: the firmware allocates at init and never after.
+ */
+
+#define SPEED 3600.0
+#define WARMUP_US (2 * 1000 * 1000)
+#define SOAK_US (20 * 1000 * 1000)
+#define PROFILE_US (1000 * 1000)
+//Every update is logged and goes to nvs, so not every round
+#define THRESHOLD_UPDATE_ROUNDS 100
+//glibc keeps a few freed chunks per thread in its cache, those still count as used
+#define TOLERANCE_BYTES 1024
+
+void app_main(void);
+
+static const char* const requests[] = {
+    "/api/v1/readings",
+    "/api/v1/history?metric=light_level",
+    "/api/v1/history?metric=soil_moisture_level&from=0",
+    "/api/v1/thresholds",
+    "/metrics",
+    "/api/v1/export?from=0&to=4294967295"
+};
+
+static host_http_response_t response;
+
+static bool receive(int fd, const uint8_t* payload, size_t len, void* context)
+{
+    return true;
+}
+
+//Everything a client can make the firmware do, once
+static void exercise(uint32_t round)
+{
+    char body[64];
+
+    for(size_t i = 0; i < sizeof(requests) / sizeof(requests[0]); ++i)
+    {
+        host_http_request(HTTP_GET, requests[i], NULL, &response);
+        CHECK_EQUAL(200, response.status);
+    }
+
+    if(round % THRESHOLD_UPDATE_ROUNDS == 0)
+    {
+        snprintf(body, sizeof(body), "{\"light\":%u,\"moisture\":%u}", 900 + round % 200, 1400 + round % 200);
+        host_http_request(HTTP_PUT, "/api/v1/thresholds", body, &response);
+        CHECK_EQUAL(202, response.status);
+    }
+    host_http_request(HTTP_PUT, "/api/v1/thresholds", "{\"light\":-1}", &response);
+    CHECK_EQUAL(400, response.status);
+
+    int fd = host_ws_connect("/api/v1/ws", receive, NULL);
+    CHECK(fd >= 0);
+    host_sleep_us(1000);
+    host_ws_close(fd);
+}
+
+int main(void)
+{
+    host_log_level = ESP_LOG_WARN;
+    plant_initialize(1, SPEED);
+    broker_initialize(1, 20);
+    broker_inject("plant/1/threshold/light", "1000");
+    broker_inject("plant/1/threshold/moisture", "1500");
+    host_task_adopt("main");
+    app_main();
+    //The server starts once wifi connected
+    while(host_http_request(HTTP_GET, "/api/v1/readings", NULL, &response) != ESP_OK)
+        host_sleep_us(10 * 1000);
+
+    uint32_t round = 0;
+    int64_t start = esp_timer_get_time();
+    while(esp_timer_get_time() - start < WARMUP_US)
+        exercise(round++);
+
+    uint32_t baseline = esp_get_free_heap_size();
+    uint32_t lowest = baseline;
+    int64_t next_profile = esp_timer_get_time();
+    printf("free heap after warmup: %u\n", baseline);
+    start = esp_timer_get_time();
+    while(esp_timer_get_time() - start < SOAK_US)
+    {
+        exercise(round++);
+        uint32_t free_heap = esp_get_free_heap_size();
+        if(free_heap < lowest)
+            lowest = free_heap;
+        if(esp_timer_get_time() >= next_profile)
+        {
+            printf("%5.1f s: %u rounds, free heap %u\n", (esp_timer_get_time() - start) / 1e6, round, free_heap);
+            next_profile += PROFILE_US;
+        }
+    }
+
+    broker_stats_t broker;
+    broker_get_stats(&broker);
+    printf("%u rounds, %u publishes, lowest free heap %u, %d below the level after warmup\n", round,
+           broker.publishes, lowest, (int)(baseline - lowest));
+    CHECK(broker.publishes > 0);
+    CHECK(baseline - lowest <= TOLERANCE_BYTES);
+    CHECK(esp_get_minimum_free_heap_size() <= lowest);
+    fflush(stdout);
+    //The firmware tasks never end
+    exit(TEST_RESULT());
+}
@@ -0,0 +1,33 @@
+//
+// Created by derk on 19-10-26.
+//
+
+#ifndef TEST_H
+#define TEST_H
+
+#include <stdio.h>
+
+//The host tests are plain programs, ctest runs them and a non-zero exit is a failure
+
+static int test_failures = 0;
+
+#define CHECK(condition) \
+    do { \
+        if(!(condition)) { \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #condition); \
+            ++test_failures; \
+        } \
+    } while(0)
+
+#define CHECK_EQUAL(expected, actual) \
+    do { \
+        long long expected_ = (long long)(expected), actual_ = (long long)(actual); \
+        if(expected_ != actual_) { \
+            fprintf(stderr, "%s:%d: %s is %lld, expected %lld\n", __FILE__, __LINE__, #actual, actual_, expected_); \
+            ++test_failures; \
+        } \
+    } while(0)
+
+#define TEST_RESULT() (test_failures ? 1 : 0)
+
+#endif //TEST_H
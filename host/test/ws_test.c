@@ -0,0 +1,221 @@
+//
+// Created by derk on 19-10-26.
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+#include "http.h"
+#include "ws.h"
+#include "host.h"
+#include "test.h"
+
+/*
+ * ws.c on the emulated http server of src/http_server.c. A load test with 1,
+ * 4 and 8 clients that prints latency and cpu per sample, and two clients
+ * that stall one after the other while the samples keep coming, which ran
+ * the frame pool dry when full queues kept their oldest frames.
+ */
+
+#define LOAD_SAMPLES 2000
+#define STALLED_SAMPLES 16
+#define TIMEOUT_US (2 * 1000 * 1000)
+
+typedef struct
+{
+    int fd;
+    uint32_t received;
+    uint32_t last_id;
+    bool stall_next;
+    bool fail_after_stall;
+    int64_t latency_sum;
+    int64_t latency_max;
+} client_t;
+
+static SemaphoreHandle_t stalled;
+static SemaphoreHandle_t unstall;
+static int64_t pushed_at;
+
+static bool receive(int fd, const uint8_t* payload, size_t len, void* context)
+{
+    client_t* client = context;
+    char text[WS_FRAME_SIZE + 1];
+    memcpy(text, payload, len);
+    text[len] = '\0';
+
+    int64_t latency = esp_timer_get_time() - __atomic_load_n(&pushed_at, __ATOMIC_RELAXED);
+    client->latency_sum += latency;
+    if(latency > client->latency_max)
+        client->latency_max = latency;
+    ++client->received;
+    __atomic_store_n(&client->last_id, strtoul(text + strlen("{\"sample_id\":"), NULL, 10), __ATOMIC_RELEASE);
+
+    if(!client->stall_next) return true;
+    //A full socket, the send blocks the httpd task until the test lets go
+    client->stall_next = false;
+    xSemaphoreGive(stalled);
+    xSemaphoreTake(unstall, portMAX_DELAY);
+    return !client->fail_after_stall;
+}
+
+static void push(uint32_t sample_id)
+{
+    measurement_snapshot_t sample = {
+        .sample_id = sample_id,
+        .timestamp = esp_timer_get_time(),
+        .valid = MEASUREMENT_ALL_VALID
+    };
+    __atomic_store_n(&pushed_at, sample.timestamp, __ATOMIC_RELAXED);
+    ws_push_sample(&sample);
+}
+
+static bool wait_for_last(client_t* clients, int count, uint32_t sample_id)
+{
+    int64_t deadline = esp_timer_get_time() + TIMEOUT_US;
+    for(int i = 0; i < count; ++i)
+    {
+        while(__atomic_load_n(&clients[i].last_id, __ATOMIC_ACQUIRE) != sample_id)
+        {
+            if(esp_timer_get_time() > deadline) return false;
+            host_sleep_us(10);
+        }
+    }
+    return true;
+}
+
+static void connect_clients(client_t* clients, int count)
+{
+    for(int i = 0; i < count; ++i)
+    {
+        clients[i].fd = host_ws_connect("/api/v1/ws", receive, &clients[i]);
+        CHECK(clients[i].fd >= 0);
+    }
+}
+
+static void close_clients(client_t* clients, int count)
+{
+    for(int i = 0; i < count; ++i)
+    {
+        if(clients[i].fd >= 0)
+            host_ws_close(clients[i].fd);
+    }
+}
+
+static uint32_t httpd_cpu_us(void)
+{
+    TaskStatus_t tasks[16];
+    UBaseType_t count = uxTaskGetSystemState(tasks, 16, NULL);
+    for(UBaseType_t i = 0; i < count; ++i)
+    {
+        if(strcmp(tasks[i].pcTaskName, "httpd") == 0)
+            return tasks[i].ulRunTimeCounter;
+    }
+    return 0;
+}
+
+static int64_t thread_cpu_ns(void)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+    return (int64_t) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+//One sample at a time, each one waits until every client has it
+static void test_load(int count, uint32_t* sample_id)
+{
+    client_t clients[WS_MAX_CLIENTS] = { 0 };
+    ws_stats_t before, after;
+
+    connect_clients(clients, count);
+    ws_get_stats(&before);
+    uint32_t httpd_before = httpd_cpu_us();
+    int64_t push_ns = 0;
+
+    for(int i = 0; i < LOAD_SAMPLES; ++i)
+    {
+        int64_t start = thread_cpu_ns();
+        push(++*sample_id);
+        push_ns += thread_cpu_ns() - start;
+        if(!wait_for_last(clients, count, *sample_id)) break;
+    }
+
+    uint32_t httpd_us = httpd_cpu_us() - httpd_before;
+    ws_get_stats(&after);
+    int64_t latency_sum = 0, latency_max = 0;
+    for(int i = 0; i < count; ++i)
+    {
+        CHECK_EQUAL(LOAD_SAMPLES, clients[i].received);
+        latency_sum += clients[i].latency_sum;
+        if(clients[i].latency_max > latency_max)
+            latency_max = clients[i].latency_max;
+    }
+    CHECK_EQUAL(LOAD_SAMPLES * count, after.frames_sent - before.frames_sent);
+    CHECK_EQUAL(before.frames_dropped, after.frames_dropped);
+    CHECK_EQUAL(0, after.frames_not_encoded);
+
+    printf("%d clients: latency avg %lld us, max %lld us; cpu per sample %lld ns pushing, %lld ns on httpd\n",
+           count, (long long)(latency_sum / (LOAD_SAMPLES * count)), (long long) latency_max,
+           (long long)(push_ns / LOAD_SAMPLES), (long long) httpd_us * 1000 / LOAD_SAMPLES);
+    close_clients(clients, count);
+}
+
+//The first client stalls, then the second one does while the others already got newer frames
+static void test_stalled_clients(uint32_t* sample_id)
+{
+    client_t clients[WS_MAX_CLIENTS] = { 0 };
+    ws_stats_t stats;
+
+    connect_clients(clients, WS_MAX_CLIENTS);
+    clients[0].stall_next = true;
+    clients[1].stall_next = true;
+    clients[1].fail_after_stall = true;
+
+    push(++*sample_id);
+    xSemaphoreTake(stalled, portMAX_DELAY);
+    for(int i = 0; i < WS_QUEUE_DEPTH; ++i)
+        push(++*sample_id);
+
+    //The first client catches up, the second one stalls on its oldest frame
+    xSemaphoreGive(unstall);
+    xSemaphoreTake(stalled, portMAX_DELAY);
+    for(int i = 0; i < STALLED_SAMPLES; ++i)
+        push(++*sample_id);
+    ws_get_stats(&stats);
+    CHECK_EQUAL(0, stats.frames_not_encoded);
+
+    //Its send fails, the server drops it and the others get the newest sample
+    xSemaphoreGive(unstall);
+    clients[1].fd = -1;
+    CHECK(wait_for_last(clients, 1, *sample_id));
+    CHECK(wait_for_last(clients + 2, WS_MAX_CLIENTS - 2, *sample_id));
+
+    ws_get_stats(&stats);
+    CHECK_EQUAL(WS_MAX_CLIENTS - 1, stats.clients);
+    CHECK_EQUAL(0, stats.frames_not_encoded);
+    CHECK(stats.frames_dropped > 0);
+    close_clients(clients, WS_MAX_CLIENTS);
+}
+
+int main(void)
+{
+    host_log_level = ESP_LOG_WARN;
+    host_task_adopt("main");
+    stalled = xSemaphoreCreateBinary();
+    unstall = xSemaphoreCreateBinary();
+    start_webserver(false);
+
+    uint32_t sample_id = 0;
+    test_load(1, &sample_id);
+    test_load(4, &sample_id);
+    test_load(8, &sample_id);
+    test_stalled_clients(&sample_id);
+
+    ws_stats_t stats;
+    ws_get_stats(&stats);
+    CHECK_EQUAL(0, stats.clients);
+    stop_webserver();
+    return TEST_RESULT();
+}
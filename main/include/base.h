@@ -7,6 +7,9 @@
 
 #define RELAY_GPIO 22
 #define LIGHT_THRESHOLD_MARGIN 100
+#define WATERING_DURATION_MS 2000
+#define WATERING_SOAK_MS 10000
+#define RESOURCE_REPORT_INTERVAL_MS 60000
 void initialize_nvs(void);
 
 #endif //BASE_H
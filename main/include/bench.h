@@ -0,0 +1,37 @@
+//
+// Created by derk on 19-10-26.
+//
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <stdint.h>
+
+//Every kernel is repeated, doubling the count, until one run takes this long
+#define BENCH_MIN_US 20000
+#ifdef PLANT_HOST
+//The host nvs is a table in ram, it runs as long as the other kernels
+#define BENCH_NVS_WRITES UINT32_MAX
+#else
+//nvs commits wear the flash, a boot with CONFIG_PLANT_BENCHMARK writes this many
+#define BENCH_NVS_WRITES 32
+#endif
+#define BENCH_NAMESPACE "bench"
+
+/*
+ * Micro-benchmarks of the hot kernels of the firmware: KAKU code words, DHT11
+ * frame decoding, telemetry payloads, threshold checks and threshold storage.
+ * They call the same functions as the drivers, without touching any pin.
+ *
+ * Needs initialize_nvs and initialize_settings. Runs on the calling task,
+ * anything else running on its core shows up in the figures.
+ */
+
+/**
+ * @brief Run every kernel and print one line per kernel:
+ *        #BENCH <name> <ns/op> <cycles/op> <iterations>
+ * @note Read by tools/bench_check.py, cycles are TSC ticks on the host
+ */
+void bench_run(void);
+
+#endif //BENCH_H
@@ -0,0 +1,41 @@
+//
+// Created by derk on 19-10-26.
+//
+
+#ifndef BOOT_H
+#define BOOT_H
+
+#include <stdint.h>
+
+//The report is printed at the first publish, or after this long when that never happens
+#define BOOT_REPORT_TIMEOUT_MS 60000
+
+typedef enum
+{
+    BOOT_PHASE_NVS,
+    BOOT_PHASE_LED,
+    BOOT_PHASE_SERVICES,
+    BOOT_PHASE_SENSORS,
+    BOOT_PHASE_WIFI_INIT,
+    BOOT_PHASE_FIRST_SAMPLE,
+    BOOT_PHASE_DHT11_READY,
+    BOOT_PHASE_WIFI_CONNECTED,
+    BOOT_PHASE_MQTT_CONNECTED,
+    BOOT_PHASE_FIRST_PUBLISH,
+    BOOT_PHASE_COUNT
+} boot_phase_t;
+
+/**
+ * @brief Record the end of a boot phase, only the first mark of each phase counts
+ * @note Safe from any task
+ */
+void boot_mark(boot_phase_t phase);
+
+/**
+ * @brief Time since startup at which the phase ended, 0 when it did not end yet
+ */
+int64_t boot_phase_time(boot_phase_t phase);
+
+void initialize_boot_report(void);
+
+#endif //BOOT_H
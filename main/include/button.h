@@ -6,10 +6,23 @@
 #define BUTTON_H
 
 #include <stdbool.h>
+#include <freertos/FreeRTOS.h>
 
 #define RESET_CONNECTION_BUTTON_GPIO GPIO_NUM_4
+#define BUTTON_DEBOUNCE_MS 30
+#define BUTTON_LONG_PRESS_MS 1500
+#define BUTTON_DOUBLE_PRESS_MS 300
 
+typedef enum
+{
+    BUTTON_EVENT_SHORT_PRESS,
+    BUTTON_EVENT_LONG_PRESS,
+    BUTTON_EVENT_DOUBLE_PRESS
+} button_event_t;
+
+/**
+ * @brief Configure the reset button, gestures are posted as EVENT_BUTTON_PRESSED
+ */
 void setup_reset_button(void);
-bool wait_until_reset_button_pressed(void);
 
 #endif //BUTTON_H
@@ -0,0 +1,67 @@
+//
+// Created by derk on 19-10-26.
+//
+
+#ifndef CONTROL_H
+#define CONTROL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "mqtt.h"
+
+/*
+ * The threshold rules of the plant, free of tasks, timers and networking.
+ * apply_threshold and the event handlers in main.c call them on the device,
+ * the replay tool in host/ runs the same functions over recorded samples.
+ */
+
+typedef enum
+{
+    //Light under its threshold, EVENT_LIGHT_THRESHOLD_REACHED
+    CONTROL_LIGHT_REACHED = 1 << 0,
+    //Soil moisture under its threshold, EVENT_MOISTURE_THRESHOLD_REACHED
+    CONTROL_MOISTURE_REACHED = 1 << 1
+} control_reached_t;
+
+typedef enum
+{
+    CONTROL_LIGHT_KEEP,
+    CONTROL_LIGHT_ON,
+    CONTROL_LIGHT_OFF
+} control_light_t;
+
+typedef struct
+{
+    //Light level when the lamp was switched on, what it adds is measured against it
+    uint16_t light_value_before;
+    //From the start of watering to the end of the soak period
+    bool watering;
+    bool pump_on;
+} control_t;
+
+#define CONTROL_INITIALIZER { .light_value_before = 0, .watering = false, .pump_on = false }
+
+/**
+ * @return CONTROL_*_REACHED flags for one sample
+ */
+uint32_t control_check_thresholds(uint16_t light_threshold, uint16_t moisture_threshold, int32_t light,
+                                  int32_t moisture);
+
+//Both do nothing while the lamp state is unknown; that is before mqtt connected,
+//unless CONFIG_PLANT_LOCAL_LIGHT switches the lamp and knows its state from boot on
+control_light_t control_light_reached(control_t* control, light_states_t state, uint16_t light);
+control_light_t control_light_above(control_t* control, light_states_t state, uint16_t light, uint16_t threshold,
+                                    uint16_t margin);
+
+/**
+ * @return true when the pump has to start, false while still watering or soaking
+ */
+bool control_watering_start(control_t* control);
+
+/**
+ * @brief Next step of a watering cycle: the pump stops, then the soak period ends
+ * @return milliseconds until the step after this one, 0 when the cycle is over
+ */
+uint32_t control_watering_step(control_t* control, uint32_t soak_ms);
+
+#endif //CONTROL_H
@@ -27,8 +27,16 @@
 
 #include "driver/gpio.h"
 
+//Datasheet frame: 80us low + 80us high response, 40 bits of 50us low + 26-70us high
+#define DHT11_MIN_INTERVAL_US 2000000
+#define DHT11_SETTLE_US 1000000
+#define DHT11_FRAME_MIN_US 3000
+#define DHT11_FRAME_MAX_US 6000
+#define DHT11_FRAME_BITS 40
+
 enum dht11_status {
-    DHT11_CRC_ERROR = -2,
+    DHT11_BUSY_ERROR = -3,
+    DHT11_CRC_ERROR,
     DHT11_TIMEOUT_ERROR,
     DHT11_OK
 };
@@ -39,9 +47,21 @@ typedef struct
     int32_t temperature;
     int32_t humidity;
     int64_t last_read_time;
+    //Length of the last response, from releasing the bus to the last bit
+    int32_t frame_time_us;
 } dht11_t;
 
 void initialize_dht11(dht11_t* dht11, gpio_num_t gpio);
-void read_dht11(dht11_t* dht11);
+/**
+ * @brief Read temperature and humidity, the values are only updated on DHT11_OK
+ * @note The response is read with interrupts disabled on the calling core, for ~5ms
+ */
+int32_t read_dht11(dht11_t* dht11);
+
+/**
+ * @brief Turn the lengths of the high phases of a frame into bits, check the crc and update the values
+ * @param high_ticks DHT11_FRAME_BITS lengths in microseconds, above 28 is a 1
+ */
+int32_t dht11_decode(dht11_t* dht11, const int8_t* high_ticks);
 
 #endif
\ No newline at end of file
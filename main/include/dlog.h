@@ -0,0 +1,57 @@
+//
+// Created by derk on 19-10-26.
+//
+
+#ifndef DLOG_H
+#define DLOG_H
+
+#include <stdint.h>
+#include <esp_log.h>
+
+#define DLOG_RING_SIZE 64
+#define DLOG_MAX_ARGS 6
+#define DLOG_TASK_STACK_SIZE 3072
+#define DLOG_TASK_PRIORITY 1
+#define DLOG_DRAIN_INTERVAL_MS 100
+//Prefix of a binary record on the console, see tools/dlog_decode.py
+#define DLOG_BINARY_PREFIX "#DLOG "
+
+/*
+ * Deferred logging: the caller only stores the address of the format string,
+ * the tag and up to DLOG_MAX_ARGS raw 32 bit arguments in a lock-free ring.
+ * Formatting and the UART happen later on a low priority task.
+ *
+ * Arguments are passed as 32 bit words, so only integers, chars and pointers
+ * fit (no double or int64_t). A %s argument must point at a string that
+ * outlives the call, a literal or a const table.
+ */
+
+#define DLOG_ARGC(...) DLOG_ARGC_(0, ##__VA_ARGS__, 6, 5, 4, 3, 2, 1, 0)
+#define DLOG_ARGC_(_0, _1, _2, _3, _4, _5, _6, N, ...) N
+
+#define DLOG(level, tag, format, ...) \
+    dlog_write(level, tag, format, DLOG_ARGC(__VA_ARGS__), ##__VA_ARGS__)
+
+#define DLOGE(tag, format, ...) DLOG(ESP_LOG_ERROR, tag, format, ##__VA_ARGS__)
+#define DLOGW(tag, format, ...) DLOG(ESP_LOG_WARN, tag, format, ##__VA_ARGS__)
+#define DLOGI(tag, format, ...) DLOG(ESP_LOG_INFO, tag, format, ##__VA_ARGS__)
+
+typedef struct
+{
+    uint32_t written;
+    uint32_t dropped;
+    uint32_t max_used;
+} dlog_stats_t;
+
+void initialize_dlog(void);
+
+void dlog_write(esp_log_level_t level, const char* tag, const char* format, uint32_t argc, ...);
+
+void dlog_get_stats(dlog_stats_t* stats);
+
+/**
+ * @brief Time DLOGI against ESP_LOGI and log the cost per call
+ */
+void dlog_measure_cost(void);
+
+#endif //DLOG_H
@@ -0,0 +1,76 @@
+//
+// Created by derk on 19-10-26.
+//
+
+#ifndef EVENT_BUS_H
+#define EVENT_BUS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "measurements.h"
+#include "button.h"
+
+#define EVENT_BUS_POOL_SIZE 16
+#define EVENT_BUS_MAX_SUBSCRIBERS 24
+
+typedef enum
+{
+    EVENT_WIFI_STA_START,
+    EVENT_WIFI_AP_START,
+    EVENT_WIFI_CONNECTED,
+    EVENT_WIFI_DISCONNECTED,
+    EVENT_WIFI_CONNECTION_RESET,
+    EVENT_CREDENTIALS_RECEIVED,
+    EVENT_LIGHT_THRESHOLD_RECEIVED,
+    EVENT_MOISTURE_THRESHOLD_RECEIVED,
+    EVENT_LIGHT_THRESHOLD_REACHED,
+    EVENT_LIGHT_ABOVE_THRESHOLD,
+    EVENT_MOISTURE_THRESHOLD_REACHED,
+    EVENT_NEW_SAMPLE,
+    EVENT_BUTTON_PRESSED,
+    EVENT_COUNT
+} event_id_t;
+
+typedef struct
+{
+    uint16_t value;
+    uint16_t threshold;
+} threshold_event_t;
+
+typedef struct
+{
+    event_id_t id;
+    int64_t posted;
+    union
+    {
+        uint16_t threshold;
+        threshold_event_t reached;
+        measurement_snapshot_t sample;
+        button_event_t button;
+    } data;
+} event_t;
+
+typedef void (*event_handler_t)(const event_t* event, void* context);
+
+typedef struct
+{
+    uint32_t posted;
+    uint32_t dispatched;
+    uint32_t dropped;
+    uint32_t queue_depth;
+    uint32_t max_queue_depth;
+    uint32_t last_latency_us;
+    uint32_t max_latency_us;
+    uint64_t total_latency_us;
+} event_bus_stats_t;
+
+void initialize_event_bus(void);
+bool event_bus_subscribe(event_id_t id, event_handler_t handler, void* context);
+
+bool event_bus_post(const event_t* event);
+bool event_bus_post_from_isr(const event_t* event);
+bool event_bus_post_id(event_id_t id);
+
+void event_bus_get_stats(event_bus_stats_t* stats);
+
+#endif //EVENT_BUS_H
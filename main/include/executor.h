@@ -0,0 +1,63 @@
+//
+// Created by derk on 19-10-26.
+//
+
+#ifndef EXECUTOR_H
+#define EXECUTOR_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define EXECUTOR_TASK_STACK_SIZE 4096
+#define EXECUTOR_TASK_PRIORITY 5
+//Timer wheel slots, one slot per tick; longer delays wrap around and wait for their round
+#define EXECUTOR_WHEEL_SLOTS 64
+
+typedef void (*job_fn_t)(void* arg);
+
+/**
+ * A unit of run-to-completion work. Jobs are owned by the caller (usually a
+ * static) and linked into the executor intrusively, so submitting never allocates.
+ * Submitting a job that is already queued is a no-op.
+ */
+typedef struct job
+{
+    job_fn_t fn;
+    void* arg;
+    const char* name;
+    struct job* next;
+    uint32_t queued;
+    struct job* timer_next;
+    uint32_t expiry;
+    uint32_t period;
+    bool armed;
+} job_t;
+
+#define JOB_INITIALIZER(job_fn, job_arg, job_name) { .fn = job_fn, .arg = job_arg, .name = job_name }
+
+typedef struct
+{
+    uint32_t jobs_run;
+    uint32_t max_job_us;
+    const char* slowest_job;
+    uint32_t stack_high_water_mark;
+} executor_stats_t;
+
+void initialize_executor(void);
+
+bool executor_submit(job_t* job);
+bool executor_submit_from_isr(job_t* job);
+/**
+ * @brief Run the job next, after the one that is running now; moves it up when it is already queued
+ */
+void executor_submit_urgent(job_t* job);
+
+void executor_schedule(job_t* job, uint32_t delay_ms, uint32_t period_ms);
+/**
+ * @brief Disarm the timer and take the job off the queue, also when its timer already expired; a running job finishes
+ */
+void executor_cancel(job_t* job);
+
+void executor_get_stats(executor_stats_t* stats);
+
+#endif //EXECUTOR_H
@@ -0,0 +1,89 @@
+//
+// Created by derk on 19-10-26.
+//
+
+#ifndef HAL_H
+#define HAL_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <driver/gpio.h>
+#include <driver/adc.h>
+
+/*
+ * The few hardware calls the drivers make. On the esp32 the time critical ones
+ * are inline wrappers around the IDF drivers, so bit-banging costs the same as
+ * before; the host build (PLANT_HOST) implements all of them against simulated
+ * devices in host/src/hal.c.
+ *
+ * Storage and mqtt are not wrapped here: settings.c and mqtt.c only use a
+ * handful of nvs and esp-mqtt calls, and the host build implements those
+ * interfaces directly.
+ */
+
+typedef void (*hal_isr_t)(void* arg);
+
+void hal_gpio_output(gpio_num_t pin);
+void hal_gpio_input(gpio_num_t pin, bool pull_up);
+
+/**
+ * @brief Call isr from interrupt context on every edge of an input pin
+ */
+void hal_gpio_on_edge(gpio_num_t pin, hal_isr_t isr, void* arg);
+
+//12 bit raw readings, 0 - 3.9V
+void hal_adc_init(adc1_channel_t channel);
+
+//One 8 bit pwm channel for the status led
+void hal_pwm_init(gpio_num_t pin, uint32_t frequency_hz);
+void hal_pwm_set_duty(uint8_t duty);
+
+#ifdef PLANT_HOST
+
+void hal_gpio_set_level(gpio_num_t pin, uint32_t level);
+int hal_gpio_get_level(gpio_num_t pin);
+int32_t hal_adc_read(adc1_channel_t channel);
+int64_t hal_time_us(void);
+void hal_delay_us(uint32_t microseconds);
+uint32_t hal_cycle_count(void);
+
+#else
+
+#include <esp_timer.h>
+#include <esp32/rom/ets_sys.h>
+#include <xtensa/hal.h>
+
+static inline void hal_gpio_set_level(gpio_num_t pin, uint32_t level)
+{
+    gpio_set_level(pin, level);
+}
+
+static inline int hal_gpio_get_level(gpio_num_t pin)
+{
+    return gpio_get_level(pin);
+}
+
+static inline int32_t hal_adc_read(adc1_channel_t channel)
+{
+    return adc1_get_raw(channel);
+}
+
+static inline int64_t hal_time_us(void)
+{
+    return esp_timer_get_time();
+}
+
+static inline void hal_delay_us(uint32_t microseconds)
+{
+    ets_delay_us(microseconds);
+}
+
+//CCOUNT of the calling core, wraps every ~18s at 240MHz
+static inline uint32_t hal_cycle_count(void)
+{
+    return xthal_get_ccount();
+}
+
+#endif
+
+#endif //HAL_H
@@ -0,0 +1,22 @@
+//
+// Created by derk on 19-10-26.
+//
+
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "measurements.h"
+
+//One sample every HISTORY_INTERVAL_S seconds, compressed into a ring of HISTORY_BLOCKS sample blocks.
+//A block holds some 35 samples of a slowly changing plant, the ring about three hours
+#define HISTORY_BLOCKS 32
+#define HISTORY_INTERVAL_S 10
+
+typedef bool (*history_visit_cb_t)(uint32_t timestamp, int32_t value, void* context);
+
+void history_add(const measurement_snapshot_t* sample);
+size_t history_for_each(measurement_type_t type, uint32_t from, history_visit_cb_t callback, void* context);
+
+#endif //HISTORY_H
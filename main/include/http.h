@@ -5,18 +5,22 @@
 #ifndef HTTP_H
 #define HTTP_H
 
-#define MAX_BUF_SIZE 1024
-
-typedef void (*http_cb_t)(void* data);
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include "measurements.h"
 
-typedef struct
-{
-    http_cb_t on_receive_credentials;
-} http_callbacks_t;
+#define MAX_BUF_SIZE 1024
+#define JSON_CHUNK_SIZE 64
+//Also the export chunk, a whole number of sample blocks
+#define HISTORY_CHUNK_SIZE 512
 
-void register_on_receive_credentials_cb(http_cb_t callback);
+/**
+ * @brief The /readings body and websocket frame, timestamp_ms is in ms since boot where /history counts seconds
+ */
+size_t http_format_readings(char* buf, size_t buf_len, const measurement_snapshot_t* sample);
 
-void start_webserver(void * arg);
+void start_webserver(bool provisioning);
 void stop_webserver(void);
 
 #endif //HTTP_H
@@ -0,0 +1,71 @@
+//
+// Created by derk on 19-10-26.
+//
+
+#ifndef JSON_STREAM_H
+#define JSON_STREAM_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define JSON_STREAM_MAX_KEY 16
+#define JSON_STREAM_MAX_LITERAL 24
+
+/*
+ * Incremental tokenizer for small flat JSON documents: one object with scalar
+ * values, or one bare scalar. Input can be fed in chunks of any size, values
+ * of interest are copied into caller provided fixed size fields and nothing is
+ * allocated. Nested objects/arrays and values that do not fit are rejected as
+ * soon as they are seen.
+ */
+
+typedef enum
+{
+    JSON_STREAM_OK,
+    JSON_STREAM_ERROR_SYNTAX,
+    JSON_STREAM_ERROR_OVERFLOW,
+    JSON_STREAM_ERROR_INCOMPLETE
+} json_stream_status_t;
+
+typedef enum
+{
+    JSON_VALUE_NONE,
+    JSON_VALUE_STRING,
+    JSON_VALUE_NUMBER,
+    JSON_VALUE_BOOL,
+    JSON_VALUE_NULL
+} json_value_type_t;
+
+typedef struct
+{
+    const char* key;            //NULL matches a bare top level value
+    char* value;
+    size_t size;                //capacity of value, including the terminator
+    json_value_type_t type;     //JSON_VALUE_NONE when the key was not present
+} json_field_t;
+
+typedef struct
+{
+    json_field_t* fields;
+    size_t field_count;
+    json_field_t* current;
+    uint8_t state;
+    bool top_level;
+    char key[JSON_STREAM_MAX_KEY];
+    size_t key_len;
+    bool key_overflow;
+    char literal[JSON_STREAM_MAX_LITERAL];
+    size_t value_len;
+    uint32_t codepoint;
+    uint8_t unicode_digits;
+    json_stream_status_t status;
+} json_stream_t;
+
+void json_stream_init(json_stream_t* stream, json_field_t* fields, size_t field_count);
+json_stream_status_t json_stream_feed(json_stream_t* stream, const char* data, size_t len);
+json_stream_status_t json_stream_finish(json_stream_t* stream);
+
+bool json_field_to_u16(const json_field_t* field, uint16_t* value);
+
+#endif //JSON_STREAM_H
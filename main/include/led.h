@@ -5,7 +5,14 @@
 #ifndef LED_H
 #define LED_H
 
+#include <stdbool.h>
+#include <stdint.h>
+
 #define STATUS_LED GPIO_NUM_16
+#define LED_PWM_FREQUENCY 5000
+#define LED_DUTY_MAX 255
+//Resolution of fading steps, only used while a fade is running
+#define LED_FADE_INTERVAL_MS 20
 
 enum led_modes
 {
@@ -14,10 +21,32 @@ enum led_modes
     LED_MODE_BLINK,
     LED_MODE_FAST_BLINK,
     LED_MODE_FASTER_BLINK,
+    LED_MODE_BREATHE,
+    LED_MODE_ERROR,
     LED_MODE_NOT_SET
 };
 
+/**
+ * One step of a pattern: go to duty and stay there for duration_ms.
+ * With fade set the duty ramps from the previous step's duty instead of jumping.
+ * A duration of 0 holds the step forever without waking up the cpu.
+ */
+typedef struct
+{
+    uint8_t duty;
+    uint16_t duration_ms;
+    bool fade;
+} led_step_t;
+
+typedef struct
+{
+    const led_step_t* steps;
+    uint8_t step_count;
+    bool repeat;
+} led_pattern_t;
+
 void initialize_status_led(void);
 void set_led_status(enum led_modes led_mode);
+void set_led_pattern(const led_pattern_t* pattern);
 
 #endif //LED_H
@@ -10,24 +10,47 @@
 #define DHT11_GPIO GPIO_NUM_21
 #define KAKU_GPIO GPIO_NUM_23
 #define KAKU_ID 123456
+#define MEASURE_INTERVAL_MS 1000
 
 #include "stdint.h"
-
-typedef void (*measurement_threshold_cb_t)(uint16_t value, uint16_t threshold);
-
-void register_reached_light_threshold_cb(measurement_threshold_cb_t callback);
-void register_reached_moisture_threshold_cb(measurement_threshold_cb_t callback);
-void register_above_light_threshold_cb(measurement_threshold_cb_t callback);
+#include <stdbool.h>
+
+typedef enum
+{
+    MEASUREMENT_TEMPERATURE,
+    MEASUREMENT_HUMIDITY,
+    MEASUREMENT_SOIL_MOISTURE_LEVEL,
+    MEASUREMENT_LIGHT_LEVEL,
+    MEASUREMENT_COUNT
+} measurement_type_t;
+
+#define MEASUREMENT_VALID(type) (1u << (type))
+#define MEASUREMENT_ALL_VALID (MEASUREMENT_VALID(MEASUREMENT_COUNT) - 1)
+
+typedef struct
+{
+    uint32_t sample_id;
+    int64_t timestamp;
+    int32_t values[MEASUREMENT_COUNT];
+    //MEASUREMENT_VALID bits, temperature and humidity stay clear until the DHT11 delivered a good reading
+    uint32_t valid;
+} measurement_snapshot_t;
 
 void initialize_measurements(void);
-void switch_radio_outlet(void);
+/**
+ * @brief Switch the outlet through the KAKU transmitter, sent right away or as soon as the transmitter is free
+ */
+void set_radio_outlet(bool on);
+//The state last asked for, off from boot on
+bool radio_outlet_is_on(void);
 
 int32_t get_temperature(void);
 int32_t get_humidity(void);
 int32_t get_soil_moisture_level(void);
 int32_t get_light_level(void);
-
-void set_light_threshold(uint16_t threshold);
-void set_moisture_threshold(uint16_t threshold);
+void get_measurement_snapshot(measurement_snapshot_t* snapshot);
+const char* get_measurement_name(measurement_type_t type);
+const char* get_measurement_unit(measurement_type_t type);
+measurement_type_t get_measurement_type(const char* name);
 
 #endif //MEASUREMENTS_H
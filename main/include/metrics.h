@@ -0,0 +1,82 @@
+//
+// Created by derk on 19-10-26.
+//
+
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <freertos/FreeRTOS.h>
+
+//Tasks listed with their stack high water mark
+#define METRICS_MAX_TASKS 24
+//Longest line written through the callback
+#define METRICS_LINE_SIZE 128
+
+typedef enum
+{
+    METRIC_DHT11_CRC_ERRORS,
+    METRIC_DHT11_TIMEOUTS,
+    //A get_*() getter gave up on the measure mutex and returned its fallback value
+    METRIC_SENSOR_LOCK_TIMEOUTS,
+    METRIC_MQTT_PUBLISHES,
+    METRIC_MQTT_PUBLISH_FAILURES,
+    METRIC_MQTT_PUBACKS,
+    METRIC_MQTT_CONNECTS,
+    METRIC_MQTT_DISCONNECTS,
+    METRIC_WIFI_DISCONNECTS,
+    METRIC_COUNTER_COUNT
+} metric_counter_t;
+
+typedef enum
+{
+    //Publish call to PUBACK
+    METRIC_HISTOGRAM_PUBACK_RTT,
+    //Sample taken to the PUBACK of its first message
+    METRIC_HISTOGRAM_SAMPLE_LATENCY,
+    //Start of a broker connection to CONNACK, the TLS handshake included
+    METRIC_HISTOGRAM_MQTT_CONNECT,
+    METRIC_HISTOGRAM_COUNT
+} metric_histogram_t;
+
+//Upper bounds in milliseconds, the last bucket is +Inf
+#define METRICS_BUCKETS { 5, 10, 25, 50, 100, 250, 500, 1000, 2500, 5000 }
+#define METRICS_BUCKET_COUNT 11
+
+/*
+ * Every core counts in its own slots, so an increment is a single relaxed
+ * atomic add that never contends with the other core. Readers add the slots
+ * up and may be off by whatever is being counted at that moment.
+ */
+typedef struct
+{
+    uint32_t counters[METRIC_COUNTER_COUNT];
+    uint32_t buckets[METRIC_HISTOGRAM_COUNT][METRICS_BUCKET_COUNT];
+    uint32_t sum_ms[METRIC_HISTOGRAM_COUNT];
+} metrics_core_t;
+
+extern metrics_core_t metrics_cores[portNUM_PROCESSORS];
+
+static inline void metrics_add(metric_counter_t counter, uint32_t value)
+{
+    __atomic_fetch_add(&metrics_cores[xPortGetCoreID()].counters[counter], value, __ATOMIC_RELAXED);
+}
+
+static inline void metrics_increment(metric_counter_t counter)
+{
+    metrics_add(counter, 1);
+}
+
+void metrics_observe(metric_histogram_t histogram, uint32_t value_us);
+
+typedef bool (*metrics_write_cb_t)(const char* line, size_t len, void* context);
+
+/**
+ * @brief Write every metric in the Prometheus text format, one line per callback
+ * @note Not reentrant, call it from one task only (the http server)
+ */
+void metrics_render(metrics_write_cb_t callback, void* context);
+
+#endif //METRICS_H
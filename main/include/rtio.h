@@ -0,0 +1,84 @@
+//
+// Created by derk on 19-10-26.
+//
+
+#ifndef RTIO_H
+#define RTIO_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <freertos/FreeRTOS.h>
+
+//The host build measured 3447 bytes on x86-64, the same as the executor that gets 4096
+#define RTIO_TASK_STACK_SIZE 4096
+//Above lwip (18) and the executor, the wifi task is pinned to the other core
+#define RTIO_TASK_PRIORITY 20
+#ifdef CONFIG_FREERTOS_UNICORE
+#define RTIO_TASK_CORE 0
+#else
+#define RTIO_TASK_CORE APP_CPU_NUM
+#endif
+#define RTIO_QUEUE_LENGTH 4
+#define RTIO_DHT11_RETRIES 2
+//Deviation from the nominal transmit time before a KAKU frame counts as disturbed
+#define RTIO_KAKU_TOLERANCE_PERCENT 5
+
+typedef enum
+{
+    RTIO_OP_DHT11_READ,
+    RTIO_OP_KAKU_SWITCH,
+    RTIO_OP_COUNT
+} rtio_op_t;
+
+/**
+ * A request for the real-time I/O task. The device (dht11_t or kaku_t) belongs
+ * to the rtio task while the request is pending; the owner may only read it,
+ * and the status, once rtio_pending() returns false.
+ */
+typedef struct
+{
+    rtio_op_t op;
+    void* device;
+    int32_t status;
+    uint32_t pending;
+    int64_t submitted;
+    //Sample the request belongs to, its spans show up under this id in the trace
+    uint32_t trace_id;
+} rtio_request_t;
+
+//Status of a request that never completed, no driver returns it
+#define RTIO_STATUS_NONE INT32_MIN
+
+#define RTIO_REQUEST_INITIALIZER(request_op, request_device) \
+    { .op = request_op, .device = request_device, .status = RTIO_STATUS_NONE }
+
+typedef struct
+{
+    uint32_t completed;
+    uint32_t failed;
+    uint32_t retries;
+    uint32_t timing_violations;
+    //Time between submitting and starting the operation
+    uint32_t max_start_latency_us;
+    //Deviation of the timed window from its nominal length
+    uint32_t last_jitter_us;
+    uint32_t max_jitter_us;
+} rtio_op_stats_t;
+
+typedef struct
+{
+    rtio_op_stats_t ops[RTIO_OP_COUNT];
+    uint32_t rejected;
+} rtio_stats_t;
+
+void initialize_rtio(void);
+
+/**
+ * @brief Queue a request, fails when it is still pending or the queue is full
+ */
+bool rtio_submit(rtio_request_t* request);
+bool rtio_pending(const rtio_request_t* request);
+
+void rtio_get_stats(rtio_stats_t* stats);
+
+#endif //RTIO_H
@@ -0,0 +1,87 @@
+//
+// Created by derk on 19-10-26.
+//
+
+#ifndef SAMPLE_CODEC_H
+#define SAMPLE_CODEC_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "measurements.h"
+
+/*
+ * Compressed sample blocks, for everything that keeps or moves samples in bulk.
+ *
+ * A block has a fixed size and decodes on its own, so a store of blocks can be
+ * read from any block on. Each record starts with a byte that flags the fields
+ * that changed; only those follow, as zigzag varints:
+ *  - the timestamp as delta of delta, a steady interval costs nothing
+ *  - every value as delta to the previous record; a second difference would
+ *    double the noise on the adc readings instead of removing it
+ * The first record is coded against the timestamp in the header and zeroes.
+ * Encoder and decoder keep their state in the caller's struct, nothing is allocated.
+ */
+
+#define SAMPLE_BLOCK_SIZE 128
+#define SAMPLE_BLOCK_HEADER_SIZE 8
+#define SAMPLE_BLOCK_DATA_SIZE (SAMPLE_BLOCK_SIZE - SAMPLE_BLOCK_HEADER_SIZE)
+//Flag byte plus a 5 byte varint for the timestamp and every value
+#define SAMPLE_RECORD_MAX_SIZE (1 + 5 * (1 + MEASUREMENT_COUNT))
+
+typedef struct
+{
+    //Seconds, the same clock as the history
+    uint32_t timestamp;
+    int32_t values[MEASUREMENT_COUNT];
+} sample_record_t;
+
+typedef struct
+{
+    uint32_t first_timestamp;
+    uint16_t count;
+    //Bytes of data in use
+    uint16_t length;
+    uint8_t data[SAMPLE_BLOCK_DATA_SIZE];
+} sample_block_t;
+
+_Static_assert(sizeof(sample_block_t) == SAMPLE_BLOCK_SIZE, "sample_block_t is not packed");
+
+typedef struct
+{
+    sample_block_t* block;
+    uint32_t timestamp;
+    int32_t interval;
+    int32_t values[MEASUREMENT_COUNT];
+} sample_encoder_t;
+
+typedef struct
+{
+    const sample_block_t* block;
+    uint16_t index;
+    uint16_t offset;
+    uint32_t timestamp;
+    int32_t interval;
+    int32_t values[MEASUREMENT_COUNT];
+} sample_decoder_t;
+
+/**
+ * @brief Start an empty block, its first record has to be at or after first_timestamp
+ */
+void sample_encoder_init(sample_encoder_t* encoder, sample_block_t* block, uint32_t first_timestamp);
+/**
+ * @return false when the record does not fit in the block any more, the block is left as it was
+ */
+bool sample_encoder_add(sample_encoder_t* encoder, const sample_record_t* record);
+
+/**
+ * @return false for a block that can not have been written by the encoder, such as erased flash
+ */
+bool sample_block_valid(const sample_block_t* block);
+
+void sample_decoder_init(sample_decoder_t* decoder, const sample_block_t* block);
+/**
+ * @return false after the last record, or at data that does not decode
+ */
+bool sample_decoder_next(sample_decoder_t* decoder, sample_record_t* record);
+
+#endif //SAMPLE_CODEC_H
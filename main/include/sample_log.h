@@ -0,0 +1,60 @@
+//
+// Created by derk on 19-10-26.
+//
+
+#ifndef SAMPLE_LOG_H
+#define SAMPLE_LOG_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "measurements.h"
+#include "sample_codec.h"
+
+#define SAMPLE_LOG_PARTITION_LABEL "samples"
+#define SAMPLE_LOG_PARTITION_SUBTYPE 0x41
+//Erase unit of the flash; a sector is a header block followed by sample blocks
+#define SAMPLE_LOG_SECTOR_SIZE 4096
+#define SAMPLE_LOG_BLOCKS_PER_SECTOR (SAMPLE_LOG_SECTOR_SIZE / SAMPLE_BLOCK_SIZE - 1)
+#define SAMPLE_LOG_MAX_SECTORS 256
+//Erases and writes full blocks, below the executor
+#define SAMPLE_LOG_TASK_STACK_SIZE 3072
+#define SAMPLE_LOG_TASK_PRIORITY 1
+
+typedef struct
+{
+    uint32_t sectors;
+    //Blocks on flash, the ones still in ram not included
+    uint32_t blocks;
+    uint32_t oldest;
+    uint32_t newest;
+    uint32_t erases;
+} sample_log_stats_t;
+
+/**
+ * @return false to stop
+ */
+typedef bool (*sample_log_block_cb_t)(const sample_block_t* block, void* context);
+
+void initialize_sample_log(void);
+/**
+ * @brief Log every CONFIG_PLANT_SAMPLE_LOG_INTERVAL_S seconds, called for every sample from the measure job
+ */
+void sample_log_add(const measurement_snapshot_t* sample);
+/**
+ * @brief Write the full block that still waits for the writer task, on the caller's task
+ */
+void sample_log_flush(void);
+/**
+ * @brief The log clock: seconds, carried on from the newest logged sample at boot
+ */
+uint32_t sample_log_now(void);
+/**
+ * @brief Visit, oldest first, every block that can hold samples between from and to (inclusive)
+ * @note Blocks at either end also hold samples outside the range
+ * @return Blocks visited
+ */
+size_t sample_log_for_each_block(uint32_t from, uint32_t to, sample_log_block_cb_t callback, void* context);
+void sample_log_get_stats(sample_log_stats_t* stats);
+
+#endif //SAMPLE_LOG_H
@@ -0,0 +1,60 @@
+//
+// Created by derk on 19-10-26.
+//
+
+#ifndef SETTINGS_H
+#define SETTINGS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "wifi.h"
+
+#define SETTINGS_NAMESPACE "storage"
+//Updates are committed once nothing changed for this long
+#define SETTINGS_COMMIT_DELAY_MS 5000
+
+typedef struct
+{
+    uint16_t light_threshold;
+    uint16_t moisture_threshold;
+    //An empty ssid means no network was saved
+    network_credentials_t credentials;
+} settings_t;
+
+typedef struct
+{
+    uint32_t updates;
+    uint32_t commits;
+    uint32_t failed_commits;
+    //Commits over the lifetime of the device, kept in nvs itself
+    uint32_t wear;
+    bool pending;
+} settings_stats_t;
+
+/**
+ * @brief Load the settings from nvs, call once after initialize_nvs
+ */
+void initialize_settings(void);
+
+void settings_get(settings_t* settings);
+uint16_t settings_get_light_threshold(void);
+uint16_t settings_get_moisture_threshold(void);
+bool settings_get_credentials(network_credentials_t* credentials);
+
+/*
+ * Setters update the cache right away and are never blocked by flash. The nvs
+ * commit happens on the executor, SETTINGS_COMMIT_DELAY_MS after the last change.
+ */
+void settings_set_light_threshold(uint16_t threshold);
+void settings_set_moisture_threshold(uint16_t threshold);
+void settings_set_credentials(const char* ssid, const char* password);
+void settings_clear_credentials(void);
+
+/**
+ * @brief Commit pending changes now, before a restart. Runs on the executor.
+ */
+void settings_flush(void);
+
+void settings_get_stats(settings_stats_t* stats);
+
+#endif //SETTINGS_H
@@ -0,0 +1,56 @@
+//
+// Created by derk on 19-10-26.
+//
+
+#ifndef STATIC_ALLOC_H
+#define STATIC_ALLOC_H
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/queue.h>
+#include <freertos/semphr.h>
+#include <freertos/event_groups.h>
+#include <freertos/timers.h>
+
+/*
+ * Creates RTOS objects from static buffers when CONFIG_PLANT_STATIC_ALLOCATION
+ * is set and from the heap otherwise. Buffers are declared with STATIC_BUFFER,
+ * which expands to nothing in the dynamic build. Include this header last: in
+ * the static build it poisons the heap APIs for the rest of the file.
+ */
+
+#ifdef CONFIG_PLANT_STATIC_ALLOCATION
+
+#define STATIC_BUFFER(type, name) static type name
+
+#define CREATE_TASK(fn, name, stack_size, param, priority, handle, core, stack, tcb) \
+    (*(handle) = xTaskCreateStaticPinnedToCore(fn, name, stack_size, param, priority, stack, &(tcb), core))
+#define CREATE_QUEUE(length, item_size, storage, buffer) \
+    xQueueCreateStatic(length, item_size, storage, &(buffer))
+#define CREATE_MUTEX(buffer) xSemaphoreCreateMutexStatic(&(buffer))
+#define CREATE_EVENT_GROUP(buffer) xEventGroupCreateStatic(&(buffer))
+#define CREATE_TIMER(name, period, reload, id, callback, buffer) \
+    xTimerCreateStatic(name, period, reload, id, callback, &(buffer))
+
+//The dynamic variants are macros, they have to go before they can be poisoned
+#undef xQueueCreate
+#undef xSemaphoreCreateMutex
+#undef xSemaphoreCreateBinary
+#pragma GCC poison malloc calloc realloc free strdup heap_caps_malloc heap_caps_calloc heap_caps_realloc
+#pragma GCC poison xTaskCreate xTaskCreatePinnedToCore xQueueCreate xSemaphoreCreateMutex xSemaphoreCreateBinary
+#pragma GCC poison xEventGroupCreate xTimerCreate
+
+#else
+
+#define STATIC_BUFFER(type, name)
+
+#define CREATE_TASK(fn, name, stack_size, param, priority, handle, core, stack, tcb) \
+    xTaskCreatePinnedToCore(fn, name, stack_size, param, priority, handle, core)
+#define CREATE_QUEUE(length, item_size, storage, buffer) xQueueCreate(length, item_size)
+#define CREATE_MUTEX(buffer) xSemaphoreCreateMutex()
+#define CREATE_EVENT_GROUP(buffer) xEventGroupCreate()
+#define CREATE_TIMER(name, period, reload, id, callback, buffer) xTimerCreate(name, period, reload, id, callback)
+
+#endif
+
+#endif //STATIC_ALLOC_H
@@ -49,4 +49,14 @@ typedef struct
 void initialize_kaku(gpio_num_t pin, uint32_t id, int8_t dim_level, kaku_group_t group, kaku_device_t device,
                      uint8_t repeat, kaku_t* kaku);
 
-void switch_kaku(kaku_t* kaku);
\ No newline at end of file
+void switch_kaku(kaku_t* kaku);
+
+/**
+ * @brief Code word for the current state, without the id bits when dimming
+ */
+uint32_t kaku_code(const kaku_t* kaku);
+
+/**
+ * @brief Nominal length of a switch_kaku transmission, all repeats included
+ */
+uint32_t kaku_transmit_time_us(const kaku_t* kaku);
\ No newline at end of file
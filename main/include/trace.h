@@ -0,0 +1,95 @@
+//
+// Created by derk on 19-10-26.
+//
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+//Completed spans kept for the console dump, older ones are overwritten
+#define TRACE_RING_SIZE 128
+//Publishes waiting for their PUBACK, the oldest is forgotten when full
+#define TRACE_INFLIGHT_SIZE 16
+//Tasks covered by the runtime stats
+#define TRACE_MAX_TASKS 24
+#define TRACE_DUMP_INTERVAL_MS 1000
+#define TRACE_DIAGNOSTICS_INTERVAL_MS 10000
+
+typedef enum
+{
+    TRACE_SPAN_MEASURE,
+    TRACE_SPAN_LOCK_WAIT,
+    TRACE_SPAN_SENSOR_READ,
+    TRACE_SPAN_DHT11_READ,
+    TRACE_SPAN_THRESHOLD,
+    TRACE_SPAN_SEND_DATA,
+    TRACE_SPAN_PUBLISH,
+    //From the publish call to its PUBACK, time spent in the outbox and on the network
+    TRACE_SPAN_PUBACK,
+    //From mqtt_send_light_message to the socket/1/state publish
+    TRACE_SPAN_ACTUATION,
+    //Telemetry waiting in its lane, from send_data to its publish
+    TRACE_SPAN_TELEMETRY_QUEUE,
+    TRACE_SPAN_COUNT
+} trace_span_t;
+
+typedef struct
+{
+    uint32_t count;
+    uint32_t max_us;
+    uint64_t total_us;
+} trace_span_stats_t;
+
+typedef struct
+{
+    trace_span_stats_t spans[TRACE_SPAN_COUNT];
+    //Sample taken to PUBACK of the first message carrying it
+    uint32_t samples;
+    uint32_t last_latency_us;
+    uint32_t max_latency_us;
+    uint64_t total_latency_us;
+    //Overwritten before the dump got to them, or PUBACKs for unknown messages
+    uint32_t dropped;
+    uint32_t unmatched;
+} trace_stats_t;
+
+void initialize_trace(void);
+
+/**
+ * @brief Start a span, returns the start time to hand to trace_end()
+ */
+int64_t trace_begin(void);
+
+/**
+ * @brief Record a span of the given sample that started at start
+ * @note Safe from any task, the sample id ties spans of the same measurement together
+ */
+void trace_end(trace_span_t span, uint32_t sample_id, int64_t start);
+
+/**
+ * @brief Remember a published message until its PUBACK arrives
+ * @param msg_id id returned by esp_mqtt_client_publish, ignored when it is not positive
+ * @param sampled_at timestamp of the sample in the message
+ */
+void trace_publish(int msg_id, uint32_t sample_id, int64_t sampled_at);
+
+/**
+ * @brief Close the span of a published message, call on MQTT_EVENT_PUBLISHED
+ */
+void trace_puback(int msg_id);
+
+void trace_get_stats(trace_stats_t* stats);
+
+/**
+ * @brief Write span, latency and per-task cpu statistics as json
+ * @return length written, 0 when it did not fit
+ * @note The cpu figures cover the time since the previous call
+ */
+size_t trace_format_diagnostics(char* buffer, size_t size);
+
+const char* trace_span_name(trace_span_t span);
+
+#endif //TRACE_H
@@ -0,0 +1,40 @@
+//
+// Created by derk on 19-10-26.
+//
+
+#ifndef WINDOW_STATS_H
+#define WINDOW_STATS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Count, min, max, mean and standard deviation of one measurement over a
+ * window, updated per sample in constant memory (Welford's algorithm, which
+ * does not lose the variance to cancellation like a sum of squares does).
+ */
+typedef struct
+{
+    uint32_t count;
+    int32_t min;
+    int32_t max;
+    double mean;
+    //Sum of squared distances to the mean
+    double m2;
+} window_stats_t;
+
+void window_stats_reset(window_stats_t* stats);
+void window_stats_add(window_stats_t* stats, int32_t value);
+/**
+ * @return Population standard deviation, 0 for less than two samples
+ */
+double window_stats_stddev(const window_stats_t* stats);
+
+/**
+ * @brief Format as {"count":..,"min":..,"max":..,"mean":..,"std":..,"unit":..,"window_s":..}
+ * @return Length written, 0 when it does not fit
+ */
+size_t window_stats_format(char* buffer, size_t size, const window_stats_t* stats, const char* unit,
+                           uint32_t window_s);
+
+#endif //WINDOW_STATS_H
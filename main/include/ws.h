@@ -0,0 +1,32 @@
+//
+// Created by derk on 19-10-26.
+//
+
+#ifndef WS_H
+#define WS_H
+
+#include <stdint.h>
+#include <esp_http_server.h>
+#include "measurements.h"
+
+#define WS_MAX_CLIENTS 8
+#define WS_QUEUE_DEPTH 4
+//The newest WS_QUEUE_DEPTH frames, one being sent and one being encoded; full queues drop their oldest frame
+#define WS_FRAME_POOL_SIZE (WS_QUEUE_DEPTH + 2)
+#define WS_FRAME_SIZE 256
+
+typedef struct
+{
+    uint32_t clients;
+    uint32_t frames_sent;
+    uint32_t frames_dropped;
+    uint32_t frames_not_encoded;
+} ws_stats_t;
+
+void ws_register_handlers(httpd_handle_t server);
+void ws_unregister_handlers(void);
+void ws_close_session(int sockfd);
+void ws_push_sample(const measurement_snapshot_t* sample);
+void ws_get_stats(ws_stats_t* stats);
+
+#endif //WS_H
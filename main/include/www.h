@@ -0,0 +1,17 @@
+//
+// Created by derk on 19-10-26.
+//
+
+#ifndef WWW_H
+#define WWW_H
+
+#include <esp_http_server.h>
+
+#define WWW_PARTITION_LABEL "www"
+#define WWW_PARTITION_SUBTYPE 0x40
+#define WWW_CACHE_CONTROL_PAGE "no-cache"
+#define WWW_CACHE_CONTROL_ASSET "public, max-age=3600"
+
+void www_register_handlers(httpd_handle_t server);
+
+#endif //WWW_H
@@ -3,6 +3,7 @@
 //
 
 #include "nvs_flash.h"
+#include "static_alloc.h"
 
 void initialize_nvs(void)
 {
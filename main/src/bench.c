@@ -0,0 +1,160 @@
+//
+// Created by derk on 19-10-26.
+//
+
+#include "bench.h"
+
+#include <stdio.h>
+#include <nvs.h>
+#include <esp_log.h>
+#include "hal.h"
+#include "switch_kaku.h"
+#include "dht11.h"
+#include "mqtt.h"
+#include "control.h"
+#include "settings.h"
+#include "static_alloc.h"
+
+static const char *TAG = "bench";
+
+typedef struct
+{
+    const char* name;
+    void (*run)(uint32_t iterations);
+    uint32_t max_iterations;
+} bench_case_t;
+
+//Results go here so the calls cannot be optimized away
+static volatile uint32_t sink;
+
+//humidity 55, temperature 21, crc 76; a 1 is a long high phase
+static const uint8_t dht11_frame[5] = { 55, 0, 21, 0, 76 };
+static int8_t dht11_ticks[DHT11_FRAME_BITS];
+
+static void bench_kaku_code(uint32_t iterations)
+{
+    kaku_t kaku = {
+        .id = 12345678,
+        .dim_level = -1,
+        .group = KAKU_GROUP_1,
+        .device = KAKU_DEVICE_1,
+        .repeat = 4
+    };
+
+    for(uint32_t i = 0; i < iterations; ++i)
+    {
+        kaku.state = i & 1 ? KAKU_STATE_ON : KAKU_STATE_OFF;
+        sink += kaku_code(&kaku);
+    }
+}
+
+static void bench_dht11_decode(uint32_t iterations)
+{
+    dht11_t dht11 = { 0 };
+
+    for(uint32_t i = 0; i < iterations; ++i)
+        sink += dht11_decode(&dht11, dht11_ticks) + dht11.temperature;
+}
+
+static void bench_format_value(uint32_t iterations)
+{
+    //The size send_data uses
+    char buffer[100];
+
+    for(uint32_t i = 0; i < iterations; ++i)
+        sink += mqtt_format_value(buffer, sizeof(buffer), (int32_t)(i & 4095), "raw");
+}
+
+static void bench_check_thresholds(uint32_t iterations)
+{
+    for(uint32_t i = 0; i < iterations; ++i)
+        sink += control_check_thresholds(1000, 1500, (int32_t)((i * 7) & 4095), (int32_t)((i * 13) & 4095));
+}
+
+static void bench_settings_read(uint32_t iterations)
+{
+    for(uint32_t i = 0; i < iterations; ++i)
+        sink += settings_get_light_threshold() + settings_get_moisture_threshold();
+}
+
+static void bench_nvs_read(uint32_t iterations)
+{
+    nvs_handle_t nvs_handle;
+    uint16_t value = 0;
+
+    if(nvs_open(BENCH_NAMESPACE, NVS_READWRITE, &nvs_handle) != ESP_OK) return;
+    nvs_set_u16(nvs_handle, "light_th", 1000);
+    for(uint32_t i = 0; i < iterations; ++i)
+    {
+        nvs_get_u16(nvs_handle, "light_th", &value);
+        sink += value;
+    }
+    nvs_close(nvs_handle);
+}
+
+static void bench_nvs_write(uint32_t iterations)
+{
+    nvs_handle_t nvs_handle;
+
+    if(nvs_open(BENCH_NAMESPACE, NVS_READWRITE, &nvs_handle) != ESP_OK) return;
+    //nvs skips a write of an unchanged value, alternate so every commit hits the flash
+    for(uint32_t i = 0; i < iterations; ++i)
+    {
+        nvs_set_u16(nvs_handle, "light_th", (uint16_t)(1000 + (i & 1)));
+        nvs_commit(nvs_handle);
+    }
+    nvs_close(nvs_handle);
+}
+
+static const bench_case_t cases[] = {
+    { "kaku_code", bench_kaku_code, UINT32_MAX },
+    { "dht11_decode", bench_dht11_decode, UINT32_MAX },
+    { "format_value", bench_format_value, UINT32_MAX },
+    { "check_thresholds", bench_check_thresholds, UINT32_MAX },
+    { "settings_read", bench_settings_read, UINT32_MAX },
+    { "nvs_read", bench_nvs_read, UINT32_MAX },
+    { "nvs_write", bench_nvs_write, BENCH_NVS_WRITES }
+};
+
+static void run_case(const bench_case_t* bench)
+{
+    uint32_t iterations = 1;
+
+    for(;;)
+    {
+        int64_t start = hal_time_us();
+        uint32_t start_cycles = hal_cycle_count();
+        bench->run(iterations);
+        uint32_t cycles = hal_cycle_count() - start_cycles;
+        int64_t elapsed = hal_time_us() - start;
+
+        if(elapsed >= BENCH_MIN_US || iterations >= bench->max_iterations)
+        {
+            printf("#BENCH %s %.1f %.1f %u\n", bench->name, elapsed * 1000.0 / iterations,
+                   (double)cycles / iterations, iterations);
+            return;
+        }
+        iterations = iterations > bench->max_iterations / 2 ? bench->max_iterations : iterations * 2;
+    }
+}
+
+static void remove_bench_values(void)
+{
+    nvs_handle_t nvs_handle;
+
+    if(nvs_open(BENCH_NAMESPACE, NVS_READWRITE, &nvs_handle) != ESP_OK) return;
+    nvs_erase_key(nvs_handle, "light_th");
+    nvs_commit(nvs_handle);
+    nvs_close(nvs_handle);
+}
+
+void bench_run(void)
+{
+    for(int i = 0; i < DHT11_FRAME_BITS; ++i)
+        dht11_ticks[i] = dht11_frame[i / 8] & (1 << (7 - i % 8)) ? 68 : 24;
+
+    ESP_LOGI(TAG, "%d kernels, at least %d ms each", (int)(sizeof(cases) / sizeof(cases[0])), BENCH_MIN_US / 1000);
+    for(size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); ++i)
+        run_case(&cases[i]);
+    remove_bench_values();
+}
@@ -0,0 +1,83 @@
+//
+// Created by derk on 19-10-26.
+//
+
+#include "boot.h"
+
+#include <assert.h>
+#include <stdbool.h>
+#include <freertos/FreeRTOS.h>
+#include <esp_timer.h>
+#include <esp_log.h>
+#include "executor.h"
+#include "static_alloc.h"
+
+static const char *TAG = "boot";
+
+static const char* phase_names[BOOT_PHASE_COUNT] = {
+    "nvs",
+    "led",
+    "services",
+    "sensors",
+    "wifi_init",
+    "first_sample",
+    "dht11_ready",
+    "wifi_connected",
+    "mqtt_connected",
+    "first_publish"
+};
+
+//esp_timer starts with the application, the bootloader is not included
+static int64_t phase_times[BOOT_PHASE_COUNT];
+static portMUX_TYPE boot_lock = portMUX_INITIALIZER_UNLOCKED;
+static uint32_t reported = 0;
+
+static void report(void* param);
+static job_t report_job = JOB_INITIALIZER(report, NULL, "boot_report");
+
+void boot_mark(boot_phase_t phase)
+{
+    assert(phase < BOOT_PHASE_COUNT);
+    int64_t now = esp_timer_get_time();
+
+    //No 64 bit atomics on this core
+    portENTER_CRITICAL(&boot_lock);
+    bool first = phase_times[phase] == 0;
+    if(first)
+        phase_times[phase] = now;
+    portEXIT_CRITICAL(&boot_lock);
+    if(!first) return;
+
+    if(phase == BOOT_PHASE_FIRST_PUBLISH)
+        executor_submit(&report_job);
+}
+
+int64_t boot_phase_time(boot_phase_t phase)
+{
+    assert(phase < BOOT_PHASE_COUNT);
+    portENTER_CRITICAL(&boot_lock);
+    int64_t time = phase_times[phase];
+    portEXIT_CRITICAL(&boot_lock);
+    return time;
+}
+
+static void report(void* param)
+{
+    if(__atomic_exchange_n(&reported, 1, __ATOMIC_RELAXED)) return;
+    executor_cancel(&report_job);
+
+    ESP_LOGI(TAG, "Boot report, ms since startup:");
+    for(int phase = 0; phase < BOOT_PHASE_COUNT; ++phase)
+    {
+        int64_t time = boot_phase_time(phase);
+        if(time)
+            ESP_LOGI(TAG, "  %-16s %6d", phase_names[phase], (int32_t)(time / 1000));
+        else
+            ESP_LOGI(TAG, "  %-16s      -", phase_names[phase]);
+    }
+}
+
+void initialize_boot_report(void)
+{
+    executor_schedule(&report_job, BOOT_REPORT_TIMEOUT_MS, 0);
+}
@@ -4,38 +4,129 @@
 
 #include "button.h"
 #include <freertos/FreeRTOS.h>
-#include <freertos/semphr.h>
-#include <freertos/task.h>
-#include <driver/gpio.h>
+#include <freertos/timers.h>
+#include "event_bus.h"
+#include "hal.h"
+#include "static_alloc.h"
 
-#define ESP_INTR_FLAG_DEFAULT 0
+typedef enum
+{
+    GESTURE_IDLE,
+    GESTURE_PRESSED,
+    GESTURE_SECOND_PRESSED,
+    GESTURE_LONG_HELD,
+    GESTURE_WAIT_SECOND
+} gesture_state_t;
 
-SemaphoreHandle_t reset_button_semaphore = NULL ;
+//Both run on the shared FreeRTOS timer task, no task of our own
+static TimerHandle_t debounce_timer = NULL;
+static TimerHandle_t gesture_timer = NULL;
+STATIC_BUFFER(StaticTimer_t, debounce_timer_buffer);
+STATIC_BUFFER(StaticTimer_t, gesture_timer_buffer);
 
+static gesture_state_t gesture_state = GESTURE_IDLE;
+static bool stable_pressed = false;
 
 static void IRAM_ATTR isr_reset_button_pressed(void *args)
 {
-    xSemaphoreGiveFromISR(reset_button_semaphore, NULL);
+    BaseType_t higher_priority_task_woken = pdFALSE;
+
+    //Every edge restarts the debounce period, the level is sampled once the contact settles
+    xTimerResetFromISR(debounce_timer, &higher_priority_task_woken);
+    portYIELD_FROM_ISR(higher_priority_task_woken);
 }
 
-void setup_reset_button(void)
+static void emit(button_event_t gesture)
 {
-    reset_button_semaphore = xSemaphoreCreateBinary();
-    gpio_pad_select_gpio(RESET_CONNECTION_BUTTON_GPIO);
-    gpio_set_direction(RESET_CONNECTION_BUTTON_GPIO, GPIO_MODE_INPUT);
-    gpio_set_pull_mode(RESET_CONNECTION_BUTTON_GPIO, GPIO_PULLUP_ONLY);
-    gpio_set_intr_type(RESET_CONNECTION_BUTTON_GPIO, GPIO_INTR_POSEDGE);
+    event_t event = {
+        .id = EVENT_BUTTON_PRESSED,
+        .data.button = gesture
+    };
+    event_bus_post(&event);
+}
 
-    //Configure interrupt and add handler
-    gpio_install_isr_service(ESP_INTR_FLAG_DEFAULT);
-    gpio_isr_handler_add(RESET_CONNECTION_BUTTON_GPIO, isr_reset_button_pressed, NULL);
+static void start_gesture_timer(uint32_t ms)
+{
+    xTimerChangePeriod(gesture_timer, pdMS_TO_TICKS(ms), 0);
 }
 
-bool wait_until_reset_button_pressed(void)
+static void on_press(void)
 {
-    if ( xSemaphoreTake (reset_button_semaphore , portMAX_DELAY)  == pdTRUE )
+    switch(gesture_state)
     {
-        return gpio_get_level(RESET_CONNECTION_BUTTON_GPIO);
+    case GESTURE_IDLE:
+        gesture_state = GESTURE_PRESSED;
+        start_gesture_timer(BUTTON_LONG_PRESS_MS);
+        break;
+    case GESTURE_WAIT_SECOND:
+        gesture_state = GESTURE_SECOND_PRESSED;
+        start_gesture_timer(BUTTON_LONG_PRESS_MS);
+        break;
+    default:
+        break;
     }
-    return false;
-}
\ No newline at end of file
+}
+
+static void on_release(void)
+{
+    switch(gesture_state)
+    {
+    case GESTURE_PRESSED:
+        gesture_state = GESTURE_WAIT_SECOND;
+        start_gesture_timer(BUTTON_DOUBLE_PRESS_MS);
+        break;
+    case GESTURE_SECOND_PRESSED:
+        xTimerStop(gesture_timer, 0);
+        gesture_state = GESTURE_IDLE;
+        emit(BUTTON_EVENT_DOUBLE_PRESS);
+        break;
+    case GESTURE_LONG_HELD:
+        gesture_state = GESTURE_IDLE;
+        break;
+    default:
+        break;
+    }
+}
+
+static void on_gesture_timeout(TimerHandle_t timer)
+{
+    switch(gesture_state)
+    {
+    case GESTURE_PRESSED:
+    case GESTURE_SECOND_PRESSED:
+        //Still held, report it now instead of waiting for the release
+        gesture_state = GESTURE_LONG_HELD;
+        emit(BUTTON_EVENT_LONG_PRESS);
+        break;
+    case GESTURE_WAIT_SECOND:
+        gesture_state = GESTURE_IDLE;
+        emit(BUTTON_EVENT_SHORT_PRESS);
+        break;
+    default:
+        break;
+    }
+}
+
+static void on_debounced(TimerHandle_t timer)
+{
+    //Pulled up, so pressed reads low
+    bool pressed = hal_gpio_get_level(RESET_CONNECTION_BUTTON_GPIO) == 0;
+    if(pressed == stable_pressed) return;
+
+    stable_pressed = pressed;
+    if(pressed)
+        on_press();
+    else
+        on_release();
+}
+
+void setup_reset_button(void)
+{
+    debounce_timer = CREATE_TIMER("debounce", pdMS_TO_TICKS(BUTTON_DEBOUNCE_MS), pdFALSE, NULL, on_debounced,
+                                  debounce_timer_buffer);
+    gesture_timer = CREATE_TIMER("gesture", pdMS_TO_TICKS(BUTTON_LONG_PRESS_MS), pdFALSE, NULL, on_gesture_timeout,
+                                 gesture_timer_buffer);
+
+    hal_gpio_input(RESET_CONNECTION_BUTTON_GPIO, true);
+    hal_gpio_on_edge(RESET_CONNECTION_BUTTON_GPIO, isr_reset_button_pressed, NULL);
+}
@@ -0,0 +1,68 @@
+//
+// Created by derk on 19-10-26.
+//
+
+#include "control.h"
+
+#include <assert.h>
+
+uint32_t control_check_thresholds(uint16_t light_threshold, uint16_t moisture_threshold, int32_t light,
+                                  int32_t moisture)
+{
+    uint32_t reached = 0;
+
+    //If ldr value is under threshold -> turn on light
+    if(light < light_threshold)
+        reached |= CONTROL_LIGHT_REACHED;
+    //If soil moisture is under threshold -> then give water
+    if(moisture < moisture_threshold)
+        reached |= CONTROL_MOISTURE_REACHED;
+    return reached;
+}
+
+control_light_t control_light_reached(control_t* control, light_states_t state, uint16_t light)
+{
+    assert(control);
+
+    //Only start measuring when light is off
+    if(state != LIGHT_STATES_OFF) return CONTROL_LIGHT_KEEP;
+    control->light_value_before = light;
+    return CONTROL_LIGHT_ON;
+}
+
+control_light_t control_light_above(control_t* control, light_states_t state, uint16_t light, uint16_t threshold,
+                                    uint16_t margin)
+{
+    assert(control);
+    if(state != LIGHT_STATES_ON) return CONTROL_LIGHT_KEEP;
+
+    //What switching the light added, off once there is more than that by a margin
+    uint16_t difference = light - control->light_value_before;
+    if(difference > threshold + margin)
+        return CONTROL_LIGHT_OFF;
+    return CONTROL_LIGHT_KEEP;
+}
+
+bool control_watering_start(control_t* control)
+{
+    assert(control);
+
+    //Still watering or letting the water soak in
+    if(control->watering) return false;
+    control->watering = true;
+    control->pump_on = true;
+    return true;
+}
+
+uint32_t control_watering_step(control_t* control, uint32_t soak_ms)
+{
+    assert(control);
+
+    if(control->pump_on)
+    {
+        control->pump_on = false;
+        return soak_ms;
+    }
+    control->watering = false;
+    return 0;
+}
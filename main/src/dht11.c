@@ -22,21 +22,21 @@
  * SOFTWARE.
 */
 
-#include "esp_timer.h"
-#include "driver/gpio.h"
-#include "esp32/rom/ets_sys.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 
 #include "dht11.h"
+#include "hal.h"
+
+static portMUX_TYPE dht11_lock = portMUX_INITIALIZER_UNLOCKED;
 
 static int wait_or_timeout(dht11_t* dht11, uint16_t microseconds, int32_t level) {
     int32_t micros_ticks = 0;
-    while(gpio_get_level(dht11->pin) == level)
+    while(hal_gpio_get_level(dht11->pin) == level)
     {
         if(micros_ticks++ > microseconds)
             return DHT11_TIMEOUT_ERROR;
-        ets_delay_us(1);
+        hal_delay_us(1);
     }
     return micros_ticks;
 }
@@ -51,12 +51,17 @@ static int32_t check_crc(const uint8_t* data)
 static void send_start_signal(dht11_t* dht11)
 {
     gpio_num_t pin = dht11->pin;
-    gpio_set_direction(pin, GPIO_MODE_OUTPUT);
-    gpio_set_level(pin, 0);
-    ets_delay_us(20 * 1000);
-    gpio_set_level(pin, 1);
-    ets_delay_us(40);
-    gpio_set_direction(pin, GPIO_MODE_INPUT);
+    hal_gpio_output(pin);
+    hal_gpio_set_level(pin, 0);
+    //At least 18ms, the exact length does not matter so there is no need to spin
+    vTaskDelay(pdMS_TO_TICKS(20) + 1);
+}
+
+static void release_bus(dht11_t* dht11)
+{
+    hal_gpio_set_level(dht11->pin, 1);
+    hal_delay_us(40);
+    hal_gpio_input(dht11->pin, false);
 }
 
 static int32_t check_response(dht11_t* dht11)
@@ -76,40 +81,66 @@ void initialize_dht11(dht11_t* dht11, gpio_num_t gpio)
 {
     if(!dht11) return;
 
-    // Wait 1 seconds to make the device pass its initial unstable status
-    vTaskDelay(1000 / portTICK_PERIOD_MS);
     dht11->pin = gpio;
+    // The device needs 1 second to pass its initial unstable status, reads are refused until then
+    dht11->last_read_time = hal_time_us() + DHT11_SETTLE_US - DHT11_MIN_INTERVAL_US;
 }
 
-void read_dht11(dht11_t* dht11)
+static int32_t read_response(dht11_t* dht11, int8_t* high_ticks)
 {
-    if(!dht11) return;
-    // Tried to sense too soon since last read (dht11 needs ~2 seconds to make a new read)
-    if(esp_timer_get_time() - 2000000 < dht11->last_read_time) return;
-
-    dht11->last_read_time = esp_timer_get_time();
-
-    uint8_t data[5] = {0, 0, 0, 0, 0};
-
-    send_start_signal(dht11);
-    if(check_response(dht11) == DHT11_TIMEOUT_ERROR) return;
+    if(check_response(dht11) == DHT11_TIMEOUT_ERROR) return DHT11_TIMEOUT_ERROR;
 
     // Read response
-    for(int i = 0; i < 40; i++)
+    for(int i = 0; i < DHT11_FRAME_BITS; i++)
     {
         // Initial data
-        if(wait_or_timeout(dht11, 50, 0) == DHT11_TIMEOUT_ERROR) return;
+        if(wait_or_timeout(dht11, 50, 0) == DHT11_TIMEOUT_ERROR) return DHT11_TIMEOUT_ERROR;
+
+        //A high phase that times out still ends the bit, it counts as a 0
+        high_ticks[i] = (int8_t)wait_or_timeout(dht11, 70, 1);
+    }
+    return DHT11_OK;
+}
+
+int32_t dht11_decode(dht11_t* dht11, const int8_t* high_ticks)
+{
+    uint8_t data[5] = {0, 0, 0, 0, 0};
 
-        if(wait_or_timeout(dht11, 70, 1) > 28)
+    for(int i = 0; i < DHT11_FRAME_BITS; i++)
+    {
+        if(high_ticks[i] > 28)
         {
             /* Bit received was a 1 */
             data[i/8] |= (1 << (7-(i%8)));
         }
     }
+    if(check_crc(data) == DHT11_CRC_ERROR) return DHT11_CRC_ERROR;
 
-    if(check_crc(data) != DHT11_CRC_ERROR)
-    {
-        dht11->temperature = data[2];
-        dht11->humidity = data[0];
-    }
+    dht11->temperature = data[2];
+    dht11->humidity = data[0];
+    return DHT11_OK;
+}
+
+int32_t read_dht11(dht11_t* dht11)
+{
+    if(!dht11) return DHT11_TIMEOUT_ERROR;
+    // Tried to sense too soon since last read (dht11 needs ~2 seconds to make a new read)
+    if(hal_time_us() - DHT11_MIN_INTERVAL_US < dht11->last_read_time) return DHT11_BUSY_ERROR;
+
+    dht11->last_read_time = hal_time_us();
+
+    int8_t high_ticks[DHT11_FRAME_BITS];
+
+    send_start_signal(dht11);
+
+    //Bits are told apart by the length of their high phase, an interrupt in between turns a 0 into a 1
+    portENTER_CRITICAL(&dht11_lock);
+    int64_t start = hal_time_us();
+    release_bus(dht11);
+    int32_t status = read_response(dht11, high_ticks);
+    dht11->frame_time_us = (int32_t)(hal_time_us() - start);
+    portEXIT_CRITICAL(&dht11_lock);
+
+    if(status != DHT11_OK) return status;
+    return dht11_decode(dht11, high_ticks);
 }
\ No newline at end of file
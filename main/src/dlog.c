@@ -0,0 +1,181 @@
+//
+// Created by derk on 19-10-26.
+//
+
+#include "dlog.h"
+
+#include <assert.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <esp_timer.h>
+#include "static_alloc.h"
+
+/*
+ * Bounded multi-producer ring with a sequence number per slot. A producer
+ * claims a position with a CAS, fills the slot and publishes it by bumping
+ * the slot sequence; the drain task is the only consumer. A full ring drops
+ * the record and counts it, the caller never waits.
+ */
+
+typedef struct
+{
+    uint32_t sequence;
+    uint32_t timestamp;
+    const char* format;
+    const char* tag;
+    uint8_t level;
+    uint8_t argc;
+    uint32_t args[DLOG_MAX_ARGS];
+} dlog_slot_t;
+
+static const char *TAG = "dlog";
+
+static dlog_slot_t ring[DLOG_RING_SIZE];
+static uint32_t write_position = 0;
+static uint32_t read_position = 0;
+static dlog_stats_t stats;
+
+STATIC_BUFFER(StackType_t, dlog_stack[DLOG_TASK_STACK_SIZE]);
+STATIC_BUFFER(StaticTask_t, dlog_tcb);
+
+void dlog_write(esp_log_level_t level, const char* tag, const char* format, uint32_t argc, ...)
+{
+    uint32_t position = __atomic_load_n(&write_position, __ATOMIC_RELAXED);
+    dlog_slot_t* slot;
+    for(;;)
+    {
+        slot = &ring[position % DLOG_RING_SIZE];
+        int32_t difference = (int32_t)(__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) - position);
+        if(difference == 0)
+        {
+            if(__atomic_compare_exchange_n(&write_position, &position, position + 1, true, __ATOMIC_RELAXED,
+                                           __ATOMIC_RELAXED))
+                break;
+        }
+        else if(difference < 0)
+        {
+            //The drain has not freed this slot yet
+            __atomic_add_fetch(&stats.dropped, 1, __ATOMIC_RELAXED);
+            return;
+        }
+        else
+        {
+            position = __atomic_load_n(&write_position, __ATOMIC_RELAXED);
+        }
+    }
+
+    va_list args;
+    va_start(args, argc);
+    for(uint32_t i = 0; i < argc && i < DLOG_MAX_ARGS; ++i)
+        slot->args[i] = va_arg(args, uint32_t);
+    va_end(args);
+
+    slot->timestamp = esp_log_timestamp();
+    slot->format = format;
+    slot->tag = tag;
+    slot->level = level;
+    slot->argc = argc < DLOG_MAX_ARGS ? argc : DLOG_MAX_ARGS;
+    __atomic_store_n(&slot->sequence, position + 1, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&stats.written, 1, __ATOMIC_RELAXED);
+}
+
+#ifdef CONFIG_PLANT_DLOG_BINARY
+static void emit(const dlog_slot_t* slot)
+{
+    //Little endian words: timestamp, format, tag, level | argc << 8, args
+    uint32_t words[4 + DLOG_MAX_ARGS] = {
+        slot->timestamp,
+        (uint32_t)(uintptr_t) slot->format,
+        (uint32_t)(uintptr_t) slot->tag,
+        slot->level | (uint32_t) slot->argc << 8
+    };
+    memcpy(&words[4], slot->args, slot->argc * sizeof(uint32_t));
+
+    fputs(DLOG_BINARY_PREFIX, stdout);
+    const uint8_t* bytes = (const uint8_t*) words;
+    for(size_t i = 0; i < (4 + slot->argc) * sizeof(uint32_t); ++i)
+        printf("%02x", bytes[i]);
+    putchar('\n');
+}
+#else
+static const char level_letters[] = { 'N', 'E', 'W', 'I', 'D', 'V' };
+
+static void emit(const dlog_slot_t* slot)
+{
+    const uint32_t* a = slot->args;
+    char letter = slot->level < sizeof(level_letters) ? level_letters[slot->level] : '?';
+
+    //Extra arguments are ignored by printf, so every record can pass all of them
+    printf("%c (%u) %s: ", letter, slot->timestamp, slot->tag);
+    printf(slot->format, a[0], a[1], a[2], a[3], a[4], a[5]);
+    putchar('\n');
+}
+#endif
+
+static void drain(void* param)
+{
+    uint32_t reported_drops = 0;
+    for(;;)
+    {
+        vTaskDelay(pdMS_TO_TICKS(DLOG_DRAIN_INTERVAL_MS));
+
+        uint32_t used = __atomic_load_n(&write_position, __ATOMIC_RELAXED) - read_position;
+        if(used > stats.max_used)
+            stats.max_used = used;
+
+        for(;;)
+        {
+            dlog_slot_t* slot = &ring[read_position % DLOG_RING_SIZE];
+            if(__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) != read_position + 1)
+                break;
+
+            emit(slot);
+            //Hand the slot back to the producers one lap later
+            __atomic_store_n(&slot->sequence, read_position + DLOG_RING_SIZE, __ATOMIC_RELEASE);
+            ++read_position;
+        }
+
+        uint32_t dropped = __atomic_load_n(&stats.dropped, __ATOMIC_RELAXED);
+        if(dropped != reported_drops)
+        {
+            ESP_LOGW(TAG, "Dropped %d records", dropped - reported_drops);
+            reported_drops = dropped;
+        }
+    }
+}
+
+void initialize_dlog(void)
+{
+    TaskHandle_t handle;
+    for(uint32_t i = 0; i < DLOG_RING_SIZE; ++i)
+        ring[i].sequence = i;
+
+    CREATE_TASK(drain, "dlog", DLOG_TASK_STACK_SIZE, NULL, DLOG_TASK_PRIORITY, &handle, tskNO_AFFINITY, dlog_stack,
+                dlog_tcb);
+}
+
+void dlog_get_stats(dlog_stats_t* stats_out)
+{
+    assert(stats_out);
+    memcpy(stats_out, &stats, sizeof(stats));
+}
+
+void dlog_measure_cost(void)
+{
+    const int calls = 16;
+    int64_t start = esp_timer_get_time();
+    for(int i = 0; i < calls; ++i)
+        ESP_LOGI(TAG, "cost probe %d: %d", i, calls);
+    int64_t esp_log_time = esp_timer_get_time() - start;
+
+    start = esp_timer_get_time();
+    for(int i = 0; i < calls; ++i)
+        DLOGI(TAG, "cost probe %d: %d", i, calls);
+    int64_t dlog_time = esp_timer_get_time() - start;
+
+    ESP_LOGI(TAG, "Per call: ESP_LOGI %d ns, DLOGI %d ns", (int32_t)(esp_log_time * 1000 / calls),
+             (int32_t)(dlog_time * 1000 / calls));
+}
@@ -0,0 +1,232 @@
+//
+// Created by derk on 19-10-26.
+//
+
+#include "event_bus.h"
+
+#include <assert.h>
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <esp_timer.h>
+#include <esp_log.h>
+#include "executor.h"
+#include "static_alloc.h"
+
+/*
+ * Producers take a node from a lock-free pool, fill it in and push it on a
+ * Vyukov style intrusive MPSC queue, then submit the dispatch job. All of it is
+ * O(1) and never blocks, so it is safe from event loops, timers and ISRs.
+ * Handlers run on the executor, one event after the other.
+ */
+
+#define FREE_LIST_EMPTY 0
+#define FREE_LIST_INDEX_MASK 0xFFFFu
+
+typedef struct event_node
+{
+    event_t event;
+    struct event_node* next;
+    uint16_t free_next;
+} event_node_t;
+
+typedef struct
+{
+    event_id_t id;
+    event_handler_t handler;
+    void* context;
+} subscriber_t;
+
+static const char *TAG = "event_bus";
+
+static event_node_t nodes[EVENT_BUS_POOL_SIZE];
+static event_node_t stub;
+
+//Free list head: generation tag in the upper half against ABA, index + 1 in the lower half
+static uint32_t free_list = FREE_LIST_EMPTY;
+
+static event_node_t* queue_head = &stub;
+static event_node_t* queue_tail = &stub;
+
+static subscriber_t subscribers[EVENT_BUS_MAX_SUBSCRIBERS];
+static uint32_t subscriber_count = 0;
+
+static void dispatch_events(void* param);
+
+//Submitting a queued job is a no-op, so a burst of posts costs a single dispatch run
+static job_t dispatch_job = JOB_INITIALIZER(dispatch_events, NULL, "event_bus");
+static event_bus_stats_t stats;
+
+static void free_node(event_node_t* node)
+{
+    uint16_t index = (uint16_t)(node - nodes) + 1;
+    uint32_t old_head = __atomic_load_n(&free_list, __ATOMIC_RELAXED);
+    uint32_t new_head;
+    do
+    {
+        node->free_next = old_head & FREE_LIST_INDEX_MASK;
+        new_head = (((old_head >> 16) + 1) << 16) | index;
+    } while(!__atomic_compare_exchange_n(&free_list, &old_head, new_head, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+static event_node_t* allocate_node(void)
+{
+    uint32_t old_head = __atomic_load_n(&free_list, __ATOMIC_ACQUIRE);
+    uint32_t new_head;
+    do
+    {
+        uint16_t index = old_head & FREE_LIST_INDEX_MASK;
+        if(index == FREE_LIST_EMPTY) return NULL;
+        new_head = (((old_head >> 16) + 1) << 16) | nodes[index - 1].free_next;
+    } while(!__atomic_compare_exchange_n(&free_list, &old_head, new_head, true, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE));
+    return &nodes[(old_head & FREE_LIST_INDEX_MASK) - 1];
+}
+
+static void push(event_node_t* node)
+{
+    __atomic_store_n(&node->next, NULL, __ATOMIC_RELAXED);
+    event_node_t* previous = __atomic_exchange_n(&queue_tail, node, __ATOMIC_ACQ_REL);
+    __atomic_store_n(&previous->next, node, __ATOMIC_RELEASE);
+}
+
+//Only called by the dispatcher
+static event_node_t* pop(void)
+{
+    event_node_t* head = queue_head;
+    event_node_t* next = __atomic_load_n(&head->next, __ATOMIC_ACQUIRE);
+
+    if(head == &stub)
+    {
+        if(!next) return NULL;
+        queue_head = next;
+        head = next;
+        next = __atomic_load_n(&next->next, __ATOMIC_ACQUIRE);
+    }
+
+    if(next)
+    {
+        queue_head = next;
+        return head;
+    }
+
+    //A producer swapped the tail but did not link its node yet, it submits the dispatch once it has
+    if(head != __atomic_load_n(&queue_tail, __ATOMIC_ACQUIRE))
+        return NULL;
+
+    push(&stub);
+    next = __atomic_load_n(&head->next, __ATOMIC_ACQUIRE);
+    if(next)
+    {
+        queue_head = next;
+        return head;
+    }
+    return NULL;
+}
+
+static void update_max(uint32_t* max, uint32_t value)
+{
+    uint32_t current = __atomic_load_n(max, __ATOMIC_RELAXED);
+    while(value > current &&
+          !__atomic_compare_exchange_n(max, &current, value, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+static bool enqueue(const event_t* event)
+{
+    assert(event);
+    assert(event->id < EVENT_COUNT);
+
+    event_node_t* node = allocate_node();
+    if(!node)
+    {
+        __atomic_add_fetch(&stats.dropped, 1, __ATOMIC_RELAXED);
+        return false;
+    }
+
+    memcpy(&node->event, event, sizeof(node->event));
+    node->event.posted = esp_timer_get_time();
+    push(node);
+
+    __atomic_add_fetch(&stats.posted, 1, __ATOMIC_RELAXED);
+    update_max(&stats.max_queue_depth, __atomic_add_fetch(&stats.queue_depth, 1, __ATOMIC_RELAXED));
+    return true;
+}
+
+bool event_bus_post(const event_t* event)
+{
+    if(!enqueue(event)) return false;
+    executor_submit(&dispatch_job);
+    return true;
+}
+
+bool event_bus_post_from_isr(const event_t* event)
+{
+    if(!enqueue(event)) return false;
+    executor_submit_from_isr(&dispatch_job);
+    return true;
+}
+
+bool event_bus_post_id(event_id_t id)
+{
+    event_t event = {
+        .id = id
+    };
+    return event_bus_post(&event);
+}
+
+bool event_bus_subscribe(event_id_t id, event_handler_t handler, void* context)
+{
+    assert(id < EVENT_COUNT);
+    assert(handler);
+
+    uint32_t index = __atomic_load_n(&subscriber_count, __ATOMIC_RELAXED);
+    if(index >= EVENT_BUS_MAX_SUBSCRIBERS)
+    {
+        ESP_LOGE(TAG, "No room for another subscriber");
+        return false;
+    }
+
+    subscribers[index].id = id;
+    subscribers[index].handler = handler;
+    subscribers[index].context = context;
+    //Publish the entry only once it is complete, the dispatcher reads the table without locking
+    __atomic_store_n(&subscriber_count, index + 1, __ATOMIC_RELEASE);
+    return true;
+}
+
+static void dispatch(const event_t* event)
+{
+    uint32_t latency = (uint32_t)(esp_timer_get_time() - event->posted);
+    stats.last_latency_us = latency;
+    stats.total_latency_us += latency;
+    update_max(&stats.max_latency_us, latency);
+
+    uint32_t count = __atomic_load_n(&subscriber_count, __ATOMIC_ACQUIRE);
+    for(uint32_t i = 0; i < count; ++i)
+    {
+        if(subscribers[i].id == event->id)
+            subscribers[i].handler(event, subscribers[i].context);
+    }
+    __atomic_add_fetch(&stats.dispatched, 1, __ATOMIC_RELAXED);
+}
+
+static void dispatch_events(void* param)
+{
+    event_node_t* node;
+    while((node = pop()) != NULL)
+    {
+        __atomic_sub_fetch(&stats.queue_depth, 1, __ATOMIC_RELAXED);
+        dispatch(&node->event);
+        free_node(node);
+    }
+}
+
+void initialize_event_bus(void)
+{
+    for(int i = 0; i < EVENT_BUS_POOL_SIZE; ++i)
+        free_node(&nodes[i]);
+}
+
+void event_bus_get_stats(event_bus_stats_t* stats_out)
+{
+    assert(stats_out);
+    memcpy(stats_out, &stats, sizeof(stats));
+}
@@ -0,0 +1,307 @@
+//
+// Created by derk on 19-10-26.
+//
+
+#include "executor.h"
+
+#include <assert.h>
+#include <string.h>
+#include <sys/param.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <esp_timer.h>
+#include "static_alloc.h"
+
+/*
+ * One task runs every job to completion, in submission order; urgent jobs
+ * skip ahead to the front of the queue but never preempt. Delayed and
+ * periodic jobs sit in a hashed timer wheel keyed by FreeRTOS tick and are
+ * moved to the work queue when they expire. The task sleeps until the next
+ * expiry or until something is submitted, so idle jobs cost no wakeups.
+ */
+
+static portMUX_TYPE executor_lock = portMUX_INITIALIZER_UNLOCKED;
+static TaskHandle_t executor_handle = NULL;
+STATIC_BUFFER(StackType_t, executor_stack[EXECUTOR_TASK_STACK_SIZE]);
+STATIC_BUFFER(StaticTask_t, executor_tcb);
+
+static job_t* queue_head = NULL;
+static job_t* queue_tail = NULL;
+
+static job_t* wheel[EXECUTOR_WHEEL_SLOTS];
+static uint32_t armed_count = 0;
+static TickType_t wheel_tick = 0;
+//No armed job expires before it; only early after a cancel, which costs one wakeup
+static TickType_t next_expiry = 0;
+
+static executor_stats_t stats;
+
+//Caller holds executor_lock
+static bool enqueue(job_t* job)
+{
+    if(job->queued) return false;
+    job->queued = 1;
+    job->next = NULL;
+    if(queue_tail)
+        queue_tail->next = job;
+    else
+        queue_head = job;
+    queue_tail = job;
+    return true;
+}
+
+//Caller holds executor_lock
+static void remove_queued(job_t* job)
+{
+    if(!job->queued) return;
+    job_t** link = &queue_head;
+    job_t* previous = NULL;
+    while(*link != job)
+    {
+        previous = *link;
+        link = &(*link)->next;
+    }
+    *link = job->next;
+    if(queue_tail == job)
+        queue_tail = previous;
+    job->queued = 0;
+}
+
+//Caller holds executor_lock
+static void enqueue_front(job_t* job)
+{
+    remove_queued(job);
+    job->queued = 1;
+    job->next = queue_head;
+    queue_head = job;
+    if(!queue_tail)
+        queue_tail = job;
+}
+
+static job_t* dequeue(void)
+{
+    portENTER_CRITICAL(&executor_lock);
+    job_t* job = queue_head;
+    if(job)
+    {
+        queue_head = job->next;
+        if(!queue_head) queue_tail = NULL;
+        //Cleared before running, so a job can resubmit itself
+        job->queued = 0;
+    }
+    portEXIT_CRITICAL(&executor_lock);
+    return job;
+}
+
+bool executor_submit(job_t* job)
+{
+    assert(job && job->fn);
+    portENTER_CRITICAL(&executor_lock);
+    bool queued = enqueue(job);
+    portEXIT_CRITICAL(&executor_lock);
+
+    if(queued && executor_handle)
+        xTaskNotifyGive(executor_handle);
+    return queued;
+}
+
+void executor_submit_urgent(job_t* job)
+{
+    assert(job && job->fn);
+    portENTER_CRITICAL(&executor_lock);
+    enqueue_front(job);
+    portEXIT_CRITICAL(&executor_lock);
+
+    if(executor_handle)
+        xTaskNotifyGive(executor_handle);
+}
+
+bool executor_submit_from_isr(job_t* job)
+{
+    BaseType_t higher_priority_task_woken = pdFALSE;
+    assert(job && job->fn);
+    portENTER_CRITICAL_ISR(&executor_lock);
+    bool queued = enqueue(job);
+    portEXIT_CRITICAL_ISR(&executor_lock);
+
+    if(queued && executor_handle)
+        vTaskNotifyGiveFromISR(executor_handle, &higher_priority_task_woken);
+    portYIELD_FROM_ISR(higher_priority_task_woken);
+    return queued;
+}
+
+//Caller holds executor_lock
+static void unlink_timer(job_t* job)
+{
+    if(!job->armed) return;
+    job_t** link = &wheel[job->expiry % EXECUTOR_WHEEL_SLOTS];
+    while(*link && *link != job)
+        link = &(*link)->timer_next;
+    if(*link)
+        *link = job->timer_next;
+    job->armed = false;
+    --armed_count;
+}
+
+//Caller holds executor_lock
+static void link_timer(job_t* job, uint32_t expiry)
+{
+    job->expiry = expiry;
+    job->armed = true;
+    if(!armed_count || (int32_t)(expiry - next_expiry) < 0)
+        next_expiry = expiry;
+    job->timer_next = wheel[expiry % EXECUTOR_WHEEL_SLOTS];
+    wheel[expiry % EXECUTOR_WHEEL_SLOTS] = job;
+    ++armed_count;
+}
+
+void executor_schedule(job_t* job, uint32_t delay_ms, uint32_t period_ms)
+{
+    assert(job && job->fn);
+    TickType_t delay = pdMS_TO_TICKS(delay_ms);
+
+    portENTER_CRITICAL(&executor_lock);
+    unlink_timer(job);
+    job->period = pdMS_TO_TICKS(period_ms);
+    if(period_ms && !job->period) job->period = 1;
+    //Never in the past, expire() only looks at ticks after wheel_tick
+    link_timer(job, MAX(xTaskGetTickCount(), wheel_tick + 1) + delay);
+    portEXIT_CRITICAL(&executor_lock);
+
+    //Wake the executor so it can shorten its sleep
+    if(executor_handle)
+        xTaskNotifyGive(executor_handle);
+}
+
+void executor_cancel(job_t* job)
+{
+    assert(job);
+    portENTER_CRITICAL(&executor_lock);
+    unlink_timer(job);
+    job->period = 0;
+    //Also when the timer already expired and the job waits to run
+    remove_queued(job);
+    portEXIT_CRITICAL(&executor_lock);
+}
+
+//Caller holds executor_lock and armed_count is not 0
+static TickType_t find_next_expiry(void)
+{
+    TickType_t earliest = 0;
+    bool found = false;
+
+    //Every armed job expires after wheel_tick, the first one due in its own slot is the earliest
+    for(TickType_t tick = wheel_tick + 1; tick != wheel_tick + 1 + EXECUTOR_WHEEL_SLOTS; ++tick)
+    {
+        for(job_t* job = wheel[tick % EXECUTOR_WHEEL_SLOTS]; job; job = job->timer_next)
+        {
+            if(job->expiry == tick)
+                return tick;
+            //A later round, only the earliest if nothing is due within this one
+            if(!found || (int32_t)(job->expiry - earliest) < 0)
+                earliest = job->expiry;
+            found = true;
+        }
+    }
+    return earliest;
+}
+
+static void expire(TickType_t now)
+{
+    portENTER_CRITICAL(&executor_lock);
+    //Woken by a submit, nothing is due: no need to look at the wheel
+    if(!armed_count || (int32_t)(next_expiry - now) > 0)
+    {
+        wheel_tick = now;
+        portEXIT_CRITICAL(&executor_lock);
+        return;
+    }
+
+    //Visit every slot at most once per call, older ticks map onto the same slots
+    TickType_t first = wheel_tick + 1;
+    if(now - wheel_tick > EXECUTOR_WHEEL_SLOTS)
+        first = now - EXECUTOR_WHEEL_SLOTS + 1;
+
+    for(TickType_t tick = first; (int32_t)(now - tick) >= 0; ++tick)
+    {
+        job_t** link = &wheel[tick % EXECUTOR_WHEEL_SLOTS];
+        while(*link)
+        {
+            job_t* job = *link;
+            if((int32_t)(now - job->expiry) < 0)
+            {
+                link = &job->timer_next;
+                continue;
+            }
+
+            *link = job->timer_next;
+            job->armed = false;
+            --armed_count;
+            enqueue(job);
+            //Periodic jobs keep their phase instead of drifting by their own run time
+            if(job->period)
+                link_timer(job, MAX(job->expiry + job->period, now + 1));
+            //The re-linked job may now sit in the slot we are walking, skip past it
+            if(*link == job)
+                link = &job->timer_next;
+        }
+    }
+    wheel_tick = now;
+    if(armed_count)
+        next_expiry = find_next_expiry();
+    portEXIT_CRITICAL(&executor_lock);
+}
+
+static TickType_t next_timeout(void)
+{
+    TickType_t now = xTaskGetTickCount();
+    TickType_t timeout = portMAX_DELAY;
+
+    portENTER_CRITICAL(&executor_lock);
+    if(armed_count)
+    {
+        int32_t remaining = (int32_t)(next_expiry - now);
+        timeout = remaining > 0 ? (TickType_t) remaining : 0;
+    }
+    portEXIT_CRITICAL(&executor_lock);
+    return timeout;
+}
+
+static void run_executor(void* param)
+{
+    job_t* job;
+
+    for(;;)
+    {
+        ulTaskNotifyTake(pdTRUE, next_timeout());
+        expire(xTaskGetTickCount());
+
+        while((job = dequeue()) != NULL)
+        {
+            int64_t start = esp_timer_get_time();
+            job->fn(job->arg);
+            uint32_t duration = (uint32_t)(esp_timer_get_time() - start);
+
+            ++stats.jobs_run;
+            if(duration > stats.max_job_us)
+            {
+                stats.max_job_us = duration;
+                stats.slowest_job = job->name;
+            }
+        }
+    }
+}
+
+void initialize_executor(void)
+{
+    wheel_tick = xTaskGetTickCount();
+    CREATE_TASK(run_executor, "executor", EXECUTOR_TASK_STACK_SIZE, NULL, EXECUTOR_TASK_PRIORITY,
+                &executor_handle, tskNO_AFFINITY, executor_stack, executor_tcb);
+}
+
+void executor_get_stats(executor_stats_t* stats_out)
+{
+    assert(stats_out);
+    memcpy(stats_out, &stats, sizeof(stats));
+    stats_out->stack_high_water_mark = executor_handle ? uxTaskGetStackHighWaterMark(executor_handle) : 0;
+}
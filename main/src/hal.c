@@ -0,0 +1,76 @@
+//
+// Created by derk on 19-10-26.
+//
+
+#include "hal.h"
+
+#include <esp32/rom/gpio.h>
+#include <driver/ledc.h>
+#include "static_alloc.h"
+
+#define ESP_INTR_FLAG_DEFAULT 0
+#define PWM_SPEED_MODE LEDC_HIGH_SPEED_MODE
+#define PWM_CHANNEL LEDC_CHANNEL_0
+#define PWM_TIMER LEDC_TIMER_0
+
+static bool isr_service_installed = false;
+
+void hal_gpio_output(gpio_num_t pin)
+{
+    gpio_pad_select_gpio(pin);
+    gpio_set_direction(pin, GPIO_MODE_OUTPUT);
+}
+
+void hal_gpio_input(gpio_num_t pin, bool pull_up)
+{
+    gpio_pad_select_gpio(pin);
+    gpio_set_direction(pin, GPIO_MODE_INPUT);
+    if(pull_up)
+        gpio_set_pull_mode(pin, GPIO_PULLUP_ONLY);
+}
+
+void hal_gpio_on_edge(gpio_num_t pin, hal_isr_t isr, void* arg)
+{
+    gpio_set_intr_type(pin, GPIO_INTR_ANYEDGE);
+    if(!isr_service_installed)
+    {
+        gpio_install_isr_service(ESP_INTR_FLAG_DEFAULT);
+        isr_service_installed = true;
+    }
+    gpio_isr_handler_add(pin, isr, arg);
+}
+
+void hal_adc_init(adc1_channel_t channel)
+{
+    ESP_ERROR_CHECK(adc1_config_width(ADC_WIDTH_BIT_12));
+    ESP_ERROR_CHECK(adc1_config_channel_atten(channel, ADC_ATTEN_DB_11));
+}
+
+void hal_pwm_init(gpio_num_t pin, uint32_t frequency_hz)
+{
+    ledc_timer_config_t timer_config = {
+        .speed_mode = PWM_SPEED_MODE,
+        .duty_resolution = LEDC_TIMER_8_BIT,
+        .timer_num = PWM_TIMER,
+        .freq_hz = frequency_hz,
+        .clk_cfg = LEDC_AUTO_CLK
+    };
+    ESP_ERROR_CHECK(ledc_timer_config(&timer_config));
+
+    ledc_channel_config_t channel_config = {
+        .gpio_num = pin,
+        .speed_mode = PWM_SPEED_MODE,
+        .channel = PWM_CHANNEL,
+        .intr_type = LEDC_INTR_DISABLE,
+        .timer_sel = PWM_TIMER,
+        .duty = 0,
+        .hpoint = 0
+    };
+    ESP_ERROR_CHECK(ledc_channel_config(&channel_config));
+}
+
+void hal_pwm_set_duty(uint8_t duty)
+{
+    ledc_set_duty(PWM_SPEED_MODE, PWM_CHANNEL, duty);
+    ledc_update_duty(PWM_SPEED_MODE, PWM_CHANNEL);
+}
@@ -0,0 +1,112 @@
+//
+// Created by derk on 19-10-26.
+//
+
+#include "history.h"
+#include <assert.h>
+#include <string.h>
+#include "sample_codec.h"
+#include "static_alloc.h"
+
+/*
+ * Single writer (measure task). It only ever appends to the newest block and
+ * moves on to the oldest one when that is full. Every block has a sequence
+ * count that is odd while the writer changes it; readers copy a block, retry
+ * when it changed under them and skip it when the writer lapped it.
+ */
+static sample_block_t blocks[HISTORY_BLOCKS];
+static uint32_t block_sequence[HISTORY_BLOCKS];
+//Index of the block being filled, counts up forever
+static uint32_t head = 0;
+static sample_encoder_t encoder;
+static bool started = false;
+static uint32_t last_timestamp = 0;
+
+static void begin_write(uint32_t index)
+{
+    uint32_t* sequence = &block_sequence[index % HISTORY_BLOCKS];
+    __atomic_store_n(sequence, *sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void end_write(uint32_t index)
+{
+    uint32_t* sequence = &block_sequence[index % HISTORY_BLOCKS];
+    __atomic_store_n(sequence, *sequence + 1, __ATOMIC_RELEASE);
+}
+
+void history_add(const measurement_snapshot_t* sample)
+{
+    assert(sample);
+    sample_record_t record;
+    uint32_t timestamp = (uint32_t)(sample->timestamp / 1000000);
+    if(started && timestamp - last_timestamp < HISTORY_INTERVAL_S) return;
+    last_timestamp = timestamp;
+
+    record.timestamp = timestamp;
+    memcpy(record.values, sample->values, sizeof(record.values));
+
+    uint32_t index = __atomic_load_n(&head, __ATOMIC_RELAXED);
+    begin_write(index);
+    if(!started)
+        sample_encoder_init(&encoder, &blocks[index % HISTORY_BLOCKS], timestamp);
+    bool added = sample_encoder_add(&encoder, &record);
+    end_write(index);
+    __atomic_store_n(&started, true, __ATOMIC_RELEASE);
+    if(added) return;
+
+    //Block full, recycle the oldest; readers see head move before it is cleared
+    ++index;
+    __atomic_store_n(&head, index, __ATOMIC_RELEASE);
+    begin_write(index);
+    sample_encoder_init(&encoder, &blocks[index % HISTORY_BLOCKS], timestamp);
+    added = sample_encoder_add(&encoder, &record);
+    assert(added);
+    end_write(index);
+}
+
+//false when the writer lapped the block
+static bool copy_block(uint32_t index, sample_block_t* block)
+{
+    const uint32_t* sequence = &block_sequence[index % HISTORY_BLOCKS];
+    uint32_t before, after;
+    do
+    {
+        before = __atomic_load_n(sequence, __ATOMIC_ACQUIRE);
+        memcpy(block, &blocks[index % HISTORY_BLOCKS], sizeof(*block));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        after = __atomic_load_n(sequence, __ATOMIC_RELAXED);
+    } while((before & 1u) || before != after);
+    return __atomic_load_n(&head, __ATOMIC_ACQUIRE) - index < HISTORY_BLOCKS;
+}
+
+size_t history_for_each(measurement_type_t type, uint32_t from, history_visit_cb_t callback, void* context)
+{
+    assert(callback);
+    if(type >= MEASUREMENT_COUNT) return 0;
+    if(!__atomic_load_n(&started, __ATOMIC_ACQUIRE)) return 0;
+
+    uint32_t end = __atomic_load_n(&head, __ATOMIC_ACQUIRE);
+    uint32_t begin = end >= HISTORY_BLOCKS ? end - HISTORY_BLOCKS + 1 : 0;
+    size_t visited = 0;
+    sample_block_t block;
+    sample_decoder_t decoder;
+    sample_record_t record;
+
+    for(uint32_t index = begin; index <= end; ++index)
+    {
+        if(!copy_block(index, &block))
+            continue;
+
+        sample_decoder_init(&decoder, &block);
+        while(sample_decoder_next(&decoder, &record))
+        {
+            if(record.timestamp < from)
+                continue;
+            ++visited;
+            if(!callback(record.timestamp, record.values[type], context))
+                return visited;
+        }
+    }
+    return visited;
+}
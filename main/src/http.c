@@ -11,19 +11,37 @@
 #include <esp_system.h>
 #include <nvs_flash.h>
 #include <sys/param.h>
+#include <string.h>
+#include <assert.h>
 #include "nvs_flash.h"
 #include "esp_netif.h"
 #include "esp_eth.h"
 
 #include <esp_http_server.h>
 #include "http.h"
-#include <cJSON.h>
+#include "measurements.h"
+#include "history.h"
+#include "sample_log.h"
+#include "ws.h"
+#include "www.h"
+#include <lwip/sockets.h>
+#include "json_stream.h"
+#include "wifi.h"
+#include "event_bus.h"
+#include "settings.h"
+#include "metrics.h"
+#include "static_alloc.h"
 
 static const char *TAG = "example";
 static httpd_handle_t server = NULL;
-static http_callbacks_t callbacks;
 
 static esp_err_t configure_wifi_sta_handler(httpd_req_t *req);
+static esp_err_t get_readings_handler(httpd_req_t *req);
+static esp_err_t get_history_handler(httpd_req_t *req);
+static esp_err_t get_thresholds_handler(httpd_req_t *req);
+static esp_err_t put_thresholds_handler(httpd_req_t *req);
+static esp_err_t get_metrics_handler(httpd_req_t *req);
+static esp_err_t get_export_handler(httpd_req_t *req);
 
 static const httpd_uri_t configure_wifi_sta = {
     .uri       = "/wificonfig",
@@ -32,80 +50,392 @@ static const httpd_uri_t configure_wifi_sta = {
     .user_ctx  = NULL
 };
 
-static void save_wifi_credentials(const char* ssid, const char* password)
-{
-    nvs_handle_t nvs_handle;
-    ESP_ERROR_CHECK(nvs_open("storage", NVS_READWRITE, &nvs_handle));
-    ESP_ERROR_CHECK(nvs_set_str(nvs_handle, "ssid", ssid));
-    ESP_ERROR_CHECK(nvs_set_str(nvs_handle, "password", password));
-    ESP_ERROR_CHECK(nvs_commit(nvs_handle));
-    nvs_close(nvs_handle);
-}
+static const httpd_uri_t get_readings = {
+    .uri       = "/api/v1/readings",
+    .method    = HTTP_GET,
+    .handler   = get_readings_handler,
+    .user_ctx  = NULL
+};
+
+static const httpd_uri_t get_history = {
+    .uri       = "/api/v1/history",
+    .method    = HTTP_GET,
+    .handler   = get_history_handler,
+    .user_ctx  = NULL
+};
+
+static const httpd_uri_t get_thresholds = {
+    .uri       = "/api/v1/thresholds",
+    .method    = HTTP_GET,
+    .handler   = get_thresholds_handler,
+    .user_ctx  = NULL
+};
+
+static const httpd_uri_t put_thresholds = {
+    .uri       = "/api/v1/thresholds",
+    .method    = HTTP_PUT,
+    .handler   = put_thresholds_handler,
+    .user_ctx  = NULL
+};
+
+static const httpd_uri_t get_metrics = {
+    .uri       = "/metrics",
+    .method    = HTTP_GET,
+    .handler   = get_metrics_handler,
+    .user_ctx  = NULL
+};
 
-void register_on_receive_credentials_cb(http_cb_t callback)
+static const httpd_uri_t get_export = {
+    .uri       = "/api/v1/export",
+    .method    = HTTP_GET,
+    .handler   = get_export_handler,
+    .user_ctx  = NULL
+};
+
+typedef struct
 {
-    callbacks.on_receive_credentials = callback;
-}
+    httpd_req_t* req;
+    char buf[HISTORY_CHUNK_SIZE];
+    size_t len;
+    bool first;
+    esp_err_t err;
+} history_writer_t;
 
-/* An HTTP POST handler */
-static esp_err_t configure_wifi_sta_handler(httpd_req_t *req)
+/*
+ * Feed the request body through the streaming tokenizer in small chunks, so no
+ * copy of the body is kept and malformed or oversized input is rejected early
+ */
+static esp_err_t receive_json(httpd_req_t *req, json_field_t* fields, size_t field_count)
 {
-    int total_len = req->content_len;
-    int cur_len = 0;
-    char buf[MAX_BUF_SIZE];
+    int remaining = req->content_len;
+    char chunk[JSON_CHUNK_SIZE];
     int received = 0;
-    if (total_len >= MAX_BUF_SIZE) {
-        /* Respond with 500 Internal Server Error */
-        httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "content too long");
+    json_stream_t stream;
+    json_stream_status_t status = JSON_STREAM_OK;
+
+    if (remaining >= MAX_BUF_SIZE) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "content too long");
         return ESP_FAIL;
     }
-    while (cur_len < total_len) {
-        received = httpd_req_recv(req, buf + cur_len, total_len);
+
+    json_stream_init(&stream, fields, field_count);
+    while (remaining > 0 && status == JSON_STREAM_OK) {
+        received = httpd_req_recv(req, chunk, MIN(remaining, sizeof(chunk)));
         if (received <= 0) {
             /* Respond with 500 Internal Server Error */
-            httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to post wifi config");
+            httpd_resp_send_err(req, HTTPD_500_INTERNAL_SERVER_ERROR, "Failed to receive body");
             return ESP_FAIL;
         }
-        cur_len += received;
+        remaining -= received;
+        status = json_stream_feed(&stream, chunk, received);
+    }
+
+    if (status == JSON_STREAM_OK)
+        status = json_stream_finish(&stream);
+
+    if (status != JSON_STREAM_OK) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST,
+                            status == JSON_STREAM_ERROR_OVERFLOW ? "value too long" : "invalid json");
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+/* An HTTP POST handler */
+static esp_err_t configure_wifi_sta_handler(httpd_req_t *req)
+{
+    char ssid[MAX_SSID_LENGTH];
+    char pass[MAX_PASSWORD_LENGTH];
+    json_field_t fields[] = {
+        { .key = "ssid", .value = ssid, .size = sizeof(ssid) },
+        { .key = "password", .value = pass, .size = sizeof(pass) }
+    };
+
+    if (receive_json(req, fields, sizeof(fields) / sizeof(fields[0])) != ESP_OK)
+        return ESP_FAIL;
+
+    if (fields[0].type != JSON_VALUE_STRING || fields[1].type != JSON_VALUE_STRING) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "ssid and password are required");
+        return ESP_FAIL;
     }
-    buf[total_len] = '\0';
-
-    cJSON *root = cJSON_Parse(buf);
-    char* ssid = cJSON_GetObjectItem(root, "ssid")->valuestring;
-    char* pass = cJSON_GetObjectItem(root, "password")->valuestring;
-    ESP_LOGI(TAG, "Wifi config: ssid = %s, password = %s", ssid, pass);
-    save_wifi_credentials(ssid, pass);
-    cJSON_Delete(root);
+
+    ESP_LOGI(TAG, "Wifi config: ssid = %s", ssid);
+    //Committed before the restart that EVENT_CREDENTIALS_RECEIVED triggers
+    settings_set_credentials(ssid, pass);
     httpd_resp_sendstr(req, "Post wifi config successfully");
-    if(callbacks.on_receive_credentials)
-        xTaskCreate(callbacks.on_receive_credentials, "on_receive_credentials", 2048, NULL, 5, NULL);
+    event_bus_post_id(EVENT_CREDENTIALS_RECEIVED);
     return ESP_OK;
 }
 
-void start_webserver(void * arg)
+size_t http_format_readings(char* buf, size_t buf_len, const measurement_snapshot_t* sample)
 {
-    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+    assert(buf);
+    assert(sample);
+    int len = snprintf(buf, buf_len, "{\"sample_id\":%u,\"timestamp_ms\":%lld",
+                       sample->sample_id, (long long) (sample->timestamp / 1000));
+    for(int type = 0; type < MEASUREMENT_COUNT && len < buf_len; ++type)
+    {
+        if(!(sample->valid & MEASUREMENT_VALID(type))) continue;
+        len += snprintf(buf + len, buf_len - len, ",\"%s\":{\"value\":%d,\"unit\":\"%s\"}",
+                        get_measurement_name(type), sample->values[type], get_measurement_unit(type));
+    }
+    if(len < buf_len)
+        len += snprintf(buf + len, buf_len - len, "}");
+    return len < buf_len ? len : buf_len - 1;
+}
 
-    // Start the httpd server
-    ESP_LOGI(TAG, "Starting server on port: '%d'", config.server_port);
-    if (httpd_start(&server, &config) == ESP_OK) {
-        // Set URI handlers
-        ESP_LOGI(TAG, "Registering URI handlers");
-        httpd_register_uri_handler(server, &configure_wifi_sta);
+static esp_err_t get_readings_handler(httpd_req_t *req)
+{
+    measurement_snapshot_t sample;
+    char buf[WS_FRAME_SIZE];
+
+    get_measurement_snapshot(&sample);
+    http_format_readings(buf, sizeof(buf), &sample);
+
+    httpd_resp_set_type(req, HTTPD_TYPE_JSON);
+    return httpd_resp_sendstr(req, buf);
+}
+
+static bool write_history_sample(uint32_t timestamp, int32_t value, void* context)
+{
+    history_writer_t* writer = (history_writer_t*) context;
+
+    //Flush before the next sample could overflow the chunk
+    if(writer->len > sizeof(writer->buf) - 32)
+    {
+        writer->err = httpd_resp_send_chunk(writer->req, writer->buf, writer->len);
+        writer->len = 0;
+        if(writer->err != ESP_OK) return false;
     }
 
-    for(;;)
+    writer->len += snprintf(writer->buf + writer->len, sizeof(writer->buf) - writer->len, "%s[%u,%d]",
+                            writer->first ? "" : ",", timestamp, value);
+    writer->first = false;
+    return true;
+}
+
+static esp_err_t get_history_handler(httpd_req_t *req)
+{
+    char query[64];
+    char metric[32];
+    char from[16];
+    measurement_type_t type = MEASUREMENT_COUNT;
+    uint32_t from_timestamp = 0;
+
+    if(httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK)
     {
-        vTaskDelay(100);
+        if(httpd_query_key_value(query, "metric", metric, sizeof(metric)) == ESP_OK)
+            type = get_measurement_type(metric);
+        if(httpd_query_key_value(query, "from", from, sizeof(from)) == ESP_OK)
+            from_timestamp = strtoul(from, NULL, 10);
     }
 
-    ESP_LOGI(TAG, "Error starting server!");
+    if(type == MEASUREMENT_COUNT)
+    {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "unknown metric");
+        return ESP_FAIL;
+    }
+
+    history_writer_t writer = {
+        .req = req,
+        .first = true,
+        .err = ESP_OK
+    };
+    writer.len = snprintf(writer.buf, sizeof(writer.buf), "{\"metric\":\"%s\",\"unit\":\"%s\",\"samples\":[",
+                          get_measurement_name(type), get_measurement_unit(type));
+
+    httpd_resp_set_type(req, HTTPD_TYPE_JSON);
+    history_for_each(type, from_timestamp, write_history_sample, &writer);
+    if(writer.err != ESP_OK) return writer.err;
+
+    writer.len += snprintf(writer.buf + writer.len, sizeof(writer.buf) - writer.len, "]}");
+    httpd_resp_send_chunk(req, writer.buf, writer.len);
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+static esp_err_t get_thresholds_handler(httpd_req_t *req)
+{
+    char buf[64];
+    snprintf(buf, sizeof(buf), "{\"light\":%u,\"moisture\":%u}", settings_get_light_threshold(), settings_get_moisture_threshold());
+    httpd_resp_set_type(req, HTTPD_TYPE_JSON);
+    return httpd_resp_sendstr(req, buf);
+}
+
+static esp_err_t put_thresholds_handler(httpd_req_t *req)
+{
+    char light[JSON_STREAM_MAX_LITERAL];
+    char moisture[JSON_STREAM_MAX_LITERAL];
+    char buf[64];
+    event_t event;
+    uint16_t light_threshold = settings_get_light_threshold();
+    uint16_t moisture_threshold = settings_get_moisture_threshold();
+    json_field_t fields[] = {
+        { .key = "light", .value = light, .size = sizeof(light) },
+        { .key = "moisture", .value = moisture, .size = sizeof(moisture) }
+    };
+
+    if (receive_json(req, fields, sizeof(fields) / sizeof(fields[0])) != ESP_OK)
+        return ESP_FAIL;
+
+    //Nothing is applied unless every field that is present is a valid threshold
+    if ((fields[0].type == JSON_VALUE_NONE && fields[1].type == JSON_VALUE_NONE) ||
+        (fields[0].type != JSON_VALUE_NONE && !json_field_to_u16(&fields[0], &light_threshold)) ||
+        (fields[1].type != JSON_VALUE_NONE && !json_field_to_u16(&fields[1], &moisture_threshold))) {
+        httpd_resp_send_err(req, HTTPD_400_BAD_REQUEST, "light and moisture must be numbers from 0 to 65535");
+        return ESP_FAIL;
+    }
+
+    if(fields[0].type != JSON_VALUE_NONE)
+    {
+        event.id = EVENT_LIGHT_THRESHOLD_RECEIVED;
+        event.data.threshold = light_threshold;
+        event_bus_post(&event);
+    }
+    if(fields[1].type != JSON_VALUE_NONE)
+    {
+        event.id = EVENT_MOISTURE_THRESHOLD_RECEIVED;
+        event.data.threshold = moisture_threshold;
+        event_bus_post(&event);
+    }
+
+    //Applied asynchronously by the event bus, answer with the thresholds that will be in effect
+    snprintf(buf, sizeof(buf), "{\"light\":%u,\"moisture\":%u}", light_threshold, moisture_threshold);
+    httpd_resp_set_status(req, "202 Accepted");
+    httpd_resp_set_type(req, HTTPD_TYPE_JSON);
+    return httpd_resp_sendstr(req, buf);
+}
+
+static bool write_metrics_line(const char* line, size_t len, void* context)
+{
+    history_writer_t* writer = (history_writer_t*) context;
+
+    if(writer->len + len > sizeof(writer->buf))
+    {
+        writer->err = httpd_resp_send_chunk(writer->req, writer->buf, writer->len);
+        writer->len = 0;
+        if(writer->err != ESP_OK) return false;
+    }
+    memcpy(writer->buf + writer->len, line, len);
+    writer->len += len;
+    return true;
+}
+
+static esp_err_t get_metrics_handler(httpd_req_t *req)
+{
+    //Same chunked writer as the history, METRICS_LINE_SIZE always fits in a chunk
+    history_writer_t writer = {
+        .req = req,
+        .len = 0,
+        .err = ESP_OK
+    };
+
+    httpd_resp_set_type(req, "text/plain; version=0.0.4");
+    metrics_render(write_metrics_line, &writer);
+    if(writer.err != ESP_OK) return writer.err;
+
+    httpd_resp_send_chunk(req, writer.buf, writer.len);
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+static bool write_export_block(const sample_block_t* block, void* context)
+{
+    history_writer_t* writer = (history_writer_t*) context;
+
+    //Whole blocks only, a block never straddles two chunks
+    if(writer->len + sizeof(*block) > sizeof(writer->buf))
+    {
+        writer->err = httpd_resp_send_chunk(writer->req, writer->buf, writer->len);
+        writer->len = 0;
+        if(writer->err != ESP_OK) return false;
+    }
+    memcpy(writer->buf + writer->len, block, sizeof(*block));
+    writer->len += sizeof(*block);
+    return true;
+}
+
+/*
+ * The sample log blocks between from and to, as they are on flash: the client
+ * decodes them (tools/sample_export.py). Nothing but one chunk is buffered.
+ */
+static esp_err_t get_export_handler(httpd_req_t *req)
+{
+    char query[64];
+    char value[16];
+    char now[16];
+    uint32_t from = 0;
+    uint32_t to = UINT32_MAX;
+
+    if(httpd_req_get_url_query_str(req, query, sizeof(query)) == ESP_OK)
+    {
+        if(httpd_query_key_value(query, "from", value, sizeof(value)) == ESP_OK)
+            from = strtoul(value, NULL, 10);
+        if(httpd_query_key_value(query, "to", value, sizeof(value)) == ESP_OK)
+            to = strtoul(value, NULL, 10);
+    }
+
+    history_writer_t writer = {
+        .req = req,
+        .len = 0,
+        .err = ESP_OK
+    };
+
+    //The log clock, so the client can put the samples on a calendar
+    snprintf(now, sizeof(now), "%u", sample_log_now());
+    httpd_resp_set_hdr(req, "X-Sample-Log-Now", now);
+    httpd_resp_set_type(req, "application/octet-stream");
+    sample_log_for_each_block(from, to, write_export_block, &writer);
+    if(writer.err != ESP_OK) return writer.err;
+
+    if(writer.len)
+        httpd_resp_send_chunk(req, writer.buf, writer.len);
+    return httpd_resp_send_chunk(req, NULL, 0);
+}
+
+static void close_session(httpd_handle_t hd, int sockfd)
+{
+    ws_close_session(sockfd);
+    close(sockfd);
+}
+
+void start_webserver(bool provisioning)
+{
+    httpd_config_t config = HTTPD_DEFAULT_CONFIG();
+    config.close_fn = close_session;
+    config.uri_match_fn = httpd_uri_match_wildcard;
+    //The default of 8 is used up: the api, the websocket and the dashboard
+    config.max_uri_handlers = 12;
+
+    //Already running, e.g. after a wifi reconnect
+    if(server) return;
+
+    // Start the httpd server
+    ESP_LOGI(TAG, "Starting server on port: '%d'", config.server_port);
+    if (httpd_start(&server, &config) != ESP_OK) {
+        ESP_LOGI(TAG, "Error starting server!");
+        return;
+    }
+
+    // Set URI handlers
+    ESP_LOGI(TAG, "Registering URI handlers");
+    if(provisioning)
+        httpd_register_uri_handler(server, &configure_wifi_sta);
+    httpd_register_uri_handler(server, &get_readings);
+    httpd_register_uri_handler(server, &get_history);
+    httpd_register_uri_handler(server, &get_thresholds);
+    httpd_register_uri_handler(server, &put_thresholds);
+    httpd_register_uri_handler(server, &get_metrics);
+    httpd_register_uri_handler(server, &get_export);
+    ws_register_handlers(server);
+    www_register_handlers(server);
 }
 
 void stop_webserver(void)
 {
     // Stop the httpd server
     ESP_LOGI(TAG, "Trying to stop the webserver");
+    if(!server) return;
+    ws_unregister_handlers();
     ESP_ERROR_CHECK(httpd_stop(server));
+    server = NULL;
     ESP_LOGI(TAG, "Stopped");
-}
\ No newline at end of file
+}
@@ -0,0 +1,379 @@
+//
+// Created by derk on 19-10-26.
+//
+
+#include "json_stream.h"
+
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "static_alloc.h"
+
+enum
+{
+    STATE_START,
+    STATE_FIRST_KEY,
+    STATE_KEY,
+    STATE_COLON,
+    STATE_VALUE,
+    STATE_STRING,
+    STATE_ESCAPE,
+    STATE_UNICODE,
+    STATE_LITERAL,
+    STATE_NEXT,
+    STATE_KEY_START,
+    STATE_END,
+    STATE_ERROR
+};
+
+static bool is_whitespace(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+static bool is_literal_char(char c)
+{
+    return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || c == '-' || c == '+' || c == '.' || c == 'E';
+}
+
+static bool is_digit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+//-?(0|[1-9][0-9]*)(\.[0-9]+)?([eE][+-]?[0-9]+)? and no more, strtod also takes inf, nan and hex
+static bool is_number(const char* literal)
+{
+    const char* c = literal;
+
+    if(*c == '-') c++;
+    if(*c == '0')
+        c++;
+    else if(is_digit(*c))
+        while(is_digit(*c)) c++;
+    else
+        return false;
+
+    if(*c == '.')
+    {
+        if(!is_digit(*++c)) return false;
+        while(is_digit(*c)) c++;
+    }
+    if(*c == 'e' || *c == 'E')
+    {
+        c++;
+        if(*c == '+' || *c == '-') c++;
+        if(!is_digit(*c)) return false;
+        while(is_digit(*c)) c++;
+    }
+    return *c == '\0';
+}
+
+static json_stream_status_t fail(json_stream_t* stream, json_stream_status_t status)
+{
+    stream->state = STATE_ERROR;
+    stream->status = status;
+    return status;
+}
+
+static json_field_t* find_field(json_stream_t* stream, const char* key)
+{
+    for(size_t i = 0; i < stream->field_count; ++i)
+    {
+        json_field_t* field = &stream->fields[i];
+        if(key == NULL ? field->key == NULL : (field->key != NULL && strcmp(field->key, key) == 0))
+            return field;
+    }
+    return NULL;
+}
+
+static bool append_key(json_stream_t* stream, char c)
+{
+    //Keys longer than any field name can never match, remember that and keep going
+    if(stream->key_len + 1 >= sizeof(stream->key))
+    {
+        stream->key_overflow = true;
+        return true;
+    }
+    stream->key[stream->key_len++] = c;
+    return true;
+}
+
+static bool append_value(json_stream_t* stream, char c)
+{
+    if(!stream->current)
+        return true;
+    if(stream->value_len + 1 >= stream->current->size)
+        return false;
+    stream->current->value[stream->value_len++] = c;
+    return true;
+}
+
+static bool append_utf8(json_stream_t* stream, uint32_t codepoint)
+{
+    if(codepoint < 0x80)
+        return append_value(stream, (char) codepoint);
+    if(codepoint < 0x800)
+        return append_value(stream, (char)(0xC0 | (codepoint >> 6))) &&
+               append_value(stream, (char)(0x80 | (codepoint & 0x3F)));
+    return append_value(stream, (char)(0xE0 | (codepoint >> 12))) &&
+           append_value(stream, (char)(0x80 | ((codepoint >> 6) & 0x3F))) &&
+           append_value(stream, (char)(0x80 | (codepoint & 0x3F)));
+}
+
+static json_stream_status_t begin_value(json_stream_t* stream, char c)
+{
+    stream->value_len = 0;
+    if(stream->current)
+        stream->current->value[0] = '\0';
+
+    if(c == '"')
+    {
+        stream->state = STATE_STRING;
+        return JSON_STREAM_OK;
+    }
+    if(is_literal_char(c))
+    {
+        stream->literal[stream->value_len++] = c;
+        stream->state = STATE_LITERAL;
+        return JSON_STREAM_OK;
+    }
+    return fail(stream, JSON_STREAM_ERROR_SYNTAX);
+}
+
+static json_stream_status_t end_string(json_stream_t* stream)
+{
+    if(stream->current)
+    {
+        stream->current->value[stream->value_len] = '\0';
+        stream->current->type = JSON_VALUE_STRING;
+    }
+    stream->state = stream->top_level ? STATE_END : STATE_NEXT;
+    return JSON_STREAM_OK;
+}
+
+static json_stream_status_t end_literal(json_stream_t* stream)
+{
+    json_value_type_t type;
+
+    stream->literal[stream->value_len] = '\0';
+    if(strcmp(stream->literal, "true") == 0 || strcmp(stream->literal, "false") == 0)
+        type = JSON_VALUE_BOOL;
+    else if(strcmp(stream->literal, "null") == 0)
+        type = JSON_VALUE_NULL;
+    else
+    {
+        //A number too large for a double, like 1e999, is refused as well
+        if(!is_number(stream->literal) || isinf(strtod(stream->literal, NULL)))
+            return fail(stream, JSON_STREAM_ERROR_SYNTAX);
+        type = JSON_VALUE_NUMBER;
+    }
+
+    if(stream->current)
+    {
+        if(stream->value_len >= stream->current->size)
+            return fail(stream, JSON_STREAM_ERROR_OVERFLOW);
+        memcpy(stream->current->value, stream->literal, stream->value_len + 1);
+        stream->current->type = type;
+    }
+    stream->state = stream->top_level ? STATE_END : STATE_NEXT;
+    return JSON_STREAM_OK;
+}
+
+static json_stream_status_t feed_char(json_stream_t* stream, char c)
+{
+    switch(stream->state)
+    {
+    case STATE_START:
+        if(is_whitespace(c)) return JSON_STREAM_OK;
+        if(c == '{')
+        {
+            stream->state = STATE_FIRST_KEY;
+            return JSON_STREAM_OK;
+        }
+        stream->top_level = true;
+        stream->current = find_field(stream, NULL);
+        return begin_value(stream, c);
+
+    case STATE_FIRST_KEY:
+    case STATE_KEY_START:
+        if(is_whitespace(c)) return JSON_STREAM_OK;
+        if(c == '}' && stream->state == STATE_FIRST_KEY)
+        {
+            stream->state = STATE_END;
+            return JSON_STREAM_OK;
+        }
+        if(c != '"') return fail(stream, JSON_STREAM_ERROR_SYNTAX);
+        stream->key_len = 0;
+        stream->key_overflow = false;
+        stream->state = STATE_KEY;
+        return JSON_STREAM_OK;
+
+    case STATE_KEY:
+        if(c == '"')
+        {
+            stream->key[stream->key_len] = '\0';
+            stream->current = stream->key_overflow ? NULL : find_field(stream, stream->key);
+            stream->state = STATE_COLON;
+            return JSON_STREAM_OK;
+        }
+        //Field names are plain ascii, an escaped key can not match anything
+        if(c == '\\') stream->key_overflow = true;
+        if((unsigned char) c < 0x20) return fail(stream, JSON_STREAM_ERROR_SYNTAX);
+        append_key(stream, c);
+        return JSON_STREAM_OK;
+
+    case STATE_COLON:
+        if(is_whitespace(c)) return JSON_STREAM_OK;
+        if(c != ':') return fail(stream, JSON_STREAM_ERROR_SYNTAX);
+        stream->state = STATE_VALUE;
+        return JSON_STREAM_OK;
+
+    case STATE_VALUE:
+        if(is_whitespace(c)) return JSON_STREAM_OK;
+        return begin_value(stream, c);
+
+    case STATE_STRING:
+        if(c == '"') return end_string(stream);
+        if(c == '\\')
+        {
+            stream->state = STATE_ESCAPE;
+            return JSON_STREAM_OK;
+        }
+        if((unsigned char) c < 0x20) return fail(stream, JSON_STREAM_ERROR_SYNTAX);
+        if(!append_value(stream, c)) return fail(stream, JSON_STREAM_ERROR_OVERFLOW);
+        return JSON_STREAM_OK;
+
+    case STATE_ESCAPE:
+    {
+        char decoded;
+        switch(c)
+        {
+        case '"': decoded = '"'; break;
+        case '\\': decoded = '\\'; break;
+        case '/': decoded = '/'; break;
+        case 'b': decoded = '\b'; break;
+        case 'f': decoded = '\f'; break;
+        case 'n': decoded = '\n'; break;
+        case 'r': decoded = '\r'; break;
+        case 't': decoded = '\t'; break;
+        case 'u':
+            stream->codepoint = 0;
+            stream->unicode_digits = 0;
+            stream->state = STATE_UNICODE;
+            return JSON_STREAM_OK;
+        default:
+            return fail(stream, JSON_STREAM_ERROR_SYNTAX);
+        }
+        stream->state = STATE_STRING;
+        if(!append_value(stream, decoded)) return fail(stream, JSON_STREAM_ERROR_OVERFLOW);
+        return JSON_STREAM_OK;
+    }
+
+    case STATE_UNICODE:
+    {
+        uint32_t digit;
+        if(c >= '0' && c <= '9') digit = c - '0';
+        else if(c >= 'a' && c <= 'f') digit = c - 'a' + 10;
+        else if(c >= 'A' && c <= 'F') digit = c - 'A' + 10;
+        else return fail(stream, JSON_STREAM_ERROR_SYNTAX);
+
+        stream->codepoint = (stream->codepoint << 4) | digit;
+        if(++stream->unicode_digits < 4) return JSON_STREAM_OK;
+
+        //Surrogate pairs are not needed for anything we receive
+        if(stream->codepoint == 0 || (stream->codepoint >= 0xD800 && stream->codepoint <= 0xDFFF))
+            return fail(stream, JSON_STREAM_ERROR_SYNTAX);
+        stream->state = STATE_STRING;
+        if(!append_utf8(stream, stream->codepoint)) return fail(stream, JSON_STREAM_ERROR_OVERFLOW);
+        return JSON_STREAM_OK;
+    }
+
+    case STATE_LITERAL:
+        if(is_literal_char(c))
+        {
+            if(stream->value_len + 1 >= sizeof(stream->literal))
+                return fail(stream, JSON_STREAM_ERROR_OVERFLOW);
+            stream->literal[stream->value_len++] = c;
+            return JSON_STREAM_OK;
+        }
+        if(end_literal(stream) != JSON_STREAM_OK) return stream->status;
+        return feed_char(stream, c);
+
+    case STATE_NEXT:
+        if(is_whitespace(c)) return JSON_STREAM_OK;
+        if(c == ',')
+        {
+            stream->state = STATE_KEY_START;
+            return JSON_STREAM_OK;
+        }
+        if(c == '}')
+        {
+            stream->state = STATE_END;
+            return JSON_STREAM_OK;
+        }
+        return fail(stream, JSON_STREAM_ERROR_SYNTAX);
+
+    case STATE_END:
+        if(is_whitespace(c)) return JSON_STREAM_OK;
+        return fail(stream, JSON_STREAM_ERROR_SYNTAX);
+
+    default:
+        return stream->status;
+    }
+}
+
+void json_stream_init(json_stream_t* stream, json_field_t* fields, size_t field_count)
+{
+    assert(stream);
+    assert(fields || field_count == 0);
+
+    memset(stream, 0, sizeof(*stream));
+    stream->fields = fields;
+    stream->field_count = field_count;
+    stream->state = STATE_START;
+    stream->status = JSON_STREAM_OK;
+
+    for(size_t i = 0; i < field_count; ++i)
+    {
+        assert(fields[i].value && fields[i].size > 0);
+        fields[i].type = JSON_VALUE_NONE;
+        fields[i].value[0] = '\0';
+    }
+}
+
+json_stream_status_t json_stream_feed(json_stream_t* stream, const char* data, size_t len)
+{
+    assert(stream);
+    for(size_t i = 0; i < len && stream->state != STATE_ERROR; ++i)
+        feed_char(stream, data[i]);
+    return stream->status;
+}
+
+json_stream_status_t json_stream_finish(json_stream_t* stream)
+{
+    assert(stream);
+    //A bare number has no terminator of its own
+    if(stream->state == STATE_LITERAL && stream->top_level)
+        end_literal(stream);
+
+    if(stream->state == STATE_ERROR)
+        return stream->status;
+    if(stream->state != STATE_END)
+        return fail(stream, JSON_STREAM_ERROR_INCOMPLETE);
+    return JSON_STREAM_OK;
+}
+
+bool json_field_to_u16(const json_field_t* field, uint16_t* value)
+{
+    assert(field);
+    assert(value);
+    char* end = NULL;
+
+    if(field->type != JSON_VALUE_NUMBER) return false;
+    long number = strtol(field->value, &end, 10);
+    if(*end != '\0' || number < 0 || number > UINT16_MAX) return false;
+    *value = (uint16_t) number;
+    return true;
+}
@@ -4,66 +4,181 @@
 
 #include "led.h"
 
-#include <esp32/rom/gpio.h>
-#include <driver/gpio.h>
+#include <assert.h>
+#include <sys/param.h>
+#include <esp_timer.h>
 #include <freertos/FreeRTOS.h>
-#include <freertos/task.h>
+#include <freertos/semphr.h>
+#include "hal.h"
+#include "static_alloc.h"
 
-static void led_task(void* param);
+//A callback firing this much before its deadline belongs to a pattern that was replaced
+#define LED_TIMER_SLACK_US 1000
 
-static TaskHandle_t led_task_handle = NULL;
+#define PATTERN(steps, repeat) { steps, sizeof(steps) / sizeof(steps[0]), repeat }
 
-void initialize_status_led(void)
-{
-    gpio_pad_select_gpio(STATUS_LED);
-    gpio_set_direction(STATUS_LED, GPIO_MODE_OUTPUT);
-    gpio_set_level(STATUS_LED, LED_MODE_OFF);
+static const led_step_t off_steps[] = {
+    { 0, 0, false }
+};
+
+static const led_step_t on_steps[] = {
+    { LED_DUTY_MAX, 0, false }
+};
+
+static const led_step_t blink_steps[] = {
+    { LED_DUTY_MAX, 1000, false },
+    { 0, 1000, false }
+};
+
+static const led_step_t fast_blink_steps[] = {
+    { LED_DUTY_MAX, 300, false },
+    { 0, 300, false }
+};
+
+static const led_step_t faster_blink_steps[] = {
+    { LED_DUTY_MAX, 50, false },
+    { 0, 50, false }
+};
+
+static const led_step_t breathe_steps[] = {
+    { LED_DUTY_MAX, 1500, true },
+    { 0, 1500, true }
+};
+
+//Three short pulses followed by a pause
+static const led_step_t error_steps[] = {
+    { LED_DUTY_MAX, 150, false },
+    { 0, 150, false },
+    { LED_DUTY_MAX, 150, false },
+    { 0, 150, false },
+    { LED_DUTY_MAX, 150, false },
+    { 0, 1500, false }
+};
+
+static const led_pattern_t patterns[LED_MODE_NOT_SET] = {
+    [LED_MODE_OFF] = PATTERN(off_steps, false),
+    [LED_MODE_ON] = PATTERN(on_steps, false),
+    [LED_MODE_BLINK] = PATTERN(blink_steps, true),
+    [LED_MODE_FAST_BLINK] = PATTERN(fast_blink_steps, true),
+    [LED_MODE_FASTER_BLINK] = PATTERN(faster_blink_steps, true),
+    [LED_MODE_BREATHE] = PATTERN(breathe_steps, true),
+    [LED_MODE_ERROR] = PATTERN(error_steps, true)
+};
+
+static esp_timer_handle_t led_timer = NULL;
+static SemaphoreHandle_t led_semaphore = NULL;
+STATIC_BUFFER(StaticSemaphore_t, led_semaphore_buffer);
+
+static const led_pattern_t* pattern = NULL;
+static uint8_t step = 0;
+static uint8_t duty = 0;
+static uint8_t fade_from = 0;
+static uint32_t fade_elapsed_ms = 0;
+static uint32_t armed_ms = 0;
+static int64_t deadline = 0;
 
-    xTaskCreate(led_task, "led_task", 2048, NULL, 3, &led_task_handle);
+static void set_duty(uint8_t value)
+{
+    duty = value;
+    hal_pwm_set_duty(value);
 }
 
-void set_led_status(enum led_modes led_mode)
+static void arm(uint32_t delay_ms)
 {
-    xTaskNotify(led_task_handle, led_mode, eSetValueWithOverwrite);
+    armed_ms = delay_ms;
+    deadline = esp_timer_get_time() + delay_ms * 1000;
+    esp_timer_start_once(led_timer, delay_ms * 1000);
 }
 
-static void led_task(void* param)
+static void enter_step(uint8_t index)
 {
-    uint32_t value = 0;
-    uint32_t received_value;
+    const led_step_t* current = &pattern->steps[index];
+    step = index;
+    fade_from = duty;
+    fade_elapsed_ms = 0;
+
+    //Steady state, nothing to wake up for
+    if(current->duration_ms == 0)
+    {
+        set_duty(current->duty);
+        return;
+    }
+
+    if(current->fade)
+    {
+        arm(MIN(LED_FADE_INTERVAL_MS, current->duration_ms));
+        return;
+    }
+
+    set_duty(current->duty);
+    arm(current->duration_ms);
+}
 
-    for(;;)
+static void on_led_timer(void* arg)
+{
+    xSemaphoreTake(led_semaphore, portMAX_DELAY);
+    if(!pattern || esp_timer_get_time() < deadline - LED_TIMER_SLACK_US)
     {
-        received_value = LED_MODE_NOT_SET;
-        if(xTaskNotifyWait(0x00, ULONG_MAX, &received_value, 10) == pdTRUE)
-            value = received_value;
+        xSemaphoreGive(led_semaphore);
+        return;
+    }
 
-        switch(value)
+    const led_step_t* current = &pattern->steps[step];
+    if(current->fade)
+    {
+        fade_elapsed_ms += armed_ms;
+        if(fade_elapsed_ms < current->duration_ms)
         {
-        case LED_MODE_OFF:
-        case LED_MODE_ON:
-            gpio_set_level(STATUS_LED, value);
-            vTaskDelay(10);
-            break;
-        case LED_MODE_BLINK:
-            gpio_set_level(STATUS_LED, LED_MODE_ON);
-            vTaskDelay(1000 / portTICK_PERIOD_MS);
-            gpio_set_level(STATUS_LED, LED_MODE_OFF);
-            vTaskDelay(1000 / portTICK_PERIOD_MS);
-            break;
-        case LED_MODE_FAST_BLINK:
-            gpio_set_level(STATUS_LED, LED_MODE_ON);
-            vTaskDelay(300 / portTICK_PERIOD_MS);
-            gpio_set_level(STATUS_LED, LED_MODE_OFF);
-            vTaskDelay(300 / portTICK_PERIOD_MS);
-            break;
-        case LED_MODE_FASTER_BLINK:
-            gpio_set_level(STATUS_LED, LED_MODE_ON);
-            vTaskDelay(50 / portTICK_PERIOD_MS);
-            gpio_set_level(STATUS_LED, LED_MODE_OFF);
-            vTaskDelay(50 / portTICK_PERIOD_MS);
-            break;
+            set_duty(fade_from + ((int32_t) current->duty - fade_from) * (int32_t) fade_elapsed_ms /
+                                 (int32_t) current->duration_ms);
+            arm(MIN(LED_FADE_INTERVAL_MS, current->duration_ms - fade_elapsed_ms));
+            xSemaphoreGive(led_semaphore);
+            return;
         }
-
+        set_duty(current->duty);
     }
-}
\ No newline at end of file
+
+    uint8_t next = step + 1;
+    if(next < pattern->step_count)
+        enter_step(next);
+    else if(pattern->repeat)
+        enter_step(0);
+
+    xSemaphoreGive(led_semaphore);
+}
+
+void initialize_status_led(void)
+{
+    hal_pwm_init(STATUS_LED, LED_PWM_FREQUENCY);
+
+    esp_timer_create_args_t timer_args = {
+        .callback = on_led_timer,
+        .arg = NULL,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "led"
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&timer_args, &led_timer));
+    led_semaphore = CREATE_MUTEX(led_semaphore_buffer);
+
+    set_led_status(LED_MODE_OFF);
+}
+
+void set_led_pattern(const led_pattern_t* new_pattern)
+{
+    assert(new_pattern);
+    assert(new_pattern->step_count > 0);
+    if(!led_semaphore) return;
+
+    //Takes effect right away, also in the middle of a step
+    xSemaphoreTake(led_semaphore, portMAX_DELAY);
+    esp_timer_stop(led_timer);
+    pattern = new_pattern;
+    enter_step(0);
+    xSemaphoreGive(led_semaphore);
+}
+
+void set_led_status(enum led_modes led_mode)
+{
+    if(led_mode >= LED_MODE_NOT_SET) return;
+    set_led_pattern(&patterns[led_mode]);
+}
@@ -1,9 +1,10 @@
 #include <stdio.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
-#include <driver/gpio.h>
-#include <esp32/rom/gpio.h>
 #include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_system.h>
+#include <esp_heap_caps.h>
 
 #include "measurements.h"
 #include "wifi.h"
@@ -11,141 +12,245 @@
 #include "led.h"
 #include "mqtt.h"
 #include "http.h"
+#include "ws.h"
+#include "event_bus.h"
+#include "executor.h"
+#include "rtio.h"
+#include "settings.h"
+#include "boot.h"
+#include "dlog.h"
+#include "trace.h"
+#include "hal.h"
+#include "control.h"
+#include "bench.h"
+#include "sample_log.h"
+#include "static_alloc.h"
 
-static uint16_t light_value_before = 0;
+static esp_timer_handle_t watering_timer = NULL;
+//Shared by the event handlers and the watering timer, like the flags it replaced
+static control_t control = CONTROL_INITIALIZER;
+
+static void report_resources(void* arg);
+static job_t report_job = JOB_INITIALIZER(report_resources, NULL, "report");
+static uint32_t heap_after_init = 0;
+
+static void report_resources(void* arg)
+{
+    executor_stats_t stats;
+    executor_get_stats(&stats);
+
+    uint32_t minimum_free_heap = esp_get_minimum_free_heap_size();
+    ESP_LOGI("main", "heap free: %d, min free: %d, after init: %d, tasks: %d", esp_get_free_heap_size(),
+             minimum_free_heap, heap_after_init, uxTaskGetNumberOfTasks());
+#ifdef CONFIG_PLANT_STATIC_ALLOCATION
+    //Our own code cannot allocate, whatever goes missing here is taken by wifi, lwip or mqtt
+    if(heap_after_init - minimum_free_heap > CONFIG_PLANT_HEAP_DRIFT_LIMIT)
+        ESP_LOGE("main", "heap dropped %d bytes below its level after init", heap_after_init - minimum_free_heap);
+#endif
+    //High water marks are in bytes on the esp32 port
+    ESP_LOGI("main", "executor stack left: %d, jobs run: %d, slowest: %s (%d us)", stats.stack_high_water_mark,
+             stats.jobs_run, stats.slowest_job ? stats.slowest_job : "-", stats.max_job_us);
+
+    settings_stats_t settings;
+    settings_get_stats(&settings);
+    ESP_LOGI("main", "settings: %d updates, %d commits (%d failed), wear %d%s", settings.updates, settings.commits,
+             settings.failed_commits, settings.wear, settings.pending ? ", pending" : "");
+
+    rtio_stats_t rtio;
+    rtio_get_stats(&rtio);
+    for(int op = 0; op < RTIO_OP_COUNT; ++op)
+    {
+        const rtio_op_stats_t* op_stats = &rtio.ops[op];
+        ESP_LOGI("main", "rtio op %d: done %d, failed %d, retries %d, late %d, jitter %d/%d us, start %d us", op,
+                 op_stats->completed, op_stats->failed, op_stats->retries, op_stats->timing_violations,
+                 op_stats->last_jitter_us, op_stats->max_jitter_us, op_stats->max_start_latency_us);
+    }
+
+    trace_stats_t trace;
+    trace_get_stats(&trace);
+    ESP_LOGI("main", "sample to puback: %d samples, last %d us, max %d us, unmatched %d", trace.samples,
+             trace.last_latency_us, trace.max_latency_us, trace.unmatched);
+}
+
+static void on_watering_timer(void* arg)
+{
+    //First expiry ends the watering, the second ends the soak period
+    uint32_t next_ms = control_watering_step(&control, WATERING_SOAK_MS);
+    hal_gpio_set_level(RELAY_GPIO, control.pump_on);
+    if(next_ms)
+        esp_timer_start_once(watering_timer, next_ms * 1000);
+}
 
 void initialize_relay(void)
 {
-    gpio_pad_select_gpio(RELAY_GPIO);
-    gpio_set_direction(RELAY_GPIO, GPIO_MODE_OUTPUT);
-    gpio_set_level(RELAY_GPIO, 0);
+    hal_gpio_output(RELAY_GPIO);
+    hal_gpio_set_level(RELAY_GPIO, 0);
+
+    esp_timer_create_args_t timer_args = {
+        .callback = on_watering_timer,
+        .arg = NULL,
+        .dispatch_method = ESP_TIMER_TASK,
+        .name = "watering"
+    };
+    ESP_ERROR_CHECK(esp_timer_create(&timer_args, &watering_timer));
 }
 
-static void on_wifi_connect(void *data)
+static void on_wifi_connect(const event_t* event, void* context)
 {
     set_led_status(LED_MODE_ON);
     start_mqtt_client();
+    start_webserver(false);
 }
 
-static void on_wifi_disconnect(void *data)
+static void on_wifi_disconnect(const event_t* event, void* context)
 {
     set_led_status(LED_MODE_OFF);
     stop_mqtt_client();
 }
 
-static void on_wifi_connection_reset(void* data)
+static void on_wifi_connection_reset(const event_t* event, void* context)
 {
     set_led_status(LED_MODE_FASTER_BLINK);
-    vTaskDelay(1000 / portTICK_PERIOD_MS);
-}
-
-static void on_wifi_receive_credentials(void* data)
-{
-    set_led_status(LED_MODE_FAST_BLINK);
 }
 
-static void on_wifi_sta_start(void* data)
+static void on_wifi_sta_start(const event_t* event, void* context)
 {
     set_led_status(LED_MODE_BLINK);
 }
 
-static void on_wifi_ap_start(void* data)
+static void on_wifi_ap_start(const event_t* event, void* context)
 {
     set_led_status(LED_MODE_BLINK);
-    xTaskCreate(start_webserver, "start_webserver", 4096, NULL, 5, NULL);
+    start_webserver(true);
 }
 
-static void received_credentials(void* data)
+static void received_credentials(const event_t* event, void* context)
 {
     set_led_status(LED_MODE_FAST_BLINK);
     stop_webserver();
+    settings_flush();
 
     //There are better ways to do it, but this is simple
     esp_restart();
 }
 
-static void received_light_threshold(uint16_t threshold)
+static void received_light_threshold(const event_t* event, void* context)
 {
-    set_light_threshold(threshold);
+    settings_set_light_threshold(event->data.threshold);
 }
 
-static void received_moisture_threshold(uint16_t threshold)
+static void received_moisture_threshold(const event_t* event, void* context)
 {
-    set_moisture_threshold(threshold);
+    settings_set_moisture_threshold(event->data.threshold);
 }
 
-static void reached_light_threshold(uint16_t value, uint16_t threshold)
+static light_states_t lamp_state(void)
 {
-    //Measure ldr value before
-    //assume light is off
-    light_states_t light_state = get_light_state();
-    if(light_state == LIGHT_STATES_NOT_SET) return;
+#ifdef CONFIG_PLANT_LOCAL_LIGHT
+    //Known from boot on, control does not wait for mqtt
+    return radio_outlet_is_on() ? LIGHT_STATES_ON : LIGHT_STATES_OFF;
+#else
+    return get_light_state();
+#endif
+}
 
-    //Only start measuring when light is off
-    if(light_state == LIGHT_STATES_OFF)
-    {
-        light_value_before = value;
-        mqtt_send_light_message(true);
-    }
+static void switch_lamp(bool on)
+{
+#ifdef CONFIG_PLANT_LOCAL_LIGHT
+    set_radio_outlet(on);
+#endif
+    //With the local transmitter only a report, published once connected
+    mqtt_send_light_message(on);
 }
 
-static void above_light_threshold(uint16_t value, uint16_t threshold)
+static void reached_light_threshold(const event_t* event, void* context)
 {
-    //Determine how much above the threshold
-    //light value before tells us what the light is when
-    light_states_t light_state = get_light_state();
-    if(light_state == LIGHT_STATES_NOT_SET) return;
+    //Remembers the ldr value with the light off
+    if(control_light_reached(&control, lamp_state(), event->data.reached.value) == CONTROL_LIGHT_ON)
+        switch_lamp(true);
+}
 
-    if(light_state == LIGHT_STATES_ON)
+static void above_light_threshold(const event_t* event, void* context)
+{
+    if(control_light_above(&control, lamp_state(), event->data.reached.value, event->data.reached.threshold,
+                           LIGHT_THRESHOLD_MARGIN) == CONTROL_LIGHT_OFF)
     {
-        //difference of switching the light
-        uint16_t difference = value - light_value_before;
-        ESP_LOGI("main", "difference: %d", difference);
-
-        //If old value - new value > threshold + certain margin
-        if(difference > threshold + LIGHT_THRESHOLD_MARGIN)
-            mqtt_send_light_message(false);
+        DLOGI("main", "light off at %d", event->data.reached.value);
+        switch_lamp(false);
     }
 }
 
-static void reached_moisture_threshold(uint16_t value, uint16_t threshold)
+static void new_sample(const event_t* event, void* context)
+{
+    ws_push_sample(&event->data.sample);
+}
+
+static void reached_moisture_threshold(const event_t* event, void* context)
 {
-    printf("Watering...\n");
-    gpio_set_level(RELAY_GPIO, 1);
-    vTaskDelay(2000 / portTICK_PERIOD_MS);
-    gpio_set_level(RELAY_GPIO, 0);
-    //TODO: create software timer for this
-    vTaskDelay(10000 / portTICK_PERIOD_MS);
+    if(!control_watering_start(&control)) return;
+
+    DLOGI("main", "Watering...");
+    hal_gpio_set_level(RELAY_GPIO, 1);
+    esp_timer_start_once(watering_timer, WATERING_DURATION_MS * 1000);
 }
 
 void app_main()
 {
     //Initialize components
     initialize_nvs();
+    boot_mark(BOOT_PHASE_NVS);
     initialize_status_led();
+    boot_mark(BOOT_PHASE_LED);
+    initialize_executor();
+    initialize_dlog();
+    initialize_trace();
+    initialize_rtio();
+    initialize_settings();
+    initialize_sample_log();
+    initialize_event_bus();
+    initialize_boot_report();
+    initialize_mqtt();
 
-    //Register the wifi callbacks before wifi initialization
-    register_on_wifi_connect_cb(&on_wifi_connect);
-    register_on_wifi_disconnect_cb(&on_wifi_disconnect);
-    register_on_wifi_connection_reset(&on_wifi_connection_reset);
-    register_on_wifi_receive_credentials_cb(&on_wifi_receive_credentials);
-    register_on_wifi_sta_start_cb(&on_wifi_sta_start);
-    register_on_wifi_ap_start_cb(&on_wifi_ap_start);
+    //Subscribe to the wifi events before wifi initialization
+    event_bus_subscribe(EVENT_WIFI_CONNECTED, &on_wifi_connect, NULL);
+    event_bus_subscribe(EVENT_WIFI_DISCONNECTED, &on_wifi_disconnect, NULL);
+    event_bus_subscribe(EVENT_WIFI_CONNECTION_RESET, &on_wifi_connection_reset, NULL);
+    event_bus_subscribe(EVENT_WIFI_STA_START, &on_wifi_sta_start, NULL);
+    event_bus_subscribe(EVENT_WIFI_AP_START, &on_wifi_ap_start, NULL);
 
-    //Register mqtt callbacks
-    register_received_light_threshold_cb(&received_light_threshold);
-    register_received_moisture_threshold_cb(&received_moisture_threshold);
+    //Thresholds arrive over mqtt as well as http
+    event_bus_subscribe(EVENT_CREDENTIALS_RECEIVED, &received_credentials, NULL);
+    event_bus_subscribe(EVENT_LIGHT_THRESHOLD_RECEIVED, &received_light_threshold, NULL);
+    event_bus_subscribe(EVENT_MOISTURE_THRESHOLD_RECEIVED, &received_moisture_threshold, NULL);
 
-    //Register http callbacks
-    register_on_receive_credentials_cb(&received_credentials);
+    //Subscribe to the measurement events
+    event_bus_subscribe(EVENT_LIGHT_THRESHOLD_REACHED, &reached_light_threshold, NULL);
+    event_bus_subscribe(EVENT_LIGHT_ABOVE_THRESHOLD, &above_light_threshold, NULL);
+    event_bus_subscribe(EVENT_MOISTURE_THRESHOLD_REACHED, &reached_moisture_threshold, NULL);
+    event_bus_subscribe(EVENT_NEW_SAMPLE, &new_sample, NULL);
 
-    //Register measurement callbacks
-    register_reached_light_threshold_cb(&reached_light_threshold);
-    register_above_light_threshold_cb(&above_light_threshold);
-    register_reached_moisture_threshold_cb(&reached_moisture_threshold);
+    boot_mark(BOOT_PHASE_SERVICES);
 
-    //Initializations
-    initialize_wifi();
-    initialize_measurements();
+#ifdef CONFIG_PLANT_BENCHMARK
+    //Before anything samples or transmits, the figures should only contain the kernels
+    bench_run();
+#endif
+
+    //Nothing below waits: the DHT11 settles and wifi associates while the first samples are taken
     initialize_relay();
+    initialize_measurements();
+#ifdef CONFIG_PLANT_LOCAL_LIGHT
+    //The lamp may be in any state after a reset, start from off
+    switch_lamp(false);
+#endif
+    boot_mark(BOOT_PHASE_SENSORS);
+    initialize_wifi();
+    boot_mark(BOOT_PHASE_WIFI_INIT);
+
+#ifdef CONFIG_PLANT_DLOG_BENCHMARK
+    dlog_measure_cost();
+#endif
+
+    heap_after_init = esp_get_free_heap_size();
+    executor_schedule(&report_job, RESOURCE_REPORT_INTERVAL_MS, RESOURCE_REPORT_INTERVAL_MS);
 }
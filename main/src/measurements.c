@@ -5,55 +5,71 @@
 #include  <freertos/FreeRTOS.h>
 #include <freertos/semphr.h>
 #include <freertos/task.h>
-#include <nvs.h>
 #include "esp_log.h"
 #include "sensor.h"
 #include "dht11.h"
 #include "base.h"
 #include "switch_kaku.h"
+#include "history.h"
+#include "sample_log.h"
+#include "event_bus.h"
+#include "esp_timer.h"
+#include "executor.h"
+#include "rtio.h"
+#include "settings.h"
+#include "boot.h"
+#include "trace.h"
+#include "metrics.h"
+#include "control.h"
+#include <string.h>
+#include <assert.h>
+#include "static_alloc.h"
 
 analog_sensor_t moisture_sensor, light_sensor;
 dht11_t dht11;
 SemaphoreHandle_t measure_semaphore = NULL;
-SemaphoreHandle_t threshold_semaphore = NULL;
 kaku_t kaku;
+STATIC_BUFFER(StaticSemaphore_t, measure_semaphore_buffer);
 
 
+//Last good DHT11 reading, dht11 itself belongs to the rtio task while a read is pending
 typedef struct
 {
-    measurement_threshold_cb_t reached_light_threshold;
-    measurement_threshold_cb_t above_light_threshold;
-    measurement_threshold_cb_t reached_moisture_threshold;
-} measurements_callbacks_t;
+    int32_t temperature;
+    int32_t humidity;
+    bool valid;
+} climate_t;
 
-typedef struct
-{
-    uint16_t moisture;
-    uint16_t light;
-} thresholds_t;
+static climate_t climate;
+static rtio_request_t dht11_request = RTIO_REQUEST_INITIALIZER(RTIO_OP_DHT11_READ, &dht11);
+static rtio_request_t kaku_request = RTIO_REQUEST_INITIALIZER(RTIO_OP_KAKU_SWITCH, &kaku);
+
+//Latest sample, published with a sequence lock so readers never block the measure task
+static measurement_snapshot_t snapshot;
+static uint32_t snapshot_sequence = 0;
 
-static const char *TAG = "measure";
-static thresholds_t thresholds;
-static measurements_callbacks_t callbacks;
+static const char* measurement_names[MEASUREMENT_COUNT] = {
+    "temperature",
+    "humidity",
+    "soil_moisture_level",
+    "light_level"
+};
+
+static const char* measurement_units[MEASUREMENT_COUNT] = {
+    "celsius",
+    "rh",
+    "raw",
+    "raw"
+};
 
 static void measure(void);
 static void measure_data(void *param);
 static void apply_threshold(void *param);
 
-void register_reached_light_threshold_cb(measurement_threshold_cb_t callback)
-{
-    callbacks.reached_light_threshold = callback;
-}
-
-void register_reached_moisture_threshold_cb(measurement_threshold_cb_t callback)
-{
-    callbacks.reached_moisture_threshold = callback;
-}
-
-void register_above_light_threshold_cb(measurement_threshold_cb_t callback)
-{
-    callbacks.above_light_threshold = callback;
-}
+//Both run on the executor, the period used to be a vTaskDelay(100) in their own tasks.
+//measure() submits the threshold job, so it always sees the sample that was just taken
+static job_t measure_job = JOB_INITIALIZER(measure_data, NULL, "measure");
+static job_t threshold_job = JOB_INITIALIZER(apply_threshold, NULL, "threshold");
 
 void initialize_measurements(void)
 {
@@ -62,134 +78,157 @@ void initialize_measurements(void)
     initialize_dht11(&dht11, DHT11_GPIO);
     initialize_kaku(KAKU_GPIO, KAKU_ID, -1, KAKU_GROUP_1, KAKU_DEVICE_ALL, 10, &kaku);
 
-    measure_semaphore = xSemaphoreCreateMutex();
-    threshold_semaphore = xSemaphoreCreateMutex();
+    measure_semaphore = CREATE_MUTEX(measure_semaphore_buffer);
 
-    xTaskCreate(&measure_data, "measure_data", 4096, NULL, 5, NULL);
-    xTaskCreate(&apply_threshold, "apply_threshold", 4096, NULL, 5, NULL);
+    executor_schedule(&measure_job, 0, MEASURE_INTERVAL_MS);
 }
 
 static void measure_data(void *param)
 {
-    for(;;)
-    {
-        measure();
-        vTaskDelay(100);
-    }
+    measure();
 }
 
 static void apply_threshold(void *param)
 {
-    uint16_t light_threshold = 0;
-    uint16_t moisture_threshold = 0;
-    nvs_handle_t  nvs_handle;
-    nvs_open("storage", NVS_READONLY, &nvs_handle);
-    nvs_get_u16(nvs_handle, "light_th", &light_threshold);
-    nvs_get_u16(nvs_handle, "moist_th", &moisture_threshold);
-    nvs_close(nvs_handle);
-
+    uint16_t light_threshold = settings_get_light_threshold();
+    uint16_t moisture_threshold = settings_get_moisture_threshold();
     int32_t current_light_value = 0;
     int32_t current_soil_moisture_value = 0;
+    measurement_snapshot_t sample;
+    event_t event;
 
-    if( xSemaphoreTake( threshold_semaphore, portMAX_DELAY == pdTRUE ))
-    {
-        thresholds.moisture = moisture_threshold;
-        thresholds.light = light_threshold;
-        xSemaphoreGive( threshold_semaphore );
-    }
-
-    ESP_LOGI(TAG, "Light threshold loaded from flash, value: %d", light_threshold);
-    ESP_LOGI(TAG, "Moisture threshold loaded from flash, value: %d", moisture_threshold);
-    for(;;)
-    {
-        //retrieve thresholds
-        if( threshold_semaphore != NULL )
-        {
-            if( xSemaphoreTake( threshold_semaphore, (TickType_t) 10) == pdTRUE )
-            {
-                light_threshold = thresholds.light;
-                moisture_threshold = thresholds.moisture;
-                xSemaphoreGive( threshold_semaphore );
-            }
-        }
-
-        //retrieve sensor values
-        current_light_value = get_light_level();
-        current_soil_moisture_value = get_soil_moisture_level();
+    //retrieve sensor values, all from the same sample so the trace can follow it
+    int64_t start = trace_begin();
+    get_measurement_snapshot(&sample);
+    //Nothing measured yet, all zeros would switch the lamp on and off again at every boot
+    if(sample.sample_id == 0) return;
+    current_light_value = sample.values[MEASUREMENT_LIGHT_LEVEL];
+    current_soil_moisture_value = sample.values[MEASUREMENT_SOIL_MOISTURE_LEVEL];
 
-        //If soil moisture is under threshold -> then give water for max 2 seconds
-        //If ldr value is above threshold -> turn on light
-        if(current_light_value < light_threshold)
-        {
-            if(callbacks.reached_light_threshold)
-                callbacks.reached_light_threshold(current_light_value, light_threshold);
-        }
-        else
-        {
-            if(callbacks.above_light_threshold)
-                callbacks.above_light_threshold(current_light_value, light_threshold);
-        }
+    uint32_t reached = control_check_thresholds(light_threshold, moisture_threshold, current_light_value,
+                                                current_soil_moisture_value);
+    event.id = reached & CONTROL_LIGHT_REACHED ? EVENT_LIGHT_THRESHOLD_REACHED : EVENT_LIGHT_ABOVE_THRESHOLD;
+    event.data.reached.value = current_light_value;
+    event.data.reached.threshold = light_threshold;
+    event_bus_post(&event);
 
-        if(current_soil_moisture_value < moisture_threshold)
-        {
-            if(callbacks.reached_moisture_threshold)
-                callbacks.reached_moisture_threshold(current_soil_moisture_value, moisture_threshold);
-        }
-
-        vTaskDelay(100);
+    if(reached & CONTROL_MOISTURE_REACHED)
+    {
+        event.id = EVENT_MOISTURE_THRESHOLD_REACHED;
+        event.data.reached.value = current_soil_moisture_value;
+        event.data.reached.threshold = moisture_threshold;
+        event_bus_post(&event);
     }
+    trace_end(TRACE_SPAN_THRESHOLD, sample.sample_id, start);
 }
 
-void set_light_threshold(uint16_t threshold)
+static void publish_snapshot(const measurement_snapshot_t* sample)
 {
-    nvs_handle_t nvs_handle;
-    ESP_ERROR_CHECK(nvs_open("storage", NVS_READWRITE, &nvs_handle));
-    ESP_ERROR_CHECK(nvs_set_u16(nvs_handle, "light_th", threshold));
-    ESP_ERROR_CHECK(nvs_commit(nvs_handle));
-    nvs_close(nvs_handle);
-    if( threshold_semaphore != NULL )
-    {
-        if( xSemaphoreTake( threshold_semaphore, portMAX_DELAY) == pdTRUE )
-        {
-            ESP_LOGI(TAG, "Setting moisture threshold to %d", threshold);
-            thresholds.light = threshold;
-            xSemaphoreGive( threshold_semaphore );
-        }
-    }
+    //Odd sequence means a write is in progress
+    uint32_t sequence = __atomic_load_n(&snapshot_sequence, __ATOMIC_RELAXED);
+    __atomic_store_n(&snapshot_sequence, sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(&snapshot, sample, sizeof(snapshot));
+    __atomic_store_n(&snapshot_sequence, sequence + 2, __ATOMIC_RELEASE);
 }
 
-void set_moisture_threshold(uint16_t threshold)
+void get_measurement_snapshot(measurement_snapshot_t* sample)
 {
-    nvs_handle_t nvs_handle;
-    ESP_ERROR_CHECK(nvs_open("storage", NVS_READWRITE, &nvs_handle));
-    ESP_ERROR_CHECK(nvs_set_u16(nvs_handle, "moist_th", threshold));
-    ESP_ERROR_CHECK(nvs_commit(nvs_handle));
-    nvs_close(nvs_handle);
-    if( threshold_semaphore != NULL )
+    assert(sample);
+    uint32_t before, after;
+    do
     {
-        if( xSemaphoreTake( threshold_semaphore, portMAX_DELAY) == pdTRUE )
-        {
-            ESP_LOGI(TAG, "Setting moisture threshold to %d", threshold);
-            thresholds.moisture = threshold;
-            xSemaphoreGive( threshold_semaphore );
-        }
-    }
+        before = __atomic_load_n(&snapshot_sequence, __ATOMIC_ACQUIRE);
+        memcpy(sample, &snapshot, sizeof(*sample));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        after = __atomic_load_n(&snapshot_sequence, __ATOMIC_RELAXED);
+    } while((before & 1u) || before != after);
 }
 
 static void measure(void)
 {
+    static uint32_t sample_id = 0;
+    measurement_snapshot_t sample;
+    event_t event;
+    int64_t start = trace_begin();
+    int64_t read_start;
+
     if( measure_semaphore != NULL )
     {
         if( xSemaphoreTake( measure_semaphore, ( TickType_t ) 10 ) == pdTRUE )
         {
+            sample.sample_id = ++sample_id;
+            read_start = trace_begin();
+            trace_end(TRACE_SPAN_LOCK_WAIT, sample.sample_id, start);
+
             read_analog_sensor(&moisture_sensor);
             read_analog_sensor(&light_sensor);
-            read_dht11(&dht11);
+
+            //The DHT11 is read on the rtio task, take the result of the previous request and start the next
+            if(!rtio_pending(&dht11_request))
+            {
+                if(dht11_request.status == DHT11_OK)
+                {
+                    climate.temperature = dht11.temperature;
+                    climate.humidity = dht11.humidity;
+                    climate.valid = true;
+                    boot_mark(BOOT_PHASE_DHT11_READY);
+                }
+                dht11_request.trace_id = sample.sample_id;
+                rtio_submit(&dht11_request);
+            }
+
+            sample.values[MEASUREMENT_TEMPERATURE] = climate.temperature;
+            sample.values[MEASUREMENT_HUMIDITY] = climate.humidity;
+            sample.values[MEASUREMENT_SOIL_MOISTURE_LEVEL] = moisture_sensor.value;
+            sample.values[MEASUREMENT_LIGHT_LEVEL] = light_sensor.value;
+            sample.valid = MEASUREMENT_VALID(MEASUREMENT_SOIL_MOISTURE_LEVEL) | MEASUREMENT_VALID(MEASUREMENT_LIGHT_LEVEL);
+            if(climate.valid)
+                sample.valid |= MEASUREMENT_VALID(MEASUREMENT_TEMPERATURE) | MEASUREMENT_VALID(MEASUREMENT_HUMIDITY);
             xSemaphoreGive( measure_semaphore );
+            trace_end(TRACE_SPAN_SENSOR_READ, sample.sample_id, read_start);
+
+            sample.timestamp = esp_timer_get_time();
+            publish_snapshot(&sample);
+            boot_mark(BOOT_PHASE_FIRST_SAMPLE);
+            //Their blocks hold every field, they start with the first complete sample
+            if(sample.valid == MEASUREMENT_ALL_VALID)
+            {
+                history_add(&sample);
+                sample_log_add(&sample);
+            }
+
+            event.id = EVENT_NEW_SAMPLE;
+            event.data.sample = sample;
+            event_bus_post(&event);
+            executor_submit(&threshold_job);
+            trace_end(TRACE_SPAN_MEASURE, sample.sample_id, start);
         }
     }
 }
 
+const char* get_measurement_name(measurement_type_t type)
+{
+    if(type >= MEASUREMENT_COUNT) return NULL;
+    return measurement_names[type];
+}
+
+const char* get_measurement_unit(measurement_type_t type)
+{
+    if(type >= MEASUREMENT_COUNT) return NULL;
+    return measurement_units[type];
+}
+
+measurement_type_t get_measurement_type(const char* name)
+{
+    for(int type = 0; type < MEASUREMENT_COUNT; ++type)
+    {
+        if(strcmp(name, measurement_names[type]) == 0)
+            return type;
+    }
+    return MEASUREMENT_COUNT;
+}
+
 int32_t get_temperature(void)
 {
     int32_t temperature = 0;
@@ -197,11 +236,12 @@ int32_t get_temperature(void)
     {
         if( xSemaphoreTake( measure_semaphore, ( TickType_t ) 10 ) == pdTRUE )
         {
-            temperature =  dht11.temperature;
+            temperature =  climate.temperature;
             xSemaphoreGive( measure_semaphore );
             return temperature;
         }
     }
+    metrics_increment(METRIC_SENSOR_LOCK_TIMEOUTS);
     return temperature;
 }
 
@@ -212,11 +252,12 @@ int32_t get_humidity(void)
     {
         if( xSemaphoreTake( measure_semaphore, ( TickType_t ) 10 ) == pdTRUE )
         {
-            humidity =  dht11.humidity;
+            humidity =  climate.humidity;
             xSemaphoreGive( measure_semaphore );
             return humidity;
         }
     }
+    metrics_increment(METRIC_SENSOR_LOCK_TIMEOUTS);
     return humidity;
 }
 
@@ -232,6 +273,7 @@ int32_t get_soil_moisture_level(void)
             return moisture_level;
         }
     }
+    metrics_increment(METRIC_SENSOR_LOCK_TIMEOUTS);
     return moisture_level;
 }
 
@@ -247,12 +289,47 @@ int32_t get_light_level(void)
             return light_level;
         }
     }
+    metrics_increment(METRIC_SENSOR_LOCK_TIMEOUTS);
     return light_level;
 }
 
-void switch_radio_outlet(void)
+//What set_radio_outlet asked for, kaku.state follows once a frame went out
+static kaku_state_t outlet_target = KAKU_STATE_OFF;
+//The outlet state is unknown until the first frame, that one is sent even when kaku.state already matches
+static bool outlet_synced = false;
+
+static void apply_radio_outlet(void* param);
+static job_t outlet_job = JOB_INITIALIZER(apply_radio_outlet, NULL, "outlet");
+
+static void apply_radio_outlet(void* param)
+{
+    kaku_state_t target = __atomic_load_n(&outlet_target, __ATOMIC_RELAXED);
+
+    //The transmitter is busy, try again once this frame is out
+    if(rtio_pending(&kaku_request))
+    {
+        executor_schedule(&outlet_job, kaku_transmit_time_us(&kaku) / 1000 + 1, 0);
+        return;
+    }
+    if(outlet_synced && kaku.state == target) return;
+
+    //switch_kaku toggles, so it transmits the target
+    kaku.state = target == KAKU_STATE_ON ? KAKU_STATE_OFF : KAKU_STATE_ON;
+    if(!rtio_submit(&kaku_request))
+    {
+        executor_schedule(&outlet_job, kaku_transmit_time_us(&kaku) / 1000 + 1, 0);
+        return;
+    }
+    outlet_synced = true;
+}
+
+void set_radio_outlet(bool on)
 {
-    switch_kaku(&kaku);
-    vTaskDelay(10000 / portTICK_PERIOD_MS);
-    switch_kaku(&kaku);
-}
\ No newline at end of file
+    __atomic_store_n(&outlet_target, on ? KAKU_STATE_ON : KAKU_STATE_OFF, __ATOMIC_RELAXED);
+    executor_submit_urgent(&outlet_job);
+}
+
+bool radio_outlet_is_on(void)
+{
+    return __atomic_load_n(&outlet_target, __ATOMIC_RELAXED) == KAKU_STATE_ON;
+}
@@ -0,0 +1,163 @@
+//
+// Created by derk on 19-10-26.
+//
+
+#include "metrics.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <freertos/task.h>
+#include <esp_system.h>
+#include <esp_timer.h>
+#include "settings.h"
+#include "executor.h"
+#include "dlog.h"
+#include "static_alloc.h"
+
+typedef struct
+{
+    const char* name;
+    const char* help;
+} metric_info_t;
+
+static const metric_info_t counter_info[METRIC_COUNTER_COUNT] = {
+    { "plant_dht11_crc_errors_total", "DHT11 frames with a bad checksum" },
+    { "plant_dht11_timeouts_total", "DHT11 reads without a complete response" },
+    { "plant_sensor_lock_timeouts_total", "Sensor getters that returned a fallback after waiting for the measure mutex" },
+    { "plant_mqtt_publishes_total", "Measurement values handed to the mqtt client" },
+    { "plant_mqtt_publish_failures_total", "Measurement values the mqtt client refused" },
+    { "plant_mqtt_pubacks_total", "PUBACKs received" },
+    { "plant_mqtt_connects_total", "Connections to the broker, every one after the first is a reconnect" },
+    { "plant_mqtt_disconnects_total", "Lost or closed broker connections" },
+    { "plant_wifi_disconnects_total", "Lost wifi connections and failed attempts" }
+};
+
+static const metric_info_t histogram_info[METRIC_HISTOGRAM_COUNT] = {
+    { "plant_mqtt_puback_rtt_seconds", "Time from publishing a measurement to its PUBACK" },
+    { "plant_sample_latency_seconds", "Time from taking a sample to the PUBACK of its first message" },
+    { "plant_mqtt_connect_seconds", "Time from opening a broker connection to its CONNACK, TLS handshake included" }
+};
+
+static const uint32_t bucket_bounds_ms[METRICS_BUCKET_COUNT - 1] = METRICS_BUCKETS;
+
+metrics_core_t metrics_cores[portNUM_PROCESSORS];
+
+//Only used by metrics_render, too large for the http server stack
+static char line[METRICS_LINE_SIZE];
+#ifdef CONFIG_FREERTOS_USE_TRACE_FACILITY
+static TaskStatus_t task_status[METRICS_MAX_TASKS];
+#endif
+
+void metrics_observe(metric_histogram_t histogram, uint32_t value_us)
+{
+    assert(histogram < METRIC_HISTOGRAM_COUNT);
+    metrics_core_t* core = &metrics_cores[xPortGetCoreID()];
+    int bucket = 0;
+
+    //In us, 5.9 ms is above the 5 ms bound; the sum is rounded to ms to last in 32 bits
+    while(bucket < METRICS_BUCKET_COUNT - 1 && value_us > bucket_bounds_ms[bucket] * 1000)
+        ++bucket;
+    __atomic_fetch_add(&core->buckets[histogram][bucket], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&core->sum_ms[histogram], (value_us + 500) / 1000, __ATOMIC_RELAXED);
+}
+
+static uint32_t sum_counter(metric_counter_t counter)
+{
+    uint32_t total = 0;
+    for(int core = 0; core < portNUM_PROCESSORS; ++core)
+        total += __atomic_load_n(&metrics_cores[core].counters[counter], __ATOMIC_RELAXED);
+    return total;
+}
+
+#define EMIT(...) \
+    do { \
+        int len = snprintf(line, sizeof(line), __VA_ARGS__); \
+        if(len < 0) break; \
+        if(!callback(line, (size_t)len < sizeof(line) ? len : sizeof(line) - 1, context)) return; \
+    } while(0)
+
+#define EMIT_GAUGE(name, help, value) \
+    do { \
+        EMIT("# HELP " name " " help "\n"); \
+        EMIT("# TYPE " name " gauge\n"); \
+        EMIT(name " %u\n", (uint32_t)(value)); \
+    } while(0)
+
+#define EMIT_COUNTER(name, help, value) \
+    do { \
+        EMIT("# HELP " name " " help "\n"); \
+        EMIT("# TYPE " name " counter\n"); \
+        EMIT(name " %u\n", (uint32_t)(value)); \
+    } while(0)
+
+void metrics_render(metrics_write_cb_t callback, void* context)
+{
+    assert(callback);
+
+    EMIT_GAUGE("plant_uptime_seconds", "Time since startup", esp_timer_get_time() / 1000000);
+    EMIT_GAUGE("plant_heap_free_bytes", "Free heap", esp_get_free_heap_size());
+    EMIT_GAUGE("plant_heap_min_free_bytes", "Lowest free heap since startup", esp_get_minimum_free_heap_size());
+
+    for(int counter = 0; counter < METRIC_COUNTER_COUNT; ++counter)
+    {
+        const metric_info_t* info = &counter_info[counter];
+        EMIT("# HELP %s %s\n", info->name, info->help);
+        EMIT("# TYPE %s counter\n", info->name);
+        EMIT("%s %u\n", info->name, sum_counter(counter));
+    }
+
+    settings_stats_t settings;
+    settings_get_stats(&settings);
+    EMIT_COUNTER("plant_nvs_commits_total", "Settings commits to nvs since startup", settings.commits);
+    EMIT_COUNTER("plant_nvs_commit_failures_total", "Failed settings commits since startup", settings.failed_commits);
+    EMIT_GAUGE("plant_nvs_wear_commits", "Settings commits over the lifetime of the device", settings.wear);
+
+    executor_stats_t executor;
+    executor_get_stats(&executor);
+    EMIT_COUNTER("plant_executor_jobs_total", "Jobs run by the executor", executor.jobs_run);
+    EMIT_GAUGE("plant_executor_max_job_microseconds", "Longest job run by the executor", executor.max_job_us);
+
+    dlog_stats_t dlog;
+    dlog_get_stats(&dlog);
+    EMIT_COUNTER("plant_dlog_dropped_total", "Deferred log records dropped on a full ring", dlog.dropped);
+
+    for(int histogram = 0; histogram < METRIC_HISTOGRAM_COUNT; ++histogram)
+    {
+        const metric_info_t* info = &histogram_info[histogram];
+        uint32_t cumulative = 0;
+        uint32_t sum_ms = 0;
+
+        EMIT("# HELP %s %s\n", info->name, info->help);
+        EMIT("# TYPE %s histogram\n", info->name);
+        for(int bucket = 0; bucket < METRICS_BUCKET_COUNT; ++bucket)
+        {
+            for(int core = 0; core < portNUM_PROCESSORS; ++core)
+                cumulative += __atomic_load_n(&metrics_cores[core].buckets[histogram][bucket], __ATOMIC_RELAXED);
+            if(bucket < METRICS_BUCKET_COUNT - 1)
+            {
+                EMIT("%s_bucket{le=\"%u.%03u\"} %u\n", info->name, bucket_bounds_ms[bucket] / 1000,
+                     bucket_bounds_ms[bucket] % 1000, cumulative);
+            }
+            else
+            {
+                EMIT("%s_bucket{le=\"+Inf\"} %u\n", info->name, cumulative);
+            }
+        }
+        for(int core = 0; core < portNUM_PROCESSORS; ++core)
+            sum_ms += __atomic_load_n(&metrics_cores[core].sum_ms[histogram], __ATOMIC_RELAXED);
+        EMIT("%s_sum %u.%03u\n", info->name, sum_ms / 1000, sum_ms % 1000);
+        EMIT("%s_count %u\n", info->name, cumulative);
+    }
+
+#ifdef CONFIG_FREERTOS_USE_TRACE_FACILITY
+    uint32_t count = uxTaskGetSystemState(task_status, METRICS_MAX_TASKS, NULL);
+    EMIT("# HELP plant_task_stack_free_bytes Lowest free stack of the task since it started\n");
+    EMIT("# TYPE plant_task_stack_free_bytes gauge\n");
+    for(uint32_t i = 0; i < count; ++i)
+    {
+        //High water marks are in bytes on the esp32 port
+        EMIT("plant_task_stack_free_bytes{task=\"%s\"} %u\n", task_status[i].pcTaskName,
+             task_status[i].usStackHighWaterMark);
+    }
+#endif
+}
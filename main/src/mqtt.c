@@ -11,6 +11,7 @@
    CONDITIONS OF ANY KIND, either express or implied.
 */
 
+#include <assert.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <stddef.h>
@@ -32,8 +33,18 @@
 #include "lwip/netdb.h"
 
 #include "esp_log.h"
+#include "esp_timer.h"
 #include "mqtt_client.h"
 #include "measurements.h"
+#include "json_stream.h"
+#include "event_bus.h"
+#include "executor.h"
+#include "boot.h"
+#include "trace.h"
+#include "metrics.h"
+#include "dlog.h"
+#include "window_stats.h"
+#include "static_alloc.h"
 
 static const char *TAG = "MQTT";
 
@@ -45,16 +56,29 @@ static const char *TAG = "MQTT";
 //Topic structure /plant/{plant_id}/soil_moisture
 
 static EventGroupHandle_t mqtt_event_group;
+STATIC_BUFFER(StaticEventGroup_t, mqtt_event_group_buffer);
 static esp_mqtt_client_handle_t client;
 
-static mqtt_callbacks_t callbacks;
 static light_states_t light_state = LIGHT_STATES_NOT_SET;
+//Set on every connection attempt, auto reconnects included
+static int64_t connect_started = 0;
+
+#ifdef CONFIG_PLANT_MQTT_TLS
+//The only certificate the broker may present or chain up to, see CONFIG_PLANT_MQTT_TLS
+extern const char mqtt_broker_pem_start[] asm("_binary_mqtt_broker_pem_start");
+#endif
 
 #define MQTT_CLIENT_CONNECTED BIT0
 #define MQTT_TURN_ON_LIGHT BIT1
 #define MQTT_TURN_OFF_LIGHT BIT2
 #define MQTT_FORCE_STOP BIT3
 
+#define SEND_DATA_INTERVAL_MS 100
+#define DIAGNOSTICS_BUFFER_SIZE 1536
+//Fits a window_stats_format summary
+#define TELEMETRY_PAYLOAD_SIZE 112
+#define TELEMETRY_TOPIC_SIZE 40
+
 
 typedef struct
 {
@@ -76,32 +100,70 @@ typedef struct
 } sensor_data_t;
 
 
+/*
+ * Two lanes share the executor. Light changes go out from light_job, which is
+ * submitted urgently and so runs right after whatever job is running now.
+ * Telemetry is parked here, one slot per measurement, and telemetry_job
+ * publishes one slot per run so a light change never waits behind a burst of
+ * four publishes. A value that is still parked is overwritten by a newer one,
+ * only the latest reading of a measurement is worth sending. Only executor
+ * jobs touch the lane, it needs no lock.
+ */
+typedef struct
+{
+    char topic[TELEMETRY_TOPIC_SIZE];
+    char payload[TELEMETRY_PAYLOAD_SIZE];
+    uint32_t sample_id;
+    int64_t sampled_at;
+    int64_t queued_at;
+    bool pending;
+} telemetry_slot_t;
+
+static telemetry_slot_t telemetry_lane[MEASUREMENT_COUNT];
+//Set by mqtt_send_light_message, the actuation span runs from here to the publish
+static int64_t light_requested_at = 0;
+
 light_states_t get_light_state(void)
 {
     return light_state;
 }
 
-void register_received_light_threshold_cb(mqtt_threshold_cb_t callback)
+static void update_sensor_data(sensor_data_t* sensor_data, const measurement_snapshot_t* sample)
 {
-    callbacks.received_light_threshold = callback;
+    assert(sensor_data);
+    assert(sample);
+    sensor_data->temperature.current = sample->values[MEASUREMENT_TEMPERATURE];
+    sensor_data->humidity.current = sample->values[MEASUREMENT_HUMIDITY];
+    sensor_data->soil_moisture_level.current = sample->values[MEASUREMENT_SOIL_MOISTURE_LEVEL];
+    sensor_data->light_level.current = sample->values[MEASUREMENT_LIGHT_LEVEL];
 }
 
-void register_received_moisture_threshold_cb(mqtt_threshold_cb_t callback)
+size_t mqtt_format_value(char* buffer, size_t size, int32_t value, const char* unit)
 {
-    callbacks.received_moisture_threshold = callback;
+    assert(buffer);
+    assert(unit);
+    int length = snprintf(buffer, size, "{\"value\":%d,\"unit\":\"%s\"}", value, unit);
+    if(length < 0 || (size_t)length >= size) return 0;
+    return length;
 }
 
-static void update_sensor_data(sensor_data_t* sensor_data)
+//Parks the value in its telemetry slot, telemetry_job publishes it
+static void publish_sample_value(esp_mqtt_client_handle_t* client, measurement_type_t type, const char* topic,
+                                 const char* data, const measurement_snapshot_t* sample)
 {
-    assert(sensor_data);
-    sensor_data->temperature.current = get_temperature();
-    sensor_data->humidity.current = get_humidity();
-    sensor_data->soil_moisture_level.current = get_soil_moisture_level();
-    sensor_data->light_level.current = get_light_level();
+    (void)client;
+    telemetry_slot_t* slot = &telemetry_lane[type];
+    if(!slot->pending)
+        slot->queued_at = trace_begin();
+    strlcpy(slot->topic, topic, sizeof(slot->topic));
+    strlcpy(slot->payload, data, sizeof(slot->payload));
+    slot->sample_id = sample->sample_id;
+    slot->sampled_at = sample->timestamp;
+    slot->pending = true;
 }
 
 static void send_temperature(char* buffer, size_t buffer_len, esp_mqtt_client_handle_t* client,
-    temperature_t* temperature)
+    temperature_t* temperature, const measurement_snapshot_t* sample)
 {
     assert(buffer);
     assert(temperature);
@@ -109,14 +171,14 @@ static void send_temperature(char* buffer, size_t buffer_len, esp_mqtt_client_ha
 
     if(temperature->current != temperature->last)
     {
-        memset(buffer, 0, buffer_len);
-        sprintf(buffer, "{\"value\":%d,\"unit\":\"celsius\"}", temperature->current);
-        esp_mqtt_client_publish(*client, "plant/1/temperature", buffer, 0, 1, 1);
+        mqtt_format_value(buffer, buffer_len, temperature->current, "celsius");
+        publish_sample_value(client, MEASUREMENT_TEMPERATURE, "plant/1/temperature", buffer, sample);
         temperature->last = temperature->current;
     }
 }
 
-static void send_humidity(char* buffer, size_t buffer_len, esp_mqtt_client_handle_t* client, humidity_t* humidity)
+static void send_humidity(char* buffer, size_t buffer_len, esp_mqtt_client_handle_t* client, humidity_t* humidity,
+    const measurement_snapshot_t* sample)
 {
     assert(buffer);
     assert(humidity);
@@ -124,15 +186,14 @@ static void send_humidity(char* buffer, size_t buffer_len, esp_mqtt_client_handl
 
     if(humidity->current != humidity->last)
     {
-        memset(buffer, 0, buffer_len);
-        sprintf(buffer, "{\"value\":%d,\"unit\":\"rh\"}", humidity->current);
-        esp_mqtt_client_publish(*client, "plant/1/humidity", buffer, 0, 1, 1);
+        mqtt_format_value(buffer, buffer_len, humidity->current, "rh");
+        publish_sample_value(client, MEASUREMENT_HUMIDITY, "plant/1/humidity", buffer, sample);
         humidity->last = humidity->current;
     }
 }
 
 static void send_soil_moisture_level(char* buffer, size_t buffer_len, esp_mqtt_client_handle_t* client,
-    soil_moisture_level_t* soil_moisture_level)
+    soil_moisture_level_t* soil_moisture_level, const measurement_snapshot_t* sample)
 {
     assert(buffer);
     assert(soil_moisture_level);
@@ -140,15 +201,14 @@ static void send_soil_moisture_level(char* buffer, size_t buffer_len, esp_mqtt_c
 
     if(soil_moisture_level->current != soil_moisture_level->last)
     {
-        memset(buffer, 0, buffer_len);
-        sprintf(buffer, "{\"value\":%d,\"unit\":\"raw\"}", soil_moisture_level->current);
-        esp_mqtt_client_publish(*client, "plant/1/soil_moisture_level", buffer, 0, 1, 1);
+        mqtt_format_value(buffer, buffer_len, soil_moisture_level->current, "raw");
+        publish_sample_value(client, MEASUREMENT_SOIL_MOISTURE_LEVEL, "plant/1/soil_moisture_level", buffer, sample);
         soil_moisture_level->last = soil_moisture_level->current;
     }
 }
 
 static void send_light_level(char* buffer, size_t buffer_len, esp_mqtt_client_handle_t* client,
-                                     light_level_t* light_level)
+                                     light_level_t* light_level, const measurement_snapshot_t* sample)
 {
     assert(buffer);
     assert(light_level);
@@ -156,85 +216,249 @@ static void send_light_level(char* buffer, size_t buffer_len, esp_mqtt_client_ha
 
     if(light_level->current != light_level->last)
     {
-        memset(buffer, 0, buffer_len);
-        sprintf(buffer, "{\"value\":%d,\"unit\":\"raw\"}", light_level->current);
-        esp_mqtt_client_publish(*client, "plant/1/light_level", buffer, 0, 1, 1);
+        mqtt_format_value(buffer, buffer_len, light_level->current, "raw");
+        publish_sample_value(client, MEASUREMENT_LIGHT_LEVEL, "plant/1/light_level", buffer, sample);
         light_level->last = light_level->current;
     }
 }
 
-static void send_data(void *pv_parameters)
+static void send_telemetry(void *pv_parameters);
+static job_t telemetry_job = JOB_INITIALIZER(send_telemetry, &client, "telemetry");
+
+static void send_telemetry(void *pv_parameters)
 {
     esp_mqtt_client_handle_t* client = (esp_mqtt_client_handle_t*) pv_parameters;
-    sensor_data_t sensor_data;
-    char buf[100];
-    esp_mqtt_client_publish(*client, "plant/1/status", "\"connected\"", 0, 1, 1);
+    //Round robin, a steadily changing measurement can not starve the others
+    static measurement_type_t next = 0;
 
-    for(;;)
-    {
-        EventBits_t bits = xEventGroupWaitBits(mqtt_event_group,
-                                               MQTT_CLIENT_CONNECTED | MQTT_TURN_ON_LIGHT | MQTT_TURN_OFF_LIGHT,
-                                               pdFALSE,
-                                               pdFALSE,
-                                               portMAX_DELAY);
-        if(bits & MQTT_CLIENT_CONNECTED) {
-
-            if(light_state == LIGHT_STATES_NOT_SET)
-            {
-                esp_mqtt_client_publish(*client, "socket/1/state", "\"off\"", 0, 1, 1);
-                light_state = LIGHT_STATES_OFF;
-            }
-            //TODO: maybe this can be replaced by a callback?
-            update_sensor_data(&sensor_data);
-            send_temperature(buf, sizeof(buf), client, &sensor_data.temperature);
-            send_humidity(buf, sizeof(buf), client, &sensor_data.humidity);
-            send_soil_moisture_level(buf, sizeof(buf), client, &sensor_data.soil_moisture_level);
-            send_light_level(buf, sizeof(buf), client, &sensor_data.light_level);
-        }
+    if(!(xEventGroupGetBits(mqtt_event_group) & MQTT_CLIENT_CONNECTED)) return;
 
-        if(bits & MQTT_TURN_ON_LIGHT)
+    telemetry_slot_t* slot = NULL;
+    for(int i = 0; i < MEASUREMENT_COUNT && !slot; i++)
+    {
+        measurement_type_t type = (next + i) % MEASUREMENT_COUNT;
+        if(telemetry_lane[type].pending)
         {
-            if(light_state == LIGHT_STATES_OFF)
-                esp_mqtt_client_publish(*client, "socket/1/state", "\"on\"", 0, 1, 1);
-            xEventGroupClearBits(mqtt_event_group, MQTT_TURN_ON_LIGHT);
-            light_state = LIGHT_STATES_ON;
+            slot = &telemetry_lane[type];
+            next = (type + 1) % MEASUREMENT_COUNT;
         }
-
-        if(bits & MQTT_TURN_OFF_LIGHT)
+    }
+    if(!slot) return;
+
+    slot->pending = false;
+    trace_end(TRACE_SPAN_TELEMETRY_QUEUE, slot->sample_id, slot->queued_at);
+    int64_t start = trace_begin();
+    int msg_id = esp_mqtt_client_publish(*client, slot->topic, slot->payload, 0, 1, 1);
+    trace_end(TRACE_SPAN_PUBLISH, slot->sample_id, start);
+    trace_publish(msg_id, slot->sample_id, slot->sampled_at);
+    metrics_increment(msg_id < 0 ? METRIC_MQTT_PUBLISH_FAILURES : METRIC_MQTT_PUBLISHES);
+    boot_mark(BOOT_PHASE_FIRST_PUBLISH);
+
+    for(int i = 0; i < MEASUREMENT_COUNT; i++)
+    {
+        if(telemetry_lane[i].pending)
         {
-            if(light_state == LIGHT_STATES_ON)
-                esp_mqtt_client_publish(*client, "socket/1/state", "\"off\"", 0, 1, 1);
-            xEventGroupClearBits(mqtt_event_group, MQTT_TURN_OFF_LIGHT);
-            light_state = LIGHT_STATES_OFF;
+            //Back of the queue, anything submitted meanwhile goes first
+            executor_submit(&telemetry_job);
+            break;
         }
+    }
+}
 
-        vTaskDelay(10);
+static void send_data(void *pv_parameters)
+{
+    esp_mqtt_client_handle_t* client = (esp_mqtt_client_handle_t*) pv_parameters;
+    //Kept between runs, only changed values are published
+    static sensor_data_t sensor_data;
+    measurement_snapshot_t sample;
+    char buf[TELEMETRY_PAYLOAD_SIZE];
+
+    if(!(xEventGroupGetBits(mqtt_event_group) & MQTT_CLIENT_CONNECTED)) return;
+
+    int64_t start = trace_begin();
+    get_measurement_snapshot(&sample);
+    update_sensor_data(&sensor_data, &sample);
+    //No climate before the first good DHT11 read
+    if(sample.valid & MEASUREMENT_VALID(MEASUREMENT_TEMPERATURE))
+        send_temperature(buf, sizeof(buf), client, &sensor_data.temperature, &sample);
+    if(sample.valid & MEASUREMENT_VALID(MEASUREMENT_HUMIDITY))
+        send_humidity(buf, sizeof(buf), client, &sensor_data.humidity, &sample);
+    send_soil_moisture_level(buf, sizeof(buf), client, &sensor_data.soil_moisture_level, &sample);
+    send_light_level(buf, sizeof(buf), client, &sensor_data.light_level, &sample);
+    trace_end(TRACE_SPAN_SEND_DATA, sample.sample_id, start);
+    executor_submit(&telemetry_job);
+}
+
+static job_t send_data_job = JOB_INITIALIZER(send_data, &client, "send_data");
+
+#ifdef CONFIG_PLANT_MQTT_STATS_WINDOW
+/*
+ * Statistics mode: every sample goes into its window, the raw values are not
+ * published. At the end of a window each measurement gets one summary in its
+ * telemetry slot, a summary that could not be sent yet is replaced by the next.
+ */
+#define STATS_WINDOW_US ((int64_t)CONFIG_PLANT_MQTT_STATS_WINDOW_S * 1000000)
+
+static window_stats_t window[MEASUREMENT_COUNT];
+static int64_t window_started = 0;
+
+static void close_window(const measurement_snapshot_t* sample)
+{
+    char topic[TELEMETRY_TOPIC_SIZE];
+    char payload[TELEMETRY_PAYLOAD_SIZE];
+
+    for(measurement_type_t type = 0; type < MEASUREMENT_COUNT; type++)
+    {
+        snprintf(topic, sizeof(topic), "plant/1/%s/stats", get_measurement_name(type));
+        if(window[type].count && window_stats_format(payload, sizeof(payload), &window[type], get_measurement_unit(type),
+                               CONFIG_PLANT_MQTT_STATS_WINDOW_S))
+            publish_sample_value(&client, type, topic, payload, sample);
+        window_stats_reset(&window[type]);
     }
+    executor_submit(&telemetry_job);
+}
+
+static void on_new_sample(const event_t* event, void* context)
+{
+    const measurement_snapshot_t* sample = &event->data.sample;
+
+    if(window_started == 0)
+    {
+        for(measurement_type_t type = 0; type < MEASUREMENT_COUNT; type++)
+            window_stats_reset(&window[type]);
+        window_started = sample->timestamp;
+    }
+    for(measurement_type_t type = 0; type < MEASUREMENT_COUNT; type++)
+    {
+        if(sample->valid & MEASUREMENT_VALID(type))
+            window_stats_add(&window[type], sample->values[type]);
+    }
+
+    if(sample->timestamp - window_started >= STATS_WINDOW_US)
+    {
+        close_window(sample);
+        window_started = sample->timestamp;
+    }
+}
+#endif
+
+static void send_light_state(void *pv_parameters)
+{
+    esp_mqtt_client_handle_t* client = (esp_mqtt_client_handle_t*) pv_parameters;
+
+    EventBits_t bits = xEventGroupGetBits(mqtt_event_group);
+    //The bits stay set, the job is submitted again once connected
+    if(!(bits & MQTT_CLIENT_CONNECTED)) return;
+
+    //A change asked for before the first connect is published as the first state
+    if(light_state == LIGHT_STATES_NOT_SET && !(bits & (MQTT_TURN_ON_LIGHT | MQTT_TURN_OFF_LIGHT)))
+    {
+        esp_mqtt_client_publish(*client, "socket/1/state", "\"off\"", 0, 1, 1);
+        light_state = LIGHT_STATES_OFF;
+    }
+
+    if(bits & MQTT_TURN_ON_LIGHT)
+    {
+        if(light_state != LIGHT_STATES_ON)
+            esp_mqtt_client_publish(*client, "socket/1/state", "\"on\"", 0, 1, 1);
+        xEventGroupClearBits(mqtt_event_group, MQTT_TURN_ON_LIGHT);
+        light_state = LIGHT_STATES_ON;
+    }
+
+    if(bits & MQTT_TURN_OFF_LIGHT)
+    {
+        if(light_state != LIGHT_STATES_OFF)
+            esp_mqtt_client_publish(*client, "socket/1/state", "\"off\"", 0, 1, 1);
+        xEventGroupClearBits(mqtt_event_group, MQTT_TURN_OFF_LIGHT);
+        light_state = LIGHT_STATES_OFF;
+    }
+
+    if(bits & (MQTT_TURN_ON_LIGHT | MQTT_TURN_OFF_LIGHT))
+        trace_end(TRACE_SPAN_ACTUATION, 0, light_requested_at);
+}
+
+static job_t light_job = JOB_INITIALIZER(send_light_state, &client, "light");
+
+static void send_diagnostics(void *pv_parameters)
+{
+    esp_mqtt_client_handle_t* client = (esp_mqtt_client_handle_t*) pv_parameters;
+    static char buffer[DIAGNOSTICS_BUFFER_SIZE];
+
+    size_t length = trace_format_diagnostics(buffer, sizeof(buffer));
+    if(length == 0)
+    {
+        DLOGW(TAG, "diagnostics do not fit in %d bytes", DIAGNOSTICS_BUFFER_SIZE);
+        return;
+    }
+    //Not retained and QoS 0, a missed report is replaced by the next one
+    esp_mqtt_client_publish(*client, "plant/1/diagnostics", buffer, length, 0, 0);
+}
+
+static job_t diagnostics_job = JOB_INITIALIZER(send_diagnostics, &client, "diagnostics");
+
+/**
+ * @brief Parse a threshold payload, either a bare number or {"value":<number>}
+ * @note event->data is not null terminated, the tokenizer works on the raw bytes
+ */
+static bool parse_threshold(esp_mqtt_event_handle_t event, uint16_t* threshold)
+{
+    char bare[JSON_STREAM_MAX_LITERAL];
+    char value[JSON_STREAM_MAX_LITERAL];
+    json_field_t fields[] = {
+        { .key = NULL, .value = bare, .size = sizeof(bare) },
+        { .key = "value", .value = value, .size = sizeof(value) }
+    };
+    json_stream_t stream;
+
+    //Thresholds are tiny, a fragmented payload is not a threshold
+    if(event->current_data_offset != 0 || event->data_len != event->total_data_len)
+        return false;
+
+    json_stream_init(&stream, fields, sizeof(fields) / sizeof(fields[0]));
+    if(json_stream_feed(&stream, event->data, event->data_len) != JSON_STREAM_OK ||
+       json_stream_finish(&stream) != JSON_STREAM_OK)
+    {
+        DLOGI(TAG, "Ignoring malformed threshold");
+        return false;
+    }
+    return json_field_to_u16(&fields[0], threshold) || json_field_to_u16(&fields[1], threshold);
 }
 
 static esp_err_t mqtt_event_handler_cb(esp_mqtt_event_handle_t event)
 {
-    static TaskHandle_t send_data_handle = NULL;
+    event_t threshold_event;
     switch (event->event_id) {
+    case MQTT_EVENT_BEFORE_CONNECT:
+        connect_started = esp_timer_get_time();
+        break;
     case MQTT_EVENT_CONNECTED:
-        ESP_LOGI(TAG, "Mqtt connected!");
-        xEventGroupSetBits(mqtt_event_group, MQTT_CLIENT_CONNECTED);
-        esp_mqtt_client_subscribe(client, "plant/1/threshold/+", 1);
-        if(!send_data_handle)
+        if(connect_started)
         {
-            xTaskCreate(&send_data, "send_data", 4096, (void *) &client, 5, &send_data_handle);
+            uint32_t connect_us = (uint32_t)(esp_timer_get_time() - connect_started);
+            metrics_observe(METRIC_HISTOGRAM_MQTT_CONNECT, connect_us);
+            DLOGI(TAG, "Mqtt connected in %d ms", connect_us / 1000);
         }
+        boot_mark(BOOT_PHASE_MQTT_CONNECTED);
+        metrics_increment(METRIC_MQTT_CONNECTS);
+        xEventGroupSetBits(mqtt_event_group, MQTT_CLIENT_CONNECTED);
+        esp_mqtt_client_subscribe(client, "plant/1/threshold/+", 1);
+        esp_mqtt_client_publish(client, "plant/1/status", "\"connected\"", 0, 1, 1);
+        executor_submit_urgent(&light_job);
+#ifdef CONFIG_PLANT_MQTT_STATS_WINDOW
+        //Summaries of windows closed while offline
+        executor_submit(&telemetry_job);
+#else
+        executor_schedule(&send_data_job, 0, SEND_DATA_INTERVAL_MS);
+#endif
+        executor_schedule(&diagnostics_job, TRACE_DIAGNOSTICS_INTERVAL_MS, TRACE_DIAGNOSTICS_INTERVAL_MS);
         break;
     case MQTT_EVENT_DISCONNECTED:
-        ESP_LOGI(TAG, "MQTT_EVENT_DISCONNECTED");
+        DLOGI(TAG, "MQTT_EVENT_DISCONNECTED");
+        metrics_increment(METRIC_MQTT_DISCONNECTS);
         //TODO: if got signal to stop then do nothing, otherwise reconnect
         xEventGroupClearBits(mqtt_event_group, MQTT_CLIENT_CONNECTED);
-
-        if(send_data_handle)
-        {
-            vTaskDelete(send_data_handle);
-            send_data_handle = NULL;
-        }
+        executor_cancel(&send_data_job);
+        executor_cancel(&diagnostics_job);
 
         EventBits_t bits = xEventGroupWaitBits(mqtt_event_group,
                                                MQTT_FORCE_STOP,
@@ -244,12 +468,12 @@ static esp_err_t mqtt_event_handler_cb(esp_mqtt_event_handle_t event)
 
         if(bits & MQTT_FORCE_STOP)
         {
-            ESP_LOGI(TAG, "force stopping mqtt client");
+            DLOGI(TAG, "force stopping mqtt client");
             xEventGroupClearBits(mqtt_event_group, MQTT_FORCE_STOP);
         }
         else
         {
-            ESP_LOGI(TAG, "client randomly disconnected, trying to reconnect...");
+            DLOGI(TAG, "client randomly disconnected, trying to reconnect...");
             esp_mqtt_client_start(client);
         }
 
@@ -259,26 +483,30 @@ static esp_err_t mqtt_event_handler_cb(esp_mqtt_event_handle_t event)
     case MQTT_EVENT_UNSUBSCRIBED:
         break;
     case MQTT_EVENT_PUBLISHED:
+        metrics_increment(METRIC_MQTT_PUBACKS);
+        trace_puback(event->msg_id);
         break;
     case MQTT_EVENT_DATA:
         if(strncmp(event->topic, "plant/1/threshold/light", event->topic_len) == 0)
         {
-            ESP_LOGI(TAG, "Setting light threshold");
-            if(callbacks.received_light_threshold)
-                callbacks.received_light_threshold((uint16_t)strtol(event->data, NULL, 10));
+            DLOGI(TAG, "Setting light threshold");
+            threshold_event.id = EVENT_LIGHT_THRESHOLD_RECEIVED;
+            if(parse_threshold(event, &threshold_event.data.threshold))
+                event_bus_post(&threshold_event);
         }
         else if(strncmp(event->topic, "plant/1/threshold/moisture", event->topic_len) == 0)
         {
-            ESP_LOGI(TAG, "Setting moisture threshold");
-            if(callbacks.received_moisture_threshold)
-                callbacks.received_moisture_threshold((uint16_t)strtol(event->data, NULL, 10));
+            DLOGI(TAG, "Setting moisture threshold");
+            threshold_event.id = EVENT_MOISTURE_THRESHOLD_RECEIVED;
+            if(parse_threshold(event, &threshold_event.data.threshold))
+                event_bus_post(&threshold_event);
         }
             break;
     case MQTT_EVENT_ERROR:
-        ESP_LOGI(TAG, "MQTT_EVENT_ERROR");
+        DLOGI(TAG, "MQTT_EVENT_ERROR");
         break;
     default:
-        ESP_LOGI(TAG, "Other event id:%d", event->event_id);
+        DLOGI(TAG, "Other event id:%d", event->event_id);
         break;
     }
     return ESP_OK;
@@ -290,20 +518,50 @@ static void mqtt_event_handler(void *handler_args, esp_event_base_t base, int32_
     mqtt_event_handler_cb(event_data);
 }
 
+static void create_event_group(void)
+{
+    if(!mqtt_event_group)
+        mqtt_event_group = CREATE_EVENT_GROUP(mqtt_event_group_buffer);
+}
+
 void mqtt_send_light_message(bool status)
 {
-    if(mqtt_event_group)
-        xEventGroupSetBits(mqtt_event_group, status ? MQTT_TURN_ON_LIGHT : MQTT_TURN_OFF_LIGHT);
+    //Kept until connected, the local transmitter switches the lamp before there is a connection
+    create_event_group();
+    light_requested_at = trace_begin();
+    //The latest request wins, a change and its reversal while offline cancel out
+    xEventGroupClearBits(mqtt_event_group, status ? MQTT_TURN_OFF_LIGHT : MQTT_TURN_ON_LIGHT);
+    xEventGroupSetBits(mqtt_event_group, status ? MQTT_TURN_ON_LIGHT : MQTT_TURN_OFF_LIGHT);
+    //Ahead of any telemetry already waiting on the executor
+    executor_submit_urgent(&light_job);
 }
 
 
+void initialize_mqtt(void)
+{
+    create_event_group();
+#ifdef CONFIG_PLANT_MQTT_STATS_WINDOW
+    //The window fills from the first sample on, also while wifi is still connecting
+    event_bus_subscribe(EVENT_NEW_SAMPLE, &on_new_sample, NULL);
+#endif
+}
 
 void start_mqtt_client(void)
 {
     esp_mqtt_client_config_t mqtt_cfg = {
-        .uri = "mqtt://142.93.224.106",
-        .username = "derk",
-        .password = "sopkut",
+        .host = CONFIG_PLANT_MQTT_HOST,
+        .port = CONFIG_PLANT_MQTT_PORT,
+#ifdef CONFIG_PLANT_MQTT_TLS
+        .transport = MQTT_TRANSPORT_OVER_SSL,
+        .cert_pem = mqtt_broker_pem_start,
+#ifdef CONFIG_PLANT_MQTT_SKIP_CN_CHECK
+        .skip_cert_common_name_check = true,
+#endif
+#else
+        .transport = MQTT_TRANSPORT_OVER_TCP,
+#endif
+        .username = CONFIG_PLANT_MQTT_USERNAME[0] ? CONFIG_PLANT_MQTT_USERNAME : NULL,
+        .password = CONFIG_PLANT_MQTT_PASSWORD[0] ? CONFIG_PLANT_MQTT_PASSWORD : NULL,
         .lwt_topic = "plant/1/status",
         .lwt_msg = "\"disconnected\"",
         .lwt_qos = 1,
@@ -311,11 +569,15 @@ void start_mqtt_client(void)
         .disable_auto_reconnect = false
     };
 
-    if(!mqtt_event_group)
-        mqtt_event_group = xEventGroupCreate();
+    create_event_group();
+    xEventGroupClearBits(mqtt_event_group, MQTT_FORCE_STOP);
 
-    client = esp_mqtt_client_init(&mqtt_cfg);
-    esp_mqtt_client_register_event(client, ESP_EVENT_ANY_ID, mqtt_event_handler, client);
+    //Created once and reused on every reconnect, its buffers stay where they are
+    if(!client)
+    {
+        client = esp_mqtt_client_init(&mqtt_cfg);
+        esp_mqtt_client_register_event(client, ESP_EVENT_ANY_ID, mqtt_event_handler, client);
+    }
     esp_mqtt_client_start(client);
 }
 
@@ -325,6 +587,6 @@ void stop_mqtt_client(void)
     {
         xEventGroupSetBits(mqtt_event_group, MQTT_FORCE_STOP);
         esp_mqtt_client_disconnect(client);
-        esp_mqtt_client_destroy(client);
+        esp_mqtt_client_stop(client);
     }
 }
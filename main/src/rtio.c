@@ -0,0 +1,206 @@
+//
+// Created by derk on 19-10-26.
+//
+
+#include "rtio.h"
+
+#include <assert.h>
+#include <string.h>
+#include <freertos/task.h>
+#include <freertos/queue.h>
+#include <esp_timer.h>
+#include "dht11.h"
+#include "dlog.h"
+#include "switch_kaku.h"
+#include "trace.h"
+#include "metrics.h"
+#include "static_alloc.h"
+
+/*
+ * Bit-banged protocols run here, on a high priority task of their own on the
+ * app core, away from the wifi and lwip tasks. The drivers disable interrupts
+ * only around the parts of a frame where a few microseconds matter; this task
+ * times every operation and checks it against the nominal length.
+ */
+
+static const char *TAG = "rtio";
+
+static QueueHandle_t request_queue = NULL;
+STATIC_BUFFER(uint8_t, request_queue_storage[RTIO_QUEUE_LENGTH * sizeof(rtio_request_t*)]);
+STATIC_BUFFER(StaticQueue_t, request_queue_buffer);
+STATIC_BUFFER(StackType_t, rtio_stack[RTIO_TASK_STACK_SIZE]);
+STATIC_BUFFER(StaticTask_t, rtio_tcb);
+static rtio_stats_t stats;
+
+//A failed read waits here until the sensor accepts the next start signal
+static rtio_request_t* retry_request = NULL;
+static uint8_t retry_attempt = 0;
+
+static void record_timing(rtio_op_stats_t* op_stats, int32_t actual_us, int32_t min_us, int32_t max_us)
+{
+    uint32_t jitter = 0;
+    if(actual_us < min_us)
+        jitter = min_us - actual_us;
+    else if(actual_us > max_us)
+        jitter = actual_us - max_us;
+
+    op_stats->last_jitter_us = jitter;
+    if(jitter > op_stats->max_jitter_us)
+        op_stats->max_jitter_us = jitter;
+    if(jitter)
+        ++op_stats->timing_violations;
+}
+
+static void release(rtio_request_t* request, int32_t status)
+{
+    request->status = status;
+    //Hands the device back to the owner
+    __atomic_store_n(&request->pending, 0, __ATOMIC_RELEASE);
+}
+
+static void complete(rtio_request_t* request, int32_t status)
+{
+    rtio_op_stats_t* op_stats = &stats.ops[request->op];
+    ++op_stats->completed;
+    if(status != 0)
+        ++op_stats->failed;
+    release(request, status);
+}
+
+static void read_dht11_request(rtio_request_t* request, uint8_t attempt)
+{
+    dht11_t* dht11 = (dht11_t*) request->device;
+    rtio_op_stats_t* op_stats = &stats.ops[RTIO_OP_DHT11_READ];
+
+    int64_t start = trace_begin();
+    int32_t status = read_dht11(dht11);
+    if(status == DHT11_BUSY_ERROR)
+    {
+        //Read too soon after the previous one, nothing was sent so it does not count
+        release(request, status);
+        return;
+    }
+
+    trace_end(TRACE_SPAN_DHT11_READ, request->trace_id, start);
+    if(status == DHT11_CRC_ERROR)
+        metrics_increment(METRIC_DHT11_CRC_ERRORS);
+    else if(status == DHT11_TIMEOUT_ERROR)
+        metrics_increment(METRIC_DHT11_TIMEOUTS);
+    if(status == DHT11_OK)
+        record_timing(op_stats, dht11->frame_time_us, DHT11_FRAME_MIN_US, DHT11_FRAME_MAX_US);
+
+    if(status != DHT11_OK && attempt < RTIO_DHT11_RETRIES)
+    {
+        ++op_stats->retries;
+        retry_request = request;
+        retry_attempt = attempt + 1;
+        return;
+    }
+
+    if(status != DHT11_OK)
+        DLOGW(TAG, "DHT11 read failed: %d", status);
+    complete(request, status);
+}
+
+static void switch_kaku_request(rtio_request_t* request)
+{
+    kaku_t* kaku = (kaku_t*) request->device;
+    int32_t nominal = kaku_transmit_time_us(kaku);
+    int32_t tolerance = nominal * RTIO_KAKU_TOLERANCE_PERCENT / 100;
+
+    int64_t start = esp_timer_get_time();
+    switch_kaku(kaku);
+    int32_t actual = (int32_t)(esp_timer_get_time() - start);
+
+    record_timing(&stats.ops[RTIO_OP_KAKU_SWITCH], actual, nominal - tolerance, nominal + tolerance);
+    complete(request, 0);
+}
+
+static void run(rtio_request_t* request, uint8_t attempt)
+{
+    rtio_op_stats_t* op_stats = &stats.ops[request->op];
+    uint32_t latency = (uint32_t)(esp_timer_get_time() - request->submitted);
+    if(attempt == 0 && latency > op_stats->max_start_latency_us)
+        op_stats->max_start_latency_us = latency;
+
+    switch(request->op)
+    {
+    case RTIO_OP_DHT11_READ:
+        read_dht11_request(request, attempt);
+        break;
+    case RTIO_OP_KAKU_SWITCH:
+        switch_kaku_request(request);
+        break;
+    default:
+        complete(request, -1);
+        break;
+    }
+}
+
+static TickType_t retry_timeout(void)
+{
+    if(!retry_request) return portMAX_DELAY;
+
+    const dht11_t* dht11 = (const dht11_t*) retry_request->device;
+    int64_t remaining = dht11->last_read_time + DHT11_MIN_INTERVAL_US - esp_timer_get_time();
+    if(remaining <= 0) return 0;
+    return pdMS_TO_TICKS(remaining / 1000) + 1;
+}
+
+static void rtio_task(void* param)
+{
+    rtio_request_t* request;
+    for(;;)
+    {
+        if(xQueueReceive(request_queue, &request, retry_timeout()) == pdTRUE)
+        {
+            run(request, 0);
+            continue;
+        }
+
+        if(retry_request && retry_timeout() == 0)
+        {
+            request = retry_request;
+            retry_request = NULL;
+            run(request, retry_attempt);
+        }
+    }
+}
+
+void initialize_rtio(void)
+{
+    TaskHandle_t handle;
+    request_queue = CREATE_QUEUE(RTIO_QUEUE_LENGTH, sizeof(rtio_request_t*), request_queue_storage,
+                                 request_queue_buffer);
+    CREATE_TASK(rtio_task, "rtio", RTIO_TASK_STACK_SIZE, NULL, RTIO_TASK_PRIORITY, &handle, RTIO_TASK_CORE,
+                rtio_stack, rtio_tcb);
+}
+
+bool rtio_pending(const rtio_request_t* request)
+{
+    assert(request);
+    return __atomic_load_n(&request->pending, __ATOMIC_ACQUIRE) != 0;
+}
+
+bool rtio_submit(rtio_request_t* request)
+{
+    assert(request);
+    assert(request->op < RTIO_OP_COUNT);
+    if(rtio_pending(request)) return false;
+
+    request->pending = 1;
+    request->submitted = esp_timer_get_time();
+    if(xQueueSend(request_queue, &request, 0) != pdTRUE)
+    {
+        request->pending = 0;
+        __atomic_add_fetch(&stats.rejected, 1, __ATOMIC_RELAXED);
+        return false;
+    }
+    return true;
+}
+
+void rtio_get_stats(rtio_stats_t* stats_out)
+{
+    assert(stats_out);
+    memcpy(stats_out, &stats, sizeof(stats));
+}
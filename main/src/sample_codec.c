@@ -0,0 +1,150 @@
+//
+// Created by derk on 19-10-26.
+//
+
+#include "sample_codec.h"
+
+#include <assert.h>
+#include <string.h>
+
+#define FLAG_TIMESTAMP_CHANGED (1u << MEASUREMENT_COUNT)
+
+_Static_assert(MEASUREMENT_COUNT < 8, "the flags of a record are a single byte");
+
+static inline uint32_t zigzag_encode(int32_t value)
+{
+    return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+static inline int32_t zigzag_decode(uint32_t value)
+{
+    return (int32_t)(value >> 1) ^ -(int32_t)(value & 1);
+}
+
+static size_t put_varint(uint8_t* buffer, uint32_t value)
+{
+    size_t length = 0;
+    while(value >= 0x80)
+    {
+        buffer[length++] = (uint8_t)(value | 0x80);
+        value >>= 7;
+    }
+    buffer[length++] = (uint8_t)value;
+    return length;
+}
+
+static bool get_varint(const uint8_t* buffer, uint16_t length, uint16_t* offset, uint32_t* value)
+{
+    uint32_t result = 0;
+    for(int shift = 0; shift < 35 && *offset < length; shift += 7)
+    {
+        uint8_t byte = buffer[(*offset)++];
+        result |= (uint32_t)(byte & 0x7f) << shift;
+        if(!(byte & 0x80))
+        {
+            *value = result;
+            return true;
+        }
+    }
+    return false;
+}
+
+void sample_encoder_init(sample_encoder_t* encoder, sample_block_t* block, uint32_t first_timestamp)
+{
+    assert(encoder);
+    assert(block);
+    memset(block, 0, sizeof(*block));
+    block->first_timestamp = first_timestamp;
+    encoder->block = block;
+    encoder->timestamp = first_timestamp;
+    encoder->interval = 0;
+    memset(encoder->values, 0, sizeof(encoder->values));
+}
+
+bool sample_encoder_add(sample_encoder_t* encoder, const sample_record_t* record)
+{
+    assert(encoder);
+    assert(record);
+    sample_block_t* block = encoder->block;
+    uint8_t buffer[SAMPLE_RECORD_MAX_SIZE];
+    size_t length = 1;
+    uint8_t flags = 0;
+
+    if(block->count == UINT16_MAX) return false;
+
+    //Wrapping differences, decoding wraps back to the exact value
+    int32_t interval = (int32_t)(record->timestamp - encoder->timestamp);
+    if(interval != encoder->interval)
+    {
+        flags |= FLAG_TIMESTAMP_CHANGED;
+        length += put_varint(&buffer[length],
+                             zigzag_encode((int32_t)((uint32_t)interval - (uint32_t)encoder->interval)));
+    }
+    for(int type = 0; type < MEASUREMENT_COUNT; ++type)
+    {
+        if(record->values[type] == encoder->values[type]) continue;
+        flags |= 1u << type;
+        length += put_varint(&buffer[length],
+                             zigzag_encode((int32_t)((uint32_t)record->values[type] - (uint32_t)encoder->values[type])));
+    }
+    buffer[0] = flags;
+
+    if(block->length + length > SAMPLE_BLOCK_DATA_SIZE) return false;
+    memcpy(&block->data[block->length], buffer, length);
+    block->length += length;
+    block->count++;
+
+    encoder->timestamp = record->timestamp;
+    encoder->interval = interval;
+    memcpy(encoder->values, record->values, sizeof(encoder->values));
+    return true;
+}
+
+bool sample_block_valid(const sample_block_t* block)
+{
+    assert(block);
+    //A record is at least its flag byte
+    return block->length <= SAMPLE_BLOCK_DATA_SIZE && block->count <= block->length;
+}
+
+void sample_decoder_init(sample_decoder_t* decoder, const sample_block_t* block)
+{
+    assert(decoder);
+    assert(block);
+    decoder->block = block;
+    decoder->index = 0;
+    decoder->offset = 0;
+    decoder->timestamp = block->first_timestamp;
+    decoder->interval = 0;
+    memset(decoder->values, 0, sizeof(decoder->values));
+}
+
+bool sample_decoder_next(sample_decoder_t* decoder, sample_record_t* record)
+{
+    assert(decoder);
+    assert(record);
+    const sample_block_t* block = decoder->block;
+    uint32_t delta;
+
+    if(!sample_block_valid(block) || decoder->index >= block->count || decoder->offset >= block->length)
+        return false;
+
+    uint8_t flags = block->data[decoder->offset++];
+    if(flags & FLAG_TIMESTAMP_CHANGED)
+    {
+        if(!get_varint(block->data, block->length, &decoder->offset, &delta)) return false;
+        decoder->interval = (int32_t)((uint32_t)decoder->interval + (uint32_t)zigzag_decode(delta));
+    }
+    decoder->timestamp += (uint32_t)decoder->interval;
+    for(int type = 0; type < MEASUREMENT_COUNT; ++type)
+    {
+        if(!(flags & (1u << type))) continue;
+        if(!get_varint(block->data, block->length, &decoder->offset, &delta)) return false;
+        decoder->values[type] = (int32_t)((uint32_t)decoder->values[type] + (uint32_t)zigzag_decode(delta));
+    }
+
+    decoder->index++;
+    record->timestamp = decoder->timestamp;
+    memcpy(record->values, decoder->values, sizeof(record->values));
+    return true;
+}
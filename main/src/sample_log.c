@@ -0,0 +1,452 @@
+//
+// Created by derk on 19-10-26.
+//
+
+#include "sample_log.h"
+
+#include <assert.h>
+#include <string.h>
+#include <esp_log.h>
+#include <esp_partition.h>
+#include <esp_timer.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include "static_alloc.h"
+
+/*
+ * Append-only circular log of sample blocks on its own partition.
+ *
+ * Every sector starts with a header carrying a sequence number that counts up
+ * over the whole life of the partition, the sector with the highest one is
+ * being filled. Blocks are filled in ram and written once, so every byte of
+ * flash is written once per erase and the sectors are erased in turn: the
+ * wear is spread over the whole partition. A block still in ram is lost on a
+ * power cut.
+ *
+ * The ram index holds the sequence and first timestamp of every sector, a
+ * range query skips whole sectors by it and reads only the block headers of
+ * the others. A mutex guards the index and every flash access, the writer is
+ * a low priority task and readers are http handlers. The measure job only
+ * fills the block in ram and hands it over when it is full, an erase takes
+ * tens of ms and would hold up every job behind it on the executor.
+ */
+
+#define SECTOR_MAGIC 0x31474c53 //"SLG1"
+#define ERASED_TIMESTAMP UINT32_MAX
+
+typedef struct
+{
+    uint32_t magic;
+    uint32_t sequence;
+} sector_header_t;
+
+typedef struct
+{
+    //0 for a sector that was never written
+    uint32_t sequence;
+    uint32_t first_timestamp;
+    uint16_t blocks;
+} sector_index_t;
+
+static const char *TAG = "sample_log";
+
+static void writer_task(void* param);
+
+STATIC_BUFFER(StackType_t, writer_stack[SAMPLE_LOG_TASK_STACK_SIZE]);
+STATIC_BUFFER(StaticTask_t, writer_tcb);
+
+static const esp_partition_t* partition = NULL;
+static SemaphoreHandle_t log_lock = NULL;
+STATIC_BUFFER(StaticSemaphore_t, log_lock_buffer);
+
+static sector_index_t sectors[SAMPLE_LOG_MAX_SECTORS];
+static uint32_t sector_count = 0;
+static uint32_t head = 0;
+static uint32_t sequence = 0;
+static uint32_t erases = 0;
+
+//The block being filled, written out when it is full
+static sample_block_t pending;
+static sample_encoder_t encoder;
+static bool pending_started = false;
+//A full block the writer task did not write yet, it comes right before pending
+static sample_block_t full;
+static bool full_waiting = false;
+static TaskHandle_t writer = NULL;
+
+static uint32_t clock_base = 0;
+static uint32_t last_logged = 0;
+static bool logged = false;
+
+static size_t block_offset(uint32_t sector, uint32_t block)
+{
+    return (size_t)sector * SAMPLE_LOG_SECTOR_SIZE + (size_t)(block + 1) * SAMPLE_BLOCK_SIZE;
+}
+
+static bool block_erased(const sample_block_t* block)
+{
+    return block->first_timestamp == ERASED_TIMESTAMP && block->count == UINT16_MAX && block->length == UINT16_MAX;
+}
+
+//Rebuild the index of one sector from flash
+static void scan_sector(uint32_t sector)
+{
+    sector_header_t header;
+    sample_block_t block;
+    sector_index_t* index = &sectors[sector];
+
+    memset(index, 0, sizeof(*index));
+    index->first_timestamp = ERASED_TIMESTAMP;
+    if(esp_partition_read(partition, (size_t)sector * SAMPLE_LOG_SECTOR_SIZE, &header, sizeof(header)) != ESP_OK ||
+       header.magic != SECTOR_MAGIC || header.sequence == 0 || header.sequence == UINT32_MAX)
+        return;
+
+    index->sequence = header.sequence;
+    for(uint32_t i = 0; i < SAMPLE_LOG_BLOCKS_PER_SECTOR; ++i)
+    {
+        //The header of the block is enough to tell whether it was written
+        if(esp_partition_read(partition, block_offset(sector, i), &block, SAMPLE_BLOCK_HEADER_SIZE) != ESP_OK ||
+           block_erased(&block))
+            break;
+        if(i == 0)
+            index->first_timestamp = block.first_timestamp;
+        index->blocks++;
+    }
+}
+
+//Newest timestamp in a sector, 0 when none of its blocks decodes
+static uint32_t sector_newest_timestamp(uint32_t sector)
+{
+    sample_block_t block;
+    sample_decoder_t decoder;
+    sample_record_t record;
+    uint32_t newest = 0;
+
+    for(uint32_t b = sectors[sector].blocks; b-- > 0 && newest == 0; )
+    {
+        if(esp_partition_read(partition, block_offset(sector, b), &block, sizeof(block)) != ESP_OK)
+            continue;
+        sample_decoder_init(&decoder, &block);
+        while(sample_decoder_next(&decoder, &record))
+            newest = record.timestamp;
+    }
+    return newest;
+}
+
+/*
+ * Timestamp of the last sample on flash, 0 for an empty log. The head sector
+ * has no readable block after a power cut between its header and its first
+ * block, or when that block failed to write; the newest sample is then in the
+ * sector before it by sequence.
+ */
+static uint32_t newest_timestamp(void)
+{
+    uint32_t below = UINT32_MAX;
+
+    for(;;)
+    {
+        uint32_t newest_sector = sector_count;
+        for(uint32_t sector = 0; sector < sector_count; ++sector)
+        {
+            if(sectors[sector].sequence != 0 && sectors[sector].sequence < below &&
+               (newest_sector == sector_count || sectors[sector].sequence > sectors[newest_sector].sequence))
+                newest_sector = sector;
+        }
+        if(newest_sector == sector_count)
+            return 0;
+
+        uint32_t newest = sector_newest_timestamp(newest_sector);
+        if(newest)
+            return newest;
+        below = sectors[newest_sector].sequence;
+    }
+}
+
+void initialize_sample_log(void)
+{
+    partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, SAMPLE_LOG_PARTITION_SUBTYPE,
+                                         SAMPLE_LOG_PARTITION_LABEL);
+    if(!partition)
+    {
+        ESP_LOGI(TAG, "No samples partition, samples are not logged");
+        return;
+    }
+    sector_count = partition->size / SAMPLE_LOG_SECTOR_SIZE;
+    if(sector_count > SAMPLE_LOG_MAX_SECTORS)
+        sector_count = SAMPLE_LOG_MAX_SECTORS;
+    if(sector_count < 2)
+    {
+        ESP_LOGE(TAG, "samples partition too small");
+        partition = NULL;
+        return;
+    }
+    log_lock = CREATE_MUTEX(log_lock_buffer);
+
+    //An empty log starts in the first sector, the last one counts as full
+    head = sector_count - 1;
+    for(uint32_t sector = 0; sector < sector_count; ++sector)
+    {
+        scan_sector(sector);
+        if(sectors[sector].sequence > sequence)
+        {
+            sequence = sectors[sector].sequence;
+            head = sector;
+        }
+    }
+    if(sequence == 0)
+        sectors[head].blocks = SAMPLE_LOG_BLOCKS_PER_SECTOR;
+
+    uint32_t newest = newest_timestamp();
+    clock_base = newest ? newest + 1 : 0;
+    ESP_LOGI(TAG, "%u sectors, head %u with %u blocks, clock at %u", sector_count, head, sectors[head].blocks,
+             clock_base);
+
+    CREATE_TASK(writer_task, "sample_log", SAMPLE_LOG_TASK_STACK_SIZE, NULL, SAMPLE_LOG_TASK_PRIORITY, &writer,
+                tskNO_AFFINITY, writer_stack, writer_tcb);
+}
+
+uint32_t sample_log_now(void)
+{
+    return clock_base + (uint32_t)(esp_timer_get_time() / 1000000);
+}
+
+//Caller holds log_lock
+static void write_block(const sample_block_t* block)
+{
+    if(sectors[head].blocks >= SAMPLE_LOG_BLOCKS_PER_SECTOR)
+    {
+        uint32_t next = (head + 1) % sector_count;
+        sector_header_t header = { .magic = SECTOR_MAGIC, .sequence = sequence + 1 };
+        size_t offset = (size_t)next * SAMPLE_LOG_SECTOR_SIZE;
+
+        if(esp_partition_erase_range(partition, offset, SAMPLE_LOG_SECTOR_SIZE) != ESP_OK ||
+           esp_partition_write(partition, offset, &header, sizeof(header)) != ESP_OK)
+        {
+            ESP_LOGE(TAG, "Failed to start sector %u", next);
+            //Taken out of the index, it is erased again on the next lap
+            memset(&sectors[next], 0, sizeof(sectors[next]));
+            return;
+        }
+        ++erases;
+        sequence = header.sequence;
+        head = next;
+        sectors[head].sequence = sequence;
+        sectors[head].first_timestamp = ERASED_TIMESTAMP;
+        sectors[head].blocks = 0;
+    }
+
+    if(esp_partition_write(partition, block_offset(head, sectors[head].blocks), block, sizeof(*block)) != ESP_OK)
+        ESP_LOGE(TAG, "Failed to write block %u of sector %u", sectors[head].blocks, head);
+    //Counted even when it failed, the block is not written twice
+    if(sectors[head].blocks == 0)
+        sectors[head].first_timestamp = block->first_timestamp;
+    sectors[head].blocks++;
+}
+
+//Caller holds log_lock
+static void write_full(void)
+{
+    if(!full_waiting) return;
+    write_block(&full);
+    full_waiting = false;
+}
+
+static void writer_task(void* param)
+{
+    for(;;)
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        xSemaphoreTake(log_lock, portMAX_DELAY);
+        write_full();
+        xSemaphoreGive(log_lock);
+    }
+}
+
+void sample_log_add(const measurement_snapshot_t* sample)
+{
+    assert(sample);
+    sample_record_t record;
+
+    if(!partition) return;
+    record.timestamp = clock_base + (uint32_t)(sample->timestamp / 1000000);
+    if(logged && record.timestamp - last_logged < CONFIG_PLANT_SAMPLE_LOG_INTERVAL_S) return;
+    logged = true;
+    last_logged = record.timestamp;
+    memcpy(record.values, sample->values, sizeof(record.values));
+
+    bool handed_over = false;
+    xSemaphoreTake(log_lock, portMAX_DELAY);
+    if(!pending_started || !sample_encoder_add(&encoder, &record))
+    {
+        if(pending_started)
+        {
+            //The writer is a whole block behind, the one before goes out here to keep the order
+            write_full();
+            memcpy(&full, &pending, sizeof(full));
+            full_waiting = true;
+            handed_over = true;
+        }
+        sample_encoder_init(&encoder, &pending, record.timestamp);
+        sample_encoder_add(&encoder, &record);
+        pending_started = true;
+    }
+    xSemaphoreGive(log_lock);
+    if(handed_over)
+        xTaskNotifyGive(writer);
+}
+
+void sample_log_flush(void)
+{
+    if(!partition) return;
+    xSemaphoreTake(log_lock, portMAX_DELAY);
+    write_full();
+    xSemaphoreGive(log_lock);
+}
+
+typedef struct
+{
+    uint32_t from;
+    uint32_t to;
+    sample_log_block_cb_t callback;
+    void* context;
+    //The previous block, sent once the next one shows where it ends
+    sample_block_t previous;
+    bool has_previous;
+    size_t visited;
+    bool stopped;
+} range_walk_t;
+
+//false once the walk is over
+static bool walk_block(range_walk_t* walk, const sample_block_t* block)
+{
+    if(walk->has_previous && block->first_timestamp > walk->from)
+    {
+        ++walk->visited;
+        if(!walk->callback(&walk->previous, walk->context))
+        {
+            walk->stopped = true;
+            return false;
+        }
+    }
+    walk->has_previous = false;
+    if(block->first_timestamp > walk->to)
+        return false;
+    memcpy(&walk->previous, block, sizeof(*block));
+    walk->has_previous = true;
+    return true;
+}
+
+/*
+ * Runs on the httpd task, whose stack has no room for a copy of the index. The
+ * walk goes around the ring once from the sector after the head as it was at
+ * the start, looking at one entry of the index at a time. A sector the writer
+ * took after the start has a newer sequence and is left out, it would put
+ * newer samples in between older ones.
+ */
+size_t sample_log_for_each_block(uint32_t from, uint32_t to, sample_log_block_cb_t callback, void* context)
+{
+    assert(callback);
+    range_walk_t walk = {
+        .from = from,
+        .to = to,
+        .callback = callback,
+        .context = context
+    };
+    sample_block_t block;
+
+    if(!partition || from > to) return 0;
+
+    xSemaphoreTake(log_lock, portMAX_DELAY);
+    uint32_t oldest = head + 1;
+    uint32_t newest = sequence;
+    xSemaphoreGive(log_lock);
+
+    for(uint32_t i = 0; i < sector_count; ++i)
+    {
+        uint32_t sector = (oldest + i) % sector_count;
+        uint32_t next_first_timestamp = ERASED_TIMESTAMP;
+
+        xSemaphoreTake(log_lock, portMAX_DELAY);
+        sector_index_t index = sectors[sector];
+        for(uint32_t j = i + 1; j < sector_count && next_first_timestamp == ERASED_TIMESTAMP; ++j)
+        {
+            const sector_index_t* next = &sectors[(oldest + j) % sector_count];
+            if(next->sequence != 0 && next->sequence <= newest && next->blocks != 0)
+                next_first_timestamp = next->first_timestamp;
+        }
+        xSemaphoreGive(log_lock);
+
+        if(index.sequence == 0 || index.sequence > newest || index.blocks == 0) continue;
+        //Everything in it is older than the range, the next sector starts before it
+        if(next_first_timestamp != ERASED_TIMESTAMP && next_first_timestamp <= from)
+        {
+            walk.has_previous = false;
+            continue;
+        }
+        if(index.first_timestamp > to)
+            break;
+
+        for(uint32_t b = 0; ; ++b)
+        {
+            bool read = false;
+            xSemaphoreTake(log_lock, portMAX_DELAY);
+            //Stop at the end of the sector, or when the writer came around and erased it
+            if(sectors[sector].sequence == index.sequence && b < sectors[sector].blocks)
+                read = esp_partition_read(partition, block_offset(sector, b), &block, sizeof(block)) == ESP_OK;
+            xSemaphoreGive(log_lock);
+            if(!read)
+                break;
+            if(!sample_block_valid(&block))
+                continue;
+            if(!walk_block(&walk, &block))
+                return walk.visited;
+        }
+    }
+
+    //The blocks in ram are the newest, the full one still waiting for the writer first
+    xSemaphoreTake(log_lock, portMAX_DELAY);
+    bool has_full = full_waiting;
+    if(has_full)
+        memcpy(&block, &full, sizeof(block));
+    xSemaphoreGive(log_lock);
+    if(has_full && !walk_block(&walk, &block))
+        return walk.visited;
+
+    xSemaphoreTake(log_lock, portMAX_DELAY);
+    bool has_pending = pending_started && pending.count > 0;
+    if(has_pending)
+        memcpy(&block, &pending, sizeof(block));
+    xSemaphoreGive(log_lock);
+    if(has_pending && !walk_block(&walk, &block))
+        return walk.visited;
+
+    if(walk.has_previous && !walk.stopped)
+    {
+        ++walk.visited;
+        callback(&walk.previous, context);
+    }
+    return walk.visited;
+}
+
+void sample_log_get_stats(sample_log_stats_t* stats)
+{
+    assert(stats);
+    memset(stats, 0, sizeof(*stats));
+    if(!partition) return;
+
+    xSemaphoreTake(log_lock, portMAX_DELAY);
+    stats->sectors = sector_count;
+    stats->erases = erases;
+    stats->oldest = ERASED_TIMESTAMP;
+    for(uint32_t sector = 0; sector < sector_count; ++sector)
+    {
+        if(sectors[sector].sequence == 0 || sectors[sector].blocks == 0) continue;
+        stats->blocks += sectors[sector].blocks;
+        if(sectors[sector].first_timestamp < stats->oldest)
+            stats->oldest = sectors[sector].first_timestamp;
+    }
+    if(stats->blocks == 0)
+        stats->oldest = full_waiting ? full.first_timestamp : pending_started ? pending.first_timestamp : 0;
+    stats->newest = logged ? last_logged : 0;
+    xSemaphoreGive(log_lock);
+}
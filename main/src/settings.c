@@ -0,0 +1,211 @@
+//
+// Created by derk on 19-10-26.
+//
+
+#include "settings.h"
+
+#include <assert.h>
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <nvs.h>
+#include <esp_log.h>
+#include "executor.h"
+#include "dlog.h"
+#include "static_alloc.h"
+
+#define DIRTY_LIGHT_THRESHOLD BIT0
+#define DIRTY_MOISTURE_THRESHOLD BIT1
+#define DIRTY_CREDENTIALS BIT2
+
+static const char *TAG = "settings";
+
+//Readers copy with a sequence lock, writers are serialized by settings_lock
+static settings_t settings;
+static uint32_t settings_sequence = 0;
+static portMUX_TYPE settings_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static uint32_t dirty = 0;
+static settings_stats_t stats;
+
+static void commit(void* param);
+static job_t commit_job = JOB_INITIALIZER(commit, NULL, "settings");
+
+static void begin_write(void)
+{
+    portENTER_CRITICAL(&settings_lock);
+    //Odd sequence means a write is in progress
+    __atomic_store_n(&settings_sequence, settings_sequence + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+static void end_write(uint32_t dirty_bits)
+{
+    __atomic_store_n(&settings_sequence, settings_sequence + 1, __ATOMIC_RELEASE);
+    dirty |= dirty_bits;
+    ++stats.updates;
+    portEXIT_CRITICAL(&settings_lock);
+
+    //Every change pushes the commit back, a burst of updates ends up in a single commit
+    executor_schedule(&commit_job, SETTINGS_COMMIT_DELAY_MS, 0);
+}
+
+void settings_get(settings_t* copy)
+{
+    assert(copy);
+    uint32_t before, after;
+    do
+    {
+        before = __atomic_load_n(&settings_sequence, __ATOMIC_ACQUIRE);
+        memcpy(copy, &settings, sizeof(*copy));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        after = __atomic_load_n(&settings_sequence, __ATOMIC_RELAXED);
+    } while((before & 1u) || before != after);
+}
+
+uint16_t settings_get_light_threshold(void)
+{
+    return __atomic_load_n(&settings.light_threshold, __ATOMIC_RELAXED);
+}
+
+uint16_t settings_get_moisture_threshold(void)
+{
+    return __atomic_load_n(&settings.moisture_threshold, __ATOMIC_RELAXED);
+}
+
+bool settings_get_credentials(network_credentials_t* credentials)
+{
+    assert(credentials);
+    settings_t copy;
+    settings_get(&copy);
+    memcpy(credentials, &copy.credentials, sizeof(*credentials));
+    return credentials->ssid[0] != '\0';
+}
+
+void settings_set_light_threshold(uint16_t threshold)
+{
+    DLOGI(TAG, "Setting light threshold to %d", threshold);
+    begin_write();
+    __atomic_store_n(&settings.light_threshold, threshold, __ATOMIC_RELAXED);
+    end_write(DIRTY_LIGHT_THRESHOLD);
+}
+
+void settings_set_moisture_threshold(uint16_t threshold)
+{
+    DLOGI(TAG, "Setting moisture threshold to %d", threshold);
+    begin_write();
+    __atomic_store_n(&settings.moisture_threshold, threshold, __ATOMIC_RELAXED);
+    end_write(DIRTY_MOISTURE_THRESHOLD);
+}
+
+void settings_set_credentials(const char* ssid, const char* password)
+{
+    assert(ssid);
+    assert(password);
+    begin_write();
+    strlcpy(settings.credentials.ssid, ssid, sizeof(settings.credentials.ssid));
+    strlcpy(settings.credentials.password, password, sizeof(settings.credentials.password));
+    end_write(DIRTY_CREDENTIALS);
+}
+
+void settings_clear_credentials(void)
+{
+    begin_write();
+    memset(&settings.credentials, 0, sizeof(settings.credentials));
+    end_write(DIRTY_CREDENTIALS);
+}
+
+static esp_err_t write_credentials(nvs_handle_t nvs_handle, const network_credentials_t* credentials)
+{
+    esp_err_t err;
+    if(credentials->ssid[0] == '\0')
+    {
+        err = nvs_erase_key(nvs_handle, "ssid");
+        if(err == ESP_OK || err == ESP_ERR_NVS_NOT_FOUND)
+            err = nvs_erase_key(nvs_handle, "password");
+        return err == ESP_ERR_NVS_NOT_FOUND ? ESP_OK : err;
+    }
+
+    err = nvs_set_str(nvs_handle, "ssid", credentials->ssid);
+    if(err == ESP_OK)
+        err = nvs_set_str(nvs_handle, "password", credentials->password);
+    return err;
+}
+
+static void commit(void* param)
+{
+    settings_t copy;
+    nvs_handle_t nvs_handle;
+
+    portENTER_CRITICAL(&settings_lock);
+    uint32_t bits = dirty;
+    dirty = 0;
+    portEXIT_CRITICAL(&settings_lock);
+    if(!bits) return;
+
+    settings_get(&copy);
+    esp_err_t err = nvs_open(SETTINGS_NAMESPACE, NVS_READWRITE, &nvs_handle);
+    if(err == ESP_OK)
+    {
+        if(bits & DIRTY_LIGHT_THRESHOLD)
+            err = nvs_set_u16(nvs_handle, "light_th", copy.light_threshold);
+        if(err == ESP_OK && (bits & DIRTY_MOISTURE_THRESHOLD))
+            err = nvs_set_u16(nvs_handle, "moist_th", copy.moisture_threshold);
+        if(err == ESP_OK && (bits & DIRTY_CREDENTIALS))
+            err = write_credentials(nvs_handle, &copy.credentials);
+        if(err == ESP_OK)
+            err = nvs_set_u32(nvs_handle, "commits", stats.wear + 1);
+        if(err == ESP_OK)
+            err = nvs_commit(nvs_handle);
+        nvs_close(nvs_handle);
+    }
+
+    if(err != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Commit failed: %s", esp_err_to_name(err));
+        ++stats.failed_commits;
+        //Keep the changes, they go out with the next update or flush
+        portENTER_CRITICAL(&settings_lock);
+        dirty |= bits;
+        portEXIT_CRITICAL(&settings_lock);
+        return;
+    }
+
+    ++stats.commits;
+    ++stats.wear;
+    DLOGI(TAG, "Committed %d updates, %d commits in total", stats.updates, stats.wear);
+}
+
+void settings_flush(void)
+{
+    executor_cancel(&commit_job);
+    commit(NULL);
+}
+
+void initialize_settings(void)
+{
+    nvs_handle_t nvs_handle;
+    size_t ssid_size = sizeof(settings.credentials.ssid);
+    size_t password_size = sizeof(settings.credentials.password);
+
+    memset(&settings, 0, sizeof(settings));
+    if(nvs_open(SETTINGS_NAMESPACE, NVS_READONLY, &nvs_handle) != ESP_OK)
+        return;
+
+    nvs_get_u16(nvs_handle, "light_th", &settings.light_threshold);
+    nvs_get_u16(nvs_handle, "moist_th", &settings.moisture_threshold);
+    nvs_get_u32(nvs_handle, "commits", &stats.wear);
+    if(nvs_get_str(nvs_handle, "ssid", settings.credentials.ssid, &ssid_size) != ESP_OK ||
+       nvs_get_str(nvs_handle, "password", settings.credentials.password, &password_size) != ESP_OK)
+        memset(&settings.credentials, 0, sizeof(settings.credentials));
+    nvs_close(nvs_handle);
+
+    ESP_LOGI(TAG, "Light threshold loaded from flash, value: %d", settings.light_threshold);
+    ESP_LOGI(TAG, "Moisture threshold loaded from flash, value: %d", settings.moisture_threshold);
+}
+
+void settings_get_stats(settings_stats_t* stats_out)
+{
+    assert(stats_out);
+    memcpy(stats_out, &stats, sizeof(stats));
+    stats_out->pending = __atomic_load_n(&dirty, __ATOMIC_RELAXED) != 0;
+}
@@ -9,8 +9,18 @@
  *  dimlevel = -1 (no dimmer), between 0 and 15 for the dimlevel
  */
 #include "switch_kaku.h"
-#include <driver/gpio.h>
-#include <esp32/rom/ets_sys.h>
+#include <assert.h>
+#include <freertos/FreeRTOS.h>
+#include "hal.h"
+#include "dlog.h"
+
+//Periods per part of a frame, see send_syc and send_bit
+#define KAKU_PERIOD_US 230
+#define KAKU_SYNC_PERIODS 60
+#define KAKU_BIT_PERIODS 9.4
+#define KAKU_STOP_PERIODS 1
+
+static portMUX_TYPE kaku_lock = portMUX_INITIALIZER_UNLOCKED;
 
 static void send_kaku_code(gpio_num_t pin, uint32_t code, uint8_t repeat);
 static void send_syc(gpio_num_t pin, uint8_t period);
@@ -31,31 +41,46 @@ void initialize_kaku(gpio_num_t pin, uint32_t id, int8_t dim_level, kaku_group_t
     kaku->repeat = repeat;
     kaku->state = KAKU_STATE_OFF;
 
-    gpio_pad_select_gpio(pin);
-    gpio_set_direction(pin, GPIO_MODE_OUTPUT);
-    gpio_set_level(pin, 0);
+    hal_gpio_output(pin);
+    hal_gpio_set_level(pin, 0);
 }
 
-void switch_kaku(kaku_t* kaku)
+uint32_t kaku_code(const kaku_t* kaku)
 {
     assert(kaku);
-    kaku->state =!kaku->state;
     int8_t dev = kaku->device - 1;
     if (kaku->device == KAKU_DEVICE_ALL) dev = 1u<<5u;
+    if (kaku->dim_level == -1)
+        return ((kaku->id << 6u | dev) | kaku->state << 4u) | (kaku->group - 1) << 2u;
+    return (((dev << 4u) | kaku->state << 8u) | (kaku->group - 1) << 6u) | kaku->dim_level;
+}
+
+void switch_kaku(kaku_t* kaku)
+{
+    assert(kaku);
+    kaku->state =!kaku->state;
+    uint32_t code = kaku_code(kaku);
     if (kaku->dim_level == -1)
     {
-        uint32_t code = ((kaku->id << 6u | dev) | kaku->state << 4u) | (kaku->group - 1) << 2u;
-        printf("code: %d\n", code);
+        DLOGI("kaku", "code: %d", code);
         send_kaku_code(kaku->pin, code, kaku->repeat);
     }
     else
-        send_kaku_dim_code(kaku->pin, kaku->id, (((dev << 4u) | kaku->state << 8u) | (kaku->group - 1) << 6u) |
-        kaku->dim_level, kaku->repeat);
+        send_kaku_dim_code(kaku->pin, kaku->id, code, kaku->repeat);
+}
+
+uint32_t kaku_transmit_time_us(const kaku_t* kaku)
+{
+    assert(kaku);
+    //The dim code has 26 id bits plus 10 code bits instead of 32
+    uint8_t bits = kaku->dim_level == -1 ? 32 : 36;
+    return (uint32_t)(kaku->repeat * (KAKU_SYNC_PERIODS + bits * KAKU_BIT_PERIODS + KAKU_STOP_PERIODS) *
+                      KAKU_PERIOD_US);
 }
 
 static void send_kaku_code(gpio_num_t pin, uint32_t code, uint8_t repeat)
 {
-    uint8_t period = 230;
+    uint8_t period = KAKU_PERIOD_US;
     for (uint8_t i = 0; i < repeat; i++)
     {
         send_syc(pin, period);
@@ -63,15 +88,15 @@ static void send_kaku_code(gpio_num_t pin, uint32_t code, uint8_t repeat)
         {
             send_bit(((code & (1 << j)) == (1 << j)), pin, period);
         }
-        gpio_set_level(pin, 1);
-        ets_delay_us(period);
-        gpio_set_level(pin, 0);
+        hal_gpio_set_level(pin, 1);
+        hal_delay_us(period);
+        hal_gpio_set_level(pin, 0);
     }
 }
 
 static void send_kaku_dim_code(gpio_num_t pin, uint32_t id, uint32_t code, uint8_t repeat)
 {
-    uint8_t period = 230;
+    uint8_t period = KAKU_PERIOD_US;
     for (uint8_t i = 0; i < repeat; i++){
         send_syc(pin, period);
         for (int8_t j = 25; j>=0; j--){
@@ -84,56 +109,61 @@ static void send_kaku_dim_code(gpio_num_t pin, uint32_t id, uint32_t code, uint8
                 send_bit(((code & (1 << i)) == (1 << i)), pin, period);
             }
         }
-        gpio_set_level(pin, 1);
-        ets_delay_us(period);
-        gpio_set_level(pin, 0);
+        hal_gpio_set_level(pin, 1);
+        hal_delay_us(period);
+        hal_gpio_set_level(pin, 0);
     };
 }
 
 
 static void send_syc(gpio_num_t pin, uint8_t period)
 {
-    gpio_set_level(pin, 0);
-    ets_delay_us(47*period);
-    gpio_set_level(pin, 1);
-    ets_delay_us(period);
-    gpio_set_level(pin, 0);
-    ets_delay_us(period*12);
+    hal_gpio_set_level(pin, 0);
+    hal_delay_us(47*period);
+    portENTER_CRITICAL(&kaku_lock);
+    hal_gpio_set_level(pin, 1);
+    hal_delay_us(period);
+    hal_gpio_set_level(pin, 0);
+    hal_delay_us(period*12);
+    portEXIT_CRITICAL(&kaku_lock);
 }
 
 static void send_bit(int8_t value, gpio_num_t pin, uint8_t period)
 {
 //    printf("Send bit: value -> %d, pin -> %d, period-> %d\n", value, pin, period);
+    //One bit is ~2ms, short enough to keep interrupts off for all of it
+    portENTER_CRITICAL(&kaku_lock);
     if (value == 0){
-        gpio_set_level(pin, 1);
-        ets_delay_us(period);
-        gpio_set_level(pin, 0);
-        ets_delay_us((uint32_t)(period*1.4));
-        gpio_set_level(pin,1);
-        ets_delay_us(period);
-        gpio_set_level(pin, 0);
-        ets_delay_us(period*6);
+        hal_gpio_set_level(pin, 1);
+        hal_delay_us(period);
+        hal_gpio_set_level(pin, 0);
+        hal_delay_us((uint32_t)(period*1.4));
+        hal_gpio_set_level(pin,1);
+        hal_delay_us(period);
+        hal_gpio_set_level(pin, 0);
+        hal_delay_us(period*6);
     }
     else if (value == 1)
     {
-        gpio_set_level(pin,1);
-        ets_delay_us(period);
-        gpio_set_level(pin, 0);
-        ets_delay_us(period*6);
-        gpio_set_level(pin,1);
-        ets_delay_us(period);
-        gpio_set_level(pin, 0);
-        ets_delay_us((uint32_t)(period*1.4));
+        hal_gpio_set_level(pin,1);
+        hal_delay_us(period);
+        hal_gpio_set_level(pin, 0);
+        hal_delay_us(period*6);
+        hal_gpio_set_level(pin,1);
+        hal_delay_us(period);
+        hal_gpio_set_level(pin, 0);
+        hal_delay_us((uint32_t)(period*1.4));
     }
     else
     {
-        gpio_set_level(pin, 1);
-        ets_delay_us(period);
-        gpio_set_level(pin, 0);
-        ets_delay_us((uint32_t)(period*1.4));
-        gpio_set_level(pin, 1);
-        ets_delay_us(period);
-        gpio_set_level(pin, 0);
-        ets_delay_us((uint32_t)(period*1.4));
+        hal_gpio_set_level(pin, 1);
+        hal_delay_us(period);
+        hal_gpio_set_level(pin, 0);
+        hal_delay_us((uint32_t)(period*1.4));
+        hal_gpio_set_level(pin, 1);
+        hal_delay_us(period);
+        hal_gpio_set_level(pin, 0);
+        hal_delay_us((uint32_t)(period*1.4));
     }
+    portEXIT_CRITICAL(&kaku_lock);
 }
\ No newline at end of file
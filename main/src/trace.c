@@ -0,0 +1,324 @@
+//
+// Created by derk on 19-10-26.
+//
+
+#include "trace.h"
+
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <esp_timer.h>
+#include <esp_log.h>
+#include "executor.h"
+#include "metrics.h"
+#include "static_alloc.h"
+
+static const char *TAG = "trace";
+
+static const char* span_names[TRACE_SPAN_COUNT] = {
+    "measure",
+    "lock_wait",
+    "sensor_read",
+    "dht11_read",
+    "threshold",
+    "send_data",
+    "publish",
+    "puback",
+    "actuation",
+    "telemetry_queue"
+};
+
+typedef struct
+{
+    int64_t start;
+    uint32_t duration;
+    uint32_t sample_id;
+    const char* task;
+    uint8_t span;
+    uint8_t core;
+} trace_record_t;
+
+typedef struct
+{
+    int msg_id;
+    uint32_t sample_id;
+    int64_t sampled_at;
+    int64_t published_at;
+} inflight_t;
+
+typedef struct
+{
+    char name[configMAX_TASK_NAME_LEN];
+    //Of one core, over the last diagnostics interval
+    uint16_t cpu_permille;
+    uint32_t stack_high_water_mark;
+} task_load_t;
+
+//Spans are ended on the executor, the mqtt task and the rtio task, one lock covers everything below
+static portMUX_TYPE trace_lock = portMUX_INITIALIZER_UNLOCKED;
+static trace_record_t ring[TRACE_RING_SIZE];
+static uint32_t ring_head = 0;
+#ifdef CONFIG_PLANT_TRACE_CONSOLE
+static uint32_t ring_tail = 0;
+#endif
+static inflight_t inflight[TRACE_INFLIGHT_SIZE];
+static uint32_t last_acked_sample = 0;
+static trace_stats_t stats;
+
+//Only touched from jobs, the executor runs them one at a time
+static task_load_t task_loads[TRACE_MAX_TASKS];
+static uint32_t task_load_count = 0;
+static bool task_loads_dumped = false;
+#ifdef CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+static TaskStatus_t task_status[TRACE_MAX_TASKS];
+static uint32_t previous_numbers[TRACE_MAX_TASKS];
+static uint32_t previous_runtimes[TRACE_MAX_TASKS];
+static uint32_t previous_count = 0;
+static uint32_t previous_total = 0;
+#endif
+
+static void sample_tasks(void* param);
+static job_t task_job = JOB_INITIALIZER(sample_tasks, NULL, "trace_tasks");
+#ifdef CONFIG_PLANT_TRACE_CONSOLE
+static void dump(void* param);
+static job_t dump_job = JOB_INITIALIZER(dump, NULL, "trace_dump");
+#endif
+
+void initialize_trace(void)
+{
+#ifndef CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+    ESP_LOGW(TAG, "FreeRTOS runtime stats are off, no per-task cpu figures");
+#endif
+    executor_schedule(&task_job, TRACE_DIAGNOSTICS_INTERVAL_MS, TRACE_DIAGNOSTICS_INTERVAL_MS);
+#ifdef CONFIG_PLANT_TRACE_CONSOLE
+    executor_schedule(&dump_job, TRACE_DUMP_INTERVAL_MS, TRACE_DUMP_INTERVAL_MS);
+#endif
+}
+
+int64_t trace_begin(void)
+{
+    return esp_timer_get_time();
+}
+
+static void record(trace_span_t span, uint32_t sample_id, int64_t start, uint32_t duration, const char* task)
+{
+    trace_span_stats_t* span_stats = &stats.spans[span];
+    trace_record_t* slot = &ring[ring_head % TRACE_RING_SIZE];
+
+    slot->start = start;
+    slot->duration = duration;
+    slot->sample_id = sample_id;
+    slot->task = task;
+    slot->span = span;
+    slot->core = xPortGetCoreID();
+    ++ring_head;
+
+    ++span_stats->count;
+    span_stats->total_us += duration;
+    if(duration > span_stats->max_us)
+        span_stats->max_us = duration;
+}
+
+void trace_end(trace_span_t span, uint32_t sample_id, int64_t start)
+{
+    assert(span < TRACE_SPAN_COUNT);
+    uint32_t duration = (uint32_t)(esp_timer_get_time() - start);
+    const char* task = pcTaskGetTaskName(NULL);
+
+    portENTER_CRITICAL(&trace_lock);
+    record(span, sample_id, start, duration, task);
+    portEXIT_CRITICAL(&trace_lock);
+}
+
+void trace_publish(int msg_id, uint32_t sample_id, int64_t sampled_at)
+{
+    //QoS 0 messages get no PUBACK, a negative id is a failed publish
+    if(msg_id <= 0) return;
+    int64_t now = esp_timer_get_time();
+
+    portENTER_CRITICAL(&trace_lock);
+    inflight_t* slot = &inflight[0];
+    for(int i = 0; i < TRACE_INFLIGHT_SIZE; ++i)
+    {
+        if(inflight[i].msg_id == 0)
+        {
+            slot = &inflight[i];
+            break;
+        }
+        if(inflight[i].published_at < slot->published_at)
+            slot = &inflight[i];
+    }
+    if(slot->msg_id != 0)
+        ++stats.unmatched;
+    slot->msg_id = msg_id;
+    slot->sample_id = sample_id;
+    slot->sampled_at = sampled_at;
+    slot->published_at = now;
+    portEXIT_CRITICAL(&trace_lock);
+}
+
+void trace_puback(int msg_id)
+{
+    int64_t now = esp_timer_get_time();
+    const char* task = pcTaskGetTaskName(NULL);
+
+    portENTER_CRITICAL(&trace_lock);
+    for(int i = 0; i < TRACE_INFLIGHT_SIZE; ++i)
+    {
+        inflight_t* slot = &inflight[i];
+        if(slot->msg_id != msg_id) continue;
+
+        uint32_t rtt = (uint32_t)(now - slot->published_at);
+        record(TRACE_SPAN_PUBACK, slot->sample_id, slot->published_at, rtt, task);
+        metrics_observe(METRIC_HISTOGRAM_PUBACK_RTT, rtt);
+        //One sample goes out in up to four messages, the first acknowledged one counts
+        if(slot->sample_id > last_acked_sample)
+        {
+            uint32_t latency = (uint32_t)(now - slot->sampled_at);
+            last_acked_sample = slot->sample_id;
+            ++stats.samples;
+            stats.last_latency_us = latency;
+            stats.total_latency_us += latency;
+            if(latency > stats.max_latency_us)
+                stats.max_latency_us = latency;
+            metrics_observe(METRIC_HISTOGRAM_SAMPLE_LATENCY, latency);
+        }
+        slot->msg_id = 0;
+        portEXIT_CRITICAL(&trace_lock);
+        return;
+    }
+    ++stats.unmatched;
+    portEXIT_CRITICAL(&trace_lock);
+}
+
+void trace_get_stats(trace_stats_t* out)
+{
+    assert(out);
+    portENTER_CRITICAL(&trace_lock);
+    memcpy(out, &stats, sizeof(*out));
+    portEXIT_CRITICAL(&trace_lock);
+}
+
+const char* trace_span_name(trace_span_t span)
+{
+    if(span >= TRACE_SPAN_COUNT) return NULL;
+    return span_names[span];
+}
+
+static void sample_tasks(void* param)
+{
+#ifdef CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+    uint32_t total = 0;
+    uint32_t count = uxTaskGetSystemState(task_status, TRACE_MAX_TASKS, &total);
+    //Counters are 32 bit microseconds, they wrap after 71 minutes and the interval is far shorter
+    uint32_t elapsed = total - previous_total;
+
+    if(count == 0)
+    {
+        ESP_LOGW(TAG, "more than %d tasks, no runtime stats", TRACE_MAX_TASKS);
+        return;
+    }
+
+    for(uint32_t i = 0; i < count; ++i)
+    {
+        const TaskStatus_t* status = &task_status[i];
+        uint32_t runtime = status->ulRunTimeCounter;
+        for(uint32_t j = 0; j < previous_count; ++j)
+        {
+            if(previous_numbers[j] == status->xTaskNumber)
+            {
+                runtime -= previous_runtimes[j];
+                break;
+            }
+        }
+
+        task_load_t* load = &task_loads[i];
+        strncpy(load->name, status->pcTaskName, sizeof(load->name) - 1);
+        load->name[sizeof(load->name) - 1] = '\0';
+        load->cpu_permille = elapsed ? (uint16_t)((uint64_t)runtime * 1000 / elapsed) : 0;
+        load->stack_high_water_mark = status->usStackHighWaterMark;
+    }
+
+    for(uint32_t i = 0; i < count; ++i)
+    {
+        previous_numbers[i] = task_status[i].xTaskNumber;
+        previous_runtimes[i] = task_status[i].ulRunTimeCounter;
+    }
+    previous_count = count;
+    previous_total = total;
+    task_load_count = count;
+    task_loads_dumped = false;
+#endif
+}
+
+#define APPEND(...) \
+    do { \
+        int written = snprintf(buffer + length, size - length, __VA_ARGS__); \
+        if(written < 0 || (size_t)written >= size - length) return 0; \
+        length += written; \
+    } while(0)
+
+size_t trace_format_diagnostics(char* buffer, size_t size)
+{
+    assert(buffer);
+    trace_stats_t current;
+    size_t length = 0;
+
+    trace_get_stats(&current);
+    APPEND("{\"uptime_s\":%u,\"latency\":{\"samples\":%u,\"last_us\":%u,\"avg_us\":%u,\"max_us\":%u},\"spans\":{",
+           (uint32_t)(esp_timer_get_time() / 1000000), current.samples, current.last_latency_us,
+           current.samples ? (uint32_t)(current.total_latency_us / current.samples) : 0, current.max_latency_us);
+    for(int span = 0; span < TRACE_SPAN_COUNT; ++span)
+    {
+        const trace_span_stats_t* span_stats = &current.spans[span];
+        APPEND("%s\"%s\":{\"count\":%u,\"avg_us\":%u,\"max_us\":%u}", span ? "," : "", span_names[span],
+               span_stats->count, span_stats->count ? (uint32_t)(span_stats->total_us / span_stats->count) : 0,
+               span_stats->max_us);
+    }
+    APPEND("},\"dropped\":%u,\"unmatched\":%u,\"tasks\":{", current.dropped, current.unmatched);
+    for(uint32_t i = 0; i < task_load_count; ++i)
+    {
+        APPEND("%s\"%s\":{\"cpu_permille\":%u,\"stack\":%u}", i ? "," : "", task_loads[i].name,
+               task_loads[i].cpu_permille, task_loads[i].stack_high_water_mark);
+    }
+    APPEND("}}");
+    return length;
+}
+
+#ifdef CONFIG_PLANT_TRACE_CONSOLE
+static void dump(void* param)
+{
+    trace_record_t copy;
+
+    //One record per critical section, the writers never wait for the uart
+    for(;;)
+    {
+        portENTER_CRITICAL(&trace_lock);
+        if(ring_head - ring_tail > TRACE_RING_SIZE)
+        {
+            stats.dropped += ring_head - ring_tail - TRACE_RING_SIZE;
+            ring_tail = ring_head - TRACE_RING_SIZE;
+        }
+        if(ring_tail == ring_head)
+        {
+            portEXIT_CRITICAL(&trace_lock);
+            break;
+        }
+        copy = ring[ring_tail++ % TRACE_RING_SIZE];
+        portEXIT_CRITICAL(&trace_lock);
+
+        //Read by tools/trace_to_perfetto.py
+        //Task names may contain spaces, they go last
+        printf("#TRACE %s %u %u %lld %u %s\n", span_names[copy.span], copy.sample_id, copy.core, copy.start,
+               copy.duration, copy.task);
+    }
+
+    if(task_loads_dumped) return;
+    int64_t now = esp_timer_get_time();
+    for(uint32_t i = 0; i < task_load_count; ++i)
+        printf("#TRACE_CPU %lld %u %s\n", now, task_loads[i].cpu_permille, task_loads[i].name);
+    task_loads_dumped = true;
+}
+#endif
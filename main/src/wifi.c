@@ -3,6 +3,7 @@
 //
 #include <string.h>
 #include <stdlib.h>
+#include <sys/param.h>
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/event_groups.h"
@@ -17,8 +18,16 @@
 
 #include "wifi.h"
 #include "button.h"
+#include "event_bus.h"
+#include "settings.h"
+#include "executor.h"
+#include "boot.h"
+#include "dlog.h"
+#include "metrics.h"
+#include "static_alloc.h"
 
 static EventGroupHandle_t wifi_event_group;
+STATIC_BUFFER(StaticEventGroup_t, wifi_event_group_buffer);
 
 #define WIFI_CONNECTED_BIT BIT0
 #define WIFI_FAIL_BIT BIT1
@@ -29,9 +38,11 @@ static const char *TAG = "wifi";
 static void start_smart_config(void * param);
 
 static void save_wifi_credentials(const char* ssid, const char* password);
-static bool connect_wifi(network_credentials_t* credentials);
+static void connect_wifi(network_credentials_t* credentials);
 static void reset_wifi_connection ( void * arg );
-static void delete_wifi_credentials(void);
+static void reconnect(void* arg);
+static void start_provisioning(void* arg);
+static void on_button_pressed(const event_t* event, void* context);
 static void start_connecting(void);
 
 
@@ -43,46 +54,25 @@ typedef enum
 } connect_modes_t;
 
 static connect_modes_t current_mode = MODE_NOT_SET;
-static wifi_callbacks_t wifi_callbacks;
+static bool resetting = false;
+
+//Connecting never blocks, retries and the fall back to provisioning run as jobs
+static uint8_t retries = 0;
+static bool connected_once = false;
+static uint32_t reconnect_delay_ms = WIFI_RECONNECT_MIN_MS;
+static esp_netif_t* sta_netif = NULL;
+static esp_netif_t* ap_netif = NULL;
+static job_t reconnect_job = JOB_INITIALIZER(reconnect, NULL, "wifi_reconnect");
+static job_t provisioning_job = JOB_INITIALIZER(start_provisioning, NULL, "wifi_provisioning");
+static job_t reset_job = JOB_INITIALIZER(reset_wifi_connection, NULL, "wifi_reset");
 
 static bool connect_to_saved_wifi(void);
 
-void register_on_wifi_sta_start_cb(wifi_cb_t callback)
-{
-    wifi_callbacks.on_sta_start = callback;
-}
-
-void register_on_wifi_ap_start_cb(wifi_cb_t callback)
-{
-    wifi_callbacks.on_ap_start = callback;
-}
-
-void register_on_wifi_connect_cb(wifi_cb_t callback)
-{
-    wifi_callbacks.on_connect = callback;
-}
-
-void register_on_wifi_disconnect_cb(wifi_cb_t callback)
-{
-    wifi_callbacks.on_disconnect = callback;
-}
-
-void register_on_wifi_receive_credentials_cb(wifi_cb_t callback)
-{
-    wifi_callbacks.on_receive_credentials = callback;
-}
-
-void register_on_wifi_connection_reset(wifi_cb_t callback)
-{
-    wifi_callbacks.on_connection_reset = callback;
-}
-
 static void handle_new_configuration(void* arg, esp_event_base_t event_base, int32_t event_id, void* event_data)
 {
     if (event_base == WIFI_EVENT && event_id == WIFI_EVENT_AP_START)
     {
-        if(wifi_callbacks.on_ap_start)
-            wifi_callbacks.on_ap_start(NULL);
+        event_bus_post_id(EVENT_WIFI_AP_START);
     }
 }
 
@@ -92,31 +82,56 @@ void wifi_received_credentials(void)
     connect_to_saved_wifi();
 }
 
+static void handle_disconnect(void)
+{
+    metrics_increment(METRIC_WIFI_DISCONNECTS);
+    EventBits_t bits = xEventGroupClearBits(wifi_event_group, WIFI_CONNECTED_BIT);
+    if(bits & WIFI_CONNECTED_BIT)
+        event_bus_post_id(EVENT_WIFI_DISCONNECTED);
+
+    if(connected_once)
+    {
+        //The network worked before, keep trying with a growing delay
+        DLOGI(TAG, "Disconnected, reconnecting in %d ms", reconnect_delay_ms);
+        executor_schedule(&reconnect_job, reconnect_delay_ms, 0);
+        reconnect_delay_ms = MIN(reconnect_delay_ms * 2, WIFI_RECONNECT_MAX_MS);
+    }
+    else if(++retries < MAX_RETRIES)
+    {
+        DLOGI(TAG, "connect to the AP fail, retry %d", retries);
+        executor_submit(&reconnect_job);
+    }
+    else
+    {
+        DLOGI(TAG, "connect to the AP fail");
+        xEventGroupSetBits(wifi_event_group, WIFI_FAIL_BIT);
+        executor_submit(&provisioning_job);
+    }
+}
+
 static void handle_saved_configuration(void* arg, esp_event_base_t event_base, int32_t event_id, void* event_data)
 {
     if (event_base == WIFI_EVENT)
     {
         switch (event_id) {
         case WIFI_EVENT_STA_START:
-            if(wifi_callbacks.on_sta_start)
-                wifi_callbacks.on_sta_start(NULL);
+            event_bus_post_id(EVENT_WIFI_STA_START);
             esp_wifi_connect();
             break;
         case WIFI_EVENT_STA_DISCONNECTED:
-            xEventGroupSetBits(wifi_event_group, WIFI_FAIL_BIT);
-            xEventGroupClearBits(wifi_event_group, WIFI_CONNECTED_BIT);
-            ESP_LOGI(TAG, "connect to the AP fail");
-            if(wifi_callbacks.on_disconnect)
-                wifi_callbacks.on_disconnect(NULL);
+            handle_disconnect();
             break;
         default:break;
         }
     }
     else if (event_base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP)
     {
+        retries = 0;
+        connected_once = true;
+        reconnect_delay_ms = WIFI_RECONNECT_MIN_MS;
+        boot_mark(BOOT_PHASE_WIFI_CONNECTED);
         xEventGroupSetBits(wifi_event_group, WIFI_CONNECTED_BIT);
-        if(wifi_callbacks.on_connect)
-            wifi_callbacks.on_connect(NULL);
+        event_bus_post_id(EVENT_WIFI_CONNECTED);
     }
 }
 
@@ -136,61 +151,30 @@ static void event_handler(void* arg, esp_event_base_t event_base,
     }
 }
 
-static void delete_wifi_credentials(void)
-{
-    nvs_handle_t nvs_handle;
-    if(nvs_open("storage", NVS_READWRITE, &nvs_handle) == ESP_ERR_NVS_NOT_FOUND)
-        return;
-    nvs_erase_key(nvs_handle, "ssid");
-    nvs_erase_key(nvs_handle, "password");
-    nvs_commit(nvs_handle);
-    nvs_close(nvs_handle);
-}
-
 static bool connect_to_saved_wifi(void)
 {
     network_credentials_t credentials;
-    size_t ssid_size = sizeof(credentials.ssid);
-    size_t password_size = sizeof(credentials.password);
-    nvs_handle_t  nvs_handle;
-    if(nvs_open("storage", NVS_READONLY, &nvs_handle) == ESP_ERR_NVS_NOT_FOUND)
+    if(!settings_get_credentials(&credentials))
         return false;
 
-    ESP_LOGI(TAG, "Opened nvs");
-    esp_err_t ssid_err = nvs_get_str(nvs_handle, "ssid", credentials.ssid, &ssid_size);
-    esp_err_t pass_err = nvs_get_str(nvs_handle, "password", credentials.password, &password_size);
-
-    if(ssid_err == ESP_ERR_NVS_NOT_FOUND || pass_err == ESP_ERR_NVS_NOT_FOUND)
-    {
-        nvs_close(nvs_handle);
-        return false;
-    }
-
     ESP_LOGI(TAG, "Mode connect to saved wifi");
-
-    esp_netif_t *sta_netif = esp_netif_create_default_wifi_sta();
-    assert(sta_netif);
-
-    wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT()
-    ESP_ERROR_CHECK( esp_wifi_init(&cfg) );
-
-    ESP_LOGI(TAG, "Trying to connect to the saved wifi network");
-    for(uint8_t i = 0; i < MAX_RETRIES; ++i)
+    if(!sta_netif)
     {
-        if(connect_wifi(&credentials))
-            return true;
+        sta_netif = esp_netif_create_default_wifi_sta();
+        assert(sta_netif);
     }
 
-    esp_netif_destroy(sta_netif);
-    return false;
+    ESP_LOGI(TAG, "Trying to connect to the saved wifi network");
+    connect_wifi(&credentials);
+    return true;
 }
 
 /**
- * @brief Connect with wifi
+ * @brief Start connecting with wifi, the outcome arrives as EVENT_WIFI_CONNECTED or a fall back to provisioning
  * @note Wifi auth mode has to be WPA2 PSK
  * @param credentials
  */
-static bool connect_wifi(network_credentials_t* credentials)
+static void connect_wifi(network_credentials_t* credentials)
 {
     assert(credentials);
     wifi_config_t wifi_config;
@@ -199,24 +183,54 @@ static bool connect_wifi(network_credentials_t* credentials)
     strlcpy((char *) wifi_config.sta.password, credentials->password, sizeof(wifi_config.sta.password));
     wifi_config.sta.threshold.authmode = WIFI_AUTH_WPA2_PSK;
 
+    xEventGroupClearBits(wifi_event_group, WIFI_CONNECTED_BIT | WIFI_FAIL_BIT);
     ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
     ESP_ERROR_CHECK(esp_wifi_set_config(ESP_IF_WIFI_STA, &wifi_config));
     ESP_ERROR_CHECK(esp_wifi_start());
+}
 
-    EventBits_t bits = xEventGroupWaitBits(wifi_event_group,
-                                           WIFI_CONNECTED_BIT | WIFI_FAIL_BIT,
-                                           pdFALSE,
-                                           pdFALSE,
-                                           portMAX_DELAY);
+static void reconnect(void* arg)
+{
+    if(current_mode == MODE_SAVED_CONFIGURATION)
+        esp_wifi_connect();
+}
 
-    xEventGroupClearBits(wifi_event_group, WIFI_CONNECTED_BIT | WIFI_FAIL_BIT);
-    return bits & WIFI_CONNECTED_BIT;
+static void start_access_point(void)
+{
+    ESP_LOGI(TAG, "Mode new config");
+    current_mode = MODE_NEW_CONFIGURATION;
+
+    if(!ap_netif)
+    {
+        ap_netif = esp_netif_create_default_wifi_ap();
+        assert(ap_netif);
+    }
+
+    ESP_ERROR_CHECK( esp_wifi_set_mode(WIFI_MODE_AP) );
+    wifi_config_t config = {
+        .ap = {
+            .password = "test123456789",
+            .ssid = "plant-system",
+            .authmode = WIFI_AUTH_WPA2_PSK,
+            .max_connection = 4,
+            .channel = 7
+        }
+    };
+    esp_wifi_set_config(ESP_IF_WIFI_AP, &config);
+    ESP_ERROR_CHECK( esp_wifi_start() );
 }
 
+static void start_provisioning(void* arg)
+{
+    //Gave up on the saved network, wait for new credentials instead
+    current_mode = MODE_NOT_SET;
+    esp_wifi_stop();
+    start_access_point();
+}
 
 void initialize_wifi(void)
 {
-    wifi_event_group = xEventGroupCreate();
+    wifi_event_group = CREATE_EVENT_GROUP(wifi_event_group_buffer);
     ESP_ERROR_CHECK(esp_netif_init());
     ESP_ERROR_CHECK(esp_event_loop_create_default());
 
@@ -224,56 +238,52 @@ void initialize_wifi(void)
     ESP_ERROR_CHECK( esp_event_handler_register(IP_EVENT, IP_EVENT_STA_GOT_IP, &event_handler, NULL) );
     ESP_ERROR_CHECK( esp_event_handler_register(SC_EVENT, ESP_EVENT_ANY_ID, &event_handler, NULL) );
 
+    wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT()
+    ESP_ERROR_CHECK( esp_wifi_init(&cfg) );
+
     start_connecting();
+    event_bus_subscribe(EVENT_BUTTON_PRESSED, &on_button_pressed, NULL);
     setup_reset_button();
-    xTaskCreate(reset_wifi_connection, "reset_wifi_connection", 2048, NULL, 3, NULL);
 }
 
 static void start_connecting(void)
 {
+    retries = 0;
+    connected_once = false;
+    reconnect_delay_ms = WIFI_RECONNECT_MIN_MS;
     current_mode = MODE_SAVED_CONFIGURATION;
     if(!connect_to_saved_wifi())
-    {
-        ESP_LOGI(TAG, "Mode new config");
-        current_mode = MODE_NEW_CONFIGURATION;
-
-        esp_netif_t *sta_netif = esp_netif_create_default_wifi_ap();
-        assert(sta_netif);
+        start_access_point();
+}
 
-        wifi_init_config_t cfg = WIFI_INIT_CONFIG_DEFAULT()
-        ESP_ERROR_CHECK( esp_wifi_init(&cfg) );
-
-
-        ESP_ERROR_CHECK( esp_wifi_set_mode(WIFI_MODE_AP) );
-        wifi_config_t config = {
-            .ap = {
-                .password = "test123456789",
-                .ssid = "plant-system",
-                .authmode = WIFI_AUTH_WPA2_PSK,
-                .max_connection = 4,
-                .channel = 7
-            }
-        };
-        esp_wifi_set_config(ESP_IF_WIFI_AP, &config);
-        ESP_ERROR_CHECK( esp_wifi_start() );
-    }
+static void on_button_pressed(const event_t* event, void* context)
+{
+    //Only a deliberate hold wipes the credentials, short and double presses are left free for other uses
+    if(event->data.button != BUTTON_EVENT_LONG_PRESS) return;
+    //Only runs on the executor, a press during a reset is ignored
+    if(resetting) return;
+
+    resetting = true;
+    event_bus_post_id(EVENT_WIFI_CONNECTION_RESET);
+    //Give the user a moment to see the reset before the connection drops
+    executor_schedule(&reset_job, 1000, 0);
 }
 
 static void reset_wifi_connection ( void * arg )
 {
-    for ( ;; )
-    {
-        if(wait_until_reset_button_pressed())
-        {
-            if (wifi_callbacks.on_connection_reset)
-                wifi_callbacks.on_connection_reset(NULL);
-            ESP_LOGI(TAG, "Stopping wifi...");
-            esp_wifi_stop();
-            ESP_LOGI(TAG, "Deleting wifi credentials...");
-            delete_wifi_credentials();
-            ESP_LOGI(TAG, "Starting wifi...");
-            start_connecting();
-        }
-    }
-}
+    //Nothing may reconnect to the old network from here on
+    current_mode = MODE_NOT_SET;
+    executor_cancel(&reconnect_job);
+    executor_cancel(&provisioning_job);
+
+    ESP_LOGI(TAG, "Stopping wifi...");
+    esp_wifi_stop();
+    if(xEventGroupClearBits(wifi_event_group, WIFI_CONNECTED_BIT) & WIFI_CONNECTED_BIT)
+        event_bus_post_id(EVENT_WIFI_DISCONNECTED);
+    ESP_LOGI(TAG, "Deleting wifi credentials...");
+    settings_clear_credentials();
+    ESP_LOGI(TAG, "Starting wifi...");
+    start_connecting();
 
+    resetting = false;
+}
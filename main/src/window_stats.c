@@ -0,0 +1,52 @@
+//
+// Created by derk on 19-10-26.
+//
+
+#include "window_stats.h"
+
+#include <assert.h>
+#include <math.h>
+#include <stdio.h>
+
+void window_stats_reset(window_stats_t* stats)
+{
+    assert(stats);
+    stats->count = 0;
+    stats->min = INT32_MAX;
+    stats->max = INT32_MIN;
+    stats->mean = 0;
+    stats->m2 = 0;
+}
+
+void window_stats_add(window_stats_t* stats, int32_t value)
+{
+    assert(stats);
+    if(value < stats->min) stats->min = value;
+    if(value > stats->max) stats->max = value;
+
+    stats->count++;
+    double delta = value - stats->mean;
+    stats->mean += delta / stats->count;
+    stats->m2 += delta * (value - stats->mean);
+}
+
+double window_stats_stddev(const window_stats_t* stats)
+{
+    assert(stats);
+    if(stats->count < 2) return 0;
+    return sqrt(stats->m2 / stats->count);
+}
+
+size_t window_stats_format(char* buffer, size_t size, const window_stats_t* stats, const char* unit,
+                           uint32_t window_s)
+{
+    assert(buffer);
+    assert(stats);
+    assert(unit);
+    int length = snprintf(buffer, size,
+                          "{\"count\":%u,\"min\":%d,\"max\":%d,\"mean\":%.2f,\"std\":%.2f,\"unit\":\"%s\","
+                          "\"window_s\":%u}", stats->count, stats->min, stats->max, stats->mean,
+                          window_stats_stddev(stats), unit, window_s);
+    if(length < 0 || (size_t)length >= size) return 0;
+    return length;
+}
@@ -0,0 +1,235 @@
+//
+// Created by derk on 19-10-26.
+//
+
+#include "ws.h"
+#include "http.h"
+
+#include <string.h>
+#include <assert.h>
+#include <freertos/FreeRTOS.h>
+#include <esp_log.h>
+#include "dlog.h"
+#include "static_alloc.h"
+
+typedef struct
+{
+    char payload[WS_FRAME_SIZE];
+    size_t len;
+    uint32_t references;
+} ws_frame_t;
+
+//fd 0 marks a free slot, lwip never hands out socket 0
+typedef struct
+{
+    int fd;
+    ws_frame_t* queue[WS_QUEUE_DEPTH];
+    uint8_t head;
+    uint8_t count;
+} ws_client_t;
+
+static const char *TAG = "ws";
+static httpd_handle_t ws_server = NULL;
+static portMUX_TYPE ws_lock = portMUX_INITIALIZER_UNLOCKED;
+
+//Every connected client shares the same encoded frames, so N clients cost one encode
+static ws_frame_t frames[WS_FRAME_POOL_SIZE];
+static ws_client_t clients[WS_MAX_CLIENTS];
+static uint32_t flush_scheduled = 0;
+static ws_stats_t stats;
+
+static esp_err_t ws_handler(httpd_req_t *req);
+
+static const httpd_uri_t ws_samples = {
+    .uri        = "/api/v1/ws",
+    .method     = HTTP_GET,
+    .handler    = ws_handler,
+    .user_ctx   = NULL,
+    .is_websocket = true
+};
+
+static void release_frame(ws_frame_t* frame)
+{
+    __atomic_sub_fetch(&frame->references, 1, __ATOMIC_RELEASE);
+}
+
+static ws_frame_t* acquire_frame(void)
+{
+    for(int i = 0; i < WS_FRAME_POOL_SIZE; ++i)
+    {
+        uint32_t expected = 0;
+        if(__atomic_compare_exchange_n(&frames[i].references, &expected, 1, false,
+                                       __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            return &frames[i];
+    }
+    return NULL;
+}
+
+static void add_client(int fd)
+{
+    portENTER_CRITICAL(&ws_lock);
+    for(int i = 0; i < WS_MAX_CLIENTS; ++i)
+    {
+        if(clients[i].fd == 0)
+        {
+            clients[i].fd = fd;
+            clients[i].head = 0;
+            clients[i].count = 0;
+            ++stats.clients;
+            break;
+        }
+    }
+    portEXIT_CRITICAL(&ws_lock);
+}
+
+static void remove_client(ws_client_t* client)
+{
+    portENTER_CRITICAL(&ws_lock);
+    while(client->count)
+    {
+        release_frame(client->queue[client->head]);
+        client->head = (client->head + 1) % WS_QUEUE_DEPTH;
+        --client->count;
+    }
+    if(client->fd)
+        --stats.clients;
+    client->fd = 0;
+    portEXIT_CRITICAL(&ws_lock);
+}
+
+static ws_frame_t* pop_frame(ws_client_t* client)
+{
+    ws_frame_t* frame = NULL;
+    portENTER_CRITICAL(&ws_lock);
+    if(client->count)
+    {
+        frame = client->queue[client->head];
+        client->head = (client->head + 1) % WS_QUEUE_DEPTH;
+        --client->count;
+    }
+    portEXIT_CRITICAL(&ws_lock);
+    return frame;
+}
+
+//Runs on the httpd task, so a slow socket only delays other clients, never the sampler
+static void flush_clients(void* arg)
+{
+    __atomic_store_n(&flush_scheduled, 0, __ATOMIC_RELEASE);
+
+    for(int i = 0; i < WS_MAX_CLIENTS; ++i)
+    {
+        ws_client_t* client = &clients[i];
+        ws_frame_t* frame;
+        while(client->fd && (frame = pop_frame(client)) != NULL)
+        {
+            httpd_ws_frame_t ws_frame = {
+                .final = true,
+                .type = HTTPD_WS_TYPE_TEXT,
+                .payload = (uint8_t*) frame->payload,
+                .len = frame->len
+            };
+            esp_err_t err = httpd_ws_send_frame_async(ws_server, client->fd, &ws_frame);
+            release_frame(frame);
+
+            if(err != ESP_OK)
+            {
+                DLOGI(TAG, "Dropping client %d", client->fd);
+                httpd_sess_trigger_close(ws_server, client->fd);
+                remove_client(client);
+                break;
+            }
+            __atomic_add_fetch(&stats.frames_sent, 1, __ATOMIC_RELAXED);
+        }
+    }
+}
+
+void ws_push_sample(const measurement_snapshot_t* sample)
+{
+    if(!ws_server || !__atomic_load_n(&stats.clients, __ATOMIC_RELAXED)) return;
+
+    ws_frame_t* frame = acquire_frame();
+    if(!frame)
+    {
+        __atomic_add_fetch(&stats.frames_not_encoded, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    frame->len = http_format_readings(frame->payload, sizeof(frame->payload), sample);
+
+    portENTER_CRITICAL(&ws_lock);
+    for(int i = 0; i < WS_MAX_CLIENTS; ++i)
+    {
+        ws_client_t* client = &clients[i];
+        if(!client->fd) continue;
+
+        //Bounded queue: a slow consumer loses its oldest frame instead of holding up everyone else.
+        //Every queue then holds only the newest frames, which all clients share, so the pool never runs dry
+        if(client->count == WS_QUEUE_DEPTH)
+        {
+            release_frame(client->queue[client->head]);
+            client->head = (client->head + 1) % WS_QUEUE_DEPTH;
+            --client->count;
+            ++stats.frames_dropped;
+        }
+        client->queue[(client->head + client->count) % WS_QUEUE_DEPTH] = frame;
+        ++client->count;
+        __atomic_add_fetch(&frame->references, 1, __ATOMIC_RELAXED);
+    }
+    portEXIT_CRITICAL(&ws_lock);
+
+    //Drop the encoder's own reference, queued clients keep the frame alive
+    release_frame(frame);
+
+    if(__atomic_exchange_n(&flush_scheduled, 1, __ATOMIC_ACQ_REL) == 0)
+    {
+        if(httpd_queue_work(ws_server, flush_clients, NULL) != ESP_OK)
+            __atomic_store_n(&flush_scheduled, 0, __ATOMIC_RELEASE);
+    }
+}
+
+static esp_err_t ws_handler(httpd_req_t *req)
+{
+    if(req->method == HTTP_GET)
+    {
+        //Handshake done, from now on the client only receives samples
+        add_client(httpd_req_to_sockfd(req));
+        return ESP_OK;
+    }
+
+    //Clients are not expected to send anything, read and discard the frame
+    uint8_t buf[16];
+    httpd_ws_frame_t ws_frame = {
+        .payload = buf
+    };
+    esp_err_t err = httpd_ws_recv_frame(req, &ws_frame, sizeof(buf));
+    if(err == ESP_OK && ws_frame.type == HTTPD_WS_TYPE_CLOSE)
+        ws_close_session(httpd_req_to_sockfd(req));
+    return err;
+}
+
+void ws_close_session(int sockfd)
+{
+    for(int i = 0; i < WS_MAX_CLIENTS; ++i)
+    {
+        if(clients[i].fd == sockfd)
+            remove_client(&clients[i]);
+    }
+}
+
+void ws_register_handlers(httpd_handle_t server)
+{
+    ws_server = server;
+    httpd_register_uri_handler(server, &ws_samples);
+}
+
+void ws_unregister_handlers(void)
+{
+    ws_server = NULL;
+}
+
+void ws_get_stats(ws_stats_t* stats_out)
+{
+    assert(stats_out);
+    portENTER_CRITICAL(&ws_lock);
+    memcpy(stats_out, &stats, sizeof(stats));
+    portEXIT_CRITICAL(&ws_lock);
+}
@@ -0,0 +1,150 @@
+//
+// Created by derk on 19-10-26.
+//
+
+#include "www.h"
+
+#include <string.h>
+#include <stdio.h>
+#include <esp_log.h>
+#include <esp_partition.h>
+#include <esp_spi_flash.h>
+#include "static_alloc.h"
+
+//Must match the layout written by tools/mkwww.py
+#define WWW_MAGIC "WWW1"
+
+typedef struct
+{
+    char magic[4];
+    uint32_t count;
+} www_header_t;
+
+typedef struct
+{
+    char path[32];
+    char content_type[24];
+    uint32_t offset;
+    uint32_t length;
+    uint32_t etag;
+} www_entry_t;
+
+static const char *TAG = "www";
+
+//The partition stays mapped for the lifetime of the firmware, responses are sent straight from flash
+static const uint8_t* image = NULL;
+static const www_entry_t* entries = NULL;
+static uint32_t entry_count = 0;
+
+static esp_err_t www_handler(httpd_req_t *req);
+
+static const httpd_uri_t www = {
+    .uri       = "/*",
+    .method    = HTTP_GET,
+    .handler   = www_handler,
+    .user_ctx  = NULL
+};
+
+static bool map_partition(void)
+{
+    static spi_flash_mmap_handle_t handle;
+    const void* mapped = NULL;
+
+    if(image) return true;
+
+    const esp_partition_t* partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, WWW_PARTITION_SUBTYPE,
+                                                                WWW_PARTITION_LABEL);
+    if(!partition)
+    {
+        ESP_LOGI(TAG, "No www partition, dashboard disabled");
+        return false;
+    }
+
+    if(esp_partition_mmap(partition, 0, partition->size, SPI_FLASH_MMAP_DATA, &mapped, &handle) != ESP_OK)
+    {
+        ESP_LOGE(TAG, "Failed to map www partition");
+        return false;
+    }
+
+    const www_header_t* header = (const www_header_t*) mapped;
+    if(memcmp(header->magic, WWW_MAGIC, sizeof(header->magic)) != 0 ||
+       sizeof(www_header_t) + header->count * sizeof(www_entry_t) > partition->size)
+    {
+        ESP_LOGE(TAG, "www partition holds no valid image");
+        spi_flash_munmap(handle);
+        return false;
+    }
+
+    const www_entry_t* table = (const www_entry_t*)(header + 1);
+    for(uint32_t i = 0; i < header->count; ++i)
+    {
+        if(table[i].offset + table[i].length > partition->size ||
+           !memchr(table[i].path, '\0', sizeof(table[i].path)) ||
+           !memchr(table[i].content_type, '\0', sizeof(table[i].content_type)))
+        {
+            ESP_LOGE(TAG, "www entry %u is corrupt", i);
+            spi_flash_munmap(handle);
+            return false;
+        }
+    }
+
+    entries = table;
+    entry_count = header->count;
+    image = mapped;
+    ESP_LOGI(TAG, "Serving %u files from flash", entry_count);
+    return true;
+}
+
+static const www_entry_t* find_entry(const char* uri)
+{
+    size_t len = strcspn(uri, "?#");
+    if(len == 1 && uri[0] == '/')
+    {
+        uri = "/index.html";
+        len = strlen(uri);
+    }
+
+    for(uint32_t i = 0; i < entry_count; ++i)
+    {
+        if(strlen(entries[i].path) == len && strncmp(entries[i].path, uri, len) == 0)
+            return &entries[i];
+    }
+    return NULL;
+}
+
+static esp_err_t www_handler(httpd_req_t *req)
+{
+    char etag[12];
+    char if_none_match[12];
+
+    const www_entry_t* entry = find_entry(req->uri);
+    if(!entry)
+    {
+        httpd_resp_send_err(req, HTTPD_404_NOT_FOUND, "not found");
+        return ESP_FAIL;
+    }
+
+    snprintf(etag, sizeof(etag), "\"%08x\"", entry->etag);
+    httpd_resp_set_hdr(req, "ETag", etag);
+    httpd_resp_set_hdr(req, "Cache-Control",
+                       strcmp(entry->content_type, "text/html") == 0 ? WWW_CACHE_CONTROL_PAGE : WWW_CACHE_CONTROL_ASSET);
+
+    //The browser already has this version, answer without a body
+    if(httpd_req_get_hdr_value_str(req, "If-None-Match", if_none_match, sizeof(if_none_match)) == ESP_OK &&
+       strcmp(if_none_match, etag) == 0)
+    {
+        httpd_resp_set_status(req, "304 Not Modified");
+        return httpd_resp_send(req, NULL, 0);
+    }
+
+    httpd_resp_set_type(req, entry->content_type);
+    httpd_resp_set_hdr(req, "Content-Encoding", "gzip");
+    return httpd_resp_send(req, (const char*) image + entry->offset, entry->length);
+}
+
+void www_register_handlers(httpd_handle_t server)
+{
+    //Registered last, the wildcard catches everything the API does not handle
+    if(map_partition())
+        httpd_register_uri_handler(server, &www);
+}
@@ -0,0 +1,98 @@
+#!/usr/bin/env python3
+#
+# Compare micro-benchmark results against a stored baseline.
+#
+# Reads the lines printed by bench_run, from plant-bench on the host or from a
+# console capture of a device built with CONFIG_PLANT_BENCHMARK:
+#   #BENCH <kernel> <ns/op> <cycles/op> <iterations>
+#
+# A kernel that shows up more than once counts with its fastest run, so several
+# runs can be piped in to ride out a noisy machine. A kernel is a regression
+# when it got slower than the baseline by more than the tolerance. Runs shorter
+# than a millisecond in total are reported but not compared, the clock is too
+# coarse for them.
+#
+# A baseline only holds for the machine it was taken on, record one there first:
+#   for i in 1 2 3 4 5; do ./build-host/plant-bench; done | tools/bench_check.py --update baseline.txt
+#   for i in 1 2 3 4 5; do ./build-host/plant-bench; done | tools/bench_check.py baseline.txt
+#   idf.py monitor | tee capture.log
+#   tools/bench_check.py --update esp32_baseline.txt capture.log
+#
+import argparse
+import sys
+
+PREFIX = '#BENCH '
+MIN_TOTAL_NS = 1000000
+
+
+def parse(lines):
+    results = {}
+    for line in lines:
+        start = line.find(PREFIX)
+        if start < 0:
+            continue
+        fields = line[start + len(PREFIX):].split()
+        if len(fields) != 4:
+            continue
+        name = fields[0]
+        ns, cycles, iterations = float(fields[1]), float(fields[2]), int(fields[3])
+        if name not in results or ns < results[name][0]:
+            results[name] = (ns, cycles, iterations)
+    return results
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Compare #BENCH lines against a baseline')
+    parser.add_argument('baseline', help='baseline file, #BENCH lines')
+    parser.add_argument('capture', nargs='?', default='-', help='bench output, - for stdin')
+    parser.add_argument('--tolerance', type=float, default=25.0, help='allowed slowdown in percent')
+    parser.add_argument('--update', action='store_true', help='write the capture to the baseline file')
+    args = parser.parse_args()
+
+    if args.capture == '-':
+        current = parse(sys.stdin)
+    else:
+        with open(args.capture, errors='replace') as f:
+            current = parse(f)
+    if not current:
+        sys.exit('no #BENCH lines in the input')
+
+    if args.update:
+        with open(args.baseline, 'w') as f:
+            for name, (ns, cycles, iterations) in current.items():
+                f.write('%s%s %.1f %.1f %d\n' % (PREFIX, name, ns, cycles, iterations))
+        print('wrote %d kernels to %s' % (len(current), args.baseline))
+        return
+
+    try:
+        with open(args.baseline) as f:
+            baseline = parse(f)
+    except FileNotFoundError:
+        sys.exit('no baseline at %s, record one on this machine with --update first' % args.baseline)
+
+    regressions = 0
+    print('%-20s %12s %12s %8s %12s' % ('kernel', 'base ns/op', 'ns/op', 'change', 'cycles/op'))
+    for name, (ns, cycles, iterations) in current.items():
+        if name not in baseline:
+            print('%-20s %12s %12.1f %8s %12.1f' % (name, '-', ns, 'new', cycles))
+            continue
+        base_ns, _, base_iterations = baseline[name]
+        change = (ns - base_ns) * 100.0 / base_ns if base_ns else 0.0
+        verdict = ''
+        if min(ns * iterations, base_ns * base_iterations) < MIN_TOTAL_NS:
+            verdict = 'too short to compare'
+        elif change > args.tolerance:
+            verdict = 'REGRESSION'
+            regressions += 1
+        print('%-20s %12.1f %12.1f %+7.1f%% %12.1f  %s' % (name, base_ns, ns, change, cycles, verdict))
+    for name in baseline:
+        if name not in current:
+            print('%-20s missing from the capture' % name)
+            regressions += 1
+
+    if regressions:
+        sys.exit('%d regressions over %.0f%%' % (regressions, args.tolerance))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,121 @@
+#!/usr/bin/env python3
+#
+# Decode binary deferred log records (CONFIG_PLANT_DLOG_BINARY) in console output.
+#
+# Lines starting with "#DLOG " carry a hex encoded record of little endian words:
+#   timestamp (ms), format address, tag address, level | argc << 8, argc arguments
+# The format and tag addresses point into the flash rodata of the application, so
+# the strings are read back from the elf the firmware was built from. All other
+# lines are passed through untouched.
+#
+#   idf.py monitor | tools/dlog_decode.py build/plant-system.elf
+#   tools/dlog_decode.py build/plant-system.elf capture.log
+#
+import argparse
+import re
+import struct
+import sys
+
+PREFIX = '#DLOG '
+LEVELS = 'NEWIDV'
+SHF_ALLOC = 0x2
+SHT_NOBITS = 8
+
+CONVERSION = re.compile(r'%([-+ #0]*)(\d+|\*)?(?:\.(\d+))?(hh|h|ll|l|z|j|t)?([diouxXcspn%])')
+
+
+class Elf:
+    """Just enough of an ELF32 little endian reader to look up strings by address"""
+
+    def __init__(self, path):
+        with open(path, 'rb') as f:
+            self.data = f.read()
+        if self.data[:4] != b'\x7fELF' or self.data[4] != 1:
+            raise ValueError('%s is not a 32 bit elf' % path)
+
+        shoff, = struct.unpack_from('<I', self.data, 0x20)
+        shentsize, shnum = struct.unpack_from('<HH', self.data, 0x2E)
+        self.sections = []
+        for i in range(shnum):
+            _, sh_type, flags, addr, offset, size = struct.unpack_from('<IIIIII', self.data, shoff + i * shentsize)
+            if flags & SHF_ALLOC and sh_type != SHT_NOBITS and size:
+                self.sections.append((addr, offset, size))
+
+    def string(self, address):
+        for addr, offset, size in self.sections:
+            if addr <= address < addr + size:
+                start = offset + address - addr
+                end = self.data.index(b'\0', start, offset + size)
+                return self.data[start:end].decode('utf-8', 'replace')
+        return None
+
+
+def render(elf, fmt, args):
+    """printf with 32 bit arguments, the way the firmware passed them"""
+    args = list(args)
+
+    def take():
+        return args.pop(0) if args else 0
+
+    def convert(match):
+        flags, width, precision, _, kind = match.groups()
+        if kind == '%':
+            return '%'
+        if width == '*':
+            width = str(take())
+        spec = '%' + flags + (width or '') + ('.' + precision if precision else '')
+        value = take()
+        if kind in 'di':
+            return (spec + 'd') % (value - (1 << 32) if value & 0x80000000 else value)
+        if kind in 'ouxX':
+            return (spec + kind) % value
+        if kind == 'c':
+            return (spec + 'c') % chr(value & 0xFF)
+        if kind == 'p':
+            return (spec + 's') % ('0x%08x' % value)
+        if kind == 's':
+            text = elf.string(value)
+            return (spec + 's') % (text if text is not None else '<0x%08x>' % value)
+        return match.group(0)
+
+    return CONVERSION.sub(convert, fmt)
+
+
+def decode(elf, line):
+    raw = bytes.fromhex(line[len(PREFIX):].strip())
+    timestamp, fmt_address, tag_address, info = struct.unpack_from('<IIII', raw)
+    level, argc = info & 0xFF, info >> 8
+    args = struct.unpack_from('<%dI' % argc, raw, 16)
+
+    fmt = elf.string(fmt_address)
+    tag = elf.string(tag_address) or '0x%08x' % tag_address
+    letter = LEVELS[level] if level < len(LEVELS) else '?'
+    if fmt is None:
+        text = 'unknown format 0x%08x %s' % (fmt_address, ' '.join('0x%08x' % a for a in args))
+    else:
+        text = render(elf, fmt, args)
+    return '%s (%d) %s: %s' % (letter, timestamp, tag, text)
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Decode binary deferred log records')
+    parser.add_argument('elf', help='application elf the firmware was built from')
+    parser.add_argument('log', nargs='?', help='captured console output, stdin when omitted')
+    args = parser.parse_args()
+
+    elf = Elf(args.elf)
+    source = open(args.log, errors='replace') if args.log else sys.stdin
+    for line in source:
+        position = line.find(PREFIX)
+        if position < 0:
+            sys.stdout.write(line)
+            continue
+        try:
+            sys.stdout.write(line[:position] + decode(elf, line[position:]) + '\n')
+        except (ValueError, struct.error) as error:
+            sys.stdout.write('%s (undecodable: %s)\n' % (line.rstrip('\n'), error))
+        sys.stdout.flush()
+
+
+if __name__ == '__main__':
+    main()
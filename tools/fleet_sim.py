@@ -0,0 +1,493 @@
+#!/usr/bin/env python3
+#
+# Load a broker with a fleet of virtual plant nodes speaking the firmware protocol.
+#
+# Every node is one MQTT 3.1.1 connection, set up like start_mqtt_client():
+#   - clean session, LWT "disconnected" on plant/<id>/status, QoS 1 retained
+#   - on connect: subscribe plant/<id>/threshold/+ (QoS 1), publish "connected"
+#     on plant/<id>/status and, once per boot, "off" on socket/<id>/state
+#   - every sample: only the changed values on plant/<id>/{temperature,humidity,
+#     soil_moisture_level,light_level} as {"value":N,"unit":"..."}, QoS 1 retained
+#   - lamp switches go out on socket/<id>/state, thresholds are applied when they
+#     arrive, as a bare number or {"value":N}
+#
+# A monitor connection counts the LWTs and pushes threshold updates to random
+# nodes, timing them from publish to arrival. --storm-at drops every node at once
+# without a DISCONNECT, so the broker fires all wills, and measures how long the
+# fleet takes to get back. Everything runs on one asyncio loop and only needs
+# the standard library; raise the open file limit (ulimit -n) for large fleets.
+#
+#   mosquitto -p 1883 &
+#   tools/fleet_sim.py --nodes 500 --ramp 10 --duration 60 --storm-at 30
+#
+import argparse
+import asyncio
+import json
+import random
+import struct
+import sys
+import time
+
+CONNECT, CONNACK, PUBLISH, PUBACK, SUBSCRIBE, SUBACK, PINGREQ, PINGRESP, DISCONNECT = 1, 2, 3, 4, 8, 9, 12, 13, 14
+
+#base.h
+LIGHT_THRESHOLD_MARGIN = 100
+UNITS = (('temperature', 'celsius'), ('humidity', 'rh'), ('soil_moisture_level', 'raw'), ('light_level', 'raw'))
+
+
+class MqttError(Exception):
+    pass
+
+
+def encode_string(text):
+    data = text.encode() if isinstance(text, str) else text
+    return struct.pack('>H', len(data)) + data
+
+
+def packet(kind, flags, body):
+    length = len(body)
+    header = bytearray([kind << 4 | flags])
+    while True:
+        byte = length & 0x7f
+        length >>= 7
+        header.append(byte | 0x80 if length else byte)
+        if not length:
+            return bytes(header) + body
+
+
+def connect_packet(client_id, keepalive, username, password, will_topic, will_message):
+    flags = 0x02 | 0x04 | 1 << 3 | 0x20
+    payload = encode_string(client_id) + encode_string(will_topic) + encode_string(will_message)
+    if username:
+        flags |= 0x80
+        payload += encode_string(username)
+        if password:
+            flags |= 0x40
+            payload += encode_string(password)
+    return packet(CONNECT, 0, encode_string('MQTT') + bytes([4, flags]) + struct.pack('>H', keepalive) + payload)
+
+
+def publish_packet(topic, payload, qos, retain, packet_id):
+    body = encode_string(topic)
+    if qos:
+        body += struct.pack('>H', packet_id)
+    return packet(PUBLISH, qos << 1 | (1 if retain else 0), body + payload.encode())
+
+
+async def read_packet(reader):
+    first = (await reader.readexactly(1))[0]
+    length, shift = 0, 0
+    while True:
+        byte = (await reader.readexactly(1))[0]
+        length |= (byte & 0x7f) << shift
+        shift += 7
+        if not byte & 0x80:
+            break
+    return first >> 4, first & 0x0f, await reader.readexactly(length) if length else b''
+
+
+def parse_publish(flags, body):
+    topic_length = struct.unpack('>H', body[:2])[0]
+    topic = body[2:2 + topic_length].decode(errors='replace')
+    offset = 2 + topic_length
+    packet_id = None
+    if flags >> 1 & 3:
+        packet_id = struct.unpack('>H', body[offset:offset + 2])[0]
+        offset += 2
+    return topic, body[offset:], packet_id, bool(flags & 1)
+
+
+def parse_threshold(payload):
+    try:
+        value = json.loads(payload)
+    except ValueError:
+        return None
+    if isinstance(value, dict):
+        value = value.get('value')
+    if isinstance(value, (int, float)) and 0 <= value <= 0xffff:
+        return int(value)
+    return None
+
+
+def percentiles(samples, points=(50, 90, 99, 99.9)):
+    if not samples:
+        return 'no samples'
+    ordered = sorted(samples)
+    parts = ['p%g %.1f' % (p, ordered[min(len(ordered) - 1, int(len(ordered) * p / 100))] * 1000) for p in points]
+    return '%s, max %.1f ms (%d)' % (', '.join(parts), ordered[-1] * 1000, len(ordered))
+
+
+class Stats:
+    def __init__(self):
+        self.publishes = 0
+        self.pubacks = 0
+        self.rtt = []
+        self.window_rtt = []
+        self.window_pubacks = 0
+        self.connects = 0
+        self.connect_failures = 0
+        self.disconnects = 0
+        self.connect_latency = []
+        self.threshold_latency = []
+        self.lamp_switches = 0
+        self.wills = 0
+
+
+class Connection:
+    def __init__(self, reader, writer):
+        self.reader = reader
+        self.writer = writer
+        self.next_id = 0
+        self.inflight = {}
+
+    def packet_id(self):
+        self.next_id = self.next_id % 0xffff + 1
+        return self.next_id
+
+    def send(self, data):
+        self.writer.write(data)
+
+    def abort(self):
+        self.writer.transport.abort()
+
+
+async def open_connection(args, client_id, will_topic, will_message):
+    reader, writer = await asyncio.wait_for(asyncio.open_connection(args.host, args.port), args.connect_timeout)
+    connection = Connection(reader, writer)
+    try:
+        connection.send(connect_packet(client_id, args.keepalive, args.username, args.password, will_topic,
+                                       will_message))
+        kind, _, body = await asyncio.wait_for(read_packet(reader), args.connect_timeout)
+        if kind != CONNACK or len(body) < 2 or body[1] != 0:
+            raise MqttError('connection refused, code %d' % (body[1] if kind == CONNACK and len(body) > 1 else -1))
+    except BaseException:
+        writer.transport.abort()
+        raise
+    return connection
+
+
+async def run_until_first_done(*coroutines):
+    tasks = [asyncio.ensure_future(coroutine) for coroutine in coroutines]
+    try:
+        done, _ = await asyncio.wait(tasks, return_when=asyncio.FIRST_COMPLETED)
+    finally:
+        for task in tasks:
+            task.cancel()
+    #A closed connection ends the receive loop with an exception, that is the normal way out
+    for task in done:
+        if not task.cancelled():
+            task.exception()
+
+
+async def keep_alive(connection, keepalive):
+    while True:
+        await asyncio.sleep(keepalive / 2)
+        connection.send(packet(PINGREQ, 0, b''))
+
+
+class Node:
+    def __init__(self, sim, node_id):
+        self.sim = sim
+        self.id = node_id
+        self.connection = None
+        self.light_threshold = 0
+        self.moisture_threshold = 0
+        #LIGHT_STATES_NOT_SET until the first connect
+        self.lamp = None
+        self.light_before = 0
+        self.values = {
+            'temperature': random.randint(15, 25),
+            'humidity': random.randint(40, 70),
+            'soil_moisture_level': random.randint(1500, 2500),
+            'light_level': random.randint(200, 3000)
+        }
+        self.last = {}
+
+    def publish(self, topic, payload):
+        connection = self.connection
+        packet_id = connection.packet_id()
+        connection.inflight[packet_id] = time.monotonic()
+        connection.send(publish_packet(topic, payload, 1, True, packet_id))
+        self.sim.stats.publishes += 1
+
+    def sample(self):
+        values = self.values
+        if random.random() < 0.02:
+            values['temperature'] += random.choice((-1, 1))
+        if random.random() < 0.05:
+            values['humidity'] = min(95, max(20, values['humidity'] + random.choice((-1, 1))))
+        values['soil_moisture_level'] = min(4095, max(0, values['soil_moisture_level'] + random.randint(-3, 3)))
+        values['light_level'] = min(4095, max(0, values['light_level'] + random.randint(-40, 40)))
+
+    def send_data(self):
+        for name, unit in UNITS:
+            value = self.values[name]
+            if self.last.get(name) != value:
+                self.publish('plant/%d/%s' % (self.id, name), '{"value":%d,"unit":"%s"}' % (value, unit))
+                self.last[name] = value
+
+        #The light rules of control.c, including the uint16_t difference
+        light = self.values['light_level']
+        if light < self.light_threshold and self.lamp == 'off':
+            self.light_before = light
+            self.switch_lamp('on')
+        elif light >= self.light_threshold and self.lamp == 'on' and \
+                (light - self.light_before) & 0xffff > self.light_threshold + LIGHT_THRESHOLD_MARGIN:
+            self.switch_lamp('off')
+
+    def switch_lamp(self, state):
+        self.lamp = state
+        self.sim.stats.lamp_switches += 1
+        self.publish('socket/%d/state' % self.id, '"%s"' % state)
+
+    async def sample_loop(self):
+        await asyncio.sleep(random.uniform(0, self.sim.args.interval))
+        while True:
+            self.sample()
+            self.send_data()
+            await asyncio.sleep(self.sim.args.interval)
+
+    async def receive_loop(self):
+        stats = self.sim.stats
+        connection = self.connection
+        while True:
+            kind, flags, body = await read_packet(connection.reader)
+            if kind == PUBACK:
+                sent = connection.inflight.pop(struct.unpack('>H', body[:2])[0], None)
+                if sent is not None:
+                    rtt = time.monotonic() - sent
+                    stats.pubacks += 1
+                    stats.window_pubacks += 1
+                    stats.rtt.append(rtt)
+                    stats.window_rtt.append(rtt)
+            elif kind == PUBLISH:
+                topic, payload, packet_id, _ = parse_publish(flags, body)
+                if packet_id is not None:
+                    connection.send(packet(PUBACK, 0, struct.pack('>H', packet_id)))
+                self.threshold(topic, payload)
+
+    def threshold(self, topic, payload):
+        value = parse_threshold(payload)
+        if value is None:
+            return
+        if topic.endswith('/light'):
+            self.light_threshold = value
+        elif topic.endswith('/moisture'):
+            self.moisture_threshold = value
+        else:
+            return
+        sent = self.sim.pending_thresholds.pop((topic, value), None)
+        if sent is not None:
+            self.sim.stats.threshold_latency.append(time.monotonic() - sent)
+
+    async def session(self):
+        args = self.sim.args
+        stats = self.sim.stats
+        start = time.monotonic()
+        try:
+            self.connection = await open_connection(args, 'plant-%d' % self.id, 'plant/%d/status' % self.id,
+                                                    '"disconnected"')
+        except (OSError, asyncio.TimeoutError, asyncio.IncompleteReadError, MqttError):
+            stats.connect_failures += 1
+            return
+        stats.connects += 1
+        stats.connect_latency.append(time.monotonic() - start)
+        self.sim.connected.add(self)
+
+        connection = self.connection
+        connection.send(packet(SUBSCRIBE, 2, struct.pack('>H', connection.packet_id()) +
+                               encode_string('plant/%d/threshold/+' % self.id) + b'\x01'))
+        self.publish('plant/%d/status' % self.id, '"connected"')
+        if self.lamp is None:
+            self.publish('socket/%d/state' % self.id, '"off"')
+            self.lamp = 'off'
+
+        try:
+            await run_until_first_done(self.receive_loop(), self.sample_loop(),
+                                       keep_alive(connection, args.keepalive))
+        finally:
+            self.sim.connected.discard(self)
+            self.connection = None
+            connection.abort()
+        if not self.sim.stopping:
+            stats.disconnects += 1
+
+    async def run(self, delay):
+        await asyncio.sleep(delay)
+        while not self.sim.stopping:
+            await self.session()
+            if self.sim.stopping:
+                break
+            #esp-mqtt waits reconnect_timeout_ms, the storm jitter stands in for wifi coming back unevenly
+            await asyncio.sleep(self.sim.reconnect_delay())
+
+    def disconnect(self):
+        if self.connection:
+            self.connection.send(packet(DISCONNECT, 0, b''))
+
+
+class Simulation:
+    def __init__(self, args):
+        self.args = args
+        self.stats = Stats()
+        self.nodes = [Node(self, args.first_id + i) for i in range(args.nodes)]
+        self.connected = set()
+        self.pending_thresholds = {}
+        self.stopping = False
+        self.storm_until = 0
+        self.storms = []
+
+    def reconnect_delay(self):
+        if time.monotonic() < self.storm_until:
+            return random.uniform(0, self.args.storm_jitter)
+        return self.args.reconnect_s
+
+    async def monitor(self, connection):
+        args = self.args
+        connection.send(packet(SUBSCRIBE, 2, struct.pack('>H', connection.packet_id()) +
+                               encode_string('plant/+/status') + b'\x01'))
+
+        async def receive():
+            while True:
+                kind, flags, body = await read_packet(connection.reader)
+                if kind != PUBLISH:
+                    continue
+                topic, payload, packet_id, retained = parse_publish(flags, body)
+                if packet_id is not None:
+                    connection.send(packet(PUBACK, 0, struct.pack('>H', packet_id)))
+                if not retained and payload == b'"disconnected"':
+                    self.stats.wills += 1
+
+        async def push_thresholds():
+            while args.threshold_interval > 0:
+                await asyncio.sleep(args.threshold_interval)
+                node = random.choice(self.nodes)
+                kind = random.choice(('light', 'moisture'))
+                value = random.randint(500, 2000)
+                topic = 'plant/%d/threshold/%s' % (node.id, kind)
+                self.pending_thresholds[(topic, value)] = time.monotonic()
+                #Alternate the two payload forms parse_threshold accepts
+                payload = str(value) if value & 1 else '{"value":%d}' % value
+                connection.send(publish_packet(topic, payload, 1, False, connection.packet_id()))
+
+        try:
+            await run_until_first_done(receive(), push_thresholds(), keep_alive(connection, args.keepalive))
+        finally:
+            connection.abort()
+
+    async def storm(self, at):
+        await asyncio.sleep(at)
+        stats = self.stats
+        storm = {'at': at, 'dropped': len(self.connected), 'wills_before': stats.wills,
+                 'failures_before': stats.connect_failures, 'recovered_s': None, 'connect_latency': []}
+        self.storms.append(storm)
+        latency_start = len(stats.connect_latency)
+        self.storm_until = time.monotonic() + self.args.storm_jitter
+        start = time.monotonic()
+        print('%7.1f s  storm: dropping %d connections' % (time.monotonic() - self.start, storm['dropped']))
+        for node in list(self.connected):
+            if node.connection:
+                node.connection.abort()
+        #The sessions notice on their next read, do not count them as connected until then
+        self.connected.clear()
+        while len(self.connected) < storm['dropped'] and not self.stopping:
+            await asyncio.sleep(0.05)
+        if not self.stopping:
+            storm['recovered_s'] = time.monotonic() - start
+        storm['connect_latency'] = stats.connect_latency[latency_start:]
+        storm['wills'] = stats.wills - storm['wills_before']
+        storm['failures'] = stats.connect_failures - storm['failures_before']
+
+    async def report(self):
+        stats = self.stats
+        previous = time.monotonic()
+        while True:
+            await asyncio.sleep(self.args.report_s)
+            now = time.monotonic()
+            #A busy generator inflates every latency, the oversleep of this task shows it
+            lag = (now - previous - self.args.report_s) * 1000
+            rtt = sorted(stats.window_rtt)
+            p50 = rtt[len(rtt) // 2] * 1000 if rtt else 0
+            p99 = rtt[min(len(rtt) - 1, len(rtt) * 99 // 100)] * 1000 if rtt else 0
+            print('%7.1f s  %5d connected  %8.1f acks/s  rtt p50 %6.1f ms  p99 %6.1f ms  %d wills  loop lag %.0f ms' %
+                  (now - self.start, len(self.connected), stats.window_pubacks / (now - previous), p50, p99,
+                   stats.wills, lag))
+            stats.window_rtt = []
+            stats.window_pubacks = 0
+            previous = now
+
+    async def run(self):
+        args = self.args
+        self.start = time.monotonic()
+        #Fails the whole run when the broker is not there
+        connection = await open_connection(args, 'fleet-sim-monitor', 'fleet-sim/status', '"disconnected"')
+        monitor = asyncio.ensure_future(self.monitor(connection))
+        nodes = [asyncio.ensure_future(node.run(args.ramp * i / len(self.nodes))) for i, node in
+                 enumerate(self.nodes)]
+        background = [asyncio.ensure_future(self.report())]
+        background += [asyncio.ensure_future(self.storm(at)) for at in args.storm_at]
+
+        await asyncio.sleep(args.duration)
+        self.stopping = True
+        for node in list(self.connected):
+            node.disconnect()
+        await asyncio.sleep(0.5)
+        for task in nodes + background + [monitor]:
+            task.cancel()
+        await asyncio.gather(*nodes, *background, monitor, return_exceptions=True)
+        self.summary(time.monotonic() - self.start)
+
+    def summary(self, elapsed):
+        stats = self.stats
+        print()
+        print('%d nodes for %.1f s' % (len(self.nodes), elapsed))
+        print('publishes: %d sent, %d acked, %.1f acks/s, %d lamp switches' %
+              (stats.publishes, stats.pubacks, stats.pubacks / elapsed, stats.lamp_switches))
+        print('puback rtt: %s' % percentiles(stats.rtt))
+        print('connects: %d, %d failed, %d dropped; latency %s' %
+              (stats.connects, stats.connect_failures, stats.disconnects, percentiles(stats.connect_latency)))
+        print('thresholds: %s, %d not delivered' % (percentiles(stats.threshold_latency), len(self.pending_thresholds)))
+        for storm in self.storms:
+            recovered = 'back in %.2f s' % storm['recovered_s'] if storm['recovered_s'] is not None else 'not back'
+            print('storm at %.0f s: %d dropped, %d wills seen, %s, %d failed connects; latency %s' %
+                  (storm['at'], storm['dropped'], storm.get('wills', 0), recovered, storm.get('failures', 0),
+                   percentiles(storm['connect_latency'])))
+
+
+def main():
+    parser = argparse.ArgumentParser(description='MQTT load generator speaking the plant firmware protocol')
+    parser.add_argument('--host', default='localhost')
+    parser.add_argument('--port', type=int, default=1883)
+    parser.add_argument('--username')
+    parser.add_argument('--password')
+    parser.add_argument('--nodes', type=int, default=100)
+    parser.add_argument('--first-id', type=int, default=1000, help='plant id of the first node, 1 is the real one')
+    parser.add_argument('--duration', type=float, default=60, help='seconds')
+    parser.add_argument('--ramp', type=float, default=5, help='seconds to spread the first connects over')
+    parser.add_argument('--interval', type=float, default=1.0, help='seconds between samples, MEASURE_INTERVAL_MS')
+    parser.add_argument('--keepalive', type=int, default=120, help='seconds, the esp-mqtt default')
+    parser.add_argument('--connect-timeout', type=float, default=10, help='seconds, network_timeout_ms')
+    parser.add_argument('--reconnect-s', type=float, default=10, help='seconds, reconnect_timeout_ms')
+    parser.add_argument('--storm-at', type=float, action='append', default=[],
+                        help='seconds, drop every node at once; repeatable')
+    parser.add_argument('--storm-jitter', type=float, default=0,
+                        help='nodes come back within this many seconds after a storm, 0 is all at once')
+    parser.add_argument('--threshold-interval', type=float, default=0.5,
+                        help='seconds between threshold updates to a random node, 0 for none')
+    parser.add_argument('--report-s', type=float, default=5)
+    parser.add_argument('--seed', type=int, default=1)
+    args = parser.parse_args()
+    if args.nodes < 1:
+        parser.error('--nodes must be at least 1')
+
+    random.seed(args.seed)
+    try:
+        asyncio.run(Simulation(args).run())
+    except (OSError, MqttError, asyncio.TimeoutError) as error:
+        sys.exit('broker %s:%d: %s' % (args.host, args.port, error))
+    except KeyboardInterrupt:
+        pass
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,83 @@
+#!/usr/bin/env python3
+#
+# Pack the dashboard into an image for the www partition.
+#
+# Every file is gzip compressed at build time so the firmware can serve it
+# straight from memory mapped flash with Content-Encoding: gzip.
+#
+# Layout (little endian):
+#   header  magic "WWW1", uint32 entry count
+#   entries char path[32], char content_type[24], uint32 offset, uint32 length, uint32 etag
+#   data    compressed files, 4 byte aligned, offsets relative to the image start
+#
+import argparse
+import gzip
+import os
+import struct
+import sys
+import zlib
+
+MAGIC = b'WWW1'
+HEADER = struct.Struct('<4sI')
+ENTRY = struct.Struct('<32s24sIII')
+
+CONTENT_TYPES = {
+    '.html': 'text/html',
+    '.js': 'application/javascript',
+    '.css': 'text/css',
+    '.svg': 'image/svg+xml',
+    '.ico': 'image/x-icon',
+    '.json': 'application/json',
+}
+
+
+def pack(files, partition_size):
+    entries = []
+    blobs = []
+    offset = HEADER.size + ENTRY.size * len(files)
+
+    for path in sorted(files):
+        name = '/' + os.path.basename(path)
+        extension = os.path.splitext(name)[1]
+        if extension not in CONTENT_TYPES:
+            sys.exit('mkwww: no content type for {}'.format(path))
+        if len(name) >= 32:
+            sys.exit('mkwww: path too long: {}'.format(name))
+
+        with open(path, 'rb') as f:
+            # mtime=0 keeps the image, and therefore the etags, reproducible
+            blob = gzip.compress(f.read(), compresslevel=9, mtime=0)
+
+        offset = (offset + 3) & ~3
+        etag = zlib.crc32(blob) & 0xffffffff
+        entries.append(ENTRY.pack(name.encode(), CONTENT_TYPES[extension].encode(), offset, len(blob), etag))
+        blobs.append((offset, blob))
+        offset += len(blob)
+
+    if partition_size and offset > partition_size:
+        sys.exit('mkwww: image is {} bytes, partition holds {}'.format(offset, partition_size))
+
+    image = bytearray(offset)
+    image[0:HEADER.size] = HEADER.pack(MAGIC, len(entries))
+    for index, entry in enumerate(entries):
+        start = HEADER.size + index * ENTRY.size
+        image[start:start + ENTRY.size] = entry
+    for start, blob in blobs:
+        image[start:start + len(blob)] = blob
+    return bytes(image)
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Pack gzip compressed web assets into a www partition image')
+    parser.add_argument('output')
+    parser.add_argument('files', nargs='+')
+    parser.add_argument('--size', type=lambda x: int(x, 0), default=0, help='partition size in bytes')
+    args = parser.parse_args()
+
+    image = pack(args.files, args.size)
+    with open(args.output, 'wb') as f:
+        f.write(image)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,131 @@
+#!/usr/bin/env python3
+#
+# Download the flash sample log of a node and write it as CSV.
+#
+# GET /api/v1/export?from=&to= answers with the raw 128 byte blocks of the log
+# (main/src/sample_codec.c): a little endian header of first timestamp (u32),
+# record count (u16) and used length (u16), then per record a flag byte and a
+# zigzag varint for every flagged field. Bit 4 flags the timestamp, as delta of
+# delta; bits 0-3 temperature, humidity, soil moisture and light, as deltas.
+#
+# Timestamps are the log clock of the node, seconds that carry on over reboots.
+# --wall-clock maps them to unix time with the X-Sample-Log-Now header; samples
+# from before the last reboot are off by however long the node was down.
+#
+#   tools/sample_export.py http://192.168.4.1 > samples.csv
+#   tools/sample_export.py --from 86400 --to 172800 http://plant.local
+#   curl -o log.bin http://plant.local/api/v1/export && tools/sample_export.py log.bin
+#
+# The CSV reads straight into plant-replay and plant-codec.
+#
+import argparse
+import struct
+import sys
+import time
+import urllib.request
+
+BLOCK_SIZE = 128
+HEADER = struct.Struct('<IHH')
+COLUMNS = ['temperature', 'humidity', 'soil_moisture_level', 'light_level']
+FLAG_TIMESTAMP = 1 << len(COLUMNS)
+
+
+def to_int32(value):
+    value &= 0xffffffff
+    return value - (1 << 32) if value & 0x80000000 else value
+
+
+def zigzag(value):
+    return (value >> 1) ^ -(value & 1)
+
+
+def varint(data, offset, end):
+    result = 0
+    for shift in range(0, 35, 7):
+        if offset >= end:
+            raise ValueError('truncated varint')
+        byte = data[offset]
+        offset += 1
+        result |= (byte & 0x7f) << shift
+        if not byte & 0x80:
+            return result & 0xffffffff, offset
+    raise ValueError('varint too long')
+
+
+def decode_block(block):
+    """Yields (timestamp, values) for every record in one block"""
+    timestamp, count, length = HEADER.unpack_from(block)
+    data = block[HEADER.size:]
+    if length > len(data) or count > length:
+        return
+    interval = 0
+    values = [0] * len(COLUMNS)
+    offset = 0
+    try:
+        for _ in range(count):
+            flags = data[offset]
+            offset += 1
+            if flags & FLAG_TIMESTAMP:
+                delta, offset = varint(data, offset, length)
+                interval = to_int32(interval + zigzag(delta))
+            timestamp = (timestamp + interval) & 0xffffffff
+            for column in range(len(COLUMNS)):
+                if flags & (1 << column):
+                    delta, offset = varint(data, offset, length)
+                    values[column] = to_int32(values[column] + zigzag(delta))
+            yield timestamp, list(values)
+    except (ValueError, IndexError):
+        return
+
+
+def fetch(url, first, last):
+    query = []
+    if first is not None:
+        query.append('from=%d' % first)
+    if last is not None:
+        query.append('to=%d' % last)
+    url = url.rstrip('/') + '/api/v1/export' + ('?' + '&'.join(query) if query else '')
+    with urllib.request.urlopen(url) as response:
+        now = response.headers.get('X-Sample-Log-Now')
+        return response.read(), int(now) if now else None
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Decode the flash sample log of a node to CSV')
+    parser.add_argument('source', help='http://<node> to download, or a file with the exported blocks')
+    parser.add_argument('--from', dest='first', type=int, help='first log clock second')
+    parser.add_argument('--to', dest='last', type=int, help='last log clock second')
+    parser.add_argument('--wall-clock', action='store_true', help='write unix time instead of the log clock')
+    args = parser.parse_args()
+
+    if args.source.startswith(('http://', 'https://')):
+        data, now = fetch(args.source, args.first, args.last)
+        received = time.time()
+    else:
+        with open(args.source, 'rb') as f:
+            data = f.read()
+        now = None
+    if args.wall_clock and now is None:
+        sys.exit('--wall-clock needs the X-Sample-Log-Now header of a download')
+    if len(data) % BLOCK_SIZE:
+        print('ignoring %d trailing bytes' % (len(data) % BLOCK_SIZE), file=sys.stderr)
+
+    out = sys.stdout
+    out.write('time,%s\n' % ','.join(COLUMNS))
+    samples = 0
+    for start in range(0, len(data) - BLOCK_SIZE + 1, BLOCK_SIZE):
+        for timestamp, values in decode_block(data[start:start + BLOCK_SIZE]):
+            # Blocks at the edges of the range hold samples outside of it
+            if args.first is not None and timestamp < args.first:
+                continue
+            if args.last is not None and timestamp > args.last:
+                continue
+            if args.wall_clock:
+                timestamp = int(received - (now - timestamp))
+            out.write('%d,%s\n' % (timestamp, ','.join(str(value) for value in values)))
+            samples += 1
+    print('%d samples from %d blocks' % (samples, len(data) // BLOCK_SIZE), file=sys.stderr)
+
+
+if __name__ == '__main__':
+    main()
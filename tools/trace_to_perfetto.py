@@ -0,0 +1,101 @@
+#!/usr/bin/env python3
+#
+# Turn a console capture with CONFIG_PLANT_TRACE_CONSOLE into a Chrome trace.
+#
+# The firmware prints (times in microseconds since startup):
+#   #TRACE <span> <sample id> <core> <start> <duration> <task name>
+#   #TRACE_CPU <time> <cpu permille of one core> <task name>
+#
+# Spans become slices on a track per task, grouped per core. Spans of the same
+# sample are linked with flow arrows, so one measurement can be followed from
+# measure() to its PUBACK. The cpu figures become counter tracks. Open the
+# output in https://ui.perfetto.dev or chrome://tracing.
+#
+#   idf.py monitor | tee capture.log
+#   tools/trace_to_perfetto.py capture.log trace.json
+#
+import argparse
+import json
+import sys
+
+SPAN_PREFIX = '#TRACE '
+CPU_PREFIX = '#TRACE_CPU '
+CPU_PID = 100
+
+
+class Trace:
+    def __init__(self):
+        self.events = []
+        self.threads = {}
+        self.samples = {}
+
+    def thread(self, core, task):
+        key = (core, task)
+        if key not in self.threads:
+            tid = len(self.threads) + 1
+            self.threads[key] = tid
+            self.events.append({'ph': 'M', 'name': 'thread_name', 'pid': core, 'tid': tid, 'args': {'name': task}})
+        return self.threads[key]
+
+    def span(self, fields):
+        span, sample, core, start, duration = fields[:5]
+        task = ' '.join(fields[5:]) or '?'
+        core, sample, start, duration = int(core), int(sample), int(start), int(duration)
+        event = {'ph': 'X', 'name': span, 'cat': 'plant', 'pid': core, 'tid': self.thread(core, task),
+                 'ts': start, 'dur': duration, 'args': {'sample': sample}}
+        self.events.append(event)
+        if sample:
+            self.samples.setdefault(sample, []).append(event)
+
+    def cpu(self, fields):
+        time, permille = int(fields[0]), int(fields[1])
+        task = ' '.join(fields[2:]) or '?'
+        self.events.append({'ph': 'C', 'name': 'cpu ' + task, 'pid': CPU_PID, 'ts': time,
+                            'args': {'percent': permille / 10.0}})
+
+    def flows(self):
+        for sample, spans in self.samples.items():
+            if len(spans) < 2:
+                continue
+            spans.sort(key=lambda event: event['ts'])
+            for index, event in enumerate(spans):
+                phase = 's' if index == 0 else 'f' if index == len(spans) - 1 else 't'
+                flow = {'ph': phase, 'name': 'sample', 'cat': 'plant', 'id': sample, 'pid': event['pid'],
+                        'tid': event['tid'], 'ts': event['ts']}
+                if phase == 'f':
+                    flow['bp'] = 'e'
+                yield flow
+
+    def dump(self, output):
+        metadata = [{'ph': 'M', 'name': 'process_name', 'pid': core, 'args': {'name': 'core %d' % core}}
+                    for core in sorted({core for core, _ in self.threads})]
+        metadata.append({'ph': 'M', 'name': 'process_name', 'pid': CPU_PID, 'args': {'name': 'cpu'}})
+        json.dump({'traceEvents': metadata + self.events + list(self.flows()), 'displayTimeUnit': 'ms'}, output)
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Convert #TRACE console lines into a Chrome/Perfetto trace')
+    parser.add_argument('log', nargs='?', help='captured console output, stdin when omitted')
+    parser.add_argument('output', nargs='?', help='trace json, stdout when omitted')
+    args = parser.parse_args()
+
+    trace = Trace()
+    source = open(args.log, errors='replace') if args.log else sys.stdin
+    skipped = 0
+    for line in source:
+        try:
+            if CPU_PREFIX in line:
+                trace.cpu(line[line.index(CPU_PREFIX) + len(CPU_PREFIX):].split())
+            elif SPAN_PREFIX in line:
+                trace.span(line[line.index(SPAN_PREFIX) + len(SPAN_PREFIX):].split())
+        except (ValueError, IndexError):
+            skipped += 1
+
+    output = open(args.output, 'w') if args.output else sys.stdout
+    trace.dump(output)
+    if skipped:
+        print('skipped %d malformed lines' % skipped, file=sys.stderr)
+
+
+if __name__ == '__main__':
+    main()
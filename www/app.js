@@ -0,0 +1,62 @@
+'use strict';
+
+const metrics = ['temperature', 'humidity', 'soil_moisture_level', 'light_level'];
+
+function show(reading) {
+  for (const metric of metrics) {
+    if (reading[metric]) {
+      document.getElementById(metric).textContent = reading[metric].value;
+    }
+  }
+}
+
+function status(text) {
+  document.getElementById('status').textContent = text;
+}
+
+function connect() {
+  const socket = new WebSocket('ws://' + location.host + '/api/v1/ws');
+  socket.onopen = () => status('live');
+  socket.onmessage = (event) => show(JSON.parse(event.data));
+  socket.onclose = () => {
+    status('reconnecting...');
+    setTimeout(connect, 2000);
+  };
+}
+
+function showThresholds(thresholds) {
+  const form = document.getElementById('thresholds');
+  form.light.value = thresholds.light;
+  form.moisture.value = thresholds.moisture;
+}
+
+async function loadThresholds() {
+  const response = await fetch('/api/v1/thresholds');
+  showThresholds(await response.json());
+}
+
+document.getElementById('thresholds').addEventListener('submit', async (event) => {
+  event.preventDefault();
+  const form = event.target;
+  const response = await fetch('/api/v1/thresholds', {
+    method: 'PUT',
+    body: JSON.stringify({ light: Number(form.light.value), moisture: Number(form.moisture.value) }),
+  });
+  showThresholds(await response.json());
+});
+
+document.getElementById('wifi').addEventListener('submit', async (event) => {
+  event.preventDefault();
+  const form = event.target;
+  const response = await fetch('/wificonfig', {
+    method: 'POST',
+    body: JSON.stringify({ ssid: form.ssid.value, password: form.password.value }),
+  });
+  document.getElementById('wifi-result').textContent = response.ok
+    ? 'Saved, the plant system restarts and joins the network'
+    : 'Wifi can only be configured while the plant system is in setup mode';
+});
+
+fetch('/api/v1/readings').then((response) => response.json()).then(show);
+loadThresholds();
+connect();